@@ -22,9 +22,11 @@
 #include "config.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <errno.h>
-#include <ctype.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "trace.h"
 
 /* The collection should use the real structures */
@@ -43,18 +45,62 @@
 /* Special internal error code to indicate that collection search was interrupted */
 #define EINTR_INTERNAL 10000
 
+/* Collections with more items than this get a hash index of their items */
+#define COL_INDEX_THRESHOLD 32
+/* Smallest index, the index is kept at most half full */
+#define COL_INDEX_MIN_SIZE 64
+
+/* Size of the slot of a packed collection, the item is followed by
+ * the inline space for its data and property name.
+ */
+#define COL_SLOT_SIZE 128
+/* Number of slots in the first and the biggest block of slots */
+#define COL_POOL_FIRST 16
+#define COL_POOL_MAX 1024
+
+/* Arena blocks are 16 to 256 bytes in steps of 16 and then
+ * powers of two up to 4k. Bigger blocks are allocated alone.
+ */
+#define COL_ARENA_CLASSES 20
+#define COL_ARENA_BIG COL_ARENA_CLASSES
+#define COL_ARENA_MAX_BLOCK 4096
+/* Size of the first and the biggest chunk of an arena */
+#define COL_ARENA_FIRST 16384
+#define COL_ARENA_MAX 262144
+
+/* Smallest table of interned names, the table is kept at most full */
+#define COL_NAMES_MIN_SIZE 256
+
+/* Shorter values are copied rather than shared by COL_COPY_SHARED */
+#define COL_SHARE_MIN 32
+/* Parallel copy starts threads only for this many items
+ * in the subcollections and uses at most COL_PARALLEL_MAX threads.
+ */
+#define COL_PARALLEL_MIN 1024
+#define COL_PARALLEL_MAX 16
+
 
 /* Magic numbers for hashing */
 #if SIZEOF_LONG == 8
-    #define FNV1a_prime 1099511628211ul
     #define FNV1a_base 14695981039346656037ul
 #elif SIZEOF_LONG_LONG == 8
-    #define FNV1a_prime 1099511628211ull
     #define FNV1a_base 14695981039346656037ull
 #else
     #error "Platform cannot support 64-bit constant integers"
 #endif
 
+/* ASCII upper case of the character, the same in every locale */
+#define COL_FOLD(c) ((((c) >= 'a') && ((c) <= 'z')) ? ((c) - ('a' - 'A')) : (c))
+
+/* Byte masks for working on 8 characters at a time */
+#define COL_ONES  UINT64_C(0x0101010101010101)
+#define COL_HIGHS UINT64_C(0x8080808080808080)
+#define COL_LOW7  UINT64_C(0x7F7F7F7F7F7F7F7F)
+#define COL_BANGS UINT64_C(0x2121212121212121)
+/* Multipliers of the property hash */
+#define COL_HASH_MUL UINT64_C(0x9E3779B97F4A7C15)
+#define COL_HASH_MIX UINT64_C(0xBF58476D1CE4E5B9)
+
 /* Struct used for passing parameter for update operation */
 struct update_property {
         int type;
@@ -72,6 +118,114 @@ struct path_data {
     struct path_data *previous_path;
 };
 
+/* Index of the items of one collection by property hash.
+ * Open addressing with linear probing, empty slots are NULL.
+ * The index only speeds up lookups, the order of the items
+ * and duplicates are still resolved by walking the list.
+ */
+struct col_index {
+    struct collection_item **slots;
+    unsigned size;
+    unsigned used;
+    /* Number of COL_TYPE_COLLECTIONREF items */
+    unsigned refs;
+};
+
+/* Block of slots of a packed collection */
+struct col_chunk {
+    struct col_chunk *next;
+    unsigned count;
+};
+
+/* Storage for the items of a packed collection.
+ * Free slots are chained through the next member of the item.
+ * The pool is referenced by the collection header and by every
+ * item carved from it so items that are extracted from the
+ * collection stay valid after the collection is destroyed.
+ */
+struct col_pool {
+    struct col_chunk *chunks;
+    struct collection_item *free;
+    unsigned next_count;
+    unsigned refs;
+};
+
+/* Header in front of every block of an arena */
+union col_block {
+    unsigned cls;
+    uint64_t align;
+};
+
+/* Block of an arena that is too big for the chunks */
+struct col_big {
+    struct col_big *next;
+    struct col_big *prev;
+    union col_block head;
+};
+
+/* Memory shared by the collections created with col_create_collection_ex().
+ * Blocks are cut from chunks and freed blocks are kept on the list
+ * of their size class. The arena is released when its last item is
+ * freed. It is released at once, without freeing the items one by one,
+ * when a collection is destroyed and nothing outside of the arena can
+ * reach the memory of the arena any more:
+ *  - all other collections of the arena are held only by the
+ *    references from the items of the arena,
+ *  - no item of the arena references a collection outside of it,
+ *  - every item of the arena is linked into a collection of the arena
+ *    and every item linked into these collections is from the arena.
+ */
+struct col_arena {
+    struct col_chunk *chunks;
+    struct col_big *big;
+    char *next;
+    size_t left;
+    size_t chunk_size;
+    union col_block *free[COL_ARENA_CLASSES];
+    /* Items allocated from the arena */
+    unsigned live;
+    /* Sum of reference counts of the collections of the arena */
+    unsigned holds;
+    /* Reference items of the arena pointing into and out of the arena */
+    unsigned inner;
+    unsigned outer;
+    /* Items that are not linked where the arena expects them */
+    unsigned strays;
+    /* Number of collections of the arena being deleted item by item */
+    unsigned busy;
+};
+
+/* Property name shared by the items of the collections created
+ * with COL_CLASS_INTERN. The characters follow the structure.
+ */
+struct col_name {
+    struct col_name *next;
+    uint64_t hash;
+    unsigned refs;
+    int len;
+};
+
+/* Table of interned names of all collections in the process.
+ * Names are looked up by the property hash and compared as is,
+ * so names that differ in case are different names.
+ */
+struct col_names {
+    struct col_name **buckets;
+    unsigned size;
+    unsigned count;
+};
+
+static struct col_names col_names = { NULL, 0, 0 };
+static pthread_mutex_t col_names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Header of the value shared by an item and its copies.
+ * The value follows the header.
+ */
+union col_shared {
+    unsigned refs;
+    uint64_t align;
+};
+
 /* Structure to keep data needed to
  * copy collection
  * while traversing it
@@ -83,6 +237,25 @@ struct col_copy {
     int given_len;
     col_copy_cb copy_cb;
     void *ext_data;
+    /* Share the values of the items, see COL_COPY_SHARED */
+    int share;
+};
+
+/* Subcollection copied by a thread of the parallel copy */
+struct col_copy_job {
+    struct collection_item *donor;
+    struct collection_item *copy;
+    int error;
+};
+
+/* Work shared by the threads of the parallel copy */
+struct col_copy_work {
+    struct col_copy_job *jobs;
+    unsigned count;
+    unsigned next;
+    int copy_mode;
+    col_copy_cb copy_cb;
+    void *ext_data;
 };
 
 /******************** FUNCTION DECLARATIONS ****************************/
@@ -105,6 +278,15 @@ static int col_act_traverse_handler(struct collection_item *head,
                                     void *custom_data,
                                     int *stop);
 
+/* Perform the action on the found item */
+static int col_act_on_item(struct collection_item *head,
+                           struct collection_item *previous,
+                           struct collection_item *current,
+                           int action,
+                           col_item_fn user_item_handler,
+                           void *custom_data,
+                           int *stop);
+
 /* Traverse handler to find parent of the item */
 static int col_parent_traverse_handler(struct collection_item *head,
                                        struct collection_item *previous,
@@ -143,7 +325,118 @@ static int col_get_subcollection(const char *property,
 /* Function to destroy collection */
 void col_destroy_collection(struct collection_item *ci);
 
+/* Function to copy collection into an arena */
+static int col_copy_collection_in(struct collection_item **collection_copy,
+                                  struct collection_item *collection_to_copy,
+                                  const char *name_to_use,
+                                  int copy_mode,
+                                  col_copy_cb copy_cb,
+                                  void *ext_data,
+                                  struct collection_item *arena_of);
+
+/* Function to free the index of the collection */
+static void col_index_destroy(struct collection_header *header);
+
+/* Functions to manage the slots of packed collections */
+static void col_pool_unref(struct col_pool *pool);
+static void col_pool_put(struct collection_item *item);
+static void col_free_part(struct collection_item *item, void *part);
+static void col_free_property(struct collection_item *item);
+static void col_free_data(struct collection_item *item);
+
+/* Functions to manage the arenas */
+static void *col_arena_alloc(struct col_arena *arena, size_t size);
+static void col_arena_free(struct col_arena *arena, void *ptr);
+static void col_arena_release(struct col_arena *arena);
+static void col_arena_track(struct collection_item *item, int delta);
+
 /******************** SUPPLEMENTARY FUNCTIONS ****************************/
+/* HASHING */
+
+/* Fold ASCII lower case letters among 8 characters to upper case */
+static inline uint64_t col_fold_word(uint64_t word)
+{
+    uint64_t low7 = word & COL_LOW7;
+    /* High bit of a byte is set if the byte is 'a' or above ... */
+    uint64_t from_a = low7 + (0x80 - 'a') * COL_ONES;
+    /* ... and if it is above 'z' */
+    uint64_t past_z = low7 + (0x80 - 'z' - 1) * COL_ONES;
+    uint64_t lower = from_a & ~past_z & ~word & COL_HIGHS;
+
+    return word ^ (lower >> 2);
+}
+
+/* Hash the characters ignoring the case of ASCII letters.
+ * The characters are folded and mixed in 8 at a time.
+ */
+static uint64_t col_hash_chars(const char *str, size_t len)
+{
+    uint64_t hash = FNV1a_base ^ ((uint64_t)len * COL_HASH_MUL);
+    uint64_t word;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&word, str + i, 8);
+        hash = (hash ^ col_fold_word(word)) * COL_HASH_MUL;
+        hash ^= hash >> 29;
+    }
+
+    if (i < len) {
+        word = 0;
+        memcpy(&word, str + i, len - i);
+        hash = (hash ^ col_fold_word(word)) * COL_HASH_MUL;
+        hash ^= hash >> 29;
+    }
+
+    /* Make the low bits depend on all characters */
+    hash ^= hash >> 32;
+    hash *= COL_HASH_MIX;
+    hash ^= hash >> 29;
+
+    return hash;
+}
+
+/* Find the last segment of the path in one pass and hash it.
+ * Sets last to the start of the segment.
+ */
+static uint64_t col_hash_path(const char *path, size_t len, const char **last)
+{
+    uint64_t word;
+    size_t i = 0;
+    size_t j;
+
+    *last = path;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&word, path + i, 8);
+        word ^= COL_BANGS;
+        /* No '!' among the 8 characters */
+        if (((word - COL_ONES) & ~word & COL_HIGHS) == 0) continue;
+
+        for (j = i; j < i + 8; j++)
+            if (path[j] == '!') *last = path + j + 1;
+    }
+
+    for (; i < len; i++)
+        if (path[i] == '!') *last = path + i + 1;
+
+    return col_hash_chars(*last, len - (*last - path));
+}
+
+/* Check if the names are the same ignoring the case of ASCII letters */
+static int col_same_name(const char *first, const char *second)
+{
+    /* Items with interned names share the string */
+    if (first == second) return 1;
+
+    while ((*first != '\0') && (COL_FOLD(*first) == COL_FOLD(*second))) {
+        first++;
+        second++;
+    }
+
+    return COL_FOLD(*first) == COL_FOLD(*second);
+}
+
 /* BASIC OPERATIONS */
 
 /* Function that checks if property can be added */
@@ -174,6 +467,7 @@ void col_delete_item_with_cb(struct collection_item *item,
                              void *custom_data)
 {
     struct collection_item *other_collection;
+    struct col_arena *arena;
 
     TRACE_FLOW_STRING("col_delete_item","Entry point.");
 
@@ -187,7 +481,12 @@ void col_delete_item_with_cb(struct collection_item *item,
         /* Our data is a pointer to a whole external collection so dereference
          * it or delete */
         other_collection = *((struct collection_item **)(item->data));
+        arena = ((struct collection_header *)other_collection->data)->arena;
         col_destroy_collection_with_cb(other_collection, cb, custom_data);
+        if (item->arena != NULL) {
+            if (arena == item->arena) item->arena->inner--;
+            else item->arena->outer--;
+        }
     }
 
     /* Call the callback */
@@ -201,10 +500,25 @@ void col_delete_item_with_cb(struct collection_item *item,
     TRACE_INFO_STRING("Deleting property:", item->property);
     TRACE_INFO_NUMBER("Type:", item->type);
 
-    if (item->property != NULL) free(item->property);
-    if (item->data != NULL) free(item->data);
+    /* Header of the collection owns the index and the pool */
+    if ((item->type == COL_TYPE_COLLECTION) && (item->data != NULL)) {
+        col_index_destroy((struct collection_header *)item->data);
+        col_pool_unref(((struct collection_header *)item->data)->pool);
+    }
 
-    free(item);
+    col_free_property(item);
+    col_free_data(item);
+
+    col_arena_track(item, -1);
+
+    if (item->pool != NULL) col_pool_put(item);
+    else if (item->arena != NULL) {
+        arena = item->arena;
+        col_arena_free(arena, item);
+        arena->live--;
+        if ((arena->live == 0) && (arena->busy == 0)) col_arena_release(arena);
+    }
+    else free(item);
 
     TRACE_FLOW_STRING("col_delete_item","Exit.");
 }
@@ -216,82 +530,814 @@ void col_delete_item(struct collection_item *item)
 
     col_delete_item_with_cb(item, NULL, NULL);
 
-    TRACE_FLOW_STRING("col_delete_item","Exit.");
-}
+    TRACE_FLOW_STRING("col_delete_item","Exit.");
+}
+
+
+
+/* POOL */
+
+/* Create pool for a packed collection */
+static int col_pool_create(struct col_pool **pool)
+{
+    struct col_pool *new_pool;
+
+    new_pool = (struct col_pool *)malloc(sizeof(struct col_pool));
+    if (new_pool == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate pool.", ENOMEM);
+        return ENOMEM;
+    }
+
+    new_pool->chunks = NULL;
+    new_pool->free = NULL;
+    new_pool->next_count = COL_POOL_FIRST;
+    new_pool->refs = 1;
+
+    *pool = new_pool;
+    return EOK;
+}
+
+/* Drop reference to the pool, last one frees all blocks */
+static void col_pool_unref(struct col_pool *pool)
+{
+    struct col_chunk *chunk;
+
+    if (pool == NULL) return;
+
+    pool->refs--;
+    if (pool->refs > 0) return;
+
+    TRACE_INFO_STRING("Freeing pool", "");
+    while (pool->chunks != NULL) {
+        chunk = pool->chunks;
+        pool->chunks = chunk->next;
+        free(chunk);
+    }
+    free(pool);
+}
+
+/* Take a slot from the pool, NULL if there is no memory */
+static struct collection_item *col_pool_get(struct col_pool *pool)
+{
+    struct col_chunk *chunk;
+    struct collection_item *item;
+    char *slot;
+    unsigned i;
+
+    if (pool->free == NULL) {
+        chunk = (struct col_chunk *)malloc(sizeof(struct col_chunk) +
+                                           pool->next_count * COL_SLOT_SIZE);
+        if (chunk == NULL) {
+            TRACE_ERROR_NUMBER("Failed to allocate block of slots.", ENOMEM);
+            return NULL;
+        }
+        chunk->count = pool->next_count;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        if (pool->next_count < COL_POOL_MAX) pool->next_count *= 2;
+
+        /* Chain the slots so that they are handed out in address order */
+        slot = (char *)(chunk + 1) + chunk->count * COL_SLOT_SIZE;
+        for (i = 0; i < chunk->count; i++) {
+            slot -= COL_SLOT_SIZE;
+            ((struct collection_item *)slot)->next = pool->free;
+            pool->free = (struct collection_item *)slot;
+        }
+    }
+
+    item = pool->free;
+    pool->free = item->next;
+    item->pool = pool;
+    pool->refs++;
+
+    return item;
+}
+
+/* Return slot of the item to its pool */
+static void col_pool_put(struct collection_item *item)
+{
+    struct col_pool *pool = item->pool;
+
+    item->next = pool->free;
+    pool->free = item;
+    col_pool_unref(pool);
+}
+
+/* ARENA */
+
+/* Create an empty arena */
+static int col_arena_create(struct col_arena **arena)
+{
+    struct col_arena *new_arena;
+
+    new_arena = (struct col_arena *)calloc(1, sizeof(struct col_arena));
+    if (new_arena == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate arena.", ENOMEM);
+        return ENOMEM;
+    }
+
+    new_arena->chunk_size = COL_ARENA_FIRST;
+
+    *arena = new_arena;
+    return EOK;
+}
+
+/* Free all memory of the arena */
+static void col_arena_release(struct col_arena *arena)
+{
+    struct col_chunk *chunk;
+    struct col_big *big;
+
+    TRACE_FLOW_STRING("col_arena_release", "Entry.");
+
+    while (arena->chunks != NULL) {
+        chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    while (arena->big != NULL) {
+        big = arena->big;
+        arena->big = big->next;
+        free(big);
+    }
+    free(arena);
+
+    TRACE_FLOW_STRING("col_arena_release", "Exit.");
+}
+
+/* Size class of the block that holds size bytes with its header */
+static unsigned col_arena_class(size_t size)
+{
+    unsigned cls = 16;
+
+    if (size <= 256) return (unsigned)((size + 15) / 16 - 1);
+    while (((size_t)256 << (cls - 15)) < size) cls++;
+    return cls;
+}
+
+/* Size of the blocks of the class */
+static size_t col_arena_class_size(unsigned cls)
+{
+    if (cls < 16) return (size_t)(cls + 1) * 16;
+    return (size_t)256 << (cls - 15);
+}
+
+/* Allocate block from the arena, NULL if there is no memory */
+static void *col_arena_alloc(struct col_arena *arena, size_t size)
+{
+    struct col_chunk *chunk;
+    struct col_big *big;
+    union col_block *block;
+    size_t total = size + sizeof(union col_block);
+    size_t block_size;
+    unsigned cls;
+
+    if (total > COL_ARENA_MAX_BLOCK) {
+        big = (struct col_big *)malloc(sizeof(struct col_big) + size);
+        if (big == NULL) return NULL;
+        big->prev = NULL;
+        big->next = arena->big;
+        if (arena->big != NULL) arena->big->prev = big;
+        arena->big = big;
+        big->head.cls = COL_ARENA_BIG;
+        return &(big->head) + 1;
+    }
+
+    cls = col_arena_class(total);
+    if (arena->free[cls] != NULL) {
+        block = arena->free[cls];
+        arena->free[cls] = *((union col_block **)(block + 1));
+        return block + 1;
+    }
+
+    block_size = col_arena_class_size(cls);
+    if (arena->left < block_size) {
+        chunk = (struct col_chunk *)malloc(sizeof(struct col_chunk) +
+                                           arena->chunk_size);
+        if (chunk == NULL) {
+            TRACE_ERROR_NUMBER("Failed to allocate arena chunk.", ENOMEM);
+            return NULL;
+        }
+        chunk->count = (unsigned)arena->chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = (char *)(chunk + 1);
+        arena->left = arena->chunk_size;
+        if (arena->chunk_size < COL_ARENA_MAX) arena->chunk_size *= 2;
+    }
+
+    block = (union col_block *)arena->next;
+    arena->next += block_size;
+    arena->left -= block_size;
+    block->cls = cls;
+
+    return block + 1;
+}
+
+/* Return block to the arena */
+static void col_arena_free(struct col_arena *arena, void *ptr)
+{
+    union col_block *block = (union col_block *)ptr - 1;
+    struct col_big *big;
+
+    if (block->cls == COL_ARENA_BIG) {
+        big = (struct col_big *)((char *)block - offsetof(struct col_big, head));
+        if (big->prev != NULL) big->prev->next = big->next;
+        else arena->big = big->next;
+        if (big->next != NULL) big->next->prev = big->prev;
+        free(big);
+        return;
+    }
+
+    *((union col_block **)ptr) = arena->free[block->cls];
+    arena->free[block->cls] = block;
+}
+
+/* Count item that is not linked into a collection of its own arena
+ * or is linked into an arena collection from somewhere else.
+ * Called with -1 before the owner of the item changes and
+ * with 1 after that.
+ */
+static void col_arena_track(struct collection_item *item, int delta)
+{
+    struct col_arena *home = NULL;
+
+    if (item->type == COL_TYPE_COLLECTION) return;
+
+    if (item->owner != NULL)
+        home = ((struct collection_header *)item->owner->data)->arena;
+    if (home == item->arena) return;
+
+    if (item->arena != NULL) item->arena->strays += delta;
+    if (home != NULL) home->strays += delta;
+}
+
+/* Allocate memory from the arena or the heap */
+static void *col_mem_alloc(struct col_arena *arena, size_t size)
+{
+    if (arena != NULL) return col_arena_alloc(arena, size);
+    return malloc(size);
+}
+
+/* Free memory allocated by col_mem_alloc() */
+static void col_mem_free(struct col_arena *arena, void *ptr)
+{
+    if (ptr == NULL) return;
+    if (arena != NULL) col_arena_free(arena, ptr);
+    else free(ptr);
+}
+
+/* NAMES */
+
+/* Characters of the interned name */
+static char *col_name_str(struct col_name *name)
+{
+    return (char *)(name + 1);
+}
+
+/* Double the table of interned names */
+static int col_names_grow(void)
+{
+    struct col_name **buckets;
+    struct col_name *name;
+    unsigned size;
+    unsigned i;
+
+    size = (col_names.size != 0) ? col_names.size * 2 : COL_NAMES_MIN_SIZE;
+    buckets = (struct col_name **)calloc(size, sizeof(struct col_name *));
+    if (buckets == NULL) return ENOMEM;
+
+    for (i = 0; i < col_names.size; i++) {
+        while ((name = col_names.buckets[i]) != NULL) {
+            col_names.buckets[i] = name->next;
+            name->next = buckets[name->hash & (size - 1)];
+            buckets[name->hash & (size - 1)] = name;
+        }
+    }
+
+    free(col_names.buckets);
+    col_names.buckets = buckets;
+    col_names.size = size;
+    return EOK;
+}
+
+/* Take a reference to the interned name, intern it if it is new.
+ * Returns NULL if there is no memory.
+ */
+static struct col_name *col_name_get(const char *property,
+                                     int len,
+                                     uint64_t hash)
+{
+    struct col_name *name = NULL;
+
+    pthread_mutex_lock(&col_names_lock);
+
+    if (col_names.size != 0) {
+        name = col_names.buckets[hash & (col_names.size - 1)];
+        while ((name != NULL) &&
+               ((name->hash != hash) || (name->len != len) ||
+                ((col_name_str(name) != property) &&
+                 (memcmp(col_name_str(name), property, len) != 0))))
+            name = name->next;
+    }
+
+    if (name != NULL) name->refs++;
+    else if ((col_names.count < col_names.size) || (col_names_grow() == EOK)) {
+        name = (struct col_name *)malloc(sizeof(struct col_name) + len + 1);
+        if (name != NULL) {
+            name->hash = hash;
+            name->refs = 1;
+            name->len = len;
+            memcpy(col_name_str(name), property, len);
+            col_name_str(name)[len] = '\0';
+            name->next = col_names.buckets[hash & (col_names.size - 1)];
+            col_names.buckets[hash & (col_names.size - 1)] = name;
+            col_names.count++;
+        }
+    }
+
+    pthread_mutex_unlock(&col_names_lock);
+    return name;
+}
+
+/* Drop a reference to the interned name */
+static void col_name_put(struct col_name *name)
+{
+    struct col_name **link;
+
+    pthread_mutex_lock(&col_names_lock);
+
+    name->refs--;
+    if (name->refs == 0) {
+        link = &(col_names.buckets[name->hash & (col_names.size - 1)]);
+        while (*link != name) link = &((*link)->next);
+        *link = name->next;
+        free(name);
+
+        /* Do not keep the table when nothing is interned */
+        col_names.count--;
+        if (col_names.count == 0) {
+            free(col_names.buckets);
+            col_names.buckets = NULL;
+            col_names.size = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&col_names_lock);
+}
+
+/* SHARING */
+
+/* Header of the shared value */
+static union col_shared *col_shared_of(void *data)
+{
+    return (union col_shared *)data - 1;
+}
+
+/* Check if the value of the item can be shared with its copy
+ * in the collection with the given header.
+ */
+static int col_can_share(struct collection_item *item,
+                         const struct collection_header *storage)
+{
+    /* Arenas free the memory without visiting the items */
+    return (item->shared) &&
+           ((storage == NULL) || (storage->arena == NULL));
+}
+
+/* Allocate the value of the item.
+ * Long string and binary values outside of arenas get a reference
+ * counted block right away, so copies can share them later without
+ * touching the item.
+ */
+static void *col_alloc_data(struct collection_item *item,
+                            int type,
+                            int length)
+{
+    union col_shared *block;
+
+    if (((type == COL_TYPE_STRING) || (type == COL_TYPE_BINARY)) &&
+        (length >= COL_SHARE_MIN) && (item->arena == NULL)) {
+        block = (union col_shared *)malloc(sizeof(union col_shared) +
+                                           length);
+        if (block == NULL) return NULL;
+        block->refs = 1;
+        item->shared = 1;
+        return block + 1;
+    }
+
+    return col_mem_alloc(item->arena, length);
+}
+
+/* Free the data of the item or drop its reference to the shared value */
+static void col_free_data(struct collection_item *item)
+{
+    union col_shared *block;
+
+    if (item->shared) {
+        block = col_shared_of(item->data);
+        if (__atomic_sub_fetch(&(block->refs), 1, __ATOMIC_ACQ_REL) == 0)
+            free(block);
+        item->shared = 0;
+    }
+    else col_free_part(item, item->data);
+    item->data = NULL;
+}
+
+/* Duplicate string into the memory of the item */
+static char *col_dup_part(struct collection_item *item, const char *str)
+{
+    char *copy;
+    size_t len = strlen(str) + 1;
+
+    copy = (char *)col_mem_alloc(item->arena, len);
+    if (copy != NULL) memcpy(copy, str, len);
+    return copy;
+}
+
+/* Check if the property or data of the item is kept in its slot */
+static int col_is_inline(struct collection_item *item, void *part)
+{
+    return (item->pool != NULL) &&
+           ((char *)part >= (char *)(item + 1)) &&
+           ((char *)part < (char *)item + COL_SLOT_SIZE);
+}
+
+/* Free property or data of the item unless it is kept in its slot */
+static void col_free_part(struct collection_item *item, void *part)
+{
+    if ((part != NULL) && (!col_is_inline(item, part)))
+        col_mem_free(item->arena, part);
+}
+
+/* Free the property of the item or release its interned name */
+static void col_free_property(struct collection_item *item)
+{
+    if (item->name != NULL) {
+        col_name_put(item->name);
+        item->name = NULL;
+    }
+    else col_free_part(item, item->property);
+    item->property = NULL;
+}
+
+/* Allocate item for the collection with the given header.
+ * With NULL header the item is allocated on its own.
+ * With shared_data set the item references this shared value
+ * instead of copying item_data.
+ */
+static int col_allocate_item_in(const struct collection_header *storage,
+                                struct collection_item **ci,
+                                const char *property,
+                                const void *item_data,
+                                int length,
+                                int type,
+                                void *shared_data)
+{
+    struct collection_item *item = NULL;
+    const struct collection_item *ref;
+    struct col_pool *pool = NULL;
+    struct col_arena *arena = NULL;
+    char *space = NULL;
+    int room = 0;
+    int intern = 0;
+
+    TRACE_FLOW_STRING("col_allocate_item", "Entry point.");
+    TRACE_INFO_NUMBER("Will be using type:", type);
+
+    /* Check the length */
+    if ((length < 0) || (length >= COL_MAX_DATA) ||
+        ((type == COL_TYPE_STRING) && (length == 0))) {
+        TRACE_ERROR_STRING("col_allocate_item", "Bad data length.");
+        return EMSGSIZE;
+    }
+
+    if (col_validate_property(property)) {
+        TRACE_ERROR_STRING("Invalid chracters in the property name", property);
+        return EINVAL;
+    }
+
+    /* The header item can't come from the pool it owns */
+    if (storage != NULL) {
+        arena = storage->arena;
+        intern = storage->intern;
+        if (type != COL_TYPE_COLLECTION) pool = storage->pool;
+    }
+
+    /* Allocate memory for the structure */
+    if (pool != NULL) {
+        item = col_pool_get(pool);
+        if (item != NULL) {
+            space = (char *)(item + 1);
+            room = COL_SLOT_SIZE - sizeof(struct collection_item);
+            item->arena = NULL;
+        }
+    }
+    else {
+        item = (struct collection_item *)
+               col_mem_alloc(arena, sizeof(struct collection_item));
+        if (item != NULL) {
+            item->pool = NULL;
+            item->arena = arena;
+        }
+    }
+    if (item == NULL)  {
+        TRACE_ERROR_STRING("col_allocate_item", "Malloc failed.");
+        return ENOMEM;
+    }
+
+    /* After we initialize members we can use delete_item() in case of error */
+    item->next = NULL;
+    item->property = NULL;
+    item->data = NULL;
+    item->owner = NULL;
+    item->name = NULL;
+    item->shared = 0;
+    TRACE_INFO_NUMBER("About to set type to:", type);
+    item->type = type;
+    if (arena != NULL) {
+        arena->live++;
+        col_arena_track(item, 1);
+    }
+
+    item->phash = col_make_hash(property, 0, &(item->property_len));
+    TRACE_INFO_NUMBER("Item hash", item->phash);
+    TRACE_INFO_NUMBER("Item property length", item->property_len);
+
+    /* Data goes first into the slot to stay aligned */
+    if (shared_data != NULL) {
+        __atomic_add_fetch(&(col_shared_of(shared_data)->refs), 1,
+                           __ATOMIC_RELAXED);
+        item->data = shared_data;
+        item->shared = 1;
+    }
+    else if (length <= room) {
+        item->data = space;
+        space += length;
+        room -= length;
+    }
+    else item->data = col_alloc_data(item, type, length);
+
+    /* Share or copy property */
+    if (intern) {
+        item->name = col_name_get(property, item->property_len, item->phash);
+        if (item->name != NULL) item->property = col_name_str(item->name);
+    }
+    else if (item->property_len < room) {
+        item->property = space;
+        memcpy(item->property, property, item->property_len + 1);
+    }
+    else item->property = col_dup_part(item, property);
+    if (item->property == NULL) {
+        TRACE_ERROR_STRING("col_allocate_item", "Failed to dup property.");
+        col_delete_item(item);
+        return ENOMEM;
+    }
+    TRACE_INFO_NUMBER("Item property strlen", strlen(item->property));
+
+    /* Deal with data */
+    if ((length > 0) && (shared_data == NULL)) {
+        if (item->data == NULL) {
+            TRACE_ERROR_STRING("col_allocate_item", "Failed to dup data.");
+            col_delete_item(item);
+            return ENOMEM;
+        }
+
+        memcpy(item->data, item_data, length);
+    }
+    item->length = length;
+
+    /* The arena has to know where its references point */
+    if ((arena != NULL) && (type == COL_TYPE_COLLECTIONREF)) {
+        ref = *((const struct collection_item * const *)item_data);
+        if (((struct collection_header *)ref->data)->arena == arena)
+            arena->inner++;
+        else arena->outer++;
+    }
+
+    /* Make sure that data is NULL terminated in case of string */
+    if ((type == COL_TYPE_STRING) && (shared_data == NULL))
+        ((char *)(item->data))[length-1] = '\0';
+
+    *ci = item;
+
+    TRACE_INFO_STRING("Item property", item->property);
+    TRACE_INFO_NUMBER("Item property type", item->type);
+    TRACE_INFO_NUMBER("Item data length", item->length);
+    TRACE_FLOW_STRING("col_allocate_item", "Success exit.");
+    return EOK;
+}
+
+/* A generic function to allocate a property item */
+int col_allocate_item(struct collection_item **ci, const char *property,
+                      const void *item_data, int length, int type)
+{
+    return col_allocate_item_in(NULL, ci, property, item_data, length, type,
+                                NULL);
+}
+
+/* Header that tells how to allocate item for the collection.
+ * The header item of a new collection is allocated with the
+ * header it carries.
+ */
+static const struct collection_header *col_storage_of(
+                                        struct collection_item *collection,
+                                        int type,
+                                        const void *data)
+{
+    if (collection == NULL) {
+        if (type == COL_TYPE_COLLECTION)
+            return (const struct collection_header *)data;
+        return NULL;
+    }
+
+    if (collection->type != COL_TYPE_COLLECTION) return NULL;
+
+    return (struct collection_header *)collection->data;
+}
+
+/* INDEX */
+
+/* Free the index of the collection */
+static void col_index_destroy(struct collection_header *header)
+{
+    if (header->index != NULL) {
+        col_mem_free(header->arena, header->index->slots);
+        col_mem_free(header->arena, header->index);
+        header->index = NULL;
+    }
+}
+
+/* Put item into the index that has room for it */
+static void col_index_put(struct col_index *index,
+                          struct collection_item *item)
+{
+    unsigned mask = index->size - 1;
+    unsigned i = (unsigned)(item->phash & mask);
+
+    while (index->slots[i] != NULL) i = (i + 1) & mask;
+
+    index->slots[i] = item;
+    index->used++;
+    if (item->type == COL_TYPE_COLLECTIONREF) index->refs++;
+}
+
+/* (Re)build the index of all items of the collection */
+static int col_index_build(struct collection_item *collection)
+{
+    struct collection_header *header;
+    struct col_index *index;
+    struct collection_item *item;
+    unsigned size = COL_INDEX_MIN_SIZE;
+
+    TRACE_FLOW_STRING("col_index_build", "Entry.");
+
+    header = (struct collection_header *)collection->data;
+    while (size < header->count * 2) size *= 2;
+
+    index = (struct col_index *)col_mem_alloc(header->arena,
+                                              sizeof(struct col_index));
+    if (index == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate index.", ENOMEM);
+        return ENOMEM;
+    }
+
+    index->slots = (struct collection_item **)
+                   col_mem_alloc(header->arena,
+                                 size * sizeof(struct collection_item *));
+    if (index->slots == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate index slots.", ENOMEM);
+        col_mem_free(header->arena, index);
+        return ENOMEM;
+    }
+    memset(index->slots, 0, size * sizeof(struct collection_item *));
+    index->size = size;
+    index->used = 0;
+    index->refs = 0;
+
+    for (item = collection->next; item != NULL; item = item->next)
+        col_index_put(index, item);
 
+    col_index_destroy(header);
+    header->index = index;
 
+    TRACE_FLOW_NUMBER("col_index_build. Index size:", size);
+    return EOK;
+}
 
-/* A generic function to allocate a property item */
-int col_allocate_item(struct collection_item **ci, const char *property,
-                      const void *item_data, int length, int type)
+/* Record that the item was just linked into the collection */
+static void col_index_link(struct collection_item *collection,
+                           struct collection_item *item)
 {
-    struct collection_item *item = NULL;
+    struct collection_header *header;
 
-    TRACE_FLOW_STRING("col_allocate_item", "Entry point.");
-    TRACE_INFO_NUMBER("Will be using type:", type);
+    col_arena_track(item, -1);
+    item->owner = collection;
+    col_arena_track(item, 1);
 
-    /* Check the length */
-    if ((length < 0) || (length >= COL_MAX_DATA) ||
-        ((type == COL_TYPE_STRING) && (length == 0))) {
-        TRACE_ERROR_STRING("col_allocate_item", "Bad data length.");
-        return EMSGSIZE;
+    header = (struct collection_header *)collection->data;
+    if (((header->index == NULL) && (header->count > COL_INDEX_THRESHOLD)) ||
+        ((header->index != NULL) &&
+         ((header->index->used + 1) * 2 > header->index->size))) {
+        /* The item is already in the list so the build picks it up.
+         * Without memory we keep searching the list.
+         */
+        if (col_index_build(collection)) col_index_destroy(header);
     }
+    else if (header->index != NULL) col_index_put(header->index, item);
+}
 
-    if (col_validate_property(property)) {
-        TRACE_ERROR_STRING("Invalid chracters in the property name", property);
-        return EINVAL;
+/* Take item out of the index of its collection */
+static void col_index_remove(struct collection_item *item)
+{
+    struct col_index *index;
+    unsigned mask;
+    unsigned home;
+    unsigned i, j;
+
+    if (item->owner == NULL) return;
+    index = ((struct collection_header *)item->owner->data)->index;
+    if (index == NULL) return;
+
+    mask = index->size - 1;
+    i = (unsigned)(item->phash & mask);
+    while (index->slots[i] != item) {
+        if (index->slots[i] == NULL) return;
+        i = (i + 1) & mask;
     }
 
-    /* Allocate memory for the structure */
-    item = (struct collection_item *)malloc(sizeof(struct collection_item));
-    if (item == NULL)  {
-        TRACE_ERROR_STRING("col_allocate_item", "Malloc failed.");
-        return ENOMEM;
+    /* Move back the following items that can not be found past the hole */
+    for (j = (i + 1) & mask; index->slots[j] != NULL; j = (j + 1) & mask) {
+        home = (unsigned)(index->slots[j]->phash & mask);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            index->slots[i] = index->slots[j];
+            i = j;
+        }
     }
+    index->slots[i] = NULL;
+    index->used--;
+    if (item->type == COL_TYPE_COLLECTIONREF) index->refs--;
+}
 
-    /* After we initialize members we can use delete_item() in case of error */
-    item->next = NULL;
-    item->property = NULL;
-    item->data = NULL;
-    TRACE_INFO_NUMBER("About to set type to:", type);
-    item->type = type;
+/* Put item taken out by col_index_remove() back after it changed */
+static void col_index_readd(struct collection_item *item)
+{
+    struct col_index *index;
 
-    /* Copy property */
-    item->property = strdup(property);
-    if (item->property == NULL) {
-        TRACE_ERROR_STRING("col_allocate_item", "Failed to dup property.");
-        col_delete_item(item);
-        return ENOMEM;
-    }
+    if (item->owner == NULL) return;
+    index = ((struct collection_header *)item->owner->data)->index;
+    if (index != NULL) col_index_put(index, item);
+}
 
-    item->phash = col_make_hash(property, 0, &(item->property_len));
-    TRACE_INFO_NUMBER("Item hash", item->phash);
-    TRACE_INFO_NUMBER("Item property length", item->property_len);
-    TRACE_INFO_NUMBER("Item property strlen", strlen(item->property));
+/* Record that the item was unlinked from its collection */
+static void col_index_unlink(struct collection_item *item)
+{
+    col_index_remove(item);
+    col_arena_track(item, -1);
+    item->owner = NULL;
+    col_arena_track(item, 1);
+}
 
-    /* Deal with data */
-    item->data = malloc(length);
-    if (length > 0) {
-        if (item->data == NULL) {
-            TRACE_ERROR_STRING("col_allocate_item", "Failed to dup data.");
-            col_delete_item(item);
-            return ENOMEM;
+/* Find the item with the given property and one of the given types
+ * in the index of the collection. Unless onelevel is set the items
+ * of referenced collections count too.
+ * Returns 1 with found set to the item or NULL if there is none.
+ * Returns 0 if the collection has to be searched instead: it has
+ * no index, it references other collections or more than one item
+ * matches and only the list knows which of them comes first.
+ */
+static int col_index_find(struct collection_item *collection,
+                          const char *property,
+                          uint64_t hash,
+                          int type,
+                          int onelevel,
+                          struct collection_item **found)
+{
+    struct col_index *index;
+    struct collection_item *item;
+    unsigned mask;
+    unsigned i;
+
+    if (collection->type != COL_TYPE_COLLECTION) return 0;
+
+    index = ((struct collection_header *)collection->data)->index;
+    if ((index == NULL) || ((!onelevel) && (index->refs != 0))) return 0;
+
+    *found = NULL;
+    mask = index->size - 1;
+    for (i = (unsigned)(hash & mask);
+         index->slots[i] != NULL;
+         i = (i + 1) & mask) {
+        item = index->slots[i];
+        if ((item->phash == hash) &&
+            (type & item->type) &&
+            (col_same_name(item->property, property))) {
+            if (*found != NULL) return 0;
+            *found = item;
         }
-
-        memcpy(item->data, item_data, length);
     }
-    item->length = length;
-
-    /* Make sure that data is NULL terminated in case of string */
-    if (type == COL_TYPE_STRING) ((char *)(item->data))[length-1] = '\0';
-
-    *ci = item;
 
-    TRACE_INFO_STRING("Item property", item->property);
-    TRACE_INFO_NUMBER("Item property type", item->type);
-    TRACE_INFO_NUMBER("Item data length", item->length);
-    TRACE_FLOW_STRING("col_allocate_item", "Success exit.");
-    return EOK;
+    return 1;
 }
 
 /* Structure used to find things in collection */
@@ -320,9 +1366,9 @@ static int col_find_property_sub(struct collection_item *collection,
                                  struct collection_item **parent)
 {
     struct property_search ps;
-    int i = 0;
     unsigned depth = 0;
     struct collection_item *sub = NULL;
+    struct collection_item *found = NULL;
     int error = EOK;
 
     TRACE_FLOW_ENTRY();
@@ -330,7 +1376,7 @@ static int col_find_property_sub(struct collection_item *collection,
     *parent = NULL;
 
     ps.property = refprop;
-    ps.hash = FNV1a_base;
+    ps.hash = col_make_hash(refprop, 0, NULL);
     ps.parent = NULL;
     ps.index = idx;
     ps.count = 0;
@@ -340,13 +1386,6 @@ static int col_find_property_sub(struct collection_item *collection,
     ps.interrupt = interrupt;
     ps.exact = exact;
 
-    /* Create hash of the string to search */
-    while(refprop[i] != 0) {
-        ps.hash = ps.hash ^ toupper(refprop[i]);
-        ps.hash *= FNV1a_prime;
-        i++;
-    }
-
     /* Add item to collection */
     if (subcollection == NULL) {
         sub = collection;
@@ -374,6 +1413,17 @@ static int col_find_property_sub(struct collection_item *collection,
 
     }
 
+    /* The index can tell that there is no such item.
+     * The walk also looks at the header so check it too.
+     */
+    if ((col_index_find(sub, refprop, ps.hash,
+                        use_type ? type : COL_TYPE_ANY, 1, &found)) &&
+        (found == NULL) &&
+        ((sub->phash != ps.hash) || (!col_same_name(sub->property, refprop)))) {
+        TRACE_FLOW_STRING("col_find_property", "Exit - item NOT in index");
+        return 0;
+    }
+
     /* We do not care about error here */
     (void)col_walk_items(sub, COL_TRAVERSE_ONELEVEL,
                          col_parent_traverse_handler,
@@ -533,7 +1583,9 @@ int col_insert_item_into_current(struct collection_item *collection,
                                     item->next = current->next;
                                     parent->next = item;
                                     if (header->last == current) header->last = item;
+                                    col_index_unlink(current);
                                     col_delete_item(current);
+                                    col_index_link(collection, item);
                                     /* Deleted one added another - count stays the same! */
                                     TRACE_FLOW_STRING("col_insert_item_into_current", "Dup overwrite exit");
                                     return EOK;
@@ -547,7 +1599,9 @@ int col_insert_item_into_current(struct collection_item *collection,
                                     item->next = current->next;
                                     parent->next = item;
                                     if (header->last == current) header->last = item;
+                                    col_index_unlink(current);
                                     col_delete_item(current);
+                                    col_index_link(collection, item);
                                     /* Deleted one added another - count stays the same! */
                                     TRACE_FLOW_STRING("col_insert_item_into_current", "Dup overwrite exit");
                                     return EOK;
@@ -574,6 +1628,7 @@ int col_insert_item_into_current(struct collection_item *collection,
                                     current = parent->next;
                                     parent->next = current->next;
                                     if (header->last == current) header->last = parent;
+                                    col_index_unlink(current);
                                     col_delete_item(current);
                                     header->count--;
                                 }
@@ -588,6 +1643,7 @@ int col_insert_item_into_current(struct collection_item *collection,
                                     current = parent->next;
                                     parent->next = current->next;
                                     if (header->last == current) header->last = parent;
+                                    col_index_unlink(current);
                                     col_delete_item(current);
                                     header->count--;
                                 }
@@ -735,6 +1791,8 @@ int col_insert_item_into_current(struct collection_item *collection,
 
     }
 
+    /* Header of a new collection is not an item of it */
+    if (item != collection) col_index_link(collection, item);
 
     TRACE_INFO_STRING("Collection:", collection->property);
     TRACE_INFO_STRING("Just added item is:", item->property);
@@ -929,6 +1987,7 @@ int col_extract_item_from_current(struct collection_item *collection,
 
 
     /* Clear item and reduce count */
+    col_index_unlink(*ret_ref);
     (*ret_ref)->next = NULL;
     header->count--;
 
@@ -1167,7 +2226,8 @@ static int col_insert_property_with_ref_int(struct collection_item *collection,
     TRACE_FLOW_STRING("col_insert_property_with_ref_int", "Entry point.");
 
     /* Create a new property out of the given parameters */
-    error = col_allocate_item(&item, property, data, length, type);
+    error = col_allocate_item_in(col_storage_of(collection, type, data), &item,
+                                 property, data, length, type, NULL);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to allocate item", error);
         return error;
@@ -1195,12 +2255,15 @@ static int col_insert_property_with_ref_int(struct collection_item *collection,
 
 /* Special function used to copy item from one
  * collection to another using caller's callback.
+ * With shared_data set the item references this shared value
+ * of the donor instead of copying data.
  */
 static int col_copy_item_with_cb(struct collection_item *collection,
                                  const char *property,
                                  int type,
                                  const void *data,
                                  int length,
+                                 void *shared_data,
                                  col_copy_cb copy_cb,
                                  void *ext_data)
 {
@@ -1211,7 +2274,8 @@ static int col_copy_item_with_cb(struct collection_item *collection,
     TRACE_FLOW_STRING("col_copy_item_with_cb", "Entry point.");
 
     /* Create a new property out of the given parameters */
-    error = col_allocate_item(&item, property, data, length, type);
+    error = col_allocate_item_in(col_storage_of(collection, type, data), &item,
+                                 property, data, length, type, shared_data);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to allocate item", error);
         return error;
@@ -1251,6 +2315,28 @@ static int col_copy_item_with_cb(struct collection_item *collection,
 }
 
 
+/* Copy the item under the given name sharing its value if asked */
+static int col_copy_value(struct collection_item *collection,
+                          const char *property,
+                          struct collection_item *donor,
+                          struct col_copy *traverse_data)
+{
+    void *shared_data = NULL;
+
+    if ((traverse_data->share) &&
+        (col_can_share(donor, col_storage_of(collection, donor->type, NULL))))
+        shared_data = donor->data;
+
+    return col_copy_item_with_cb(collection,
+                                 property,
+                                 donor->type,
+                                 donor->data,
+                                 donor->length,
+                                 shared_data,
+                                 traverse_data->copy_cb,
+                                 traverse_data->ext_data);
+}
+
 /* This is public function so we need to check the validity
  * of the arguments.
  */
@@ -1475,11 +2561,11 @@ static int col_match_item(struct collection_item *current,
         TRACE_INFO_STRING("Searching for:", traverse_data->name_to_find);
         TRACE_INFO_STRING("Item name:", current->property);
         TRACE_INFO_STRING("Current path:", traverse_data->current_path->name);
-        TRACE_INFO_NUMBER("Searching:", toupper(*find_str));
-        TRACE_INFO_NUMBER("Have:", toupper(*data_str));
+        TRACE_INFO_NUMBER("Searching:", COL_FOLD(*find_str));
+        TRACE_INFO_NUMBER("Have:", COL_FOLD(*data_str));
 
         /* We start pointing to 0 so the loop will be executed at least once */
-        while (toupper(*data_str) == toupper(*find_str)) {
+        while (COL_FOLD(*data_str) == COL_FOLD(*find_str)) {
 
             TRACE_INFO_STRING("Loop iteration:","");
 
@@ -1510,8 +2596,8 @@ static int col_match_item(struct collection_item *current,
 
             data_str--;
             find_str--;
-            TRACE_INFO_NUMBER("Searching:", toupper(*find_str));
-            TRACE_INFO_NUMBER("Have:", toupper(*data_str));
+            TRACE_INFO_NUMBER("Searching:", COL_FOLD(*find_str));
+            TRACE_INFO_NUMBER("Have:", COL_FOLD(*data_str));
 
         }
     }
@@ -1725,10 +2811,11 @@ static int col_find_item_and_do(struct collection_item *ci,
 
     int error = EOK;
     struct find_name *traverse_data = NULL;
+    struct collection_item *found = NULL;
     unsigned depth = 0;
-    int count = 0;
+    int stop = 0;
     const char *last_part;
-    char *sep;
+    const char *sep = NULL;
 
     TRACE_FLOW_STRING("col_find_item_and_do", "Entry.");
 
@@ -1770,31 +2857,20 @@ static int col_find_item_and_do(struct collection_item *ci,
         traverse_data->name_len_to_find = strlen(property_to_find);
 
         /* Check if the search string ends with "!" - this is illegal */
-        if (traverse_data->name_to_find[traverse_data->name_len_to_find - 1] == '!') {
+        if ((traverse_data->name_len_to_find > 0) &&
+            (traverse_data->name_to_find[traverse_data->name_len_to_find - 1] == '!')) {
             TRACE_ERROR_NUMBER("Search string is invalid.", EINVAL);
             free(traverse_data);
             return EINVAL;
         }
 
-        /* Find last ! if any */
-        sep = strrchr(traverse_data->name_to_find, '!');
-        if (sep != NULL) {
-            sep++;
-            last_part = sep;
-        }
-        else last_part = traverse_data->name_to_find;
-
-        TRACE_INFO_STRING("Last item", last_part);
-
         /* Create hash of the last part */
-        traverse_data->hash = FNV1a_base;
+        traverse_data->hash = col_hash_path(property_to_find,
+                                            traverse_data->name_len_to_find,
+                                            &last_part);
+        if (last_part != property_to_find) sep = last_part;
 
-        /* Create hash of the string to search */
-        while(last_part[count] != 0) {
-            traverse_data->hash = traverse_data->hash ^ toupper(last_part[count]);
-            traverse_data->hash *= FNV1a_prime;
-            count++;
-        }
+        TRACE_INFO_STRING("Last item", last_part);
     }
     else {
         /* We a looking for a first element of a given type */
@@ -1809,6 +2885,28 @@ static int col_find_item_and_do(struct collection_item *ci,
     traverse_data->current_path = NULL;
     traverse_data->action = action;
 
+    /* Try the index with a simple name. References are only matched
+     * when the walk shows them and the walk does not descend into
+     * referenced collections if the search is limited to one level.
+     */
+    if ((property_to_find != NULL) && (*property_to_find != '\0') &&
+        (sep == NULL) &&
+        (col_index_find(ci, property_to_find, traverse_data->hash,
+                        (mode_flags & (COL_TRAVERSE_IGNORE | COL_TRAVERSE_FLAT)) ?
+                        (type & ~COL_TYPE_COLLECTIONREF) : type,
+                        mode_flags & (COL_TRAVERSE_IGNORE | COL_TRAVERSE_ONELEVEL),
+                        &found))) {
+        /* Delete needs the item before the found one so it walks */
+        if ((found == NULL) || (action != COLLECTION_ACTION_DEL)) {
+            if (found != NULL)
+                error = col_act_on_item(ci, NULL, found, action,
+                                        item_handler, custom_data, &stop);
+            free(traverse_data);
+            TRACE_FLOW_NUMBER("col_find_item_and_do. Found in index:", error);
+            return error;
+        }
+    }
+
     mode_flags |= COL_TRAVERSE_END;
 
     TRACE_INFO_STRING("col_find_item_and_do", "About to walk the tree.");
@@ -1849,8 +2947,9 @@ static int col_update_current_item(struct collection_item *current,
         ((current->type == COL_TYPE_STRING) ||
          (current->type == COL_TYPE_BINARY)))) {
         TRACE_INFO_STRING("Replacing item data buffer", "");
-        free(current->data);
-        current->data = malloc(update_data->length);
+        col_free_data(current);
+        current->data = col_alloc_data(current, update_data->type,
+                                       update_data->length);
         if (current->data == NULL) {
             TRACE_ERROR_STRING("Failed to allocate memory", "");
             current->length = 0;
@@ -1861,7 +2960,12 @@ static int col_update_current_item(struct collection_item *current,
 
     TRACE_INFO_STRING("Overwriting item data", "");
     memcpy(current->data, update_data->data, current->length);
-    current->type = update_data->type;
+    if (current->type != update_data->type) {
+        /* The index counts references */
+        col_index_remove(current);
+        current->type = update_data->type;
+        col_index_readd(current);
+    }
 
     if (current->type == COL_TYPE_STRING)
         ((char *)(current->data))[current->length-1] = '\0';
@@ -1937,7 +3041,7 @@ static int col_parent_traverse_handler(struct collection_item *head,
         }
 
         /* Validate property. Make sure we include terminating 0 in the comparison */
-        if (strncasecmp(current->property, to_find->property, current->property_len + 1) == 0) {
+        if (col_same_name(current->property, to_find->property)) {
 
             match = 1;
             to_find->found = 1;
@@ -2010,6 +3114,98 @@ static int col_parent_traverse_handler(struct collection_item *head,
 }
 
 
+/* Perform the action on the found item */
+static int col_act_on_item(struct collection_item *head,
+                           struct collection_item *previous,
+                           struct collection_item *current,
+                           int action,
+                           col_item_fn user_item_handler,
+                           void *custom_data,
+                           int *stop)
+{
+    int error = EOK;
+    struct collection_header *header;
+    struct update_property *update_data;
+
+    TRACE_FLOW_STRING("col_act_on_item", "Entry.");
+
+    switch (action) {
+    case COLLECTION_ACTION_FIND:
+        TRACE_INFO_STRING("It is a find action - calling handler.", "");
+        if (user_item_handler != NULL) {
+            /* Call user handler */
+            error = user_item_handler(current->property,
+                                      current->property_len,
+                                      current->type,
+                                      current->data,
+                                      current->length,
+                                      custom_data,
+                                      stop);
+
+            TRACE_INFO_NUMBER("Handler returned:", error);
+            TRACE_INFO_NUMBER("Handler set STOP to:", *stop);
+
+        }
+        break;
+
+    case COLLECTION_ACTION_GET:
+        TRACE_INFO_STRING("It is a get action.", "");
+        if (custom_data != NULL)
+            *((struct collection_item **)(custom_data)) = current;
+        break;
+
+    case COLLECTION_ACTION_DEL:
+        TRACE_INFO_STRING("It is a delete action.", "");
+        /* Make sure we tell the caller we found a match */
+        if (custom_data != NULL)
+            *(int *)custom_data = COL_MATCH;
+
+        /* Adjust header of the collection */
+        header = (struct collection_header *)head->data;
+        header->count--;
+        if (current->next == NULL)
+            header->last = previous;
+
+        /* Unlink and delete iteam */
+        /* Previous can't be NULL here becuase we never delete
+         * header elements */
+        previous->next = current->next;
+        col_index_unlink(current);
+        col_delete_item(current);
+        TRACE_INFO_STRING("Did the delete of the item.", "");
+        break;
+
+    case COLLECTION_ACTION_UPDATE:
+        TRACE_INFO_STRING("It is an update action.", "");
+        if((current->type == COL_TYPE_COLLECTION) ||
+           (current->type == COL_TYPE_COLLECTIONREF)) {
+            TRACE_ERROR_STRING("Can't update collections it is an error for now", "");
+            return EINVAL;
+        }
+
+        /* Make sure we tell the caller we found a match */
+        if (custom_data != NULL) {
+            update_data = (struct update_property *)custom_data;
+            update_data->found = COL_MATCH;
+            error = col_update_current_item(current, update_data);
+        }
+        else {
+            TRACE_ERROR_STRING("Error - update data is required", "");
+            return EINVAL;
+        }
+
+        TRACE_INFO_STRING("Did the delete of the item.", "");
+        break;
+    default:
+        break;
+    }
+    /* Force interrupt if we found */
+    *stop = 1;
+
+    TRACE_FLOW_NUMBER("col_act_on_item returning", error);
+    return error;
+}
+
 /* Traverse callback for find & delete function */
 static int col_act_traverse_handler(struct collection_item *head,
                                     struct collection_item *previous,
@@ -2024,10 +3220,8 @@ static int col_act_traverse_handler(struct collection_item *head,
     char *name;
     int length;
     struct path_data *temp;
-    struct collection_header *header;
     char *property;
     int property_len;
-    struct update_property *update_data;
 
     TRACE_FLOW_STRING("col_act_traverse_handler", "Entry.");
 
@@ -2097,77 +3291,9 @@ static int col_act_traverse_handler(struct collection_item *head,
     /* Do here what we do with items */
     if (col_match_item(current, traverse_data)) {
         TRACE_INFO_STRING("Matched item:", current->property);
-        switch (traverse_data->action) {
-        case COLLECTION_ACTION_FIND:
-            TRACE_INFO_STRING("It is a find action - calling handler.", "");
-            if (user_item_handler != NULL) {
-                /* Call user handler */
-                error = user_item_handler(current->property,
-                                          current->property_len,
-                                          current->type,
-                                          current->data,
-                                          current->length,
-                                          custom_data,
-                                          stop);
-
-                TRACE_INFO_NUMBER("Handler returned:", error);
-                TRACE_INFO_NUMBER("Handler set STOP to:", *stop);
-
-            }
-            break;
-
-        case COLLECTION_ACTION_GET:
-            TRACE_INFO_STRING("It is a get action.", "");
-            if (custom_data != NULL)
-                *((struct collection_item **)(custom_data)) = current;
-            break;
-
-        case COLLECTION_ACTION_DEL:
-            TRACE_INFO_STRING("It is a delete action.", "");
-            /* Make sure we tell the caller we found a match */
-            if (custom_data != NULL)
-                *(int *)custom_data = COL_MATCH;
-
-            /* Adjust header of the collection */
-            header = (struct collection_header *)head->data;
-            header->count--;
-            if (current->next == NULL)
-                header->last = previous;
-
-            /* Unlink and delete iteam */
-            /* Previous can't be NULL here becuase we never delete
-             * header elements */
-            previous->next = current->next;
-            col_delete_item(current);
-            TRACE_INFO_STRING("Did the delete of the item.", "");
-            break;
-
-        case COLLECTION_ACTION_UPDATE:
-            TRACE_INFO_STRING("It is an update action.", "");
-            if((current->type == COL_TYPE_COLLECTION) ||
-               (current->type == COL_TYPE_COLLECTIONREF)) {
-                TRACE_ERROR_STRING("Can't update collections it is an error for now", "");
-                return EINVAL;
-            }
-
-            /* Make sure we tell the caller we found a match */
-            if (custom_data != NULL) {
-                update_data = (struct update_property *)custom_data;
-                update_data->found = COL_MATCH;
-                error = col_update_current_item(current, update_data);
-            }
-            else {
-                TRACE_ERROR_STRING("Error - update data is required", "");
-                return EINVAL;
-            }
-
-            TRACE_INFO_STRING("Did the delete of the item.", "");
-            break;
-        default:
-            break;
-        }
-        /* Force interrupt if we found */
-        *stop = 1;
+        error = col_act_on_item(head, previous, current,
+                                traverse_data->action,
+                                user_item_handler, custom_data, stop);
     }
 
     TRACE_FLOW_NUMBER("col_act_traverse_handler returning", error);
@@ -2280,12 +3406,15 @@ static int col_copy_traverse_handler(struct collection_item *head,
         switch (traverse_data->mode) {
         case COL_COPY_NORMAL:
 
-            error = col_copy_collection_with_cb(&other,
+            error = col_copy_collection_in(&other,
                                         *((struct collection_item **)(current->data)),
                                         current->property,
+                                        traverse_data->share ?
+                                        COL_COPY_NORMAL | COL_COPY_SHARED :
                                         COL_COPY_NORMAL,
                                         traverse_data->copy_cb,
-                                        traverse_data->ext_data);
+                                        traverse_data->ext_data,
+                                        parent);
             if (error) {
                 TRACE_ERROR_NUMBER("Copy subcollection returned error:", error);
                 return error;
@@ -2313,7 +3442,7 @@ static int col_copy_traverse_handler(struct collection_item *head,
             /* Just increase reference count of the referenced collection */
 			other = *((struct collection_item **)(current->data));
             header = (struct collection_header *)(other->data);
-            header->reference_count++;
+            col_hold_collection(header);
 
             /* Add new item to a collection
              * all references are now sub collections */
@@ -2380,13 +3509,7 @@ static int col_copy_traverse_handler(struct collection_item *head,
 
         TRACE_INFO_STRING("Using property:", property);
 
-        error = col_copy_item_with_cb(parent,
-                                      property,
-                                      current->type,
-                                      current->data,
-                                      current->length,
-                                      traverse_data->copy_cb,
-                                      traverse_data->ext_data);
+        error = col_copy_value(parent, property, current, traverse_data);
 
         /* Free property if we allocated it */
         if (traverse_data->mode == COL_COPY_FLATDOT) free(property);
@@ -2409,9 +3532,11 @@ static int col_copy_traverse_handler(struct collection_item *head,
 
 /* CREATE */
 
-/* Function that creates an named collection of a given class*/
-int col_create_collection(struct collection_item **ci, const char *name,
-                          unsigned cclass)
+/* Create collection that takes memory from the arena if it is not NULL */
+static int col_create_collection_in(struct collection_item **ci,
+                                    const char *name,
+                                    unsigned cclass,
+                                    struct col_arena *arena)
 {
     struct collection_item *handle = NULL;
     struct collection_header header;
@@ -2423,7 +3548,18 @@ int col_create_collection(struct collection_item **ci, const char *name,
     header.last = NULL;
     header.reference_count = 1;
     header.count = 0;
-    header.cclass = cclass;
+    header.cclass = cclass & ~(COL_CLASS_PACKED | COL_CLASS_INTERN);
+    header.index = NULL;
+    header.pool = NULL;
+    header.arena = arena;
+    /* The arena frees the names at once so they can't be shared */
+    header.intern = ((cclass & COL_CLASS_INTERN) && (arena == NULL));
+
+    /* Items of an arena are packed anyway */
+    if ((cclass & COL_CLASS_PACKED) && (arena == NULL)) {
+        error = col_pool_create(&(header.pool));
+        if (error) return error;
+    }
 
     /* Create a collection type property */
     error = col_insert_property_with_ref_int(NULL,
@@ -2439,7 +3575,12 @@ int col_create_collection(struct collection_item **ci, const char *name,
                                              &handle);
 
 
-    if (error) return error;
+    if (error) {
+        col_pool_unref(header.pool);
+        return error;
+    }
+
+    if (arena != NULL) arena->holds++;
 
     *ci = handle;
 
@@ -2447,6 +3588,79 @@ int col_create_collection(struct collection_item **ci, const char *name,
     return EOK;
 }
 
+/* Function that creates an named collection of a given class*/
+int col_create_collection(struct collection_item **ci, const char *name,
+                          unsigned cclass)
+{
+    return col_create_collection_in(ci, name, cclass, NULL);
+}
+
+/* Create collection in the arena of the other collection or in a new
+ * arena if the other collection is NULL.
+ */
+static int col_create_collection_arena(struct collection_item **ci,
+                                       const char *name,
+                                       unsigned cclass,
+                                       struct collection_item *arena_of)
+{
+    struct col_arena *arena = NULL;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_create_collection_arena", "Entry.");
+
+    if (arena_of != NULL) {
+        arena = ((struct collection_header *)arena_of->data)->arena;
+        error = col_create_collection_in(ci, name, cclass, arena);
+        TRACE_FLOW_NUMBER("col_create_collection_arena returning", error);
+        return error;
+    }
+
+    error = col_arena_create(&arena);
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to create arena", error);
+        return error;
+    }
+
+    /* Keep the arena while the collection is not there */
+    arena->busy++;
+    error = col_create_collection_in(ci, name, cclass, arena);
+    arena->busy--;
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to create collection", error);
+        col_arena_release(arena);
+        return error;
+    }
+
+    TRACE_FLOW_STRING("col_create_collection_arena", "Exit.");
+    return EOK;
+}
+
+/* Function that creates a collection that uses an arena */
+int col_create_collection_ex(struct collection_item **ci,
+                             const char *name,
+                             unsigned cclass,
+                             struct collection_item *arena_of)
+{
+    TRACE_FLOW_STRING("col_create_collection_ex", "Entry.");
+
+    if ((ci == NULL) ||
+        ((arena_of != NULL) &&
+         ((arena_of->type != COL_TYPE_COLLECTION) ||
+          (((struct collection_header *)arena_of->data)->arena == NULL)))) {
+        TRACE_ERROR_NUMBER("Invalid argument", EINVAL);
+        return EINVAL;
+    }
+
+    return col_create_collection_arena(ci, name, cclass, arena_of);
+}
+
+/* Take one more reference to the collection */
+void col_hold_collection(struct collection_header *header)
+{
+    header->reference_count++;
+    if (header->arena != NULL) header->arena->holds++;
+}
+
 
 /* DESTROY */
 
@@ -2456,6 +3670,7 @@ void col_destroy_collection_with_cb(struct collection_item *ci,
                                     void *custom_data)
 {
     struct collection_header *header;
+    struct col_arena *arena;
 
     TRACE_FLOW_STRING("col_destroy_collection_with_cb", "Entry.");
 
@@ -2473,13 +3688,33 @@ void col_destroy_collection_with_cb(struct collection_item *ci,
 
     /* Collection can be referenced by other collection */
     header = (struct collection_header *)(ci->data);
+    arena = header->arena;
     TRACE_INFO_NUMBER("Reference count:", header->reference_count);
     if (header->reference_count > 1) {
         TRACE_INFO_STRING("Dereferencing a referenced collection.", "");
         header->reference_count--;
+        if (arena != NULL) arena->holds--;
         TRACE_INFO_NUMBER("Number after dereferencing.",
                           header->reference_count);
     }
+    else if (arena != NULL) {
+        arena->holds--;
+        if ((cb == NULL) &&
+            (arena->busy == 0) &&
+            (arena->holds == arena->inner) &&
+            (arena->outer == 0) &&
+            (arena->strays == 0)) {
+            TRACE_INFO_STRING("Nothing else uses the arena - releasing.", "");
+            col_arena_release(arena);
+        }
+        else {
+            arena->busy++;
+            col_delete_collection(ci, cb, custom_data);
+            arena->busy--;
+            if ((arena->busy == 0) && (arena->live == 0))
+                col_arena_release(arena);
+        }
+    }
     else {
         col_delete_collection(ci, cb, custom_data);
     }
@@ -2528,6 +3763,141 @@ int col_copy_collection_with_cb(struct collection_item **collection_copy,
                                 int copy_mode,
                                 col_copy_cb copy_cb,
                                 void *ext_data)
+{
+    return col_copy_collection_in(collection_copy, collection_to_copy,
+                                  name_to_use, copy_mode, copy_cb, ext_data,
+                                  NULL);
+}
+
+/* Copy collection into the arena of another collection.
+ * If that collection is NULL or does not use an arena the copy
+ * of a collection that uses an arena gets an arena of its own.
+ */
+/* Thread of the parallel copy, takes subcollections to copy one by one */
+static void *col_copy_worker(void *data)
+{
+    struct col_copy_work *work = (struct col_copy_work *)data;
+    struct col_copy_job *job;
+    unsigned i;
+
+    while ((i = __atomic_fetch_add(&(work->next), 1, __ATOMIC_RELAXED)) <
+           work->count) {
+        job = &(work->jobs[i]);
+        job->error = col_copy_collection_in(&(job->copy),
+                        *((struct collection_item **)(job->donor->data)),
+                        job->donor->property,
+                        work->copy_mode,
+                        work->copy_cb,
+                        work->ext_data,
+                        NULL);
+    }
+
+    return NULL;
+}
+
+/* Copy subcollections of the collection in parallel threads and
+ * then add them together with the other items to the new collection
+ * in their order.
+ */
+static int col_copy_parallel(struct collection_item *new_collection,
+                             struct collection_item *collection_to_copy,
+                             struct col_copy *traverse_data)
+{
+    pthread_t threads[COL_PARALLEL_MAX];
+    struct col_copy_work work;
+    struct collection_item *item;
+    unsigned items = 0;
+    unsigned started = 0;
+    unsigned wanted = 0;
+    unsigned i;
+    long cpus;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_copy_parallel", "Entry.");
+
+    work.count = 0;
+    for (item = collection_to_copy->next; item != NULL; item = item->next) {
+        if (item->type == COL_TYPE_COLLECTIONREF) {
+            work.count++;
+            items += ((struct collection_header *)
+                      (*((struct collection_item **)(item->data)))->data)->count;
+        }
+    }
+
+    work.jobs = (struct col_copy_job *)calloc(work.count + 1,
+                                              sizeof(struct col_copy_job));
+    if (work.jobs == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        return ENOMEM;
+    }
+
+    i = 0;
+    for (item = collection_to_copy->next; item != NULL; item = item->next)
+        if (item->type == COL_TYPE_COLLECTIONREF) work.jobs[i++].donor = item;
+
+    work.next = 0;
+    work.copy_mode = COL_COPY_NORMAL;
+    work.copy_cb = traverse_data->copy_cb;
+    work.ext_data = traverse_data->ext_data;
+
+    if (traverse_data->share) work.copy_mode |= COL_COPY_SHARED;
+
+    /* Small copies are not worth the threads */
+    if ((items >= COL_PARALLEL_MIN) && (work.count > 1)) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        wanted = (cpus > COL_PARALLEL_MAX) ? COL_PARALLEL_MAX :
+                 (cpus > 0) ? (unsigned)cpus : 1;
+        if (wanted > work.count) wanted = work.count;
+    }
+
+    /* This thread does its part too */
+    for (started = 0; started + 1 < wanted; started++)
+        if (pthread_create(&(threads[started]), NULL,
+                           col_copy_worker, &work) != 0) break;
+    col_copy_worker(&work);
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    for (i = 0; (i < work.count) && (!error); i++) error = work.jobs[i].error;
+
+    /* Add items in their order */
+    i = 0;
+    for (item = collection_to_copy->next;
+         (item != NULL) && (!error);
+         item = item->next) {
+        if (item->type == COL_TYPE_COLLECTIONREF) {
+            error = col_insert_property_with_ref_int(new_collection,
+                                                     NULL,
+                                                     COL_DSP_END,
+                                                     NULL,
+                                                     0,
+                                                     0,
+                                                     item->property,
+                                                     COL_TYPE_COLLECTIONREF,
+                                                     (void *)(&(work.jobs[i].copy)),
+                                                     sizeof(struct collection_item **),
+                                                     NULL);
+            if (!error) work.jobs[i].copy = NULL;
+            i++;
+        }
+        else error = col_copy_value(new_collection, item->property,
+                                    item, traverse_data);
+    }
+
+    for (i = 0; i < work.count; i++)
+        col_destroy_collection(work.jobs[i].copy);
+    free(work.jobs);
+
+    TRACE_FLOW_NUMBER("col_copy_parallel returning", error);
+    return error;
+}
+
+static int col_copy_collection_in(struct collection_item **collection_copy,
+                                  struct collection_item *collection_to_copy,
+                                  const char *name_to_use,
+                                  int copy_mode,
+                                  col_copy_cb copy_cb,
+                                  void *ext_data,
+                                  struct collection_item *arena_of)
 {
     int error = EOK;
     struct collection_item *new_collection = NULL;
@@ -2535,7 +3905,9 @@ int col_copy_collection_with_cb(struct collection_item **collection_copy,
     struct collection_header *header;
     unsigned depth = 0;
     struct col_copy traverse_data;
+    unsigned cclass;
     int flags;
+    int mode;
 
     TRACE_FLOW_STRING("col_copy_collection_with_cb", "Entry.");
 
@@ -2552,7 +3924,8 @@ int col_copy_collection_with_cb(struct collection_item **collection_copy,
     }
 
     /* NOTE: Refine this check if adding a new copy mode */
-    if ((copy_mode < 0) || (copy_mode > COL_COPY_TOP)) {
+    mode = copy_mode & ~(COL_COPY_SHARED | COL_COPY_PARALLEL);
+    if ((mode < 0) || (mode > COL_COPY_TOP)) {
         TRACE_ERROR_NUMBER("Invalid copy mode:", copy_mode);
         return EINVAL;
     }
@@ -2565,27 +3938,48 @@ int col_copy_collection_with_cb(struct collection_item **collection_copy,
 
     header = (struct collection_header *)collection_to_copy->data;
 
+    if ((arena_of != NULL) &&
+        (((struct collection_header *)arena_of->data)->arena == NULL))
+        arena_of = NULL;
+
     /* Create a new collection */
-    error = col_create_collection(&new_collection, name, header->cclass);
+    if ((arena_of != NULL) || (header->arena != NULL))
+        error = col_create_collection_arena(&new_collection, name,
+                                            header->cclass, arena_of);
+    else {
+        /* Copy is stored the same way */
+        cclass = header->cclass;
+        if (header->pool != NULL) cclass |= COL_CLASS_PACKED;
+        if (header->intern) cclass |= COL_CLASS_INTERN;
+        error = col_create_collection(&new_collection, name, cclass);
+    }
     if (error) {
         TRACE_ERROR_NUMBER("col_create_collection failed returning", error);
         return error;
     }
 
-    traverse_data.mode = copy_mode;
+    traverse_data.mode = mode;
     traverse_data.current_path = NULL;
     traverse_data.given_name = NULL;
     traverse_data.given_len = 0;
     traverse_data.copy_cb = copy_cb;
     traverse_data.ext_data = ext_data;
+    traverse_data.share = (copy_mode & COL_COPY_SHARED) != 0;
 
-    if (copy_mode == COL_COPY_FLATDOT) flags = COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END;
-    else if (copy_mode == COL_COPY_FLAT) flags = COL_TRAVERSE_FLAT;
+    if (mode == COL_COPY_FLATDOT) flags = COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END;
+    else if (mode == COL_COPY_FLAT) flags = COL_TRAVERSE_FLAT;
     else flags = COL_TRAVERSE_ONELEVEL;
 
-    error = col_walk_items(collection_to_copy, flags,
-                           col_copy_traverse_handler, (void *)(&traverse_data),
-                           NULL, new_collection, &depth);
+    /* Threads can't share an arena */
+    if ((copy_mode & COL_COPY_PARALLEL) && (mode == COL_COPY_NORMAL) &&
+        (((struct collection_header *)new_collection->data)->arena == NULL))
+        error = col_copy_parallel(new_collection, collection_to_copy,
+                                  &traverse_data);
+    else
+        error = col_walk_items(collection_to_copy, flags,
+                               col_copy_traverse_handler,
+                               (void *)(&traverse_data),
+                               NULL, new_collection, &depth);
 
     if (!error) *collection_copy = new_collection;
     else col_destroy_collection(new_collection);
@@ -2645,7 +4039,7 @@ int col_get_collection_reference(struct collection_item *ci,
     header = (struct collection_header *)subcollection->data;
     TRACE_INFO_NUMBER("Count:", header->count);
     TRACE_INFO_NUMBER("Ref count:", header->reference_count);
-    header->reference_count++;
+    col_hold_collection(header);
     TRACE_INFO_NUMBER("Ref count after increment:", header->reference_count);
     *acceptor = subcollection;
 
@@ -2674,7 +4068,7 @@ int col_get_reference_from_item(struct collection_item *ci,
     header = (struct collection_header *)subcollection->data;
     TRACE_INFO_NUMBER("Count:", header->count);
     TRACE_INFO_NUMBER("Ref count:", header->reference_count);
-    header->reference_count++;
+    col_hold_collection(header);
     TRACE_INFO_NUMBER("Ref count after increment:", header->reference_count);
     *acceptor = subcollection;
 
@@ -2777,7 +4171,7 @@ int col_add_collection_to_collection(struct collection_item *ci,
         header = (struct collection_header *)collection_to_add->data;
         TRACE_INFO_NUMBER("Count:", header->count);
         TRACE_INFO_NUMBER("Ref count:", header->reference_count);
-        header->reference_count++;
+        col_hold_collection(header);
         TRACE_INFO_NUMBER("Ref count after increment:",
                           header->reference_count);
         /* -> Transaction end */
@@ -2816,9 +4210,10 @@ int col_add_collection_to_collection(struct collection_item *ci,
         TRACE_INFO_STRING("Name we will use.", name_to_use);
 
         /* For future thread safety: Transaction start -> */
-        error = col_copy_collection(&collection_copy,
-                                    collection_to_add, name_to_use,
-                                    COL_COPY_NORMAL);
+        error = col_copy_collection_in(&collection_copy,
+                                       collection_to_add, name_to_use,
+                                       COL_COPY_NORMAL, NULL, NULL,
+                                       acceptor);
         if (error) return error;
 
         TRACE_INFO_STRING("We have a collection copy.", collection_copy->property);
@@ -3084,6 +4479,11 @@ int col_modify_item(struct collection_item *item,
                     const void *data,
                     int length)
 {
+    struct col_name *name = NULL;
+    char *copy;
+    uint64_t hash;
+    int len;
+
     TRACE_FLOW_STRING("col_modify_item", "Entry");
 
     /* Allow renameing only */
@@ -3099,15 +4499,29 @@ int col_modify_item(struct collection_item *item,
             TRACE_ERROR_STRING("Invalid chracters in the property name", property);
             return EINVAL;
         }
-        free(item->property);
-        item->property = strdup(property);
-        if (item->property == NULL) {
+        hash = col_make_hash(property, 0, &len);
+
+        /* Interned name is replaced with an interned one */
+        if (item->name != NULL) {
+            name = col_name_get(property, len, hash);
+            copy = (name != NULL) ? col_name_str(name) : NULL;
+        }
+        else copy = col_dup_part(item, property);
+        if (copy == NULL) {
             TRACE_ERROR_STRING("Failed to allocate memory", "");
             return ENOMEM;
         }
 
+        /* The index has to find the item under the new name */
+        col_index_remove(item);
+        col_free_property(item);
+        item->property = copy;
+        item->name = name;
+
         /* Update property length and hash if we rename the property */
-        item->phash = col_make_hash(property, 0, &(item->property_len));
+        item->phash = hash;
+        item->property_len = len;
+        col_index_readd(item);
         TRACE_INFO_NUMBER("Item hash", item->phash);
         TRACE_INFO_NUMBER("Item property length", item->property_len);
         TRACE_INFO_NUMBER("Item property strlen", strlen(item->property));
@@ -3123,8 +4537,8 @@ int col_modify_item(struct collection_item *item,
             ((item->type == type) &&
             ((item->type == COL_TYPE_STRING) || (item->type == COL_TYPE_BINARY)))) {
             TRACE_INFO_STRING("Replacing item data buffer", "");
-            free(item->data);
-            item->data = malloc(length);
+            col_free_data(item);
+            item->data = col_alloc_data(item, type, length);
             if (item->data == NULL) {
                 TRACE_ERROR_STRING("Failed to allocate memory", "");
                 item->length = 0;
@@ -3135,7 +4549,12 @@ int col_modify_item(struct collection_item *item,
 
         TRACE_INFO_STRING("Overwriting item data", "");
         memcpy(item->data, data, item->length);
-        item->type = type;
+        if (item->type != type) {
+            /* The index counts references */
+            col_index_remove(item);
+            item->type = type;
+            col_index_readd(item);
+        }
 
         if (item->type == COL_TYPE_STRING)
             ((char *)(item->data))[item->length - 1] = '\0';
@@ -3160,7 +4579,7 @@ int col_set_collection_class(struct collection_item *item,
     }
 
     header = (struct collection_header *)item->data;
-    header->cclass = cclass;
+    header->cclass = cclass & ~(COL_CLASS_PACKED | COL_CLASS_INTERN);
     TRACE_FLOW_STRING("col_set_collection_class", "Exit");
     return EOK;
 }
@@ -3265,16 +4684,10 @@ uint64_t col_make_hash(const char *string, int sub_len, int *length)
     TRACE_FLOW_STRING("col_make_hash called for string:", string);
 
     if (string) {
-        hash = FNV1a_base;
-        while (string[str_len] != 0) {
+        if (sub_len > 0) str_len = (int)strnlen(string, sub_len);
+        else str_len = (int)strlen(string);
 
-            /* Check if we need to stop */
-            if ((sub_len > 0) && (str_len == sub_len)) break;
-
-            hash = hash ^ toupper(string[str_len]);
-            hash *= FNV1a_prime;
-            str_len++;
-        }
+        hash = col_hash_chars(string, str_len);
     }
 
     if (length) *length = str_len;
@@ -119,6 +119,39 @@
  */
 #define COL_CLASS_DEFAULT      0
 
+/**
+ * @brief Flag to request packed storage of the collection items.
+ *
+ * The flag can be combined with the class passed to
+ * \ref col_create_collection "col_create_collection()".
+ * It is not a part of the class of the collection.
+ * Items of a packed collection are carved from contiguous
+ * blocks of memory together with their property names and
+ * small data values. This saves allocations and makes
+ * traversing and iterating over the collection faster.
+ * The interface to the items is the same as for other
+ * collections.
+ */
+#define COL_CLASS_PACKED       0x80000000
+
+/**
+ * @brief Flag to request interned property names.
+ *
+ * The flag can be combined with the class passed to
+ * \ref col_create_collection "col_create_collection()"
+ * and with \ref COL_CLASS_PACKED.
+ * It is not a part of the class of the collection.
+ * Items of such collection do not own a copy of their
+ * property name. They share one reference counted copy
+ * of the name with all other items of such collections
+ * that have the same name. This saves memory when the
+ * same names repeat in many collections, for example
+ * in the sections of a configuration file, and copies of
+ * such collections do not duplicate the names.
+ * Collections that use an arena ignore the flag.
+ */
+#define COL_CLASS_INTERN       0x40000000
+
 /**
  * @brief Value indicates that property is not found.
  *
@@ -367,6 +400,33 @@
 #define COL_COPY_KEEPREF        3
 /** @brief Copy only top level collection. */
 #define COL_COPY_TOP            4
+/**
+ * @brief Share long string and binary values with the donor.
+ *
+ * The flag can be combined with any copy mode.
+ * The copy references the values of the donor instead of
+ * duplicating them. Only string and binary values of 32 bytes
+ * or more that the donor keeps in their own reference counted
+ * block are shared, values of arena collections never are.
+ * The donor itself is not modified, so several threads can
+ * copy the same collection and the pointers returned by
+ * \ref col_get_item_data "col_get_item_data()" for the donor
+ * stay valid. A value stops being shared when it is
+ * modified or updated through the collection interface.
+ * Values must not be changed in place through the pointer
+ * returned by \ref col_get_item_data "col_get_item_data()".
+ */
+#define COL_COPY_SHARED         0x100
+/**
+ * @brief Copy subcollections in parallel threads.
+ *
+ * The flag can be combined with \ref COL_COPY_NORMAL.
+ * The subcollections of a big collection are copied by
+ * several threads. The copy callback, if any, has to be
+ * safe to call from several threads at once.
+ * Collections that use an arena are copied by one thread.
+ */
+#define COL_COPY_PARALLEL       0x200
 /**
  * @}
  */
@@ -393,6 +453,16 @@
  * Ignored if \ref COL_SORT_SUB is not specified.
  */
 #define COL_SORT_MYSUB  0x00000004
+/**
+ * @brief Sort big collections using several threads.
+ *
+ * Collections with many items are split into parts
+ * that are sorted by separate threads and then merged.
+ * The order is the same as without the flag.
+ * The collection must not be used by other threads
+ * while it is sorted.
+ */
+#define COL_SORT_PARALLEL 0x00000008
 /**
  * @}
  */
@@ -432,6 +502,53 @@ struct collection_iterator;
 
 #endif /* COLLECTION_PRIV_H */
 
+/**
+ * @brief Levels of nesting an iterator handles
+ * without allocating memory.
+ */
+#define COL_ITERATOR_DEPTH 8
+
+/**
+ * @brief Memory for an iterator kept by the caller.
+ *
+ * Declare it as a local variable and bind it with
+ * \ref col_bind_iterator_ex "col_bind_iterator_ex()"
+ * to iterate a collection without allocating memory.
+ * Caller should never assume anything about
+ * the members of this structure.
+ */
+struct col_iterator_space {
+    /** Private. */
+    uint64_t reserved[COL_ITERATOR_DEPTH + 24];
+};
+
+/**
+ * @struct col_ring
+ * @brief Opaque ring buffer of values.
+ *
+ * Ring queues and stacks keep their values in it, see
+ * \ref col_create_queue_ring "col_create_queue_ring()" and
+ * \ref col_create_stack_ring "col_create_stack_ring()".
+ */
+struct col_ring;
+
+/**
+ * @brief Value taken from a ring queue or stack.
+ *
+ * The name and the data stay in the ring and are valid
+ * until the next value is added or the ring is destroyed.
+ */
+struct col_value {
+    /** Name of the property. */
+    const char *property;
+    /** Type of the value, see \ref coltypes "type constants". */
+    int type;
+    /** Length of the data. */
+    int length;
+    /** The data. */
+    const void *data;
+};
+
 
 /**
  * @brief Create a collection
@@ -463,6 +580,10 @@ struct collection_iterator;
  *                    library pick a range for the classes you are
  *                    going to use and make sure that they do not collide
  *                    with other interfaces built on top of the collection.
+ *                    The class can be combined with \ref COL_CLASS_PACKED
+ *                    to store the items of the collection in blocks.
+ *                    It can be also combined with \ref COL_CLASS_INTERN
+ *                    to share the property names of the items.
  *
  * @return 0          - Collection was created successfully.
  * @return ENOMEM     - No memory.
@@ -473,6 +594,50 @@ int col_create_collection(struct collection_item **ci,
                           const char *name,
                           unsigned cclass);
 
+/**
+ * @brief Create a collection that allocates its memory from an arena.
+ *
+ * The function is the same as
+ * \ref col_create_collection "col_create_collection()"
+ * but the collection and its items take memory from an arena.
+ * Memory of deleted items is reused by the arena.
+ * Collections that will be embedded into the collection,
+ * for example the sections of a configuration, should be
+ * created in the same arena.
+ *
+ * Destroying the collection releases the whole arena at once
+ * if nothing outside of the arena uses it any more. That is the
+ * case if all other collections of the arena are only referenced
+ * by the collections of the arena and the collections of the arena
+ * neither reference other collections nor have items that were
+ * allocated somewhere else. Items extracted from the collections
+ * of the arena and not deleted yet keep the arena too.
+ * Otherwise the collection is destroyed item by item and the
+ * arena is released when its last item is deleted.
+ *
+ * Copies of a collection that uses an arena get an arena
+ * of their own.
+ *
+ * @param[out] ci       Newly allocated collection object.
+ * @param[in]  name     Name of the collection, see
+ *                      \ref col_create_collection "col_create_collection()".
+ * @param[in]  cclass   Class of the collection.
+ *                      \ref COL_CLASS_PACKED and \ref COL_CLASS_INTERN
+ *                      are ignored.
+ * @param[in]  arena_of Collection to share the arena with.
+ *                      If NULL a new arena is created.
+ *
+ * @return 0          - Collection was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid characters in the collection name
+ *                      or arena_of is not a collection that uses an arena.
+ * @return EMSGSIZE   - Collection name is too long.
+ */
+int col_create_collection_ex(struct collection_item **ci,
+                             const char *name,
+                             unsigned cclass,
+                             struct collection_item *arena_of);
+
 /**
  * @brief Destroy a collection
  *
@@ -865,9 +1030,14 @@ int col_get_dup_item(struct collection_item *ci,
  * is sorted with sub collections the referenced
  * collection will be sorted more than once.
  *
- * NOTE: Current implementation of the sorting
- * function is very simple and alternative
- * implementations might be provided later.
+ * The sort is a stable merge sort: items that compare
+ * as same keep their relative order (in the descending
+ * order they come out reversed).
+ * Sorting by the property name, property length, data
+ * length or the value of numbers of one type compares
+ * keys extracted from the items once, other
+ * combinations of the comparison flags use
+ * \ref col_compare_items "col_compare_items()".
  *
  * @param[in]  col         Collection to sort.
  * @param[in]  cmp_flags   For more information see
@@ -3245,6 +3415,49 @@ int col_bind_iterator(struct collection_iterator **iterator,
                       struct collection_item *ci,
                       int mode_flags);
 
+/**
+ * @brief Bind iterator kept in the caller's memory to a collection.
+ *
+ * Works like \ref col_bind_iterator "col_bind_iterator()" but
+ * places the iterator into the memory provided by the caller.
+ * Such iterator allocates memory only if it goes more than
+ * \ref COL_ITERATOR_DEPTH levels deep into the sub collections.
+ * The iterator must still be unbound with
+ * \ref col_unbind_iterator "col_unbind_iterator()" which
+ * does not free the space.
+ * The space must not be copied or moved while the iterator is bound.
+ *
+ * @code
+ * struct col_iterator_space space;
+ * struct collection_iterator *iterator;
+ * struct collection_item *item;
+ * int error;
+ *
+ * error = col_bind_iterator_ex(&iterator, col, COL_TRAVERSE_DEFAULT, &space);
+ * if (error) return error;
+ * COL_FOR_EACH_ITEM(iterator, item, error) {
+ *     ...
+ * }
+ * col_unbind_iterator(iterator);
+ * @endcode
+ *
+ * @param[out] iterator   Iterator object placed into the space.
+ * @param[in]  ci         Collection to iterate.
+ * @param[in]  mode_flags Flags define how to traverse the collection.
+ *                        For more information see \ref traverseconst
+ *                        "constants defining traverse modes".
+ * @param[in]  space      Memory for the iterator.
+ *                        If NULL the iterator is allocated.
+ *
+ * @return 0          - Iterator was bound successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - The value of some of the arguments is invalid.
+ */
+int col_bind_iterator_ex(struct collection_iterator **iterator,
+                         struct collection_item *ci,
+                         int mode_flags,
+                         struct col_iterator_space *space);
+
 /**
  * @brief Unbind the iterator from the collection.
  *
@@ -3252,6 +3465,22 @@ int col_bind_iterator(struct collection_iterator **iterator,
  */
 void col_unbind_iterator(struct collection_iterator *iterator);
 
+/**
+ * @brief Loop over the items of a collection.
+ *
+ * Calls \ref col_iterate_collection "col_iterate_collection()"
+ * before each pass of the loop until it fails or gets to the end.
+ * After the loop error is 0 if all items were seen.
+ *
+ * @param[in]  iterator   Iterator object to use.
+ * @param[out] item       Variable to set to the current item.
+ * @param[out] error      Variable to set to the result of the iteration.
+ */
+#define COL_FOR_EACH_ITEM(iterator, item, error) \
+    for ((item) = NULL; \
+         (((error) = col_iterate_collection((iterator), &(item))) == EOK) && \
+         ((item) != NULL); )
+
 /**
  * @brief Iterate collection.
  *
@@ -25,6 +25,9 @@
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "trace.h"
 
 /* The collection should use the real structures */
@@ -87,10 +90,13 @@ int col_compare_items(struct collection_item *first,
             /* Compare hashes and lengths first */
             if ((first->phash == second->phash) &&
                 (first->property_len == second->property_len)) {
-                /* Collections are case insensitive, sorry... */
-                cmpres = strncasecmp(first->property,
-                                     second->property,
-                                     second->property_len);
+                /* Collections are case insensitive, sorry...
+                 * Interned names are the same string.
+                 */
+                if (first->property == second->property) cmpres = 0;
+                else cmpres = strncasecmp(first->property,
+                                          second->property,
+                                          second->property_len);
                 if (cmpres != 0) {
                     result = NONZERO;
                     if (cmpres < 0) {
@@ -292,6 +298,280 @@ int col_compare_items(struct collection_item *first,
     return result;
 }
 
+/* Runs this short are sorted by insertion */
+#define COL_SORT_RUN            16
+/* Smallest number of items sorted by several threads */
+#define COL_SORT_PARALLEL_MIN   32768
+/* Upper limit on the number of sorting threads */
+#define COL_SORT_PARALLEL_MAX   16
+
+/* Item being sorted and the key extracted from it */
+struct col_sort_key {
+    uint64_t key;
+    struct collection_item *item;
+};
+
+/* How the keys are compared */
+struct col_sort_ctx {
+    unsigned cmp_flags;
+    /* Different keys decide the order */
+    int use_key;
+    /* Equal keys mean equal items */
+    int key_only;
+};
+
+/* Check if the first item goes after the second one.
+ * This is the condition the comparison of the two
+ * items produces: they are different and the second
+ * one is not greater in any way.
+ */
+static int col_sort_after(const struct col_sort_ctx *ctx,
+                          const struct col_sort_key *first,
+                          const struct col_sort_key *second)
+{
+    unsigned out_flags = 0;
+    int res;
+
+    if (ctx->use_key) {
+        if (first->key != second->key) return first->key > second->key;
+        if (ctx->key_only) return 0;
+    }
+
+    res = col_compare_items(first->item, second->item,
+                            ctx->cmp_flags, &out_flags);
+    return (res != 0) && (out_flags == 0);
+}
+
+/* Key of a property: first bytes of the name
+ * folded the way strncasecmp() folds them and
+ * packed so that the keys compare as the names do.
+ * Returns nonzero if the name can't be keyed.
+ */
+static int col_sort_prop_key(struct collection_item *item, uint64_t *key)
+{
+    uint64_t value = 0;
+    unsigned char c;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        c = (i < item->property_len) ? (unsigned char)item->property[i] : 0;
+        /* Outside ASCII the folding depends on the locale */
+        if (c >= 0x80) return 1;
+        if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+        value = (value << 8) | c;
+    }
+
+    *key = value;
+    return 0;
+}
+
+/* Key of the numeric data */
+static uint64_t col_sort_data_key(struct collection_item *item)
+{
+    switch (item->type) {
+    case COL_TYPE_INTEGER:
+        return (uint64_t)(int64_t)*((int *)(item->data)) ^ (1ULL << 63);
+    case COL_TYPE_UNSIGNED:
+        return *((unsigned *)(item->data));
+    case COL_TYPE_LONG:
+        return (uint64_t)(int64_t)*((long *)(item->data)) ^ (1ULL << 63);
+    case COL_TYPE_ULONG:
+        return *((unsigned long *)(item->data));
+    case COL_TYPE_BOOL:
+    default:
+        return *((unsigned char *)(item->data));
+    }
+}
+
+/* Extract the keys if the comparison flags allow it */
+static void col_sort_extract(struct col_sort_ctx *ctx,
+                             struct col_sort_key *keys,
+                             size_t count)
+{
+    size_t i;
+    int type;
+
+    ctx->use_key = 0;
+    ctx->key_only = 1;
+
+    if (count == 0) return;
+
+    switch (ctx->cmp_flags) {
+    case COL_CMPIN_PROP_EQU:
+        for (i = 0; i < count; i++) {
+            if (col_sort_prop_key(keys[i].item, &keys[i].key)) return;
+        }
+        /* Names can differ past the key */
+        ctx->key_only = 0;
+        break;
+
+    case COL_CMPIN_PROP_LEN:
+        for (i = 0; i < count; i++) {
+            keys[i].key = (uint64_t)keys[i].item->property_len;
+        }
+        break;
+
+    case COL_CMPIN_DATA_LEN:
+        for (i = 0; i < count; i++) {
+            keys[i].key = (uint64_t)keys[i].item->length;
+        }
+        break;
+
+    case COL_CMPIN_DATA:
+        /* Only numbers of one type are ordered by value */
+        type = keys[0].item->type;
+        if ((type != COL_TYPE_INTEGER) &&
+            (type != COL_TYPE_UNSIGNED) &&
+            (type != COL_TYPE_LONG) &&
+            (type != COL_TYPE_ULONG) &&
+            (type != COL_TYPE_BOOL)) return;
+        for (i = 0; i < count; i++) {
+            if (keys[i].item->type != type) return;
+            keys[i].key = col_sort_data_key(keys[i].item);
+        }
+        break;
+
+    default:
+        return;
+    }
+
+    ctx->use_key = 1;
+}
+
+/* Merge two sorted neighbouring runs.
+ * Only the first run is moved to the temporary space.
+ */
+static void col_sort_merge(const struct col_sort_ctx *ctx,
+                           struct col_sort_key *keys,
+                           size_t half,
+                           size_t count,
+                           struct col_sort_key *tmp)
+{
+    size_t i = 0;
+    size_t j = half;
+    size_t k = 0;
+
+    /* Already in order */
+    if (!col_sort_after(ctx, &keys[half - 1], &keys[half])) return;
+
+    memcpy(tmp, keys, half * sizeof(struct col_sort_key));
+
+    while ((i < half) && (j < count)) {
+        /* Take the second run only if it is strictly
+         * smaller so the equal items keep their order */
+        if (col_sort_after(ctx, &tmp[i], &keys[j])) keys[k++] = keys[j++];
+        else keys[k++] = tmp[i++];
+    }
+    while (i < half) keys[k++] = tmp[i++];
+}
+
+/* Stable merge sort */
+static void col_sort_keys(const struct col_sort_ctx *ctx,
+                          struct col_sort_key *keys,
+                          size_t count,
+                          struct col_sort_key *tmp)
+{
+    struct col_sort_key key;
+    size_t half;
+    size_t i, j;
+
+    if (count <= COL_SORT_RUN) {
+        for (i = 1; i < count; i++) {
+            key = keys[i];
+            j = i;
+            while ((j > 0) && col_sort_after(ctx, &keys[j - 1], &key)) {
+                keys[j] = keys[j - 1];
+                j--;
+            }
+            keys[j] = key;
+        }
+        return;
+    }
+
+    half = count / 2;
+    col_sort_keys(ctx, keys, half, tmp);
+    col_sort_keys(ctx, keys + half, count - half, tmp);
+    col_sort_merge(ctx, keys, half, count, tmp);
+}
+
+/* Part of the array sorted by one thread */
+struct col_sort_part {
+    const struct col_sort_ctx *ctx;
+    struct col_sort_key *keys;
+    struct col_sort_key *tmp;
+    size_t count;
+    pthread_t thread;
+};
+
+static void *col_sort_worker(void *arg)
+{
+    struct col_sort_part *part = (struct col_sort_part *)arg;
+
+    col_sort_keys(part->ctx, part->keys, part->count, part->tmp);
+    return NULL;
+}
+
+/* Sort the parts in threads and merge them.
+ * Falls back to one thread if threads can't be used.
+ */
+static void col_sort_parallel(const struct col_sort_ctx *ctx,
+                              struct col_sort_key *keys,
+                              size_t count,
+                              struct col_sort_key *tmp)
+{
+    struct col_sort_part part[COL_SORT_PARALLEL_MAX];
+    size_t start[COL_SORT_PARALLEL_MAX + 1];
+    long cpus;
+    int num;
+    int width;
+    int i;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num = (cpus > COL_SORT_PARALLEL_MAX) ? COL_SORT_PARALLEL_MAX : (int)cpus;
+    if ((size_t)num > count / (COL_SORT_PARALLEL_MIN / 2)) {
+        num = (int)(count / (COL_SORT_PARALLEL_MIN / 2));
+    }
+    if (num < 2) {
+        col_sort_keys(ctx, keys, count, tmp);
+        return;
+    }
+
+    TRACE_INFO_NUMBER("Sorting threads:", num);
+
+    for (i = 0; i <= num; i++) start[i] = count * i / num;
+
+    for (i = 0; i < num; i++) {
+        part[i].ctx = ctx;
+        part[i].keys = keys + start[i];
+        part[i].tmp = tmp + start[i];
+        part[i].count = start[i + 1] - start[i];
+        /* The first part is sorted by this thread */
+        if ((i == 0) ||
+            (pthread_create(&part[i].thread, NULL,
+                            col_sort_worker, &part[i]) != 0)) {
+            part[i].thread = pthread_self();
+            col_sort_worker(&part[i]);
+        }
+    }
+
+    for (i = 1; i < num; i++) {
+        if (!pthread_equal(part[i].thread, pthread_self())) {
+            pthread_join(part[i].thread, NULL);
+        }
+    }
+
+    /* Merge the parts pairwise */
+    for (width = 1; width < num; width *= 2) {
+        for (i = 0; i + width < num; i += 2 * width) {
+            col_sort_merge(ctx, keys + start[i],
+                           start[i + width] - start[i],
+                           start[(i + 2 * width < num) ?
+                                 i + 2 * width : num] - start[i],
+                           tmp);
+        }
+    }
+}
+
 /* Sort collection */
 int col_sort_collection(struct collection_item *col,
                         unsigned cmp_flags,
@@ -301,14 +581,13 @@ int col_sort_collection(struct collection_item *col,
 
     struct collection_item *current;
     struct collection_header *header;
-    struct collection_item **array;
-    struct collection_item *temp_item;
+    struct col_sort_key *keys;
+    struct col_sort_key *tmp;
+    struct col_sort_ctx ctx;
     struct collection_item *other;
     size_t size;
-    int ind, last;
-    int i, j;
-    int res;
-    unsigned out_flags;
+    size_t ind, last;
+    size_t i;
 
     TRACE_FLOW_STRING("col_sort_collection", "Entry.");
 
@@ -320,7 +599,6 @@ int col_sort_collection(struct collection_item *col,
         return EINVAL;
     }
 
-    /* This will be a fast and simple implementation for now */
     header = (struct collection_header *)(col->data);
 
     if ((sort_flags & COL_SORT_SUB) &&
@@ -330,29 +608,37 @@ int col_sort_collection(struct collection_item *col,
         return error;
     }
 
-    size = sizeof(struct collection_item *) * (header->count - 1);
-    array = (struct collection_item **)malloc(size);
-    if (array == NULL) {
+    /* Nothing to sort */
+    if (header->count < 2) {
+        TRACE_FLOW_STRING("col_sort_collection", "Exit.");
+        return error;
+    }
+
+    /* The keys and the space to merge them */
+    size = sizeof(struct col_sort_key) * (header->count - 1);
+    keys = (struct col_sort_key *)malloc(size * 2);
+    if (keys == NULL) {
         TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
         return ENOMEM;
     }
+    tmp = keys + (header->count - 1);
 
     /* Fill array */
     current = col->next;
     ind = 0;
     while (current != NULL) {
         TRACE_INFO_STRING("Item:", current->property);
-        array[ind] = current;
+        keys[ind].item = current;
         if ((sort_flags & COL_SORT_SUB) &&
-            (array[ind]->type == COL_TYPE_COLLECTIONREF)) {
+            (current->type == COL_TYPE_COLLECTIONREF)) {
             /* If we found a subcollection and we need to sort it
              * then sort it.
              */
-            other = *((struct collection_item **)(array[ind]->data));
+            other = *((struct collection_item **)(current->data));
             error = col_sort_collection(other, cmp_flags, sort_flags);
             if (error) {
                 TRACE_ERROR_NUMBER("Subcollection sort failed", error);
-                free(array);
+                free(keys);
                 return error;
             }
         }
@@ -362,72 +648,33 @@ int col_sort_collection(struct collection_item *col,
 
     last = ind - 1;
 
-    for (i = 0; i < last; i++) {
-
-        TRACE_INFO_STRING("Arg1:", array[i]->property);
-        TRACE_INFO_STRING("Arg2:", array[i + 1]->property);
+    ctx.cmp_flags = cmp_flags;
+    col_sort_extract(&ctx, keys, ind);
 
-        res = col_compare_items(array[i],
-                                array[i + 1],
-                                cmp_flags,
-                                &out_flags);
-
-        TRACE_INFO_STRING("Result:", ((res == 0) ? "same" : "different"));
-        TRACE_INFO_NUMBER("Out flags", out_flags);
-
-        /* If they are not same and second is not greater
-         * in any way then we need to swap them */
-        if ((res != 0) && (out_flags == 0)) {
-            /* Swap */
-            TRACE_INFO_STRING("Swapping:", "");
-            TRACE_INFO_STRING("Item:", array[i]->property);
-            TRACE_INFO_STRING("Item:", array[i + 1]->property);
-
-            temp_item = array[i];
-            array[i] = array[i + 1];
-            array[i + 1] = temp_item;
-
-            /* But we need to go up bubbling this item
-             */
-            j = i;
-            while (j > 0) {
-                res = col_compare_items(array[j - 1],
-                                        array[j],
-                                        cmp_flags,
-                                        &out_flags);
-                /* If they are not same and second is not greater
-                 * in any way then we need to swap them */
-                if ((res != 0) && (out_flags == 0)) {
-                    /* Swap */
-                    temp_item = array[j - 1];
-                    array[j - 1] = array[j];
-                    array[j] = temp_item;
-                }
-                else break;
-                j--;
-            }
-        }
+    if ((sort_flags & COL_SORT_PARALLEL) && (ind >= COL_SORT_PARALLEL_MIN)) {
+        col_sort_parallel(&ctx, keys, ind, tmp);
     }
+    else col_sort_keys(&ctx, keys, ind, tmp);
 
     /* Build the chain back */
     if (sort_flags & COL_SORT_DESC) {
-        col->next = array[last];
+        col->next = keys[last].item;
         for (i = last; i > 0 ; i--) {
-            array[i]->next = array[i - 1];
+            keys[i].item->next = keys[i - 1].item;
         }
-        array[0]->next = NULL;
-        header->last = array[0];
+        keys[0].item->next = NULL;
+        header->last = keys[0].item;
     }
     else {
-        col->next = array[0];
+        col->next = keys[0].item;
         for (i = 0; i < last ; i++) {
-            array[i]->next = array[i + 1];
+            keys[i].item->next = keys[i + 1].item;
         }
-        array[last]->next = NULL;
-        header->last = array[last];
+        keys[last].item->next = NULL;
+        header->last = keys[last].item;
     }
 
-    free(array);
+    free(keys);
 
     TRACE_FLOW_STRING("col_sort_collection", "Exit.");
     return error;
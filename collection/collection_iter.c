@@ -34,6 +34,11 @@
 /* Depth for iterator depth allocation block */
 #define STACK_DEPTH_BLOCK   15
 
+/* The caller's space must hold the iterator */
+typedef char col_iterator_space_check[
+    (sizeof(struct col_iterator_space) >=
+     sizeof(struct collection_iterator)) ? 1 : -1];
+
 /* Grow iteration stack */
 static int col_grow_stack(struct collection_iterator *iterator, unsigned desired)
 {
@@ -44,7 +49,15 @@ static int col_grow_stack(struct collection_iterator *iterator, unsigned desired
 
     if (desired > iterator->stack_size) {
         grow_by = (((desired - iterator->stack_size) / STACK_DEPTH_BLOCK) + 1) * STACK_DEPTH_BLOCK;
-        temp = (struct collection_item **)realloc(iterator->stack, grow_by * sizeof(struct collection_item *));
+        if (iterator->stack == iterator->inline_stack) {
+            /* Spill the inline stack to the heap */
+            temp = (struct collection_item **)malloc((iterator->stack_size + grow_by) * sizeof(struct collection_item *));
+            if (temp != NULL) {
+                memcpy(temp, iterator->inline_stack,
+                       iterator->stack_size * sizeof(struct collection_item *));
+            }
+        }
+        else temp = (struct collection_item **)realloc(iterator->stack, (iterator->stack_size + grow_by) * sizeof(struct collection_item *));
         if (temp == NULL) {
             TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
             return ENOMEM;
@@ -56,18 +69,16 @@ static int col_grow_stack(struct collection_iterator *iterator, unsigned desired
     return EOK;
 }
 
-
-
-/* Bind iterator to a collection */
-int col_bind_iterator(struct collection_iterator **iterator,
-                      struct collection_item *ci,
-                      int mode_flags)
+/* Bind iterator to a collection in the given memory */
+int col_bind_iterator_ex(struct collection_iterator **iterator,
+                         struct collection_item *ci,
+                         int mode_flags,
+                         struct col_iterator_space *space)
 {
-    int error;
     struct collection_header *header;
     struct collection_iterator *iter = NULL;
 
-    TRACE_FLOW_STRING("col_bind_iterator", "Entry.");
+    TRACE_FLOW_STRING("col_bind_iterator_ex", "Entry.");
 
     /* Do some argument checking first */
     if ((iterator == NULL) || (ci == NULL)) {
@@ -75,42 +86,36 @@ int col_bind_iterator(struct collection_iterator **iterator,
         return EINVAL;
     }
 
-    iter = (struct collection_iterator *)malloc(sizeof(struct collection_iterator));
-    if (iter == NULL) {
-        TRACE_ERROR_NUMBER("Error allocating memory for the iterator.", ENOMEM);
-        return ENOMEM;
+    if (space != NULL) iter = (struct collection_iterator *)space;
+    else {
+        iter = (struct collection_iterator *)malloc(sizeof(struct collection_iterator));
+        if (iter == NULL) {
+            TRACE_ERROR_NUMBER("Error allocating memory for the iterator.", ENOMEM);
+            return ENOMEM;
+        }
     }
 
-    /* Allocate memory for the stack */
-    iter->stack = NULL;
-    iter->stack_size = 0;
+    /* The stack starts inline */
+    iter->stack = iter->inline_stack;
+    iter->stack_size = COL_ITERATOR_DEPTH;
     iter->stack_depth = 0;
     iter->item_level = 0;
     iter->flags = mode_flags;
     iter->pin_level = 0;
     iter->can_break = 0;
+    iter->in_place = (space != NULL);
 
-    TRACE_INFO_NUMBER("Iterator flags", iter->flags);
-
-    /* Allocate memory for stack */
-    error = col_grow_stack(iter, 1);
-    if(error) {
-        free(iter);
-        TRACE_ERROR_NUMBER("Error growing stack.", error);
-        return error;
-    }
+    /* End item lives in the iterator */
+    memset(&(iter->end_item), 0, sizeof(struct collection_item));
+    iter->end_property[0] = '\0';
+    iter->end_item.property = iter->end_property;
+    iter->end_item.type = COL_TYPE_END;
 
-    /* Create a special end item */
-    error = col_allocate_item(&(iter->end_item), "", NULL, 0, COL_TYPE_END);
-    if(error) {
-        free(iter);
-        TRACE_ERROR_NUMBER("Error allocating end item.", error);
-        return error;
-    }
+    TRACE_INFO_NUMBER("Iterator flags", iter->flags);
 
     /* Make sure that we tie iterator to the collection */
     header = (struct collection_header *)ci->data;
-    header->reference_count++;
+    col_hold_collection(header);
     iter->top = ci;
     iter->pin = ci;
     *(iter->stack) = ci;
@@ -118,10 +123,18 @@ int col_bind_iterator(struct collection_iterator **iterator,
 
     *iterator = iter;
 
-    TRACE_FLOW_STRING("col_bind_iterator", "Exit");
+    TRACE_FLOW_STRING("col_bind_iterator_ex", "Exit");
     return EOK;
 }
 
+/* Bind iterator to a collection */
+int col_bind_iterator(struct collection_iterator **iterator,
+                      struct collection_item *ci,
+                      int mode_flags)
+{
+    return col_bind_iterator_ex(iterator, ci, mode_flags, NULL);
+}
+
 /* Stop processing this subcollection and move to the next item in the
  * collection 'level' levels up.*/
 int col_iterate_up(struct collection_iterator *iterator, unsigned level)
@@ -189,9 +202,8 @@ void col_unbind_iterator(struct collection_iterator *iterator)
     TRACE_FLOW_STRING("col_unbind_iterator", "Entry.");
     if (iterator != NULL) {
         col_destroy_collection(iterator->top);
-        col_delete_item(iterator->end_item);
-        free(iterator->stack);
-        free(iterator);
+        if (iterator->stack != iterator->inline_stack) free(iterator->stack);
+        if (!iterator->in_place) free(iterator);
     }
     TRACE_FLOW_STRING("col_unbind_iterator", "Exit");
 }
@@ -361,7 +373,7 @@ int col_iterate_collection(struct collection_iterator *iterator,
 
                     /* Return dummy entry to indicate the end of the collection */
                     TRACE_INFO_STRING("Finished level", "told to return END");
-                    *item = iterator->end_item;
+                    *item = &(iterator->end_item);
                     break;
                 }
             }
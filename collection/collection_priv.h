@@ -24,6 +24,19 @@
 
 #include <stdint.h>
 
+/* Defined below, collection.h leaves them out once this file is included */
+struct collection_item;
+struct collection_iterator;
+
+#include "collection.h"
+
+/* Storage of the items of a packed collection, see collection.c */
+struct col_pool;
+/* Memory of collections created with col_create_collection_ex() */
+struct col_arena;
+/* Property name shared by items, see collection.c */
+struct col_name;
+
 /* Define real strcutures */
 /* Structure that holds one property.
  * This structure should never be assumed and used directly other than
@@ -46,6 +59,17 @@ struct collection_item {
     int length;
     void *data;
     uint64_t phash;
+    /* Collection the item is linked into, NULL if it is not in any */
+    struct collection_item *owner;
+    /* Pool the item was carved from, NULL if it was allocated alone */
+    struct col_pool *pool;
+    /* Arena the item and its parts are allocated from, NULL if none */
+    struct col_arena *arena;
+    /* Interned name the property points to, NULL if the item owns it */
+    struct col_name *name;
+    /* Nonzero if the data is in a reference counted block
+     * that copies of the item can share */
+    int shared;
 };
 
 
@@ -59,19 +83,37 @@ struct collection_iterator {
     unsigned stack_depth;
     unsigned item_level;
     int flags;
-    struct collection_item *end_item;
+    /* Item returned at the end of a collection */
+    struct collection_item end_item;
+    char end_property[1];
     struct collection_item *pin;
     unsigned pin_level;
     unsigned can_break;
+    /* Nonzero if the iterator lives in the caller's memory */
+    unsigned in_place;
+    /* First levels of the stack, the stack spills to the heap
+     * only if the iterator goes deeper */
+    struct collection_item *inline_stack[COL_ITERATOR_DEPTH];
 };
 
 
+/* Hash index of the items of a big collection, see collection.c */
+struct col_index;
+
 /* Special type of data that stores collection header information. */
 struct collection_header {
     struct collection_item *last;
     unsigned reference_count;
     unsigned count;
     unsigned cclass;
+    /* Built once count exceeds COL_INDEX_THRESHOLD, NULL until then */
+    struct col_index *index;
+    /* Slots for the items of a COL_CLASS_PACKED collection, NULL otherwise */
+    struct col_pool *pool;
+    /* Arena of the collection, NULL for collections that use the heap */
+    struct col_arena *arena;
+    /* Nonzero if the property names of the items are interned */
+    unsigned intern;
 };
 
 /* Internal function to allocate item */
@@ -81,4 +123,22 @@ int col_allocate_item(struct collection_item **ci,
                       int length,
                       int type);
 
+/* Internal function to take one more reference to the collection */
+void col_hold_collection(struct collection_header *header);
+
+/* Ring of values behind the ring queues and stacks, see collection_ring.c */
+int col_create_ring(struct col_ring **ring,
+                    unsigned cclass,
+                    unsigned capacity);
+void col_destroy_ring(struct col_ring *ring);
+int col_is_ring_of_class(struct col_ring *ring, unsigned cclass);
+int col_put_ring_value(struct col_ring *ring,
+                       const char *property,
+                       int type,
+                       const void *data,
+                       int length);
+int col_take_ring_value(struct col_ring *ring,
+                        int last,
+                        struct col_value *value);
+
 #endif
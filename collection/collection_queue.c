@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <errno.h>
+#include "collection_priv.h"
 #include "collection_queue.h"
 #include "trace.h"
 
@@ -359,3 +360,69 @@ int col_dequeue_item(struct collection_item *queue,
     TRACE_FLOW_STRING("col_dequeue_item", "Exit.");
     return error;
 }
+
+/* Create a queue kept in a ring buffer */
+int col_create_queue_ring(struct col_ring **queue, unsigned capacity)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_create_queue_ring", "Entry point.");
+
+    error = col_create_ring(queue, COL_CLASS_QUEUE, capacity);
+
+    TRACE_FLOW_STRING("col_create_queue_ring", "Exit.");
+    return error;
+}
+
+/* Destroy a ring queue */
+void col_destroy_queue_ring(struct col_ring *queue)
+{
+    TRACE_FLOW_STRING("col_destroy_queue_ring", "Entry point.");
+
+    col_destroy_ring(queue);
+
+    TRACE_FLOW_STRING("col_destroy_queue_ring", "Exit");
+}
+
+/* Put a value into a ring queue */
+int col_enqueue_value(struct col_ring *queue,
+                      const char *property,
+                      int type,
+                      const void *data,
+                      int length)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_enqueue_value", "Entry point.");
+
+    /* Make sure it is a queue */
+    if (!col_is_ring_of_class(queue, COL_CLASS_QUEUE)) {
+        TRACE_ERROR_STRING("Wrong class", "");
+        return EINVAL;
+    }
+
+    error = col_put_ring_value(queue, property, type, data, length);
+
+    TRACE_FLOW_STRING("col_enqueue_value", "Exit.");
+    return error;
+}
+
+/* Get a value from a ring queue */
+int col_dequeue_value(struct col_ring *queue,
+                      struct col_value *value)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_dequeue_value", "Entry point.");
+
+    /* Make sure it is a queue */
+    if (!col_is_ring_of_class(queue, COL_CLASS_QUEUE)) {
+        TRACE_ERROR_STRING("Wrong class", "");
+        return EINVAL;
+    }
+
+    error = col_take_ring_value(queue, 0, value);
+
+    TRACE_FLOW_STRING("col_dequeue_value", "Exit.");
+    return error;
+}
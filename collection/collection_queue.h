@@ -319,6 +319,71 @@ int col_enqueue_item(struct collection_item *queue,
 int col_dequeue_item(struct collection_item *queue,
                      struct collection_item **item);
 
+/**
+ * @brief Create queue kept in a ring buffer.
+ *
+ * A ring queue keeps copies of the values in a ring buffer
+ * of slots that grows when it is full. Small values are kept
+ * in the slots and the space for bigger values stays with
+ * the slot to be used again, so a ring queue that is used
+ * over and over stops allocating memory.
+ * Unlike the queue built on a collection it is not a collection
+ * and only the functions of this section can be used with it.
+ *
+ * @param[out] queue         Newly created queue object.
+ * @param[in]  capacity      Number of values the queue is expected
+ *                           to hold. Zero means the default.
+ *
+ * @return 0          - Queue was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_create_queue_ring(struct col_ring **queue, unsigned capacity);
+
+/**
+ * @brief Destroy ring queue.
+ *
+ * @param[in] queue          Ring queue to destroy.
+ */
+void col_destroy_queue_ring(struct col_ring *queue);
+
+/**
+ * @brief Add value to the end of the ring queue.
+ *
+ * @param[in] queue       Ring queue object.
+ * @param[in] property    Name of the property.
+ * @param[in] type        Type of the value, one of the
+ *                        \ref coltypes "type constants" for data.
+ * @param[in] data        Data to copy.
+ * @param[in] length      Length of the data. Zero means
+ *                        the whole string for \ref COL_TYPE_STRING.
+ *
+ * @return 0          - Value was added successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ * @return EMSGSIZE   - Length of the data is invalid or too big.
+ */
+int col_enqueue_value(struct col_ring *queue,
+                      const char *property,
+                      int type,
+                      const void *data,
+                      int length);
+
+/**
+ * @brief Get the first value from the ring queue.
+ *
+ * @param[in]  queue      Ring queue object.
+ * @param[out] value      Receives the value. It points into the
+ *                        queue and is valid until the next value
+ *                        is added or the queue is destroyed.
+ *
+ * @return 0          - Value was retrieved successfully.
+ * @return ENOENT     - Queue is empty.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_dequeue_value(struct col_ring *queue,
+                      struct col_value *value);
+
 /**
  * @}
  */
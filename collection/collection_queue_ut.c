@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #define TRACE_HOME
 #include "trace.h"
 #include "collection_queue.h"
@@ -186,12 +187,124 @@ static int empty_test(void)
 }
 
 
+static int ring_test(void)
+{
+    struct col_ring *queue = NULL;
+    struct col_value value;
+    char text[200];
+    char saved[200];
+    char name[20];
+    uint32_t number;
+    int i, j;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("ring_test","Entry.");
+
+    COLOUT(printf("\n\nRING QUEUE TEST!!!.\n\n\n"));
+
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    /* Small ring that has to grow after it wrapped around */
+    number = 0;
+    if ((error = col_create_queue_ring(&queue, 2)) ||
+        (error = col_enqueue_value(queue, "first", COL_TYPE_UNSIGNED,
+                                   &number, sizeof(uint32_t))) ||
+        (error = col_enqueue_value(queue, "long", COL_TYPE_STRING,
+                                   text, 0)) ||
+        (error = col_dequeue_value(queue, &value)) ||
+        (value.type != COL_TYPE_UNSIGNED) ||
+        (strcmp(value.property, "first") != 0) ||
+        (*((const uint32_t *)value.data) != 0)) {
+        printf("Failed to use ring queue. Error %d\n", error);
+        col_destroy_queue_ring(queue);
+        return error ? error : EINVAL;
+    }
+
+    for (i = 1; i < 20; i++) {
+        number = i;
+        sprintf(name, "item%d", i);
+        if ((error = col_enqueue_value(queue, name, COL_TYPE_UNSIGNED,
+                                       &number, sizeof(uint32_t)))) {
+            printf("Failed to enqueue value. Error %d\n", error);
+            col_destroy_queue_ring(queue);
+            return error;
+        }
+    }
+
+    /* Rotate the queue, the values must come out in order */
+    for (j = 0; j < 3; j++) {
+        for (i = 0; i < 20; i++) {
+            if ((error = col_dequeue_value(queue, &value))) {
+                printf("Failed to dequeue value. Error %d\n", error);
+                col_destroy_queue_ring(queue);
+                return error;
+            }
+            if (i == 0) {
+                if ((value.type != COL_TYPE_STRING) ||
+                    (value.length != sizeof(text)) ||
+                    (strcmp((const char *)value.data, text) != 0)) {
+                    printf("Wrong string\n");
+                    col_destroy_queue_ring(queue);
+                    return EINVAL;
+                }
+            }
+            else {
+                sprintf(name, "item%d", i);
+                if ((strcmp(value.property, name) != 0) ||
+                    (*((const uint32_t *)value.data) != i)) {
+                    printf("Expected %s got %s\n", name, value.property);
+                    col_destroy_queue_ring(queue);
+                    return EINVAL;
+                }
+            }
+            /* The value is valid until the next one is added */
+            memcpy(saved, value.data, value.length);
+            strcpy(name, value.property);
+            if ((error = col_enqueue_value(queue, name, value.type,
+                                           saved, value.length))) {
+                printf("Failed to enqueue value. Error %d\n", error);
+                col_destroy_queue_ring(queue);
+                return error;
+            }
+        }
+    }
+
+    for (i = 0; i < 20; i++) {
+        if ((error = col_dequeue_value(queue, &value))) {
+            printf("Failed to dequeue value. Error %d\n", error);
+            col_destroy_queue_ring(queue);
+            return error;
+        }
+    }
+
+    /* Empty queue and wrong arguments */
+    if ((col_dequeue_value(queue, &value) != ENOENT) ||
+        (col_enqueue_value(queue, "bad", COL_TYPE_COLLECTION,
+                           &number, sizeof(uint32_t)) != EINVAL) ||
+        (col_enqueue_value(queue, "bad", COL_TYPE_BINARY,
+                           text, 0) != EMSGSIZE)) {
+        printf("Wrong arguments are accepted\n");
+        col_destroy_queue_ring(queue);
+        return EINVAL;
+    }
+
+    col_destroy_queue_ring(queue);
+    TRACE_FLOW_NUMBER("ring_test. Returning", error);
+
+    COLOUT(printf("\n\nEND OF RING QUEUE TEST!!!.\n\n\n"));
+
+    return error;
+}
+
+
 /* Main function of the unit test */
 int main(int argc, char *argv[])
 {
     int error = 0;
     test_fn tests[] = { queue_test,
                         empty_test,
+                        ring_test,
                         NULL };
     test_fn t;
     int i = 0;
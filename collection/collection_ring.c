@@ -0,0 +1,296 @@
+/*
+    COLLECTION LIBRARY
+
+    Ring buffer behind the ring queues and stacks.
+
+    Copyright (C) 2026 Red Hat
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Number of slots if the caller does not care */
+#define COL_RING_DEFAULT    16
+/* Bytes of the name and data kept in the slot itself */
+#define COL_RING_SMALL      40
+/* Data follows the name at this alignment */
+#define COL_RING_ALIGN(len) (((len) + 7) & ~((size_t)7))
+
+/* Types a ring can keep */
+#define COL_RING_TYPES  (COL_TYPE_STRING | COL_TYPE_BINARY | \
+                         COL_TYPE_INTEGER | COL_TYPE_UNSIGNED | \
+                         COL_TYPE_LONG | COL_TYPE_ULONG | \
+                         COL_TYPE_DOUBLE | COL_TYPE_BOOL)
+
+/* One value of the ring.
+ * The name and then the data are kept in the slot if they fit,
+ * otherwise in a heap block that stays with the slot so that
+ * the later values of the same size do not allocate.
+ */
+struct col_ring_slot {
+    int type;
+    int length;
+    int property_len;
+    /* Nonzero if the value is in the heap block */
+    int in_heap;
+    char *heap;
+    size_t heap_size;
+    union {
+        uint64_t align;
+        char bytes[COL_RING_SMALL];
+    } small;
+};
+
+struct col_ring {
+    /* COL_CLASS_QUEUE or COL_CLASS_STACK */
+    unsigned cclass;
+    /* Number of slots, a power of two */
+    unsigned size;
+    /* Slot of the oldest value */
+    unsigned head;
+    unsigned count;
+    struct col_ring_slot *slots;
+};
+
+/* Create a ring */
+int col_create_ring(struct col_ring **ring,
+                    unsigned cclass,
+                    unsigned capacity)
+{
+    struct col_ring *new_ring;
+    unsigned size = 1;
+
+    TRACE_FLOW_STRING("col_create_ring", "Entry.");
+
+    if (ring == NULL) {
+        TRACE_ERROR_NUMBER("Invalid parameter.", EINVAL);
+        return EINVAL;
+    }
+
+    if (capacity == 0) capacity = COL_RING_DEFAULT;
+    if (capacity > (1U << 30)) {
+        TRACE_ERROR_NUMBER("Capacity is too big.", EINVAL);
+        return EINVAL;
+    }
+    while (size < capacity) size <<= 1;
+
+    new_ring = (struct col_ring *)malloc(sizeof(struct col_ring));
+    if (new_ring == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        return ENOMEM;
+    }
+
+    new_ring->slots = (struct col_ring_slot *)calloc(size, sizeof(struct col_ring_slot));
+    if (new_ring->slots == NULL) {
+        free(new_ring);
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        return ENOMEM;
+    }
+
+    new_ring->cclass = cclass;
+    new_ring->size = size;
+    new_ring->head = 0;
+    new_ring->count = 0;
+
+    *ring = new_ring;
+
+    TRACE_FLOW_STRING("col_create_ring", "Exit.");
+    return EOK;
+}
+
+/* Destroy a ring */
+void col_destroy_ring(struct col_ring *ring)
+{
+    unsigned i;
+
+    TRACE_FLOW_STRING("col_destroy_ring", "Entry.");
+
+    if (ring != NULL) {
+        for (i = 0; i < ring->size; i++) free(ring->slots[i].heap);
+        free(ring->slots);
+        free(ring);
+    }
+
+    TRACE_FLOW_STRING("col_destroy_ring", "Exit.");
+}
+
+/* Check that the ring is of the right class */
+int col_is_ring_of_class(struct col_ring *ring, unsigned cclass)
+{
+    return (ring != NULL) && (ring->cclass == cclass);
+}
+
+/* Double the number of slots keeping the order of the values */
+static int col_grow_ring(struct col_ring *ring)
+{
+    struct col_ring_slot *slots;
+    unsigned first;
+
+    TRACE_FLOW_STRING("col_grow_ring", "Entry.");
+
+    if (ring->size >= (1U << 30)) {
+        TRACE_ERROR_NUMBER("Ring is too big", ENOMEM);
+        return ENOMEM;
+    }
+
+    slots = (struct col_ring_slot *)calloc(ring->size * 2, sizeof(struct col_ring_slot));
+    if (slots == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        return ENOMEM;
+    }
+
+    /* The ring is full so all slots move */
+    first = ring->size - ring->head;
+    memcpy(slots, ring->slots + ring->head,
+           first * sizeof(struct col_ring_slot));
+    memcpy(slots + first, ring->slots,
+           ring->head * sizeof(struct col_ring_slot));
+
+    free(ring->slots);
+    ring->slots = slots;
+    ring->head = 0;
+    ring->size *= 2;
+
+    TRACE_FLOW_STRING("col_grow_ring", "Exit.");
+    return EOK;
+}
+
+/* Add a value after the last one */
+int col_put_ring_value(struct col_ring *ring,
+                       const char *property,
+                       int type,
+                       const void *data,
+                       int length)
+{
+    struct col_ring_slot *slot;
+    size_t property_len;
+    size_t offset;
+    size_t needed;
+    char *base;
+    char *block;
+    int error;
+
+    TRACE_FLOW_STRING("col_put_ring_value", "Entry.");
+
+    if ((ring == NULL) || (property == NULL) || (data == NULL) ||
+        ((type & COL_RING_TYPES) == 0) || ((type & (type - 1)) != 0)) {
+        TRACE_ERROR_NUMBER("Invalid parameter.", EINVAL);
+        return EINVAL;
+    }
+
+    /* Strings are measured and terminated the way collections do it */
+    if ((type == COL_TYPE_STRING) && (length == 0)) {
+        length = strlen((const char *)data) + 1;
+    }
+    if ((length <= 0) || (length >= COL_MAX_DATA)) {
+        TRACE_ERROR_NUMBER("Bad data length.", EMSGSIZE);
+        return EMSGSIZE;
+    }
+
+    property_len = strlen(property);
+
+    if (ring->count == ring->size) {
+        error = col_grow_ring(ring);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to grow the ring", error);
+            return error;
+        }
+    }
+
+    slot = &ring->slots[(ring->head + ring->count) & (ring->size - 1)];
+
+    offset = COL_RING_ALIGN(property_len + 1);
+    needed = offset + (size_t)length;
+    if (needed <= COL_RING_SMALL) {
+        base = slot->small.bytes;
+        slot->in_heap = 0;
+    }
+    else {
+        if (needed > slot->heap_size) {
+            block = (char *)realloc(slot->heap, needed);
+            if (block == NULL) {
+                TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+                return ENOMEM;
+            }
+            slot->heap = block;
+            slot->heap_size = needed;
+        }
+        base = slot->heap;
+        slot->in_heap = 1;
+    }
+
+    memcpy(base, property, property_len + 1);
+    if (type == COL_TYPE_STRING) {
+        memcpy(base + offset, data, length - 1);
+        base[offset + length - 1] = '\0';
+    }
+    else memcpy(base + offset, data, length);
+
+    slot->type = type;
+    slot->length = length;
+    slot->property_len = (int)property_len;
+    ring->count++;
+
+    TRACE_FLOW_STRING("col_put_ring_value", "Exit.");
+    return EOK;
+}
+
+/* Take the first or the last value */
+int col_take_ring_value(struct col_ring *ring,
+                        int last,
+                        struct col_value *value)
+{
+    struct col_ring_slot *slot;
+    unsigned ind;
+    char *base;
+
+    TRACE_FLOW_STRING("col_take_ring_value", "Entry.");
+
+    if ((ring == NULL) || (value == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter.", EINVAL);
+        return EINVAL;
+    }
+
+    if (ring->count == 0) {
+        TRACE_FLOW_STRING("col_take_ring_value", "Empty.");
+        return ENOENT;
+    }
+
+    if (last) ind = (ring->head + ring->count - 1) & (ring->size - 1);
+    else {
+        ind = ring->head;
+        ring->head = (ring->head + 1) & (ring->size - 1);
+    }
+    ring->count--;
+
+    /* The slot is not reused until the next value is added */
+    slot = &ring->slots[ind];
+    base = slot->in_heap ? slot->heap : slot->small.bytes;
+    value->property = base;
+    value->type = slot->type;
+    value->length = slot->length;
+    value->data = base + COL_RING_ALIGN(slot->property_len + 1);
+
+    TRACE_FLOW_STRING("col_take_ring_value", "Exit.");
+    return EOK;
+}
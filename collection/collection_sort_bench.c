@@ -0,0 +1,296 @@
+/*
+    COLLECTION LIBRARY
+
+    Benchmark for sorting collections.
+
+    Copyright (C) 2026 Red Hat
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Fills a collection with --count integer properties that have random
+ * names and random values with duplicates, then sorts it by:
+ *
+ *   name     COL_CMPIN_PROP_EQU
+ *   data     COL_CMPIN_DATA
+ *   generic  COL_CMPIN_DATA | COL_CMPIN_TYPE, which has no key to extract
+ *
+ * unless --by picks one. Each order is sorted twice:
+ *
+ *   reference  the insertion sort col_sort_collection() used to do,
+ *              run over an array of the items since the list itself
+ *              can't be relinked from outside of the library
+ *   merge      col_sort_collection() on a copy of the collection,
+ *              with COL_SORT_PARALLEL if --parallel is given
+ *
+ * The reference sort is quadratic, --no-reference skips it for big
+ * counts. The random stream only depends on --seed.
+ *
+ * Every sort prints one JSON object per line with its time and, for the
+ * merge sort, if it produced the same order as the reference.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include "collection.h"
+
+enum order_t {
+    ORDER_NAME,
+    ORDER_DATA,
+    ORDER_GENERIC,
+    ORDER_COUNT
+};
+
+static const char *order_names[ORDER_COUNT] = { "name", "data", "generic" };
+
+static const unsigned order_flags[ORDER_COUNT] = {
+    COL_CMPIN_PROP_EQU,
+    COL_CMPIN_DATA,
+    COL_CMPIN_DATA | COL_CMPIN_TYPE
+};
+
+static unsigned long n_items = 10000;
+
+static void fail(const char *what, int status)
+{
+    fprintf(stderr, "Error: %s failed (%s)\n", what, strerror(status));
+    exit(1);
+}
+
+static uint64_t next_rand(uint64_t *state)
+{
+    /* xorshift64* */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The items of the collection in the list order */
+static struct collection_item **get_items(struct collection_item *col)
+{
+    struct collection_iterator *iterator = NULL;
+    struct collection_item *item = NULL;
+    struct collection_item **items;
+    unsigned long i = 0;
+    int status;
+
+    items = malloc(n_items * sizeof(struct collection_item *));
+    if (items == NULL) fail("malloc", ENOMEM);
+
+    status = col_bind_iterator(&iterator, col, COL_TRAVERSE_ONELEVEL);
+    if (status) fail("col_bind_iterator", status);
+
+    while (1) {
+        status = col_iterate_collection(iterator, &item);
+        if (status) fail("col_iterate_collection", status);
+        if (item == NULL) break;
+        if (col_get_item_type(item) == COL_TYPE_COLLECTION) continue;
+        if (i < n_items) items[i] = item;
+        i++;
+    }
+    col_unbind_iterator(iterator);
+
+    if (i != n_items) fail("get_items", EINVAL);
+    return items;
+}
+
+/* The sort col_sort_collection() did before the merge sort */
+static void reference_sort(struct collection_item **array, unsigned cmp_flags)
+{
+    struct collection_item *temp_item;
+    unsigned long i, j;
+    unsigned out_flags;
+    int res;
+
+    for (i = 0; i + 1 < n_items; i++) {
+        res = col_compare_items(array[i], array[i + 1], cmp_flags, &out_flags);
+        if ((res != 0) && (out_flags == 0)) {
+            temp_item = array[i];
+            array[i] = array[i + 1];
+            array[i + 1] = temp_item;
+
+            j = i;
+            while (j > 0) {
+                res = col_compare_items(array[j - 1], array[j],
+                                        cmp_flags, &out_flags);
+                if ((res != 0) && (out_flags == 0)) {
+                    temp_item = array[j - 1];
+                    array[j - 1] = array[j];
+                    array[j] = temp_item;
+                }
+                else break;
+                j--;
+            }
+        }
+    }
+}
+
+static void print_result(const char *sort, enum order_t order,
+                         const char *config, double seconds, int same)
+{
+    printf("{\"sort\":\"%s\",\"by\":\"%s\",%s,"
+           "\"seconds\":%.6f,\"items_per_sec\":%.0f",
+           sort, order_names[order], config, seconds, n_items / seconds);
+    if (same >= 0) printf(",\"same_order\":%s", same ? "true" : "false");
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void run_order(struct collection_item *col, enum order_t order,
+                      unsigned sort_flags, int reference, const char *config)
+{
+    struct collection_item *copy = NULL;
+    struct collection_item **expected = NULL;
+    struct collection_item **items;
+    double start, seconds;
+    unsigned long i;
+    int status;
+    int same = -1;
+
+    if (reference) {
+        expected = get_items(col);
+        start = now();
+        reference_sort(expected, order_flags[order]);
+        seconds = now() - start;
+        print_result("reference", order, config, seconds, -1);
+    }
+
+    status = col_copy_collection(&copy, col, NULL, COL_COPY_NORMAL);
+    if (status) fail("col_copy_collection", status);
+
+    start = now();
+    status = col_sort_collection(copy, order_flags[order], sort_flags);
+    seconds = now() - start;
+    if (status) fail("col_sort_collection", status);
+
+    if (reference) {
+        /* Compare the names, the copy has its own items */
+        items = get_items(copy);
+        same = 1;
+        for (i = 0; i < n_items; i++) {
+            if (strcmp(col_get_item_property(items[i], NULL),
+                       col_get_item_property(expected[i], NULL)) != 0) {
+                same = 0;
+                break;
+            }
+        }
+        free(items);
+        free(expected);
+    }
+    print_result("merge", order, config, seconds, same);
+
+    col_destroy_collection(copy);
+}
+
+int main(int argc, char **argv)
+{
+    struct collection_item *col = NULL;
+    uint64_t seed = 1;
+    uint64_t state;
+    unsigned sort_flags = COL_SORT_ASC;
+    int use_order[ORDER_COUNT] = { 1, 1, 1 };
+    int reference = 1;
+    char config[128], name[32];
+    unsigned long i;
+    int order, status;
+
+    while (1) {
+        int arg;
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"count", 1, 0, 'c'},
+            {"by", 1, 0, 'b'},
+            {"seed", 1, 0, 'S'},
+            {"parallel", 0, 0, 'p'},
+            {"no-reference", 0, 0, 'n'},
+            {0, 0, 0, 0}
+        };
+
+        arg = getopt_long(argc, argv, "c:b:S:pn",
+                          long_options, &option_index);
+        if (arg == -1) break;
+
+        switch (arg) {
+        case 'c':
+            n_items = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            for (order = 0; order < ORDER_COUNT; order++) {
+                use_order[order] = strcmp(optarg, order_names[order]) == 0;
+            }
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            sort_flags |= COL_SORT_PARALLEL;
+            break;
+        case 'n':
+            reference = 0;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [--count N] "
+                    "[--by name|data|generic] [--seed N] [--parallel] "
+                    "[--no-reference]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (n_items == 0 || seed == 0) {
+        fprintf(stderr, "count and seed must be positive\n");
+        exit(1);
+    }
+
+    status = col_create_collection(&col, "bench", 0);
+    if (status) fail("col_create_collection", status);
+
+    state = seed;
+    for (i = 0; i < n_items; i++) {
+        snprintf(name, sizeof(name), "key%016llx",
+                 (unsigned long long)next_rand(&state));
+        status = col_add_int_property(col, NULL, name,
+                                      (int)(next_rand(&state) % n_items));
+        if (status) fail("col_add_int_property", status);
+    }
+
+    snprintf(config, sizeof(config),
+             "\"count\":%lu,\"parallel\":%d,\"seed\":%llu",
+             n_items, (sort_flags & COL_SORT_PARALLEL) != 0,
+             (unsigned long long)seed);
+
+    for (order = 0; order < ORDER_COUNT; order++) {
+        if (use_order[order]) {
+            run_order(col, order, sort_flags, reference, config);
+        }
+    }
+
+    col_destroy_collection(col);
+    return 0;
+}
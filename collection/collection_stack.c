@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <errno.h>
+#include "collection_priv.h"
 #include "collection_stack.h"
 #include "trace.h"
 
@@ -357,3 +358,69 @@ int col_pop_item(struct collection_item *stack,
     TRACE_FLOW_STRING("col_pop_item", "Exit.");
     return error;
 }
+
+/* Create a stack kept in a ring buffer */
+int col_create_stack_ring(struct col_ring **stack, unsigned capacity)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_create_stack_ring", "Entry point.");
+
+    error = col_create_ring(stack, COL_CLASS_STACK, capacity);
+
+    TRACE_FLOW_STRING("col_create_stack_ring", "Exit.");
+    return error;
+}
+
+/* Destroy a ring stack */
+void col_destroy_stack_ring(struct col_ring *stack)
+{
+    TRACE_FLOW_STRING("col_destroy_stack_ring", "Entry point.");
+
+    col_destroy_ring(stack);
+
+    TRACE_FLOW_STRING("col_destroy_stack_ring", "Exit");
+}
+
+/* Put a value into a ring stack */
+int col_push_value(struct col_ring *stack,
+                   const char *property,
+                   int type,
+                   const void *data,
+                   int length)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_push_value", "Entry point.");
+
+    /* Make sure it is a stack */
+    if (!col_is_ring_of_class(stack, COL_CLASS_STACK)) {
+        TRACE_ERROR_STRING("Wrong class", "");
+        return EINVAL;
+    }
+
+    error = col_put_ring_value(stack, property, type, data, length);
+
+    TRACE_FLOW_STRING("col_push_value", "Exit.");
+    return error;
+}
+
+/* Get a value from a ring stack */
+int col_pop_value(struct col_ring *stack,
+                  struct col_value *value)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_pop_value", "Entry point.");
+
+    /* Make sure it is a stack */
+    if (!col_is_ring_of_class(stack, COL_CLASS_STACK)) {
+        TRACE_ERROR_STRING("Wrong class", "");
+        return EINVAL;
+    }
+
+    error = col_take_ring_value(stack, 1, value);
+
+    TRACE_FLOW_STRING("col_pop_value", "Exit.");
+    return error;
+}
@@ -322,6 +322,71 @@ int col_push_item(struct collection_item *stack,
 int col_pop_item(struct collection_item *stack,
                  struct collection_item **item);
 
+/**
+ * @brief Create stack kept in a ring buffer.
+ *
+ * A ring stack keeps copies of the values in a ring buffer
+ * of slots that grows when it is full. Small values are kept
+ * in the slots and the space for bigger values stays with
+ * the slot to be used again, so a ring stack that is used
+ * over and over stops allocating memory.
+ * Unlike the stack built on a collection it is not a collection
+ * and only the functions of this section can be used with it.
+ *
+ * @param[out] stack         Newly created stack object.
+ * @param[in]  capacity      Number of values the stack is expected
+ *                           to hold. Zero means the default.
+ *
+ * @return 0          - Stack was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_create_stack_ring(struct col_ring **stack, unsigned capacity);
+
+/**
+ * @brief Destroy ring stack.
+ *
+ * @param[in] stack          Ring stack to destroy.
+ */
+void col_destroy_stack_ring(struct col_ring *stack);
+
+/**
+ * @brief Push value into the ring stack.
+ *
+ * @param[in] stack       Ring stack object.
+ * @param[in] property    Name of the property.
+ * @param[in] type        Type of the value, one of the
+ *                        \ref coltypes "type constants" for data.
+ * @param[in] data        Data to copy.
+ * @param[in] length      Length of the data. Zero means
+ *                        the whole string for \ref COL_TYPE_STRING.
+ *
+ * @return 0          - Value was added successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ * @return EMSGSIZE   - Length of the data is invalid or too big.
+ */
+int col_push_value(struct col_ring *stack,
+                   const char *property,
+                   int type,
+                   const void *data,
+                   int length);
+
+/**
+ * @brief Pop the last pushed value from the ring stack.
+ *
+ * @param[in]  stack      Ring stack object.
+ * @param[out] value      Receives the value. It points into the
+ *                        stack and is valid until the next value
+ *                        is added or the stack is destroyed.
+ *
+ * @return 0          - Value was retrieved successfully.
+ * @return ENOENT     - Stack is empty.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_pop_value(struct col_ring *stack,
+                  struct col_value *value);
+
 /**
  * @}
  */
@@ -22,9 +22,11 @@
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #define TRACE_HOME
 #include "trace.h"
 #include "collection_stack.h"
+#include "collection_queue.h"
 #include "collection_tools.h"
 
 typedef int (*test_fn)(void);
@@ -103,12 +105,77 @@ static int stack_test(void)
     return error;
 }
 
+static int ring_test(void)
+{
+    struct col_ring *stack = NULL;
+    struct col_ring *queue = NULL;
+    struct col_value value;
+    char name[20];
+    int32_t number;
+    int i;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("ring_test","Entry.");
+
+    COLOUT(printf("\n\nRING STACK TEST!!!.\n\n"));
+
+    if ((error = col_create_stack_ring(&stack, 0))) {
+        printf("Failed to create ring stack. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 100; i++) {
+        number = -i;
+        sprintf(name, "item%d", i);
+        if ((error = col_push_value(stack, name, COL_TYPE_INTEGER,
+                                    &number, sizeof(int32_t)))) {
+            printf("Failed to push value. Error %d\n", error);
+            col_destroy_stack_ring(stack);
+            return error;
+        }
+    }
+
+    /* Values come back in the reverse order */
+    for (i = 99; i >= 0; i--) {
+        sprintf(name, "item%d", i);
+        if ((error = col_pop_value(stack, &value)) ||
+            (value.type != COL_TYPE_INTEGER) ||
+            (value.length != sizeof(int32_t)) ||
+            (strcmp(value.property, name) != 0) ||
+            (*((const int32_t *)value.data) != -i)) {
+            printf("Failed to pop %s. Error %d\n", name, error);
+            col_destroy_stack_ring(stack);
+            return error ? error : EINVAL;
+        }
+    }
+
+    /* Empty stack, queue is not a stack */
+    if ((col_pop_value(stack, &value) != ENOENT) ||
+        (error = col_create_queue_ring(&queue, 0)) ||
+        (col_push_value(queue, "item", COL_TYPE_STRING, "value", 0) != EINVAL) ||
+        (col_pop_value(queue, &value) != EINVAL)) {
+        printf("Ring stack checks failed. Error %d\n", error);
+        col_destroy_queue_ring(queue);
+        col_destroy_stack_ring(stack);
+        return error ? error : EINVAL;
+    }
+
+    col_destroy_queue_ring(queue);
+    col_destroy_stack_ring(stack);
+    TRACE_FLOW_NUMBER("ring_test. Returning", error);
+
+    COLOUT(printf("\n\nEND OF RING STACK TEST!!!.\n\n"));
+
+    return error;
+}
+
 /* Main function of the unit test */
 
 int main(int argc, char *argv[])
 {
     int error = 0;
     test_fn tests[] = { stack_test,
+                        ring_test,
                         NULL };
     test_fn t;
     int i = 0;
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include "trace.h"
 #include "collection_priv.h"
 #include "collection.h"
@@ -760,3 +761,529 @@ char **col_collection_to_list(struct collection_item *handle, int *size, int *er
     TRACE_FLOW_STRING("col_collection_to_list returning", ((list == NULL) ? "NULL" : list[0]));
     return list;
 }
+
+/* BINARY SERIALIZATION */
+
+/* Image starts with the header that is followed by the records.
+ * Every record is followed by the NUL terminated property and
+ * then by the data, both padded to 8 bytes.
+ * Collection is a COL_TYPE_COLLECTION record with the class
+ * as data, records of its items and a COL_TYPE_END record.
+ * Record of a COL_TYPE_COLLECTIONREF item is followed
+ * by the subcollection.
+ */
+#define COL_BINARY_MAGIC "DCOL"
+#define COL_BINARY_ORDER 0x0102
+#define COL_BINARY_ALIGN 8
+#define COL_BINARY_PAD(len) (((len) + COL_BINARY_ALIGN - 1) & \
+                             ~((size_t)COL_BINARY_ALIGN - 1))
+/* Size of the piece passed to the write callback */
+#define COL_BINARY_BLOCK 4096
+
+struct col_binary_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t order;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+struct col_binary_record {
+    uint32_t type;
+    uint32_t property_len;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+/* State of the binary serialization */
+struct col_binary_out {
+    col_binary_write_fn write_fn;
+    void *custom_data;
+    size_t used;
+    char block[COL_BINARY_BLOCK];
+};
+
+/* Growing buffer for col_serialize_binary_buffer() */
+struct col_binary_buffer {
+    char *buffer;
+    size_t size;
+    size_t length;
+};
+
+/* Pass collected data to the callback */
+static int col_binary_flush(struct col_binary_out *out)
+{
+    int error = EOK;
+
+    if (out->used > 0) {
+        error = out->write_fn(out->block, out->used, out->custom_data);
+        out->used = 0;
+    }
+    return error;
+}
+
+/* Add data to the image */
+static int col_binary_put(struct col_binary_out *out,
+                          const void *data,
+                          size_t len)
+{
+    int error = EOK;
+
+    if (len == 0) return EOK;
+
+    if (len > COL_BINARY_BLOCK - out->used) {
+        error = col_binary_flush(out);
+        if (error) return error;
+
+        /* Big values go to the callback as they are */
+        if (len >= COL_BINARY_BLOCK)
+            return out->write_fn(data, len, out->custom_data);
+    }
+
+    memcpy(out->block + out->used, data, len);
+    out->used += len;
+    return EOK;
+}
+
+/* Add zeros up to the next aligned offset */
+static int col_binary_pad(struct col_binary_out *out, size_t len)
+{
+    static const char zeros[COL_BINARY_ALIGN] = { 0 };
+
+    if (COL_BINARY_PAD(len) == len) return EOK;
+    return col_binary_put(out, zeros, COL_BINARY_PAD(len) - len);
+}
+
+/* Add one record */
+static int col_binary_put_record(struct col_binary_out *out,
+                                 int type,
+                                 const char *property,
+                                 int property_len,
+                                 const void *data,
+                                 int length)
+{
+    struct col_binary_record record;
+    int error = EOK;
+
+    record.type = (uint32_t)type;
+    record.property_len = (uint32_t)property_len;
+    record.length = (uint32_t)length;
+    record.reserved = 0;
+
+    if ((error = col_binary_put(out, &record, sizeof(record))) ||
+        (error = col_binary_put(out, property, property_len)) ||
+        (error = col_binary_put(out, "", 1)) ||
+        (error = col_binary_pad(out, property_len + 1)) ||
+        (error = col_binary_put(out, data, length)) ||
+        (error = col_binary_pad(out, length))) {
+        TRACE_ERROR_NUMBER("Failed to write record", error);
+        return error;
+    }
+
+    return EOK;
+}
+
+/* Add the collection at the given level with its subcollections */
+static int col_binary_put_collection(struct col_binary_out *out,
+                                     struct collection_item *ci,
+                                     int level)
+{
+    struct collection_item *item;
+    uint32_t cclass;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_binary_put_collection", "Entry");
+
+    if (level > COL_BINARY_MAX_LEVEL) {
+        TRACE_ERROR_NUMBER("Collection is nested too deep", EINVAL);
+        return EINVAL;
+    }
+
+    cclass = ((struct collection_header *)ci->data)->cclass;
+    error = col_binary_put_record(out, COL_TYPE_COLLECTION,
+                                  ci->property, ci->property_len,
+                                  &cclass, sizeof(cclass));
+    if (error) return error;
+
+    for (item = ci->next; item != NULL; item = item->next) {
+        if (item->type == COL_TYPE_COLLECTIONREF) {
+            error = col_binary_put_record(out, COL_TYPE_COLLECTIONREF,
+                                          item->property, item->property_len,
+                                          NULL, 0);
+            if (!error)
+                error = col_binary_put_collection(out,
+                            *((struct collection_item **)(item->data)),
+                            level + 1);
+        }
+        else error = col_binary_put_record(out, item->type,
+                                           item->property, item->property_len,
+                                           item->data, item->length);
+        if (error) return error;
+    }
+
+    error = col_binary_put_record(out, COL_TYPE_END, "", 0, NULL, 0);
+
+    TRACE_FLOW_NUMBER("col_binary_put_collection returning", error);
+    return error;
+}
+
+/* Serialize collection into the binary format */
+int col_serialize_binary(struct collection_item *ci,
+                         col_binary_write_fn write_fn,
+                         void *custom_data)
+{
+    struct col_binary_out *out;
+    struct col_binary_header header;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_serialize_binary", "Entry");
+
+    if ((ci == NULL) || (ci->type != COL_TYPE_COLLECTION) ||
+        (write_fn == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid argument", EINVAL);
+        return EINVAL;
+    }
+
+    out = (struct col_binary_out *)malloc(sizeof(struct col_binary_out));
+    if (out == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        return ENOMEM;
+    }
+    out->write_fn = write_fn;
+    out->custom_data = custom_data;
+    out->used = 0;
+
+    memcpy(header.magic, COL_BINARY_MAGIC, sizeof(header.magic));
+    header.version = COL_BINARY_VERSION;
+    header.order = COL_BINARY_ORDER;
+    header.flags = 0;
+    header.reserved = 0;
+
+    if ((error = col_binary_put(out, &header, sizeof(header))) ||
+        (error = col_binary_put_collection(out, ci, 0)) ||
+        (error = col_binary_flush(out))) {
+        TRACE_ERROR_NUMBER("Failed to serialize collection", error);
+    }
+
+    free(out);
+
+    TRACE_FLOW_NUMBER("col_serialize_binary returning", error);
+    return error;
+}
+
+/* Collect the image in memory */
+static int col_binary_to_buffer(const void *data,
+                                size_t length,
+                                void *custom_data)
+{
+    struct col_binary_buffer *buf = (struct col_binary_buffer *)custom_data;
+    size_t size;
+    char *tmp;
+
+    if (length > buf->size - buf->length) {
+        size = (buf->size != 0) ? buf->size : COL_BINARY_BLOCK;
+        while (length > size - buf->length) size *= 2;
+        tmp = realloc(buf->buffer, size);
+        if (tmp == NULL) {
+            TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+            return ENOMEM;
+        }
+        buf->buffer = tmp;
+        buf->size = size;
+    }
+
+    memcpy(buf->buffer + buf->length, data, length);
+    buf->length += length;
+    return EOK;
+}
+
+/* Serialize collection into the binary format in memory */
+int col_serialize_binary_buffer(struct collection_item *ci,
+                                void **buffer,
+                                size_t *size)
+{
+    struct col_binary_buffer buf;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_serialize_binary_buffer", "Entry");
+
+    if ((buffer == NULL) || (size == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid argument", EINVAL);
+        return EINVAL;
+    }
+
+    buf.buffer = NULL;
+    buf.size = 0;
+    buf.length = 0;
+
+    error = col_serialize_binary(ci, col_binary_to_buffer, &buf);
+    if (error) {
+        free(buf.buffer);
+        TRACE_ERROR_NUMBER("Failed to serialize collection", error);
+        return error;
+    }
+
+    *buffer = buf.buffer;
+    *size = buf.length;
+
+    TRACE_FLOW_STRING("col_serialize_binary_buffer", "Exit");
+    return EOK;
+}
+
+/* Initialize view of a binary image */
+int col_init_binary_view(struct col_binary_view *view,
+                         const void *buffer,
+                         size_t size)
+{
+    struct col_binary_header header;
+
+    TRACE_FLOW_STRING("col_init_binary_view", "Entry");
+
+    if ((view == NULL) || (buffer == NULL) ||
+        ((uintptr_t)buffer % COL_BINARY_ALIGN != 0) ||
+        (size < sizeof(header))) {
+        TRACE_ERROR_NUMBER("Invalid argument", EINVAL);
+        return EINVAL;
+    }
+
+    memcpy(&header, buffer, sizeof(header));
+    if (memcmp(header.magic, COL_BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        TRACE_ERROR_STRING("Not a binary image of a collection", "");
+        return EINVAL;
+    }
+    if ((header.version != COL_BINARY_VERSION) ||
+        (header.order != COL_BINARY_ORDER)) {
+        TRACE_ERROR_NUMBER("Unsupported image version", header.version);
+        return ENOTSUP;
+    }
+
+    view->buffer = (const char *)buffer;
+    view->size = size;
+    view->offset = sizeof(header);
+    view->level = 0;
+    /* The image starts with a collection */
+    view->expect = COL_TYPE_COLLECTION;
+
+    TRACE_FLOW_STRING("col_init_binary_view", "Exit");
+    return EOK;
+}
+
+/* Check the length of the value of the given type */
+static int col_binary_check_length(int type, const char *data, uint32_t length)
+{
+    switch (type) {
+    case COL_TYPE_STRING:
+        return (length > 0) && (data[length - 1] == '\0');
+    case COL_TYPE_BINARY:
+        return 1;
+    case COL_TYPE_INTEGER:
+        return length == sizeof(int32_t);
+    case COL_TYPE_UNSIGNED:
+        return length == sizeof(uint32_t);
+    case COL_TYPE_LONG:
+        return length == sizeof(int64_t);
+    case COL_TYPE_ULONG:
+        return length == sizeof(uint64_t);
+    case COL_TYPE_DOUBLE:
+        return length == sizeof(double);
+    case COL_TYPE_BOOL:
+        return length == sizeof(unsigned char);
+    case COL_TYPE_COLLECTION:
+        return length == sizeof(uint32_t);
+    case COL_TYPE_COLLECTIONREF:
+    case COL_TYPE_END:
+        return length == 0;
+    default:
+        return 0;
+    }
+}
+
+/* Read the next item from the view */
+int col_next_binary_item(struct col_binary_view *view,
+                         struct col_binary_item *item)
+{
+    struct col_binary_record record;
+    const char *property;
+    const char *data;
+    size_t left;
+    size_t len;
+
+    TRACE_FLOW_STRING("col_next_binary_item", "Entry");
+
+    if ((view == NULL) || (item == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid argument", EINVAL);
+        return EINVAL;
+    }
+
+    /* Top collection has ended */
+    if (view->expect == COL_TYPE_END) {
+        TRACE_FLOW_STRING("col_next_binary_item", "No more items");
+        return ENOENT;
+    }
+
+    left = view->size - view->offset;
+    if (left < sizeof(record)) {
+        TRACE_ERROR_STRING("Image is truncated", "");
+        return EINVAL;
+    }
+    memcpy(&record, view->buffer + view->offset, sizeof(record));
+    left -= sizeof(record);
+    property = view->buffer + view->offset + sizeof(record);
+
+    /* Property with its NUL */
+    if ((record.property_len >= INT_MAX) ||
+        (record.property_len >= left) ||
+        (property[record.property_len] != '\0') ||
+        (memchr(property, '\0', record.property_len) != NULL)) {
+        TRACE_ERROR_STRING("Image has invalid property", "");
+        return EINVAL;
+    }
+    len = COL_BINARY_PAD((size_t)record.property_len + 1);
+    if (len > left) {
+        TRACE_ERROR_STRING("Image is truncated", "");
+        return EINVAL;
+    }
+    left -= len;
+    data = property + len;
+
+    if ((record.length >= COL_MAX_DATA) ||
+        (COL_BINARY_PAD((size_t)record.length) > left) ||
+        (!col_binary_check_length(record.type, data, record.length))) {
+        TRACE_ERROR_STRING("Image has invalid data", "");
+        return EINVAL;
+    }
+
+    /* Collection has to come first and after the reference only */
+    if ((view->expect == COL_TYPE_COLLECTION) !=
+        (record.type == COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_NUMBER("Image has unexpected item", record.type);
+        return EINVAL;
+    }
+
+    item->property = property;
+    item->property_len = (int)record.property_len;
+    item->type = (int)record.type;
+    item->data = (record.length > 0) ? data : NULL;
+    item->length = (int)record.length;
+
+    switch (record.type) {
+    case COL_TYPE_COLLECTION:
+        /* Reading the image recurses once per level */
+        if (view->level > COL_BINARY_MAX_LEVEL) {
+            TRACE_ERROR_NUMBER("Image is nested too deep", view->level);
+            return EINVAL;
+        }
+        item->level = view->level;
+        view->level++;
+        view->expect = COL_TYPE_ANY;
+        break;
+    case COL_TYPE_COLLECTIONREF:
+        item->level = view->level - 1;
+        view->expect = COL_TYPE_COLLECTION;
+        break;
+    case COL_TYPE_END:
+        if (record.property_len != 0) {
+            TRACE_ERROR_STRING("Image has invalid end", "");
+            return EINVAL;
+        }
+        item->property = NULL;
+        view->level--;
+        item->level = view->level;
+        if (view->level == 0) view->expect = COL_TYPE_END;
+        break;
+    default:
+        item->level = view->level - 1;
+    }
+
+    view->offset += sizeof(record) + len + COL_BINARY_PAD((size_t)record.length);
+
+    TRACE_FLOW_STRING("col_next_binary_item", "Exit");
+    return EOK;
+}
+
+/* Create the collection which header was just read from the view */
+static int col_binary_get_collection(struct col_binary_view *view,
+                                     const struct col_binary_item *head,
+                                     struct collection_item **ci)
+{
+    struct collection_item *collection = NULL;
+    struct collection_item *sub = NULL;
+    struct col_binary_item item;
+    const char *as_property;
+    uint32_t cclass;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_binary_get_collection", "Entry");
+
+    memcpy(&cclass, head->data, sizeof(cclass));
+    error = col_create_collection(&collection, head->property, cclass);
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to create collection", error);
+        return error;
+    }
+
+    while (!(error = col_next_binary_item(view, &item))) {
+        if (item.type == COL_TYPE_END) break;
+
+        if (item.type == COL_TYPE_COLLECTIONREF) {
+            as_property = item.property;
+            if ((error = col_next_binary_item(view, &item)) ||
+                (error = col_binary_get_collection(view, &item, &sub))) break;
+            error = col_add_collection_to_collection(collection, NULL,
+                                                     as_property, sub,
+                                                     COL_ADD_MODE_EMBED);
+            if (error) {
+                col_destroy_collection(sub);
+                break;
+            }
+        }
+        else {
+            /* Same as col_add_any_property() but the data is const */
+            error = col_insert_property_with_ref(collection, NULL,
+                                                 COL_DSP_END, NULL, 0, 0,
+                                                 item.property, item.type,
+                                                 item.data, item.length,
+                                                 NULL);
+            if (error) break;
+        }
+    }
+
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to read collection", error);
+        col_destroy_collection(collection);
+        /* The image can't end inside of a collection */
+        return (error == ENOENT) ? EINVAL : error;
+    }
+
+    *ci = collection;
+
+    TRACE_FLOW_STRING("col_binary_get_collection", "Exit");
+    return EOK;
+}
+
+/* Create collection from a binary image */
+int col_unserialize_binary(struct collection_item **ci,
+                           const void *buffer,
+                           size_t size)
+{
+    struct col_binary_view view;
+    struct col_binary_item item;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_unserialize_binary", "Entry");
+
+    if (ci == NULL) {
+        TRACE_ERROR_NUMBER("Invalid argument", EINVAL);
+        return EINVAL;
+    }
+
+    if ((error = col_init_binary_view(&view, buffer, size)) ||
+        (error = col_next_binary_item(&view, &item)) ||
+        (error = col_binary_get_collection(&view, &item, ci))) {
+        TRACE_ERROR_NUMBER("Failed to read image", error);
+        return error;
+    }
+
+    TRACE_FLOW_STRING("col_unserialize_binary", "Exit");
+    return EOK;
+}
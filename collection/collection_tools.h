@@ -23,6 +23,7 @@
 #ifndef COLLECTION_TOOLS_H
 #define COLLECTION_TOOLS_H
 
+#include <stddef.h>
 #include "collection.h"
 
 /**
@@ -265,6 +266,189 @@ char **col_collection_to_list(struct collection_item *handle,
  */
 void col_free_property_list(char **str_list);
 
+/**
+ * @brief Version of the binary format written by
+ * \ref col_serialize_binary "col_serialize_binary()".
+ */
+#define COL_BINARY_VERSION 1
+
+/**
+ * @brief Deepest nesting of subcollections in a binary image.
+ *
+ * The top collection is at level 0. Deeper collections
+ * are neither written nor read.
+ */
+#define COL_BINARY_MAX_LEVEL 256
+
+/**
+ * @brief Binary serialization output callback.
+ *
+ * Called by \ref col_serialize_binary "col_serialize_binary()"
+ * with consecutive pieces of the binary image of the collection.
+ *
+ * @param[in] data        Next piece of the image.
+ * @param[in] length      Length of the piece.
+ * @param[in] custom_data Data passed to col_serialize_binary().
+ *
+ * @return 0         - Success.
+ * @return Any other value stops the serialization
+ *         and is returned by col_serialize_binary().
+ */
+typedef int (*col_binary_write_fn)(const void *data,
+                                   size_t length,
+                                   void *custom_data);
+
+/**
+ * @brief Serialize collection into the binary format.
+ *
+ * The binary image holds the properties, types and values
+ * of all items of the collection and of its subcollections.
+ * Every record of the image is length prefixed and aligned
+ * to 8 bytes so the image can be read in place with
+ * \ref col_init_binary_view "col_init_binary_view()".
+ * The image uses the byte order of the host and can be
+ * read only on hosts with the same byte order.
+ *
+ * The image is written as the collection is walked,
+ * in pieces of up to a few kilobytes.
+ *
+ * @param[in] ci          Collection to serialize.
+ * @param[in] write_fn    Function that receives the image.
+ * @param[in] custom_data Data passed to the write_fn.
+ *
+ * @return 0      - Success.
+ * @return EINVAL - Invalid argument or collection nested deeper
+ *                  than \ref COL_BINARY_MAX_LEVEL.
+ * @return Error returned by write_fn.
+ */
+int col_serialize_binary(struct collection_item *ci,
+                         col_binary_write_fn write_fn,
+                         void *custom_data);
+
+/**
+ * @brief Serialize collection into the binary format in memory.
+ *
+ * Same as \ref col_serialize_binary "col_serialize_binary()"
+ * but the image is returned in one buffer.
+ *
+ * @param[in]  ci          Collection to serialize.
+ * @param[out] buffer      Buffer with the image.
+ *                         Free it with free() when done.
+ * @param[out] size        Size of the image.
+ *
+ * @return 0      - Success.
+ * @return ENOMEM - No memory.
+ * @return EINVAL - Invalid argument or collection nested deeper
+ *                  than \ref COL_BINARY_MAX_LEVEL.
+ */
+int col_serialize_binary_buffer(struct collection_item *ci,
+                                void **buffer,
+                                size_t *size);
+
+/**
+ * @struct col_binary_view
+ * @brief Read only view of a binary image of a collection.
+ *
+ * The view can be allocated on the stack.
+ * Never access its members in your application.
+ */
+struct col_binary_view {
+    const char *buffer;
+    size_t size;
+    size_t offset;
+    int level;
+    int expect;
+};
+
+/**
+ * @struct col_binary_item
+ * @brief Item of the binary image returned by the view.
+ *
+ * Property and data point into the image and are valid
+ * as long as the image is.
+ *
+ * Every collection starts with an item of type
+ * \ref COL_TYPE_COLLECTION. Its property is the name of the
+ * collection and its data is the class of the collection
+ * as an unsigned value. Collection ends with an item of type
+ * \ref COL_TYPE_END with NULL property.
+ * A subcollection is preceded by an item of type
+ * \ref COL_TYPE_COLLECTIONREF without data. Its property
+ * is the name under which the subcollection is added.
+ */
+struct col_binary_item {
+    /** Name of the property, NUL terminated. */
+    const char *property;
+    /** Length of the name of the property. */
+    int property_len;
+    /** Type of the item. */
+    int type;
+    /** Value of the item, aligned for its type. */
+    const void *data;
+    /** Length of the value. */
+    int length;
+    /** Nesting level, 0 is the top collection. */
+    int level;
+};
+
+/**
+ * @brief Initialize view of a binary image.
+ *
+ * The image is not copied. It can be, for example,
+ * a file mapped into the memory with mmap().
+ * The records are checked as they are read.
+ *
+ * @param[out] view   View to initialize.
+ * @param[in]  buffer Image created by
+ *                    \ref col_serialize_binary "col_serialize_binary()".
+ *                    It must be aligned to 8 bytes.
+ * @param[in]  size   Size of the image.
+ *
+ * @return 0       - Success.
+ * @return EINVAL  - Not a binary image of a collection.
+ * @return ENOTSUP - Image of other version or byte order.
+ */
+int col_init_binary_view(struct col_binary_view *view,
+                         const void *buffer,
+                         size_t size);
+
+/**
+ * @brief Read the next item from the view.
+ *
+ * Items are returned in the order of
+ * \ref col_traverse_collection "col_traverse_collection()" called
+ * with \ref COL_TRAVERSE_DEFAULT and \ref COL_TRAVERSE_END flags.
+ *
+ * @param[in]  view   Initialized view.
+ * @param[out] item   Next item.
+ *
+ * @return 0       - Success.
+ * @return ENOENT  - No more items.
+ * @return EINVAL  - Image is damaged or nested deeper than
+ *                   \ref COL_BINARY_MAX_LEVEL.
+ */
+int col_next_binary_item(struct col_binary_view *view,
+                         struct col_binary_item *item);
+
+/**
+ * @brief Create collection from a binary image.
+ *
+ * @param[out] ci     New collection.
+ * @param[in]  buffer Image created by
+ *                    \ref col_serialize_binary "col_serialize_binary()".
+ *                    It must be aligned to 8 bytes.
+ * @param[in]  size   Size of the image.
+ *
+ * @return 0       - Success.
+ * @return ENOMEM  - No memory.
+ * @return EINVAL  - Image is damaged, is not an image of a collection
+ *                   or is nested deeper than \ref COL_BINARY_MAX_LEVEL.
+ * @return ENOTSUP - Image of other version or byte order.
+ */
+int col_unserialize_binary(struct collection_item **ci,
+                           const void *buffer,
+                           size_t size);
+
 /**
  * @}
  */
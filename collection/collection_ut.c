@@ -21,8 +21,10 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
 #define TRACE_HOME
 #include "trace.h"
 #include "collection.h"
@@ -2225,6 +2227,1389 @@ static int sort_test(void)
 
 /* Main function of the unit test */
 
+/* Check that property has the expected int value or, if value is -1,
+ * that it is not in the collection.
+ */
+static int index_check(struct collection_item *col,
+                       const char *property,
+                       int value,
+                       int mode_flags)
+{
+    struct collection_item *item = NULL;
+    int found = COL_NOMATCH;
+    int error;
+
+    error = col_get_item(col, property, COL_TYPE_ANY, mode_flags, &item);
+    if (error) {
+        printf("Search for %s returned error %d.\n", property, error);
+        return error;
+    }
+
+    error = col_is_item_in_collection(col, property, COL_TYPE_ANY,
+                                      mode_flags, &found);
+    if (error) {
+        printf("Check for %s returned error %d.\n", property, error);
+        return error;
+    }
+
+    if (value == -1) {
+        if ((item != NULL) || (found != COL_NOMATCH)) {
+            printf("Property %s should not be found.\n", property);
+            return EINVAL;
+        }
+        return EOK;
+    }
+
+    if ((item == NULL) || (found != COL_MATCH)) {
+        printf("Property %s should be found.\n", property);
+        return ENOENT;
+    }
+
+    if (*((int32_t *)col_get_item_data(item)) != value) {
+        printf("Property %s has value %d, expected %d.\n", property,
+               *((int32_t *)col_get_item_data(item)), value);
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+/* Test lookups in collections big enough to be indexed */
+static int index_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *item = NULL;
+    char name[20];
+    int32_t number = 7;
+    int error = EOK;
+    int i;
+
+    COLOUT(printf("\n\n==== INDEX TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "index", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 200; i++) {
+        sprintf(name, "key%d", i);
+        error = col_insert_int_property(col, NULL, COL_DSP_END, NULL, 0,
+                                        COL_INSERT_DUPERROR, name, i);
+        if (error) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Duplicates are found in list order */
+    if ((error = col_add_int_property(col, NULL, "dup", 1)) ||
+        (error = col_add_int_property(col, NULL, "dup", 2)) ||
+        (error = index_check(col, "dup", 1, COL_TRAVERSE_DEFAULT)) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_FRONT, NULL, 0,
+                                         COL_INSERT_NOCHECK, "dup", 0)) ||
+        (error = index_check(col, "DUP", 0, COL_TRAVERSE_ONELEVEL))) {
+        printf("Failed duplicate check. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    for (i = 0; i < 200; i++) {
+        sprintf(name, "KEY%d", i);
+        if ((error = index_check(col, name, i, COL_TRAVERSE_DEFAULT))) {
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    if ((error = index_check(col, "key200", -1, COL_TRAVERSE_DEFAULT)) ||
+        (col_insert_int_property(col, NULL, COL_DSP_END, NULL, 0,
+                                 COL_INSERT_DUPERROR, "key5", 5) != EEXIST)) {
+        printf("Failed existence check. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Delete, extract, rename and overwrite items */
+    for (i = 0; i < 200; i += 2) {
+        sprintf(name, "key%d", i);
+        if ((error = col_delete_property(col, name, COL_TYPE_ANY,
+                                         COL_TRAVERSE_DEFAULT))) {
+            printf("Failed to delete %s. Error %d\n", name, error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    if ((error = col_extract_item_from_current(col, COL_DSP_AFTER, "key1",
+                                               0, 0, &item))) {
+        printf("Failed to extract item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    col_delete_item(item);
+    item = NULL;
+
+    if ((error = col_get_item(col, "key9", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (error = col_modify_item_property(item, "renamed")) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_END, NULL, 0,
+                                         COL_INSERT_DUPOVER, "key11", 111)) ||
+        (error = col_update_property(col, "key13", COL_TYPE_INTEGER, &number,
+                                     sizeof(int32_t), COL_TRAVERSE_DEFAULT))) {
+        printf("Failed to change items. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    for (i = 0; i < 200; i++) {
+        sprintf(name, "key%d", i);
+        if ((error = index_check(col, name,
+                                 ((i % 2 == 0) || (i == 3) || (i == 9)) ? -1 :
+                                 (i == 11) ? 111 : (i == 13) ? 7 : i,
+                                 COL_TRAVERSE_DEFAULT))) {
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    if ((error = index_check(col, "renamed", 9, COL_TRAVERSE_DEFAULT))) {
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Items of referenced collections are still found */
+    if ((error = col_create_collection(&sub, "sub", 0)) ||
+        (error = col_add_int_property(sub, NULL, "inner", 42)) ||
+        (error = col_add_int_property(sub, NULL, "key1", 1000)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = index_check(col, "inner", 42, COL_TRAVERSE_DEFAULT)) ||
+        (error = index_check(col, "inner", -1, COL_TRAVERSE_ONELEVEL)) ||
+        (error = index_check(col, "sub!key1", 1000, COL_TRAVERSE_DEFAULT)) ||
+        (error = index_check(col, "key1", 1, COL_TRAVERSE_DEFAULT)) ||
+        (error = index_check(col, "key1", 1, COL_TRAVERSE_ONELEVEL))) {
+        printf("Failed subcollection check. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    COLOUT(col_debug_collection(col, COL_TRAVERSE_DEFAULT));
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== INDEX TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int packed_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *item = NULL;
+    struct collection_iterator *iterator = NULL;
+    char name[20];
+    char value[200];
+    unsigned cclass = 0;
+    int32_t number = 7;
+    int error = EOK;
+    int count = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== PACKED TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "packed",
+                                       COL_CLASS_PACKED | 5))) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    if ((error = col_get_collection_class(col, &cclass)) || (cclass != 5)) {
+        printf("Wrong class %u. Error %d\n", cclass, error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Values that fit into the slot and values that do not */
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    for (i = 0; i < 100; i++) {
+        sprintf(name, "key%d", i);
+        if ((error = col_add_int_property(col, NULL, name, i)) ||
+            (error = col_add_double_property(col, NULL, name, 0.5 * i)) ||
+            (error = col_add_str_property(col, NULL, name,
+                                          value + sizeof(value) - 1 - i, 0))) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Rename, update and overwrite */
+    if ((error = col_get_item(col, "key3", COL_TYPE_DOUBLE,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (error = col_modify_item_property(item, value + 100)) ||
+        (error = col_modify_str_item(item, NULL, "short", 0)) ||
+        (error = col_update_property(col, "key4", COL_TYPE_INTEGER, &number,
+                                     sizeof(int32_t), COL_TRAVERSE_DEFAULT)) ||
+        (error = col_insert_str_property(col, NULL, COL_DSP_END, NULL, 0,
+                                         COL_INSERT_DUPOVER, "key5", value, 0))) {
+        printf("Failed to change items. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    if ((error = col_get_item(col, value + 100, COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (strcmp((char *)col_get_item_data(item), "short") != 0)) {
+        printf("Renamed item is wrong. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Copy keeps the storage */
+    if ((error = col_copy_collection(&copy, col, NULL, COL_COPY_NORMAL)) ||
+        (error = col_get_collection_class(copy, &cclass)) ||
+        (cclass != 5) ||
+        (error = col_delete_property(col, "key6", COL_TYPE_ANY,
+                                     COL_TRAVERSE_DEFAULT))) {
+        printf("Failed to copy collection. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    error = col_bind_iterator(&iterator, copy, COL_TRAVERSE_DEFAULT);
+    if (error) {
+        printf("Failed to bind iterator. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    do {
+        item = NULL;
+        error = col_iterate_collection(iterator, &item);
+        if (error) {
+            printf("Failed to iterate. Error %d\n", error);
+            col_unbind_iterator(iterator);
+            col_destroy_collection(copy);
+            col_destroy_collection(col);
+            return error;
+        }
+        if (item != NULL) count++;
+    }
+    while (item != NULL);
+    col_unbind_iterator(iterator);
+
+    /* Header and 300 items, key5 was overwritten in place */
+    if (count != 301) {
+        printf("Copy has %d items instead of 301\n", count);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    /* Extracted item outlives its collection */
+    item = NULL;
+    error = col_extract_item(copy, NULL, COL_DSP_FRONT, NULL, 0,
+                             COL_TYPE_ANY, &item);
+    col_destroy_collection(copy);
+    if (error) {
+        printf("Failed to extract item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    if ((strcmp(col_get_item_property(item, NULL), "key0") != 0) ||
+        (*((int32_t *)col_get_item_data(item)) != 0) ||
+        (error = col_insert_item(col, NULL, item, COL_DSP_FRONT,
+                                 NULL, 0, COL_INSERT_NOCHECK))) {
+        printf("Extracted item is wrong. Error %d\n", error);
+        col_delete_item(item);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    COLOUT(col_debug_collection(col, COL_TRAVERSE_DEFAULT));
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== PACKED TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int arena_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *heap = NULL;
+    struct collection_item *item = NULL;
+    char name[20];
+    char value[5000];
+    int error = EOK;
+    int i, j;
+
+    COLOUT(printf("\n\n==== ARENA TEST ====\n\n"));
+
+    if ((error = col_create_collection(&heap, "heap", 0)) ||
+        (col_create_collection_ex(&col, "bad", 0, heap) != EINVAL)) {
+        printf("Expected EINVAL for collection without arena. Error %d\n",
+               error);
+        col_destroy_collection(heap);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = col_create_collection_ex(&col, "config", 0, NULL))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(heap);
+        return error;
+    }
+
+    /* Sections of the config share the arena */
+    memset(value, 'v', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    for (i = 0; i < 20; i++) {
+        sprintf(name, "section%d", i);
+        if ((error = col_create_collection_ex(&sub, name, 0, col))) {
+            printf("Failed to create section. Error %d\n", error);
+            col_destroy_collection(col);
+            col_destroy_collection(heap);
+            return error;
+        }
+        for (j = 0; j < 100; j++) {
+            sprintf(name, "key%d", j);
+            error = col_add_str_property(sub, NULL, name,
+                                         value + sizeof(value) - 1 - j * 40, 0);
+            if (error) break;
+        }
+        if ((error) ||
+            (error = col_delete_property(sub, "key7", COL_TYPE_ANY,
+                                         COL_TRAVERSE_DEFAULT)) ||
+            (error = col_add_int_property(sub, NULL, "key7", 7)) ||
+            (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                      COL_ADD_MODE_EMBED))) {
+            printf("Failed to fill section. Error %d\n", error);
+            col_destroy_collection(sub);
+            col_destroy_collection(col);
+            col_destroy_collection(heap);
+            return error;
+        }
+    }
+
+    if ((error = col_get_item(col, "section3!key99", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_length(item) != 99 * 40 + 1) ||
+        (error = col_modify_str_item(item, "longer", value, 0))) {
+        printf("Failed to find item. Error %d\n", error);
+        col_destroy_collection(col);
+        col_destroy_collection(heap);
+        return error ? error : EINVAL;
+    }
+
+    /* Copy gets its own arena, the original is released as a whole */
+    if ((error = col_copy_collection(&copy, col, NULL, COL_COPY_NORMAL))) {
+        printf("Failed to copy collection. Error %d\n", error);
+        col_destroy_collection(col);
+        col_destroy_collection(heap);
+        return error;
+    }
+    col_destroy_collection(col);
+
+    if ((error = col_get_item(copy, "section3!longer", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL)) {
+        printf("Copy is wrong. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(heap);
+        return error ? error : EINVAL;
+    }
+
+    /* References out of the arena and items from elsewhere */
+    if ((error = col_add_int_property(heap, NULL, "outside", 1)) ||
+        (error = col_add_collection_to_collection(copy, NULL, NULL, heap,
+                                                  COL_ADD_MODE_REFERENCE)) ||
+        (error = col_create_collection_ex(&sub, "other", 0, copy)) ||
+        (error = col_add_collection_to_collection(copy, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_add_str_property(heap, NULL, "loose", "x", 0)) ||
+        (error = col_extract_item(heap, NULL, COL_DSP_END, NULL, 0,
+                                  COL_TYPE_ANY, &item)) ||
+        (error = col_insert_item(sub, NULL, item, COL_DSP_END,
+                                 NULL, 0, COL_INSERT_NOCHECK))) {
+        printf("Failed to add references. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(heap);
+        return error;
+    }
+
+    item = NULL;
+    if ((error = col_extract_item(copy, "section5", COL_DSP_FRONT, NULL, 0,
+                                  COL_TYPE_ANY, &item))) {
+        printf("Failed to extract item. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(heap);
+        return error;
+    }
+
+    /* Extracted item keeps the arena */
+    col_destroy_collection(copy);
+    if (strcmp(col_get_item_property(item, NULL), "key0") != 0) {
+        printf("Extracted item is wrong.\n");
+        col_delete_item(item);
+        col_destroy_collection(heap);
+        return EINVAL;
+    }
+    col_delete_item(item);
+
+    if ((error = col_get_item(heap, "outside", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL)) {
+        printf("Referenced collection is gone. Error %d\n", error);
+        col_destroy_collection(heap);
+        return error ? error : EINVAL;
+    }
+    col_destroy_collection(heap);
+
+    COLOUT(printf("\n\n==== ARENA TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int hash_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *item = NULL;
+    char name[64];
+    char upper[64];
+    uint64_t hash;
+    int len;
+    int i, j;
+    int error = EOK;
+
+    COLOUT(printf("\n\n==== HASH TEST ====\n\n"));
+
+    /* Hash ignores the case of ASCII letters only */
+    for (i = 1; i < 60; i++) {
+        for (j = 0; j < i; j++) {
+            name[j] = "aZ_9q{`@\xe9"[(i * 7 + j) % 9];
+            upper[j] = ((name[j] >= 'a') && (name[j] <= 'z')) ?
+                       name[j] - 'a' + 'A' : name[j];
+        }
+        name[i] = '\0';
+        upper[i] = '\0';
+
+        hash = col_make_hash(name, 0, &len);
+        if ((hash != col_make_hash(upper, 0, NULL)) || (len != i) ||
+            (hash != col_make_hash(name, i, NULL))) {
+            printf("Wrong hash of %s\n", name);
+            return EINVAL;
+        }
+
+        /* Hash of the prefix is the hash of the shorter string */
+        if (i > 1) {
+            hash = col_make_hash(name, i - 1, &len);
+            name[i - 1] = '\0';
+            if ((hash != col_make_hash(name, 0, NULL)) || (len != i - 1)) {
+                printf("Wrong hash of the prefix %s\n", name);
+                return EINVAL;
+            }
+            name[i - 1] = upper[i - 1];
+        }
+
+        /* Strings that differ in one character */
+        hash = col_make_hash(name, 0, NULL);
+        upper[i / 2] = (upper[i / 2] == '\xe9') ? '\xc9' : '!';
+        if (hash == col_make_hash(upper, 0, NULL)) {
+            printf("Same hash for %s and %s\n", name, upper);
+            return EINVAL;
+        }
+    }
+
+    /* Paths are matched on ASCII letters only */
+    if ((error = col_create_collection(&col, "top", 0)) ||
+        (error = col_create_collection(&item, "Sub_Collection", 0)) ||
+        (error = col_add_int_property(item, NULL, "Some_Long_Property_Name", 1)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, item,
+                                                  COL_ADD_MODE_EMBED))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    item = NULL;
+    error = col_get_item(col, "top!SUB_COLLECTION!some_long_PROPERTY_name",
+                         COL_TYPE_ANY, COL_TRAVERSE_DEFAULT, &item);
+    if ((error) || (item == NULL) ||
+        (col_get_item_hash(item) !=
+         col_make_hash("SOME_LONG_PROPERTY_NAME", 0, NULL))) {
+        printf("Failed to find item by path. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== HASH TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int intern_test(void)
+{
+    struct collection_item *first = NULL;
+    struct collection_item *second = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *plain = NULL;
+    struct collection_item *item = NULL;
+    const char *names[4];
+    unsigned cclass = 0;
+    int error = EOK;
+
+    COLOUT(printf("\n\n==== INTERN TEST ====\n\n"));
+
+    if ((error = col_create_collection(&first, "section",
+                                       COL_CLASS_INTERN | 3)) ||
+        (error = col_create_collection(&second, "section",
+                                       COL_CLASS_INTERN | COL_CLASS_PACKED)) ||
+        (error = col_create_collection(&plain, "section", 0)) ||
+        (error = col_add_int_property(first, NULL, "debug_level", 1)) ||
+        (error = col_add_str_property(first, NULL, "id_provider", "ldap", 0)) ||
+        (error = col_add_int_property(second, NULL, "debug_level", 2)) ||
+        (error = col_add_int_property(second, NULL, "Debug_Level", 3)) ||
+        (error = col_add_int_property(plain, NULL, "debug_level", 4))) {
+        printf("Failed to create collections. Error %d\n", error);
+        col_destroy_collection(plain);
+        col_destroy_collection(second);
+        col_destroy_collection(first);
+        return error;
+    }
+
+    /* Flag is not a part of the class */
+    if ((error = col_get_collection_class(first, &cclass)) || (cclass != 3)) {
+        printf("Wrong class %u. Error %d\n", cclass, error);
+        error = error ? error : EINVAL;
+        goto done;
+    }
+
+    /* Same names share the string, names in other case do not */
+    names[0] = col_get_item_property(first, NULL);
+    names[1] = col_get_item_property(second, NULL);
+    if ((error = col_get_item(first, "debug_level", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        ((names[2] = col_get_item_property(item, NULL)) == NULL) ||
+        (error = col_get_dup_item(second, NULL, "Debug_Level", COL_TYPE_ANY,
+                                  1, 1, &item)) ||
+        (item == NULL) ||
+        ((names[3] = col_get_item_property(item, NULL)) == NULL) ||
+        (names[0] != names[1]) ||
+        (strcmp(names[3], "Debug_Level") != 0) ||
+        (names[2] == names[3]) ||
+        (error = col_get_item(second, "debug_level", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_property(item, NULL) != names[2]) ||
+        (error = col_get_item(plain, "debug_level", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_property(item, NULL) == names[2])) {
+        printf("Names are not shared. Error %d\n", error);
+        error = error ? error : EINVAL;
+        goto done;
+    }
+
+    /* Copy shares the names and keeps sharing them */
+    if ((error = col_copy_collection(&copy, first, NULL, COL_COPY_NORMAL)) ||
+        (error = col_get_item(copy, "debug_level", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_property(item, NULL) != names[2]) ||
+        (error = col_modify_item_property(item, "id_provider")) ||
+        (error = col_get_item(first, "id_provider", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        ((names[3] = col_get_item_property(item, NULL)) == NULL) ||
+        (error = col_get_dup_item(copy, NULL, "id_provider", COL_TYPE_ANY,
+                                  1, 1, &item)) ||
+        (item == NULL) ||
+        (col_get_item_property(item, NULL) != names[3]) ||
+        (error = col_get_item(first, "debug_level", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_property(item, NULL) != names[2])) {
+        printf("Copy does not share names. Error %d\n", error);
+        error = error ? error : EINVAL;
+        goto done;
+    }
+
+    /* Interned item can move to a collection that does not intern names */
+    item = NULL;
+    col_destroy_collection(first);
+    first = NULL;
+    if ((error = col_extract_item(copy, NULL, COL_DSP_INDEX, NULL, 1,
+                                  COL_TYPE_ANY, &item)) ||
+        (error = col_insert_item(plain, NULL, item, COL_DSP_END,
+                                 NULL, 0, COL_INSERT_NOCHECK))) {
+        printf("Failed to move item. Error %d\n", error);
+        col_delete_item(item);
+        goto done;
+    }
+
+    COLOUT(col_debug_collection(plain, COL_TRAVERSE_DEFAULT));
+
+done:
+    col_destroy_collection(copy);
+    col_destroy_collection(plain);
+    col_destroy_collection(second);
+    col_destroy_collection(first);
+
+    if (error) return error;
+
+    COLOUT(printf("\n\n==== INTERN TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Write binary image into the file */
+static int binary_write(const void *data, size_t length, void *custom_data)
+{
+    if (fwrite(data, 1, length, (FILE *)custom_data) != length) return EIO;
+    return EOK;
+}
+
+/* Render collection as text to compare collections */
+static char *binary_text(struct collection_item *col)
+{
+    struct col_serial_data buf_data;
+
+    buf_data.buffer = NULL;
+    buf_data.length = 0;
+    buf_data.size = 0;
+    buf_data.nest_level = 0;
+
+    if (col_traverse_collection(col, COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                                col_serialize, (void *)(&buf_data))) {
+        free(buf_data.buffer);
+        return NULL;
+    }
+
+    return buf_data.buffer;
+}
+
+static int binary_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *copy = NULL;
+    struct col_binary_view view;
+    struct col_binary_item item;
+    char binary[5000];
+    char *text = NULL;
+    char *text_copy = NULL;
+    void *buffer = NULL;
+    void *image;
+    size_t size = 0;
+    size_t i;
+    FILE *file;
+    int count = 0;
+    int error = EOK;
+
+    COLOUT(printf("\n\n==== BINARY TEST ====\n\n"));
+
+    memset(binary, 0x5A, sizeof(binary));
+
+    if ((error = col_create_collection(&col, "top", 7)) ||
+        (error = col_create_collection(&sub, "inner", 0)) ||
+        (error = col_add_str_property(col, NULL, "string", "value", 0)) ||
+        (error = col_add_binary_property(col, NULL, "binary",
+                                         binary, sizeof(binary))) ||
+        (error = col_add_int_property(col, NULL, "int", -5)) ||
+        (error = col_add_unsigned_property(col, NULL, "unsigned", 5)) ||
+        (error = col_add_long_property(col, NULL, "long", -50000000000)) ||
+        (error = col_add_ulong_property(col, NULL, "ulong", 50000000000)) ||
+        (error = col_add_double_property(col, NULL, "double", 0.25)) ||
+        (error = col_add_bool_property(col, NULL, "bool", 1)) ||
+        (error = col_add_int_property(sub, NULL, "int", 10)) ||
+        (error = col_add_collection_to_collection(col, NULL, "sub", sub,
+                                                  COL_ADD_MODE_REFERENCE)) ||
+        (error = col_add_str_property(col, NULL, "last", "x", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+    col_destroy_collection(sub);
+
+    /* Image that is written in pieces is read from the mapped file */
+    file = tmpfile();
+    if ((file == NULL) ||
+        (error = col_serialize_binary(col, binary_write, file)) ||
+        (fflush(file) != 0) ||
+        ((size = (size_t)ftell(file)) == 0) ||
+        ((image = mmap(NULL, size, PROT_READ, MAP_PRIVATE,
+                       fileno(file), 0)) == MAP_FAILED)) {
+        printf("Failed to write image. Error %d\n", error);
+        if (file != NULL) fclose(file);
+        col_destroy_collection(col);
+        return error ? error : EIO;
+    }
+    fclose(file);
+
+    if ((error = col_init_binary_view(&view, image, size))) {
+        printf("Failed to init view. Error %d\n", error);
+        munmap(image, size);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    while (!(error = col_next_binary_item(&view, &item))) {
+        count++;
+        if ((item.type == COL_TYPE_LONG) &&
+            (*((const int64_t *)item.data) != -50000000000)) break;
+        if ((item.type == COL_TYPE_BINARY) &&
+            (memcmp(item.data, binary, item.length) != 0)) break;
+        if ((item.type == COL_TYPE_INTEGER) && (item.level == 1) &&
+            (*((const int32_t *)item.data) != 10)) break;
+    }
+    munmap(image, size);
+
+    /* Two headers, two ends, reference and ten values */
+    if ((error != ENOENT) || (count != 15)) {
+        printf("View returned %d items. Error %d\n", count, error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Rebuilt collection is the same */
+    if ((error = col_serialize_binary_buffer(col, &buffer, &size)) ||
+        (error = col_unserialize_binary(&copy, buffer, size)) ||
+        ((text = binary_text(col)) == NULL) ||
+        ((text_copy = binary_text(copy)) == NULL) ||
+        (strcmp(text, text_copy) != 0)) {
+        printf("Collection is different. Error %d\n", error);
+        free(text);
+        free(text_copy);
+        free(buffer);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+    COLOUT(printf("%s\n", text_copy));
+    free(text);
+    free(text_copy);
+    col_destroy_collection(copy);
+    col_destroy_collection(col);
+
+    /* Truncated image is rejected */
+    for (i = 0; i < size; i++) {
+        copy = NULL;
+        error = col_unserialize_binary(&copy, buffer, i);
+        if (error != EINVAL) {
+            printf("Image of %u bytes is accepted. Error %d\n",
+                   (unsigned)i, error);
+            col_destroy_collection(copy);
+            free(buffer);
+            return EINVAL;
+        }
+    }
+    free(buffer);
+
+    COLOUT(printf("\n\n==== BINARY TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int binary_depth_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *outer = NULL;
+    struct collection_item *copy = NULL;
+    struct col_binary_view view;
+    struct col_binary_item item;
+    void *buffer = NULL;
+    char *deep = NULL;
+    const char *first = NULL;
+    size_t size = 0;
+    size_t last_size = 0;
+    size_t head, step, end;
+    int count = 0;
+    int level;
+    int error = EOK;
+
+    COLOUT(printf("\n\n==== BINARY DEPTH TEST ====\n\n"));
+
+    /* Collections nested as deep as the image allows */
+    error = col_create_collection(&col, "c", 0);
+    for (level = 0; (!error) && (level < COL_BINARY_MAX_LEVEL); level++) {
+        if (level == COL_BINARY_MAX_LEVEL - 1) {
+            error = col_serialize_binary_buffer(col, &buffer, &last_size);
+            free(buffer);
+            buffer = NULL;
+            if (error) break;
+        }
+        if ((error = col_create_collection(&outer, "c", 0))) break;
+        error = col_add_collection_to_collection(outer, NULL, NULL, col,
+                                                 COL_ADD_MODE_REFERENCE);
+        col_destroy_collection(col);
+        col = outer;
+    }
+
+    if ((error) ||
+        (error = col_serialize_binary_buffer(col, &buffer, &size)) ||
+        (error = col_unserialize_binary(&copy, buffer, size))) {
+        printf("Failed to read deep collection. Error %d\n", error);
+        free(buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+    col_destroy_collection(copy);
+    copy = NULL;
+
+    /* Collection with the reference that comes before
+     * the next level repeats from the first name on.
+     */
+    if ((error = col_init_binary_view(&view, buffer, size))) {
+        printf("Failed to init view. Error %d\n", error);
+        free(buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+    while (!(error = col_next_binary_item(&view, &item))) {
+        if (item.type != COL_TYPE_COLLECTION) continue;
+        if (first != NULL) break;
+        first = item.property;
+    }
+    if (error) {
+        printf("Failed to read view. Error %d\n", error);
+        free(buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+    head = first - (const char *)buffer;
+    step = item.property - first;
+    end = size - last_size - step;
+
+    /* One more level is too deep to read */
+    deep = malloc(size + step + end);
+    if (deep == NULL) {
+        printf("Failed to allocate memory\n");
+        free(buffer);
+        col_destroy_collection(col);
+        return ENOMEM;
+    }
+    memcpy(deep, buffer, head);
+    memcpy(deep + head, first, step);
+    memcpy(deep + head + step, first, size - head);
+    memcpy(deep + size + step, (const char *)buffer + size - end, end);
+    free(buffer);
+    size += step + end;
+
+    error = col_init_binary_view(&view, deep, size);
+    while (!error) {
+        error = col_next_binary_item(&view, &item);
+        if (!error) count++;
+    }
+    if ((error != EINVAL) || (count != 2 * (COL_BINARY_MAX_LEVEL + 1)) ||
+        ((error = col_unserialize_binary(&copy, deep, size)) != EINVAL)) {
+        printf("Deep image is accepted after %d items. Error %d\n",
+               count, error);
+        free(deep);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+    free(deep);
+
+    /* And to write */
+    buffer = NULL;
+    if ((error = col_create_collection(&outer, "c", 0)) ||
+        (error = col_add_collection_to_collection(outer, NULL, NULL, col,
+                                                  COL_ADD_MODE_REFERENCE))) {
+        printf("Failed to nest collection. Error %d\n", error);
+        col_destroy_collection(outer);
+        col_destroy_collection(col);
+        return error;
+    }
+    col_destroy_collection(col);
+    error = col_serialize_binary_buffer(outer, &buffer, &size);
+    free(buffer);
+    col_destroy_collection(outer);
+    if (error != EINVAL) {
+        printf("Deep collection is written. Error %d\n", error);
+        return EINVAL;
+    }
+
+    COLOUT(printf("\n\n==== BINARY DEPTH TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int shared_copy_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *plain = NULL;
+    struct collection_item *arena = NULL;
+    struct collection_item *item = NULL;
+    const void *value;
+    const void *before = NULL;
+    char updated[] = "updated";
+    char text[100];
+    char name[20];
+    char *text_col = NULL;
+    char *text_copy = NULL;
+    int error = EOK;
+    int i, j;
+
+    COLOUT(printf("\n\n==== SHARED COPY TEST ====\n\n"));
+
+    memset(text, 'v', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    if ((error = col_create_collection(&col, "top", 0)) ||
+        (error = col_add_str_property(col, NULL, "long", text, 0)) ||
+        (error = col_add_str_property(col, NULL, "short", "value", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Enough subcollections for threads, one of them is added twice */
+    for (i = 0; i < 8; i++) {
+        sprintf(name, "sub%d", i);
+        if ((error = col_create_collection(&sub, name,
+                                           (i % 2) ? COL_CLASS_PACKED : 0))) {
+            printf("Failed to create collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+        for (j = 0; j < 200; j++) {
+            sprintf(name, "key%d", j);
+            if ((error = col_add_str_property(sub, NULL, name,
+                                              text + (j % 90), 0)) ||
+                (error = col_add_int_property(sub, NULL, name, j))) break;
+        }
+        if ((!error) && (i == 3))
+            error = col_add_collection_to_collection(col, NULL, "again", sub,
+                                                     COL_ADD_MODE_REFERENCE);
+        if (!error)
+            error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                     COL_ADD_MODE_REFERENCE);
+        col_destroy_collection(sub);
+        if (error) {
+            printf("Failed to fill collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Copies leave the donor alone */
+    if ((error = col_get_item(col, "sub2!key3", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        ((before = col_get_item_data(item)) == NULL)) {
+        printf("Failed to get item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = col_copy_collection(&copy, col, NULL,
+                                     COL_COPY_NORMAL | COL_COPY_SHARED |
+                                     COL_COPY_PARALLEL)) ||
+        (error = col_copy_collection(&plain, col, NULL, COL_COPY_NORMAL)) ||
+        ((text_col = binary_text(plain)) == NULL) ||
+        ((text_copy = binary_text(copy)) == NULL) ||
+        (strcmp(text_col, text_copy) != 0)) {
+        printf("Parallel copy is different. Error %d\n", error);
+        free(text_col);
+        free(text_copy);
+        col_destroy_collection(plain);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+    free(text_copy);
+    text_copy = NULL;
+
+    /* Long values are shared until they are changed */
+    if ((error = col_get_item(col, "sub5!key7", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        ((value = col_get_item_data(item)) == NULL) ||
+        (error = col_get_item(copy, "sub5!key7", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_data(item) != value) ||
+        (error = col_get_item(plain, "sub5!key7", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_data(item) == value) ||
+        (error = col_get_item(col, "sub2!key3", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_data(item) != before) ||
+        (error = col_get_item(copy, "long", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (error = col_modify_str_item(item, NULL, "changed", 0)) ||
+        (error = col_update_str_property(copy, "sub5!key7",
+                                         COL_TRAVERSE_DEFAULT, updated, 0)) ||
+        (error = col_get_item(col, "long", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (strcmp((const char *)col_get_item_data(item), text) != 0) ||
+        (error = col_get_item(col, "sub5!key7", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_data(item) != value) ||
+        (strcmp((const char *)value, text + 7) != 0)) {
+        printf("Values are not shared right. Error %d\n", error);
+        free(text_col);
+        col_destroy_collection(plain);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Copy outlives the donor */
+    col_destroy_collection(col);
+    col_destroy_collection(plain);
+    text_copy = binary_text(copy);
+    if ((text_copy == NULL) || (strcmp(text_col, text_copy) == 0) ||
+        (error = col_get_item(copy, "sub0!key1", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (strcmp((const char *)col_get_item_data(item), text + 1) != 0)) {
+        printf("Copy is broken. Error %d\n", error);
+        free(text_col);
+        free(text_copy);
+        col_destroy_collection(copy);
+        return error ? error : EINVAL;
+    }
+    free(text_col);
+    free(text_copy);
+    col_destroy_collection(copy);
+    copy = NULL;
+
+    /* Values of an arena are not shared */
+    if ((error = col_create_collection_ex(&arena, "arena", 0, NULL)) ||
+        (error = col_add_str_property(arena, NULL, "long", text, 0)) ||
+        (error = col_copy_collection(&copy, arena, NULL,
+                                     COL_COPY_NORMAL | COL_COPY_SHARED)) ||
+        (error = col_get_item(copy, "long", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        ((value = col_get_item_data(item)) == NULL) ||
+        (error = col_get_item(arena, "long", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (col_get_item_data(item) == value)) {
+        printf("Arena values are shared. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(arena);
+        return error ? error : EINVAL;
+    }
+    col_destroy_collection(copy);
+    col_destroy_collection(arena);
+
+    COLOUT(printf("\n\n==== SHARED COPY TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Check the order of the items in a sorted collection */
+static int merge_sort_check(struct collection_item *col, int desc)
+{
+    struct collection_iterator *iterator = NULL;
+    struct collection_item *item = NULL;
+    const char *name = NULL;
+    int value = 0;
+    int error;
+
+    error = col_bind_iterator(&iterator, col, COL_TRAVERSE_ONELEVEL);
+    if (error) return error;
+
+    for (;;) {
+        error = col_iterate_collection(iterator, &item);
+        if ((error) || (item == NULL)) break;
+        if (col_get_item_type(item) == COL_TYPE_COLLECTION) continue;
+        if (name != NULL) {
+            /* Equal values keep the order they were added in */
+            if ((desc) ? (*((int *)col_get_item_data(item)) > value) :
+                         (*((int *)col_get_item_data(item)) < value)) {
+                printf("Item %s is out of order\n", col_get_item_property(item, NULL));
+                error = EINVAL;
+                break;
+            }
+            if ((*((int *)col_get_item_data(item)) == value) &&
+                ((desc) ? (strcmp(col_get_item_property(item, NULL), name) > 0) :
+                          (strcmp(col_get_item_property(item, NULL), name) < 0))) {
+                printf("Item %s is not stable\n", col_get_item_property(item, NULL));
+                error = EINVAL;
+                break;
+            }
+        }
+        name = col_get_item_property(item, NULL);
+        value = *((int *)col_get_item_data(item));
+    }
+
+    col_unbind_iterator(iterator);
+    return error;
+}
+
+static int merge_sort_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_iterator *iterator = NULL;
+    struct collection_item *item = NULL;
+    const char *names[] = { "beta", "Alpha", "alpha2", "ALPHA", "gamma",
+                            "Property_b", "alpha", "Beta", "property_A",
+                            NULL };
+    const char *sorted[] = { "Alpha", "ALPHA", "alpha", "alpha2", "beta",
+                             "Beta", "gamma", "property_A", "Property_b",
+                             NULL };
+    char *text_col = NULL;
+    char *text_copy = NULL;
+    char name[20];
+    int error = EOK;
+    int i;
+
+    COLOUT(printf("\n\n==== MERGE SORT TEST ====\n\n"));
+
+    /* Nothing to sort */
+    if ((error = col_create_collection(&col, "empty", 0)) ||
+        (error = col_sort_collection(col, COL_CMPIN_PROP_EQU, COL_SORT_ASC))) {
+        printf("Failed to sort empty collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    col_destroy_collection(col);
+    col = NULL;
+
+    /* Names are sorted ignoring the case */
+    if ((error = col_create_collection(&col, "names", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+    for (i = 0; names[i] != NULL; i++) {
+        if ((error = col_add_int_property(col, NULL, names[i], i))) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+    if ((error = col_sort_collection(col, COL_CMPIN_PROP_EQU, COL_SORT_ASC)) ||
+        (error = col_bind_iterator(&iterator, col, COL_TRAVERSE_ONELEVEL))) {
+        printf("Failed to sort collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    i = 0;
+    for (;;) {
+        error = col_iterate_collection(iterator, &item);
+        if ((error) || (item == NULL)) break;
+        if (col_get_item_type(item) == COL_TYPE_COLLECTION) continue;
+        if ((sorted[i] == NULL) ||
+            (strcmp(col_get_item_property(item, NULL), sorted[i]) != 0)) {
+            printf("Expected %s got %s\n", sorted[i] ? sorted[i] : "end",
+                   col_get_item_property(item, NULL));
+            error = EINVAL;
+            break;
+        }
+        i++;
+    }
+    col_unbind_iterator(iterator);
+    col_destroy_collection(col);
+    col = NULL;
+    if (error) return error;
+
+    /* Enough values with duplicates for the threads */
+    if ((error = col_create_collection(&col, "values", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+    for (i = 0; i < 40000; i++) {
+        sprintf(name, "p%05d", i);
+        if ((error = col_add_int_property(col, NULL, name,
+                                          (i * 7919) % 1000 - 500))) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    if ((error = col_copy_collection(&copy, col, NULL, COL_COPY_NORMAL)) ||
+        (error = col_sort_collection(col, COL_CMPIN_DATA, COL_SORT_ASC)) ||
+        (error = merge_sort_check(col, 0)) ||
+        (error = col_sort_collection(copy, COL_CMPIN_DATA,
+                                     COL_SORT_ASC | COL_SORT_PARALLEL)) ||
+        ((text_col = binary_text(col)) == NULL) ||
+        ((text_copy = binary_text(copy)) == NULL) ||
+        (strcmp(text_col, text_copy) != 0)) {
+        printf("Parallel sort is different. Error %d\n", error);
+        error = error ? error : EINVAL;
+        goto done;
+    }
+    free(text_col);
+    free(text_copy);
+    text_col = NULL;
+    text_copy = NULL;
+
+    /* Descending order with the generic comparison */
+    if ((error = col_sort_collection(col, COL_CMPIN_DATA | COL_CMPIN_TYPE,
+                                     COL_SORT_DESC)) ||
+        (error = merge_sort_check(col, 1)) ||
+        (error = col_sort_collection(copy, COL_CMPIN_DATA | COL_CMPIN_TYPE,
+                                     COL_SORT_DESC | COL_SORT_PARALLEL)) ||
+        ((text_col = binary_text(col)) == NULL) ||
+        ((text_copy = binary_text(copy)) == NULL) ||
+        (strcmp(text_col, text_copy) != 0)) {
+        printf("Descending sort is different. Error %d\n", error);
+        error = error ? error : EINVAL;
+        goto done;
+    }
+
+    COLOUT(printf("\n\n==== MERGE SORT TEST END ====\n\n"));
+
+done:
+    free(text_col);
+    free(text_copy);
+    col_destroy_collection(copy);
+    col_destroy_collection(col);
+    return error;
+}
+
+static int iterator_space_test(void)
+{
+    struct col_iterator_space space;
+    struct collection_iterator *iterator = NULL;
+    struct collection_iterator *heap = NULL;
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *next = NULL;
+    struct collection_item *item = NULL;
+    struct collection_item *expected = NULL;
+    char name[20];
+    int error = EOK;
+    int heap_error = EOK;
+    int count = 0;
+    int ends = 0;
+    int depth = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== ITERATOR SPACE TEST ====\n\n"));
+
+    /* Nested deeper than the inline stack */
+    if ((error = col_create_collection(&col, "top", 0)) ||
+        (error = col_add_int_property(col, NULL, "first", 1))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    sub = col;
+    for (i = 1; i < COL_ITERATOR_DEPTH * 3; i++) {
+        next = NULL;
+        sprintf(name, "level%d", i);
+        if ((error = col_create_collection(&next, name, 0)) ||
+            (error = col_add_int_property(next, NULL, "value", i)) ||
+            (error = col_add_collection_to_collection(sub, NULL, NULL, next,
+                                                      COL_ADD_MODE_REFERENCE))) {
+            printf("Failed to nest collection. Error %d\n", error);
+            col_destroy_collection(next);
+            col_destroy_collection(col);
+            return error;
+        }
+        /* Keep going into the reference we just added */
+        col_destroy_collection(next);
+        if ((error = col_get_item(sub, name, COL_TYPE_COLLECTIONREF,
+                                  COL_TRAVERSE_ONELEVEL, &item)) ||
+            (item == NULL)) {
+            printf("Failed to find collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error ? error : EINVAL;
+        }
+        sub = *((struct collection_item **)col_get_item_data(item));
+    }
+
+    /* Both kinds of iterators see the same items */
+    if ((error = col_bind_iterator_ex(&iterator, col,
+                                      COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                                      &space)) ||
+        (error = col_bind_iterator(&heap, col,
+                                   COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END))) {
+        printf("Failed to bind iterator. Error %d\n", error);
+        col_unbind_iterator(iterator);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    COL_FOR_EACH_ITEM(iterator, item, error) {
+        heap_error = col_iterate_collection(heap, &expected);
+        /* Each iterator has its own end item */
+        if ((heap_error) || (expected == NULL) ||
+            ((expected != item) &&
+             ((col_get_item_type(item) != COL_TYPE_END) ||
+              (col_get_item_type(expected) != COL_TYPE_END)))) {
+            printf("Iterators differ. Error %d\n", heap_error);
+            error = heap_error ? heap_error : EINVAL;
+            break;
+        }
+        if (col_get_item_type(item) == COL_TYPE_END) ends++;
+        else count++;
+        col_get_iterator_depth(iterator, &i);
+        if (i > depth) depth = i;
+    }
+    if (!error) {
+        /* Heap iterator is at the end too */
+        error = col_iterate_collection(heap, &expected);
+        if ((!error) && (expected != NULL)) error = EINVAL;
+    }
+    col_unbind_iterator(heap);
+    col_unbind_iterator(iterator);
+
+    /* Top header, then every collection has a value, an end
+     * and all but the last a reference to the next one.
+     */
+    if ((error) ||
+        (ends != COL_ITERATOR_DEPTH * 3) ||
+        (count != COL_ITERATOR_DEPTH * 3 * 2) ||
+        (depth < COL_ITERATOR_DEPTH)) {
+        printf("Iteration failed. Error %d, items %d, ends %d, depth %d\n",
+               error, count, ends, depth);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* The space can be bound again */
+    count = 0;
+    if ((error = col_bind_iterator_ex(&iterator, col, COL_TRAVERSE_ONELEVEL,
+                                      &space))) {
+        printf("Failed to bind iterator. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    COL_FOR_EACH_ITEM(iterator, item, error) count++;
+    col_unbind_iterator(iterator);
+    col_destroy_collection(col);
+
+    if ((error) || (count != 3)) {
+        printf("One level iteration failed. Error %d, items %d\n",
+               error, count);
+        return error ? error : EINVAL;
+    }
+
+    COLOUT(printf("\n\n==== ITERATOR SPACE TEST END ====\n\n"));
+
+    return EOK;
+}
+
 int main(int argc, char *argv[])
 {
     int error = 0;
@@ -2238,6 +3623,16 @@ int main(int argc, char *argv[])
                         search_test,
                         sort_test,
                         dup_test,
+                        index_test,
+                        packed_test,
+                        arena_test,
+                        hash_test,
+                        intern_test,
+                        binary_test,
+                        binary_depth_test,
+                        shared_copy_test,
+                        merge_sort_test,
+                        iterator_space_test,
                         NULL };
     test_fn t;
     int i = 0;
@@ -44,16 +44,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "dhash.h"
+#include "dhash_hash.h"
 
 /*****************************************************************************/
 /****************************** Internal Defines *****************************/
 /*****************************************************************************/
 
-#define PRIME_1                 37
-#define PRIME_2                 1048583
-
 #ifndef MIN
     #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #endif
@@ -62,7 +68,7 @@
     #define MAX(a,b) (((a) > (b)) ? (a) : (b))
 #endif
 
-#define halloc(table, size) table->halloc(size, table->halloc_pvt)
+#define halloc(table, size) stats_halloc(table, size)
 #define hfree(table, ptr) table->hfree(ptr, table->halloc_pvt)
 #define hdelete_callback(table, type, entry) do { \
     if (table->delete_callback) { \
@@ -70,15 +76,223 @@
     } \
 } while(0)
 
+#define HASH_CREATE_VALID_FLAGS (HASH_CREATE_OPEN_ADDRESSING | \
+                                 HASH_CREATE_RANDOM_SEED | \
+                                 HASH_CREATE_CONCURRENT | \
+                                 HASH_CREATE_SLAB_ALLOC | \
+                                 HASH_CREATE_BORROW_KEYS | \
+                                 HASH_CREATE_ADOPT_KEYS | \
+                                 HASH_CREATE_INTERN_KEYS | \
+                                 HASH_CREATE_EVICTION | \
+                                 HASH_CREATE_MULTIMAP)
+#define HASH_CREATE_KEY_OWNERSHIP (HASH_CREATE_BORROW_KEYS | \
+                                   HASH_CREATE_ADOPT_KEYS | \
+                                   HASH_CREATE_INTERN_KEYS)
+#define is_open_addressing(table) ((table)->flags & HASH_CREATE_OPEN_ADDRESSING)
+#define is_concurrent(table) ((table)->flags & HASH_CREATE_CONCURRENT)
+#define is_slab_alloc(table) ((table)->flags & HASH_CREATE_SLAB_ALLOC)
+#define is_image(table) ((table)->image != NULL)
+#define is_multimap(table) ((table)->flags & HASH_CREATE_MULTIMAP)
+#define is_frozen(table) ((table)->frozen_disp != NULL)
+
+/* Chain of bucket address of a chained table */
+#define bucket_chain(table, address) \
+    (&(table)->directory[(address) >> (table)->segment_size_shift] \
+                        [(address) & ((table)->segment_size - 1)])
+
+/* Slots of open addressing tables and images per hash_iterate_segment() */
+#define ITER_SEGMENT_SLOTS 4096
+#define needs_alloc_lock(table) (is_concurrent(table) && \
+    ((table)->flags & (HASH_CREATE_SLAB_ALLOC | HASH_CREATE_INTERN_KEYS)))
+
+/*
+ * String keys passed to tables adopting keys are taken over as they are,
+ * constant string and binary keys are still copied.
+ */
+#define is_adopted_key(table, key) \
+    (((table)->flags & HASH_CREATE_ADOPT_KEYS) && (key)->type == HASH_KEY_STRING)
+
+/*
+ * Slab allocated elements are followed by room for a string key of up to
+ * SLAB_INLINE_KEY_SIZE bytes including the terminating NUL. The first slab
+ * has room for SLAB_MIN_SLOTS elements, or for as many as the table was
+ * created for, every further slab is twice as large as the previous one
+ * up to SLAB_MAX_SLOTS elements.
+ */
+#define SLAB_INLINE_KEY_SIZE    48
+#define SLAB_MIN_SLOTS          64
+#define SLAB_MAX_SLOTS          65536
+
+#define slab_slot_size(table) \
+    ((table)->prefix_size + sizeof(element_t) + SLAB_INLINE_KEY_SIZE)
+#define slab_slot(table, slab, i) ((element_t *)((char *)((slab) + 1) + \
+    (i) * slab_slot_size(table) + (table)->prefix_size))
+#define inline_key(element) ((char *)((element) + 1))
+
+/*
+ * Tables with eviction keep an evict_t right in front of every element,
+ * evict_size is its size for them and zero for all other tables. Multimap
+ * tables keep a multi_t in front of that, prefix_size is the size of all
+ * that precedes an element.
+ */
+#define has_eviction(table) ((table)->evict_size != 0)
+#define element_evict(element) ((evict_t *)(element) - 1)
+#define evict_element(ev) ((element_t *)((ev) + 1))
+#define element_memory(table, element) ((char *)(element) - (table)->prefix_size)
+#define element_multi(table, element) ((multi_t *)element_memory(table, element))
+
+/* Initial size of the value vector of a multimap key */
+#define MULTI_MIN_VALUES        4
+
+/*
+ * Interned keys are packed into chunks of INTERN_CHUNK_SIZE bytes, keys
+ * larger than a quarter of that get a chunk of their own.
+ */
+#define INTERN_CHUNK_SIZE       8192
+#define INTERN_ALIGN            sizeof(void *)
+
+/*
+ * p, maxp and bucket_count are read by threads of concurrent tables while
+ * a resizing thread updates them, the sequence count in resize_seq tells
+ * the readers whether what they read is consistent.
+ */
+#define load_relaxed(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define store_relaxed(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+
+/*
+ * Runtime statistics, see hash_enable_stats(). Counters of concurrent
+ * tables are updated atomically, the rest of the tables pay only for the
+ * test of stats_flags while statistics are off.
+ */
+#define stats_enabled(table, what) (load_relaxed(&(table)->stats_flags) & (what))
+#define stat_add(table, field, n) do { \
+    if (stats_enabled(table, HASH_STATS_COUNTERS)) { \
+        if (is_concurrent(table) || is_frozen(table)) { \
+            __atomic_fetch_add(&(table)->stats.field, (n), __ATOMIC_RELAXED); \
+        } else { \
+            (table)->stats.field += (n); \
+        } \
+    } \
+} while(0)
+#define HASH_STATS_DEFAULT_INTERVAL 64
+
+/*
+ * Open addressing tables keep the load below OA_MAX_LOAD_NUM/OA_MAX_LOAD_DEN
+ * and halve the slot array when it drops below 1/OA_MIN_LOAD_DEN.
+ */
+#define OA_MIN_SLOTS            16
+#define OA_MAX_LOAD_NUM         7
+#define OA_MAX_LOAD_DEN         8
+#define OA_MIN_LOAD_DEN         8
+
+/*
+ * Frozen tables hash their entries into buckets of FROZEN_BUCKET_LOAD
+ * entries on average. Each bucket has a displacement, the smallest d for
+ * which frozen_slot() sends all entries of the bucket to slots no other
+ * entry takes, which makes the slot of every key unique.
+ */
+#define FROZEN_BUCKET_LOAD      2
+#define frozen_slot(h, d, slot_count) \
+    (dhash_priv_mix64((h) + (hash_code_t)(d) * DHASH_PRIV_PRIME64_2) % \
+     (slot_count))
+
+/* Number of keys of a batch which are hashed and prefetched together */
+#define HASH_BATCH_SIZE         16
+
+/* Distance of the occupied slot at index i from its home slot */
+#define oa_distance(table, slot, i) (((i) - (slot)->hash) & (table)->slot_mask)
+
 /*****************************************************************************/
 /************************** Internal Type Definitions ************************/
 /*****************************************************************************/
 
+/* Full width hash code of a key, the table address is taken from its low bits */
+typedef uint64_t hash_code_t;
+
 typedef struct element_t {
     hash_entry_t entry;
     struct element_t *next;
+    hash_code_t hash;              /* cached hash code of entry.key */
 } element_t, *segment_t;
 
+/*
+ * Eviction state of an element. All entries are on a list in LRU order,
+ * most recently used first, which CLOCK eviction sweeps like a ring.
+ * Entries with a time to live are also on a list sorted by expiry time.
+ */
+typedef struct evict_t {
+    struct evict_t *prev, *next;
+    struct evict_t *exp_prev, *exp_next;
+    uint64_t expires;              /* monotonic ms, 0 if never */
+    bool referenced;               /* CLOCK reference bit */
+} evict_t;
+
+/*
+ * Values of a key of a multimap table. While a key has a single value it
+ * is only kept in entry.value and values is NULL, once it has more they
+ * are all kept in values, with values[0] always equal to entry.value so
+ * that lookups and iteration see the first value.
+ */
+typedef struct multi_t {
+    hash_value_t *values;
+    unsigned long count;
+    unsigned long capacity;
+} multi_t;
+
+/*
+ * Header of a slab of elements, or of a chunk of interned keys, the element
+ * slots or keys follow it
+ */
+typedef struct slab_t {
+    struct slab_t *next;
+} slab_t;
+
+/*
+ * Layout of the files written by hash_dump(). The header is followed by
+ * slot_mask + 1 slots, an open addressing index in which hash_load()ed
+ * tables look keys up in place, and then the bytes of the string keys,
+ * each terminated by a NUL. Numbers are in host byte order and the
+ * byte_order field tells whether an image came from a different host.
+ */
+#define IMAGE_MAGIC      "DHASHIMG"
+#define IMAGE_VERSION    1
+#define IMAGE_BYTE_ORDER 0x0102030405060708ULL
+#define IMAGE_MIN_SLOTS  8
+/* Bytes of the value union which are saved */
+#define IMAGE_VALUE_SIZE MIN(sizeof(uint64_t), \
+                             sizeof(hash_value_t) - offsetof(hash_value_t, ul))
+
+typedef struct image_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t long_size;            /* sizeof(long) of the writer */
+    uint64_t byte_order;
+    uint64_t seed;
+    uint64_t count;
+    uint64_t slot_mask;
+    uint64_t size;                 /* of the whole image */
+} image_header_t;
+
+typedef struct image_slot_t {
+    uint64_t hash;                 /* 0 if the slot is empty */
+    uint64_t key;                  /* ulong key or offset of a string key */
+    uint64_t key_len;              /* length of a string key */
+    uint64_t value;                /* bits of the value union */
+    uint32_t key_type;
+    uint32_t value_type;
+} image_slot_t;
+
+/*
+ * Slot of an open addressing table. The slots live in one flat array and
+ * are kept in Robin Hood order: entries are displaced by ones which are
+ * further away from their home slot, so probe sequences stay short and a
+ * lookup can stop as soon as it sees an entry closer to home than itself.
+ * A hash of zero marks an empty slot.
+ */
+typedef struct oa_slot_t {
+    hash_code_t hash;
+    hash_entry_t entry;
+} oa_slot_t;
 
 struct hash_table_str {
     unsigned long   p;             /* Next bucket to be split */
@@ -98,6 +312,72 @@ struct hash_table_str {
     hash_free_func *hfree;
     void *halloc_pvt;
     segment_t **directory;
+    unsigned int    flags;         /* HASH_CREATE_* flags */
+    oa_slot_t      *slots;         /* open addressing slot array */
+    unsigned long   slot_mask;     /* # slots - 1 */
+    unsigned long   min_slots;     /* never shrink below this */
+    /*
+     * Resizing: at most resize_steps buckets are split or merged per
+     * operation, the table is not contracted below reserved_buckets buckets
+     * (or slots), and the segment last freed by a contraction is kept in
+     * spare_segment for the next expansion.
+     */
+    unsigned long   resize_steps;
+    unsigned long   reserved_buckets;
+    segment_t      *spare_segment;
+    hash_code_t     seed;          /* hash function seed */
+    /*
+     * Concurrent tables only. Each directory entry has its own lock which
+     * guards the chains of that segment. resize_lock serializes table
+     * expansion and contraction, resize_seq is odd while one of them is
+     * changing p and maxp, i.e. the mapping from hash codes to buckets.
+     */
+    pthread_rwlock_t *segment_locks;
+    pthread_mutex_t resize_lock;
+    unsigned long   resize_seq;
+    /*
+     * Slab allocating tables only. Unused element slots are linked through
+     * their next pointers on free_elements.
+     */
+    slab_t         *slabs;
+    element_t      *free_elements;
+    unsigned long   slab_slots;    /* # slots of the next slab */
+    unsigned long   external_keys; /* # keys to free outside the slabs */
+    /* Tables interning keys only, free space in the current chunk */
+    slab_t         *key_chunks;
+    char           *key_next;
+    size_t          key_avail;
+    /* Guards the slabs and the key chunks on concurrent tables */
+    pthread_mutex_t alloc_lock;
+    /*
+     * Tables with eviction only. evict_head is the list head of both the
+     * LRU list and the expiry list, clock_hand the next entry the CLOCK
+     * sweep looks at, or NULL for the head of the list.
+     */
+    size_t          evict_size;
+    size_t          prefix_size;
+    unsigned int    evict_policy;
+    unsigned long   max_entries;   /* 0 if unlimited */
+    unsigned long   default_ttl;   /* ms, 0 if entries don't expire */
+    evict_t         evict_head;
+    evict_t        *clock_hand;
+    /*
+     * Tables loaded by hash_load() only, the read-only mapping of the image
+     * until the first modification turns it into a chained table.
+     */
+    const image_header_t *image;
+    const image_slot_t *image_slots;
+    /*
+     * Tables frozen by hash_freeze() only, the displacements of the
+     * frozen_buckets buckets. The entries are in slots, which holds
+     * exactly one slot per entry.
+     */
+    uint32_t       *frozen_disp;
+    unsigned long   frozen_buckets;
+    /* Runtime statistics, HASH_STATS_* flags of what is collected */
+    unsigned int    stats_flags;
+    unsigned int    stats_interval; /* operations per latency sample */
+    hash_stats_t    stats;
 #ifdef HASH_STATISTICS
     hash_statistics_t statistics;
 #endif
@@ -108,28 +388,19 @@ typedef unsigned long address_t;
 
 typedef struct hash_keys_callback_data_t {
     unsigned long index;
+    unsigned long count;
     hash_key_t *keys;
 } hash_keys_callback_data_t;
 
 typedef struct hash_values_callback_data_t {
     unsigned long index;
+    unsigned long count;
     hash_value_t *values;
 } hash_values_callback_data_t;
 
 struct _hash_iter_context_t {
     struct hash_iter_context_t iter;
-    hash_table_t *table;
-    unsigned long i, j;
-    segment_t *s;
-    element_t *p;
-};
-
-enum hash_iter_state {
-    HI_STATE_0,
-    HI_STATE_1,
-    HI_STATE_2,
-    HI_STATE_3A,
-    HI_STATE_3B
+    hash_iter_t it;
 };
 
 /*****************************************************************************/
@@ -140,12 +411,13 @@ enum hash_iter_state {
 /**********************  Internal Function Declarations  *********************/
 /*****************************************************************************/
 
-static address_t convert_key(hash_key_t *key);
-static address_t hash(hash_table_t *table, hash_key_t *key);
+static hash_code_t convert_key(hash_table_t *table, hash_key_t *key);
+static address_t hash_address(hash_table_t *table, hash_code_t h);
 static bool key_equal(hash_key_t *a, hash_key_t *b);
 static int contract_table(hash_table_t *table);
 static int expand_table(hash_table_t *table);
-static hash_entry_t *hash_iter_next(struct hash_iter_context_t *iter);
+static bool image_entry(hash_table_t *table, const image_slot_t *slot,
+                        hash_entry_t *entry);
 
 /*****************************************************************************/
 /*************************  External Global Variables  ***********************/
@@ -159,10 +431,89 @@ static hash_entry_t *hash_iter_next(struct hash_iter_context_t *iter);
 int debug_level = 1;
 #endif
 
+/* Operations of this thread, picks the ones whose latency is sampled */
+static __thread unsigned int stats_tick;
+
 /*****************************************************************************/
 /***************************  Internal Functions  ****************************/
 /*****************************************************************************/
 
+/*
+ * Pick an unpredictable hash seed so that colliding keys can't be crafted
+ * in advance. Falls back to time and address entropy if /dev/urandom is
+ * not readable.
+ */
+static hash_code_t random_seed(hash_table_t *table)
+{
+    hash_code_t seed = 0;
+    ssize_t len = 0;
+    int fd;
+
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        len = read(fd, &seed, sizeof(seed));
+        close(fd);
+    }
+    if (len != sizeof(seed)) {
+        seed = (hash_code_t)time(NULL) ^ ((hash_code_t)getpid() << 32) ^
+               (hash_code_t)(uintptr_t)table ^ (hash_code_t)clock();
+    }
+
+    return seed;
+}
+
+static void *stats_halloc(hash_table_t *table, size_t size)
+{
+    stat_add(table, bytes_allocated, size);
+    return (table->halloc)(size, table->halloc_pvt);
+}
+
+/* Start timing the operation if it is sampled */
+static bool stats_begin(hash_table_t *table, struct timespec *start)
+{
+    /* Pairs with hash_enable_stats() setting the interval first */
+    if (!(__atomic_load_n(&table->stats_flags, __ATOMIC_ACQUIRE) & HASH_STATS_LATENCY) ||
+        ++stats_tick % load_relaxed(&table->stats_interval) != 0) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, start);
+    return true;
+}
+
+/* Add the time since start to a latency histogram with log2 buckets */
+static void stats_end(hash_table_t *table, unsigned long *histogram,
+                      struct timespec *start)
+{
+    struct timespec now;
+    unsigned long ns;
+    unsigned int bucket;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec - start->tv_nsec;
+    for (bucket = 0; ns > 1 && bucket < HASH_STATS_LATENCY_BUCKETS - 1; ns >>= 1) {
+        bucket++;
+    }
+    if (is_concurrent(table) || is_frozen(table)) {
+        __atomic_fetch_add(&histogram[bucket], 1, __ATOMIC_RELAXED);
+    } else {
+        histogram[bucket]++;
+    }
+}
+
+/* Count a search which compared probes entries before it ended */
+static void stats_probes(hash_table_t *table, unsigned long probes)
+{
+    stat_add(table, chain_length[MIN(probes, HASH_STATS_CHAIN_BUCKETS - 1)], 1);
+}
+
+static void stats_lookup(hash_table_t *table, int error)
+{
+    stat_add(table, lookups, 1);
+    if (error == HASH_SUCCESS) {
+        stat_add(table, hits, 1);
+    }
+}
+
 static void *sys_malloc_wrapper(size_t size, void *pvt)
 {
     return malloc(size);
@@ -173,41 +524,35 @@ static void sys_free_wrapper(void *ptr, void *pvt)
     return free(ptr);
 }
 
-static address_t convert_key(hash_key_t *key)
+static hash_code_t hash_string(const char *str, hash_code_t seed)
 {
-    address_t h;
-    const unsigned char *k;
+    return dhash_priv_bytes64(str, strlen(str), seed);
+}
 
+static hash_code_t convert_key(hash_table_t *table, hash_key_t *key)
+{
     switch(key->type) {
-    case HASH_KEY_ULONG:
-        h = key->ul;
-        break;
     case HASH_KEY_STRING:
-        /* Convert string to integer */
-        for (h = 0, k = (const unsigned char *) key->str; *k; k++)
-            h = h * PRIME_1 ^ (*k - ' ');
-        break;
+        return hash_string(key->str, table->seed);
     case HASH_KEY_CONST_STRING:
-        /* Convert string to integer */
-        for (h = 0, k = (const unsigned char *) key->c_str; *k; k++)
-            h = h * PRIME_1 ^ (*k - ' ');
-        break;
+        return hash_string(key->c_str, table->seed);
+    case HASH_KEY_BINARY:
+        return dhash_priv_bytes64(key->bin->data, key->bin->len, table->seed);
+    case HASH_KEY_ULONG:
     default:
-        h = key->ul;
-        break;
+        return dhash_priv_mix64((hash_code_t)key->ul ^ table->seed);
     }
-    return h;
 }
 
-static address_t hash(hash_table_t *table, hash_key_t *key)
+static address_t hash_address(hash_table_t *table, hash_code_t h)
 {
-    address_t h, address;
+    address_t address, p, maxp;
 
-    h = convert_key(key);
-    h %= PRIME_2;
-    address = h & (table->maxp-1);            /* h % maxp */
-    if (address < table->p)
-        address = h & ((table->maxp << 1)-1); /* h % (2*table->maxp) */
+    p = load_relaxed(&table->p);
+    maxp = load_relaxed(&table->maxp);
+    address = h & (maxp-1);            /* h % maxp */
+    if (address < p)
+        address = h & ((maxp << 1)-1); /* h % (2*maxp) */
 
     return address;
 }
@@ -218,6 +563,7 @@ static bool is_valid_key_type(hash_key_enum key_type)
     case HASH_KEY_ULONG:
     case HASH_KEY_STRING:
     case HASH_KEY_CONST_STRING:
+    case HASH_KEY_BINARY:
         return true;
     default:
         return false;
@@ -252,10 +598,158 @@ static bool key_equal(hash_key_t *a, hash_key_t *b)
         return (strcmp(a->str, b->str) == 0);
     case HASH_KEY_CONST_STRING:
         return (strcmp(a->c_str, b->c_str) == 0);
+    case HASH_KEY_BINARY:
+        return (a->bin->len == b->bin->len &&
+                memcmp(a->bin->data, b->bin->data, a->bin->len) == 0);
     }
     return false;
 }
 
+/*
+ * Concurrent tables: write lock the segments at directory indexes a and b,
+ * always in ascending order so that two resizers can't deadlock.
+ */
+static void lock_segments(hash_table_t *table, unsigned long a, unsigned long b)
+{
+    unsigned long tmp;
+
+    if (a > b) {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    pthread_rwlock_wrlock(&table->segment_locks[a]);
+    if (b != a) {
+        pthread_rwlock_wrlock(&table->segment_locks[b]);
+    }
+}
+
+static void unlock_segments(hash_table_t *table, unsigned long a, unsigned long b)
+{
+    pthread_rwlock_unlock(&table->segment_locks[a]);
+    if (b != a) {
+        pthread_rwlock_unlock(&table->segment_locks[b]);
+    }
+}
+
+/*
+ * Concurrent tables: bracket a change of p and maxp. While the sequence
+ * count is odd, or once it has changed, bucket addresses computed by
+ * other threads may be stale and must be recomputed (see lock_bucket).
+ */
+static void begin_remap(hash_table_t *table)
+{
+    __atomic_store_n(&table->resize_seq, table->resize_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_remap(hash_table_t *table)
+{
+    __atomic_store_n(&table->resize_seq, table->resize_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Return the address of the bucket for hash code h. For concurrent tables
+ * the segment holding that bucket is also locked, for reading or writing,
+ * and the address is guaranteed to stay valid until unlock_bucket().
+ */
+static address_t lock_bucket(hash_table_t *table, hash_code_t h, bool write)
+{
+    unsigned long seq;
+    address_t address;
+    pthread_rwlock_t *lock;
+
+    if (!is_concurrent(table)) {
+        return hash_address(table, h);
+    }
+
+    while (true) {
+        seq = __atomic_load_n(&table->resize_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            /* A bucket is being split or merged right now */
+            sched_yield();
+            continue;
+        }
+        address = hash_address(table, h);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        /*
+         * p and maxp might have been read in the middle of an update and
+         * the address may not even be within the table, don't lock it.
+         */
+        if (__atomic_load_n(&table->resize_seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+
+        lock = &table->segment_locks[address >> table->segment_size_shift];
+        if (write) {
+            pthread_rwlock_wrlock(lock);
+        } else {
+            pthread_rwlock_rdlock(lock);
+        }
+        /*
+         * Buckets only move while both segments involved are write locked,
+         * so if the layout did not change until we got the lock the
+         * address is still right and will stay so while we hold it.
+         */
+        if (__atomic_load_n(&table->resize_seq, __ATOMIC_ACQUIRE) == seq) {
+            return address;
+        }
+        pthread_rwlock_unlock(lock);
+    }
+}
+
+static void unlock_bucket(hash_table_t *table, address_t address)
+{
+    if (is_concurrent(table)) {
+        pthread_rwlock_unlock(&table->segment_locks[address >> table->segment_size_shift]);
+    }
+}
+
+static unsigned long add_entry_count(hash_table_t *table, long delta)
+{
+    if (is_concurrent(table)) {
+        return __atomic_add_fetch(&table->entry_count, delta, __ATOMIC_RELAXED);
+    }
+    return table->entry_count += delta;
+}
+
+/*
+ * Run one step of table expansion or contraction. On concurrent tables
+ * only one thread resizes at a time; if another one already is, this
+ * step is simply skipped and left to a later insertion or deletion.
+ */
+static bool needs_resize(hash_table_t *table, int (*step)(hash_table_t *))
+{
+    unsigned long load;
+
+    load = load_relaxed(&table->entry_count) / table->bucket_count;
+    return step == expand_table ? load > table->max_load_factor
+                                : load < table->min_load_factor;
+}
+
+static int resize_table(hash_table_t *table, int (*step)(hash_table_t *))
+{
+    unsigned long i;
+    int error = HASH_SUCCESS;
+
+    if (is_concurrent(table) && pthread_mutex_trylock(&table->resize_lock) != 0) {
+        return HASH_SUCCESS;
+    }
+    /*
+     * Split or merge up to the step budget of buckets while the load stays
+     * out of bounds, so that a table can catch up with a burst.
+     */
+    for (i = 0; i < load_relaxed(&table->resize_steps); i++) {
+        if ((error = step(table)) != HASH_SUCCESS || !needs_resize(table, step)) {
+            break;
+        }
+    }
+    if (is_concurrent(table)) {
+        pthread_mutex_unlock(&table->resize_lock);
+    }
+
+    return error;
+}
 
 static int expand_table(hash_table_t *table)
 {
@@ -274,6 +768,7 @@ static int expand_table(hash_table_t *table)
 #ifdef HASH_STATISTICS
         table->statistics.table_expansions++;
 #endif
+        stat_add(table, expansions, 1);
 
         /*
          * Locate the bucket to be split
@@ -287,9 +782,20 @@ static int expand_table(hash_table_t *table)
         new_address = table->maxp + table->p;
         new_segment_dir = new_address >> table->segment_size_shift;
         new_segment_index = new_address & (table->segment_size-1); /* new_address % segment_size */
-        if (new_segment_index == 0) {
+        if (is_concurrent(table)) {
+            lock_segments(table, old_segment_dir, new_segment_dir);
+        }
+        if (new_segment_index == 0 && table->spare_segment != NULL) {
+            /* Zeroed when it was freed */
+            table->directory[new_segment_dir] = table->spare_segment;
+            table->spare_segment = NULL;
+            table->segment_count++;
+        } else if (new_segment_index == 0) {
             table->directory[new_segment_dir] = (segment_t *)halloc(table, table->segment_size * sizeof(segment_t));
             if (table->directory[new_segment_dir] == NULL) {
+                if (is_concurrent(table)) {
+                    unlock_segments(table, old_segment_dir, new_segment_dir);
+                }
                 return HASH_ERROR_NO_MEMORY;
             }
             memset(table->directory[new_segment_dir], 0, table->segment_size * sizeof(segment_t));
@@ -299,12 +805,16 @@ static int expand_table(hash_table_t *table)
         /*
          * Adjust state variables
          */
-        table->p++;
-        if (table->p == table->maxp) {
-            table->maxp <<= 1;  /* table->maxp *= 2 */
-            table->p = 0;
+        if (is_concurrent(table)) {
+            begin_remap(table);
+        }
+        if (table->p + 1 == table->maxp) {
+            store_relaxed(&table->maxp, table->maxp << 1);  /* table->maxp *= 2 */
+            store_relaxed(&table->p, 0);
+        } else {
+            store_relaxed(&table->p, table->p + 1);
         }
-        table->bucket_count++;
+        store_relaxed(&table->bucket_count, table->bucket_count + 1);
         /*
          * Relocate records to the new bucket
          */
@@ -313,7 +823,7 @@ static int expand_table(hash_table_t *table)
         last_of_new = &new_segment[new_segment_index];
         *last_of_new = NULL;
         while (current != NULL) {
-            if (hash(table, &current->entry.key) == new_address) {
+            if (hash_address(table, current->hash) == new_address) {
                 /*
                  * Attach it to the end of the new chain
                  */
@@ -333,6 +843,10 @@ static int expand_table(hash_table_t *table)
                 current = current->next;
             }
         }
+        if (is_concurrent(table)) {
+            end_remap(table);
+            unlock_segments(table, old_segment_dir, new_segment_dir);
+        }
 #ifdef DEBUG
         if (debug_level >= 2)
             fprintf(stderr, "expand_table on exit: bucket_count=%lu, segment_count=%lu p=%lu maxp=%lu\n",
@@ -350,7 +864,8 @@ static int contract_table(hash_table_t *table)
     segment_t *old_segment, *new_segment;
     element_t *current;
 
-    if ((table->bucket_count > table->segment_size) && (table->segment_count > 1)) {
+    if ((table->bucket_count > table->segment_size) && (table->segment_count > 1) &&
+        table->bucket_count > table->reserved_buckets) {
 #ifdef DEBUG
         if (debug_level >= 2)
             fprintf(stderr, "contract_table on entry: bucket_count=%lu, segment_count=%lu p=%lu maxp=%lu\n",
@@ -360,6 +875,7 @@ static int contract_table(hash_table_t *table)
 #ifdef HASH_STATISTICS
         table->statistics.table_contractions++;
 #endif
+        stat_add(table, contractions, 1);
         /*
          * Locate the bucket to be merged with the last bucket
          */
@@ -368,23 +884,31 @@ static int contract_table(hash_table_t *table)
         old_segment = table->directory[old_segment_dir];
         old_segment_index = old_address & (table->segment_size-1); /* old_address % segment_size */
 
+        /*
+         * The last bucket is merged back into the bucket p will point to
+         */
+        new_address = table->p > 0 ? table->p - 1 : (table->maxp >> 1) - 1;
+        new_segment_dir = new_address >> table->segment_size_shift;
+        if (is_concurrent(table)) {
+            lock_segments(table, old_segment_dir, new_segment_dir);
+            begin_remap(table);
+        }
+
         /*
          * Adjust state variables
          */
         if (table->p > 0) {
-            table->p--;
+            store_relaxed(&table->p, table->p - 1);
         } else {
-            table->maxp >>= 1;
-            table->p = table->maxp - 1;
+            store_relaxed(&table->maxp, table->maxp >> 1);
+            store_relaxed(&table->p, table->maxp - 1);
         }
-        table->bucket_count--;
+        store_relaxed(&table->bucket_count, table->bucket_count - 1);
 
         /*
          * Find the last bucket to merge back
          */
         if((current = old_segment[old_segment_index]) != NULL) {
-            new_address = hash(table, &old_segment[old_segment_index]->entry.key);
-            new_segment_dir = new_address >> table->segment_size_shift;
             new_segment_index = new_address & (table->segment_size-1); /* new_address % segment_size */
             new_segment = table->directory[new_segment_dir];
 
@@ -407,11 +931,23 @@ static int contract_table(hash_table_t *table)
         }
         /*
          * If we have removed the last of the chains in this segment then free the
-         * segment since its no longer in use.
+         * segment since its no longer in use. Keep one around, so that a table
+         * going up and down across a segment boundary doesn't allocate and free
+         * it over and over.
          */
         if (old_segment_index == 0) {
             table->segment_count--;
-            hfree(table, table->directory[old_segment_dir]);
+            if (table->spare_segment == NULL) {
+                table->spare_segment = table->directory[old_segment_dir];
+            } else {
+                hfree(table, table->directory[old_segment_dir]);
+            }
+            table->directory[old_segment_dir] = NULL;
+        }
+
+        if (is_concurrent(table)) {
+            end_remap(table);
+            unlock_segments(table, old_segment_dir, new_segment_dir);
         }
 
 #ifdef DEBUG
@@ -424,26 +960,22 @@ static int contract_table(hash_table_t *table)
     return HASH_SUCCESS;
 }
 
-static int lookup(hash_table_t *table, hash_key_t *key, element_t **element_arg, segment_t **chain_arg)
+static int lookup(hash_table_t *table, hash_key_t *key, hash_code_t hash_code,
+                  address_t h, element_t **element_arg, segment_t **chain_arg)
 {
-    address_t h;
     segment_t *current_segment;
     unsigned long segment_index, segment_dir;
     segment_t *chain, element;
+    unsigned long collisions = 0;
 
     *element_arg = NULL;
     *chain_arg = NULL;
 
     if (!table) return HASH_ERROR_BAD_TABLE;
-
-#ifdef HASH_STATISTICS
-    table->statistics.hash_accesses++;
-#endif
-    h = hash(table, key);
     segment_dir = h >> table->segment_size_shift;
     segment_index = h & (table->segment_size-1); /* h % segment_size */
     /*
-     * valid segment ensured by hash()
+     * valid segment ensured by hash_address()
      */
     current_segment = table->directory[segment_dir];
 
@@ -457,641 +989,2904 @@ static int lookup(hash_table_t *table, hash_key_t *key, element_t **element_arg,
     chain = &current_segment[segment_index];
     element = *chain;
     /*
-     * Follow collision chain
+     * Follow collision chain, comparing the cached hash codes first so that
+     * the keys themselves are only compared when they are likely to match.
      */
-    while (element != NULL && !key_equal(&element->entry.key, key)) {
+    while (element != NULL &&
+           (element->hash != hash_code || !key_equal(&element->entry.key, key))) {
         chain = &element->next;
         element = *chain;
+        collisions++;
+    }
 #ifdef HASH_STATISTICS
-        table->statistics.hash_collisions++;
-#endif
+    /* Concurrent tables only count expansions and contractions */
+    if (!is_concurrent(table)) {
+        table->statistics.hash_accesses++;
+        table->statistics.hash_collisions += collisions;
     }
+#endif
+    stats_probes(table, collisions);
     *element_arg = element;
     *chain_arg = chain;
 
     return HASH_SUCCESS;
 }
 
-static bool hash_keys_callback(hash_entry_t *item, void *user_data)
+/*
+ * Bump allocate size bytes for a key of a table interning its keys. The
+ * memory is only released by hash_destroy().
+ */
+static char *intern_alloc(hash_table_t *table, size_t size)
 {
-    hash_keys_callback_data_t *data = (hash_keys_callback_data_t *)user_data;
+    slab_t *chunk;
+    char *mem = NULL;
 
-    data->keys[data->index++] = item->key;
-    return true;
-}
+    size = (size + INTERN_ALIGN - 1) & ~(INTERN_ALIGN - 1);
 
-static bool hash_values_callback(hash_entry_t *item, void *user_data)
-{
-    hash_values_callback_data_t *data = (hash_values_callback_data_t *)user_data;
+    if (needs_alloc_lock(table)) {
+        pthread_mutex_lock(&table->alloc_lock);
+    }
 
-    data->values[data->index++] = item->value;
-    return true;
+    if (size > INTERN_CHUNK_SIZE / 4) {
+        chunk = (slab_t *)halloc(table, sizeof(slab_t) + size);
+        if (chunk != NULL) {
+            chunk->next = table->key_chunks;
+            table->key_chunks = chunk;
+            mem = (char *)(chunk + 1);
+        }
+    } else {
+        if (size > table->key_avail) {
+            chunk = (slab_t *)halloc(table, sizeof(slab_t) + INTERN_CHUNK_SIZE);
+            if (chunk != NULL) {
+                chunk->next = table->key_chunks;
+                table->key_chunks = chunk;
+                table->key_next = (char *)(chunk + 1);
+                table->key_avail = INTERN_CHUNK_SIZE;
+            }
+        }
+        if (size <= table->key_avail) {
+            mem = table->key_next;
+            table->key_next += size;
+            table->key_avail -= size;
+        }
+    }
+
+    if (needs_alloc_lock(table)) {
+        pthread_mutex_unlock(&table->alloc_lock);
+    }
+
+    return mem;
 }
 
-/*****************************************************************************/
-/****************************  Exported Functions  ***************************/
-/*****************************************************************************/
+/* Bytes needed to store a copy of a string or binary key */
+static size_t key_size(hash_key_t *key)
+{
+    if (key->type == HASH_KEY_BINARY) {
+        return sizeof(hash_binary_t) + key->bin->len;
+    }
+    return strlen(key->c_str) + 1;
+}
 
-const char* hash_error_string(int error)
+/*
+ * Copy the string or binary key src into the key_size(src) bytes at mem.
+ * Binary keys are stored as their descriptor followed by the data.
+ */
+static void place_key(hash_key_t *dst, hash_key_t *src, char *mem, size_t size)
 {
-    switch(error) {
-    case HASH_SUCCESS:              return "Success";
-    case HASH_ERROR_BAD_KEY_TYPE:   return "Bad key type";
-    case HASH_ERROR_BAD_VALUE_TYPE: return "Bad value type";
-    case HASH_ERROR_NO_MEMORY:      return "No memory";
-    case HASH_ERROR_KEY_NOT_FOUND:  return "Key not found";
-    case HASH_ERROR_BAD_TABLE:      return "Bad table";
+    hash_binary_t *bin;
+
+    dst->type = src->type;
+    if (src->type == HASH_KEY_BINARY) {
+        bin = (hash_binary_t *)mem;
+        bin->data = mem + sizeof(hash_binary_t);
+        bin->len = src->bin->len;
+        memcpy(mem + sizeof(hash_binary_t), src->bin->data, src->bin->len);
+        dst->bin = bin;
+    } else {
+        memcpy(mem, src->c_str, size);
+        dst->str = mem;
     }
-    return NULL;
 }
 
+/*
+ * Memory holding a string or binary key. Binary keys stored by the table
+ * point to their copy of the descriptor, which shares the union with str.
+ */
+static void *key_memory(hash_key_t *key)
+{
+    return key->str;
+}
 
-int hash_create(unsigned long count, hash_table_t **tbl,
-                hash_delete_callback *delete_callback,
-                void *delete_private_data)
+/* Does free_key() have anything to free for a key stored by copy_key()? */
+static bool owns_key_memory(hash_table_t *table, hash_key_t *key)
 {
-    return hash_create_ex(count, tbl, 0, 0, 0, 0,
-                          NULL, NULL, NULL,
-                          delete_callback,
-                          delete_private_data);
+    return key->type != HASH_KEY_ULONG &&
+           !(table->flags & (HASH_CREATE_BORROW_KEYS | HASH_CREATE_INTERN_KEYS));
 }
 
-int hash_create_ex(unsigned long count, hash_table_t **tbl,
-                   unsigned int directory_bits,
-                   unsigned int segment_bits,
-                   unsigned long min_load_factor,
-                   unsigned long max_load_factor,
-                   hash_alloc_func *alloc_func,
-                   hash_free_func *free_func,
-                   void *alloc_private_data,
-                   hash_delete_callback *delete_callback,
-                   void *delete_private_data) {
+static int copy_key(hash_table_t *table, hash_key_t *dst, hash_key_t *src)
+{
+    size_t size;
+    char *mem;
+
+    if (src->type == HASH_KEY_ULONG) {
+        dst->type = src->type;
+        dst->ul = src->ul;
+        return HASH_SUCCESS;
+    }
+
+    if ((table->flags & HASH_CREATE_BORROW_KEYS) || is_adopted_key(table, src)) {
+        *dst = *src;
+        return HASH_SUCCESS;
+    }
+
+    size = key_size(src);
+    if (table->flags & HASH_CREATE_INTERN_KEYS) {
+        mem = intern_alloc(table, size);
+    } else {
+        mem = halloc(table, size);
+    }
+    if (mem == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    place_key(dst, src, mem, size);
+
+    return HASH_SUCCESS;
+}
+
+static void free_key(hash_table_t *table, hash_key_t *key)
+{
+    if (owns_key_memory(table, key)) {
+        /* Internally we do not use constant memory for keys
+         * in hash table elements. */
+        hfree(table, key_memory(key));
+    }
+}
+
+/*
+ * A table adopting keys owns the key passed to hash_enter() even if it
+ * was not stored because the key was in the table already.
+ */
+static void release_key(hash_table_t *table, hash_key_t *key, hash_key_t *stored)
+{
+    if (is_adopted_key(table, key) && key->str != stored->str) {
+        hfree(table, key->str);
+    }
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void evict_unlink(hash_table_t *table, evict_t *ev)
+{
+    if (table->clock_hand == ev) {
+        table->clock_hand = ev->next != &table->evict_head ? ev->next : NULL;
+    }
+    ev->prev->next = ev->next;
+    ev->next->prev = ev->prev;
+    if (ev->expires != 0) {
+        ev->exp_prev->exp_next = ev->exp_next;
+        ev->exp_next->exp_prev = ev->exp_prev;
+        ev->expires = 0;
+    }
+}
+
+/* Link ev into the LRU list in front of pos */
+static void evict_insert(evict_t *pos, evict_t *ev)
+{
+    ev->next = pos;
+    ev->prev = pos->prev;
+    pos->prev->next = ev;
+    pos->prev = ev;
+}
+
+/* (Re)start the time to live of an entry, ttl of zero means forever */
+static void evict_set_ttl(hash_table_t *table, evict_t *ev, unsigned long ttl)
+{
+    evict_t *pos;
+
+    if (ev->expires != 0) {
+        ev->exp_prev->exp_next = ev->exp_next;
+        ev->exp_next->exp_prev = ev->exp_prev;
+        ev->expires = 0;
+    }
+    if (ttl == 0) {
+        return;
+    }
+
+    ev->expires = now_ms() + ttl;
+    /*
+     * Entries usually share the same time to live and go to the end of
+     * the list right away.
+     */
+    for (pos = &table->evict_head;
+         pos->exp_prev != &table->evict_head && pos->exp_prev->expires > ev->expires;
+         pos = pos->exp_prev);
+    ev->exp_next = pos;
+    ev->exp_prev = pos->exp_prev;
+    pos->exp_prev->exp_next = ev;
+    pos->exp_prev = ev;
+}
+
+/* Put a new entry on the eviction lists */
+static void evict_link(hash_table_t *table, evict_t *ev, unsigned long ttl)
+{
+    ev->expires = 0;
+    ev->referenced = false;
+    if (table->evict_policy == HASH_EVICT_CLOCK) {
+        /* The sweep gets to it last */
+        evict_insert(table->clock_hand ? table->clock_hand : &table->evict_head, ev);
+    } else {
+        evict_insert(table->evict_head.next, ev);
+    }
+    evict_set_ttl(table, ev, ttl);
+}
+
+/* Record a use of an entry by hash_lookup() or hash_enter() */
+static void evict_touch(hash_table_t *table, evict_t *ev)
+{
+    if (table->evict_policy == HASH_EVICT_CLOCK) {
+        ev->referenced = true;
+    } else if (table->evict_head.next != ev) {
+        ev->prev->next = ev->next;
+        ev->next->prev = ev->prev;
+        evict_insert(table->evict_head.next, ev);
+    }
+}
+
+/* Pick the entry to evict from a table which is over capacity */
+static element_t *evict_victim(hash_table_t *table)
+{
+    evict_t *head = &table->evict_head;
+    evict_t *ev;
+
+    if (head->next == head) {
+        return NULL;
+    }
+    if (table->evict_policy == HASH_EVICT_LRU) {
+        return evict_element(head->prev);
+    }
+
+    /* CLOCK: referenced entries get a second chance */
+    for (ev = table->clock_hand ? table->clock_hand : head->next;
+         ev == head || ev->referenced;
+         ev = ev->next) {
+        ev->referenced = false;
+    }
+    table->clock_hand = ev;
+    return evict_element(ev);
+}
+
+static element_t *slab_alloc(hash_table_t *table)
+{
+    element_t *element;
+    slab_t *slab;
     unsigned long i;
-    unsigned int n_addr_bits, requested_bits;
-    unsigned int requested_directory_bits;
-    unsigned int requested_segment_bits;
-    address_t addr;
-    hash_table_t *table = NULL;
 
-    /* Initialize to NULL in case of an early return due to an error */
-    *tbl = NULL;
+    if (is_concurrent(table)) {
+        pthread_mutex_lock(&table->alloc_lock);
+    }
+
+    if (table->free_elements == NULL) {
+        slab = (slab_t *)halloc(table, sizeof(slab_t) + table->slab_slots * slab_slot_size(table));
+        if (slab == NULL) {
+            if (is_concurrent(table)) {
+                pthread_mutex_unlock(&table->alloc_lock);
+            }
+            return NULL;
+        }
+        slab->next = table->slabs;
+        table->slabs = slab;
+
+        /* Hand out the slots of a new slab in address order */
+        for (i = table->slab_slots; i-- > 0; ) {
+            slab_slot(table, slab, i)->next = table->free_elements;
+            table->free_elements = slab_slot(table, slab, i);
+        }
+        if (table->slab_slots < SLAB_MAX_SLOTS) {
+            table->slab_slots <<= 1;
+        }
+    }
+
+    element = table->free_elements;
+    table->free_elements = element->next;
+
+    if (is_concurrent(table)) {
+        pthread_mutex_unlock(&table->alloc_lock);
+    }
+
+    return element;
+}
+
+static void slab_free(hash_table_t *table, element_t *element)
+{
+    if (is_concurrent(table)) {
+        pthread_mutex_lock(&table->alloc_lock);
+    }
+    element->next = table->free_elements;
+    table->free_elements = element;
+    if (is_concurrent(table)) {
+        pthread_mutex_unlock(&table->alloc_lock);
+    }
+}
+
+static bool has_external_key(hash_table_t *table, element_t *element)
+{
+    return owns_key_memory(table, &element->entry.key) &&
+           key_memory(&element->entry.key) != inline_key(element);
+}
+
+/*
+ * Allocate an element holding a copy of key. Slab allocating tables take
+ * it from a slab and store short string and binary keys right behind the
+ * element, unless the key is borrowed or adopted. Returns NULL if out of
+ * memory.
+ */
+static element_t *new_element(hash_table_t *table, hash_key_t *key)
+{
+    element_t *element;
+    size_t size;
+    char *mem;
+
+    if (!is_slab_alloc(table)) {
+        mem = (char *)halloc(table, table->prefix_size + sizeof(element_t));
+        if (mem == NULL) {
+            return NULL;
+        }
+        element = (element_t *)(mem + table->prefix_size);
+        memset(element, 0, sizeof(element_t));
+        if (is_multimap(table)) {
+            memset(element_multi(table, element), 0, sizeof(multi_t));
+        }
+        if (copy_key(table, &element->entry.key, key) != HASH_SUCCESS) {
+            hfree(table, mem);
+            return NULL;
+        }
+        return element;
+    }
+
+    element = slab_alloc(table);
+    if (element == NULL) {
+        return NULL;
+    }
+    memset(element, 0, sizeof(element_t));
+    if (is_multimap(table)) {
+        memset(element_multi(table, element), 0, sizeof(multi_t));
+    }
+
+    if (key->type != HASH_KEY_ULONG &&
+        !(table->flags & HASH_CREATE_BORROW_KEYS) && !is_adopted_key(table, key) &&
+        (size = key_size(key)) <= SLAB_INLINE_KEY_SIZE) {
+        place_key(&element->entry.key, key, inline_key(element), size);
+        return element;
+    }
+
+    if (copy_key(table, &element->entry.key, key) != HASH_SUCCESS) {
+        slab_free(table, element);
+        return NULL;
+    }
+    if (owns_key_memory(table, key)) {
+        __atomic_add_fetch(&table->external_keys, 1, __ATOMIC_RELAXED);
+    }
+
+    return element;
+}
+
+static void free_values(hash_table_t *table, element_t *element)
+{
+    multi_t *multi;
+
+    if (is_multimap(table) &&
+        (multi = element_multi(table, element))->values != NULL) {
+        hfree(table, multi->values);
+        multi->values = NULL;
+    }
+}
+
+static void free_element(hash_table_t *table, element_t *element)
+{
+    if (has_eviction(table)) {
+        evict_unlink(table, element_evict(element));
+    }
+    free_values(table, element);
+
+    if (!is_slab_alloc(table)) {
+        free_key(table, &element->entry.key);
+        hfree(table, element_memory(table, element));
+        return;
+    }
+
+    if (has_external_key(table, element)) {
+        free_key(table, &element->entry.key);
+        __atomic_sub_fetch(&table->external_keys, 1, __ATOMIC_RELAXED);
+    }
+    slab_free(table, element);
+}
+
+/*
+ * Pass the entry of an element to the delete callback, once for each value
+ * of a multimap key.
+ */
+static void delete_callback_values(hash_table_t *table, hash_destroy_enum type,
+                                   element_t *element)
+{
+    hash_entry_t entry;
+    multi_t *multi;
+    unsigned long i;
+
+    hdelete_callback(table, type, &element->entry);
+    if (table->delete_callback && is_multimap(table) &&
+        (multi = element_multi(table, element))->values != NULL) {
+        entry.key = element->entry.key;
+        for (i = 1; i < multi->count; i++) {
+            entry.value = multi->values[i];
+            hdelete_callback(table, type, &entry);
+        }
+    }
+}
+
+static void set_value(hash_value_t *dst, hash_value_t *src)
+{
+    switch(dst->type = src->type) {
+    case HASH_VALUE_UNDEF:
+        dst->ul = 0;
+        break;
+    case HASH_VALUE_PTR:
+        dst->ptr = src->ptr;
+        break;
+    case HASH_VALUE_INT:
+        dst->i = src->i;
+        break;
+    case HASH_VALUE_UINT:
+        dst->ui = src->ui;
+        break;
+    case HASH_VALUE_LONG:
+        dst->l = src->l;
+        break;
+    case HASH_VALUE_ULONG:
+        dst->ul = src->ul;
+        break;
+    case HASH_VALUE_FLOAT:
+        dst->f = src->f;
+        break;
+    case HASH_VALUE_DOUBLE:
+        dst->d = src->d;
+        break;
+    }
+}
+
+static bool value_equal(hash_value_t *a, hash_value_t *b)
+{
+    if (a->type != b->type) return false;
+
+    switch(a->type) {
+    case HASH_VALUE_UNDEF:
+        return true;
+    case HASH_VALUE_PTR:
+        return a->ptr == b->ptr;
+    case HASH_VALUE_INT:
+        return a->i == b->i;
+    case HASH_VALUE_UINT:
+        return a->ui == b->ui;
+    case HASH_VALUE_LONG:
+        return a->l == b->l;
+    case HASH_VALUE_ULONG:
+        return a->ul == b->ul;
+    case HASH_VALUE_FLOAT:
+        return a->f == b->f;
+    case HASH_VALUE_DOUBLE:
+        return a->d == b->d;
+    }
+    return false;
+}
+
+/*
+ * Append value to the values of a multimap key, moving them into a vector
+ * of their own when the key gets its second value.
+ */
+static int multi_add(hash_table_t *table, element_t *element, hash_value_t *value)
+{
+    multi_t *multi = element_multi(table, element);
+    hash_value_t *values;
+    unsigned long capacity;
+
+    if (multi->values == NULL || multi->count == multi->capacity) {
+        capacity = multi->values ? multi->capacity * 2 : MULTI_MIN_VALUES;
+        values = (hash_value_t *)halloc(table, capacity * sizeof(hash_value_t));
+        if (values == NULL) {
+            return HASH_ERROR_NO_MEMORY;
+        }
+        if (multi->values) {
+            memcpy(values, multi->values, multi->count * sizeof(hash_value_t));
+            hfree(table, multi->values);
+        } else {
+            values[0] = element->entry.value;
+            multi->count = 1;
+        }
+        multi->values = values;
+        multi->capacity = capacity;
+    }
+    set_value(&multi->values[multi->count++], value);
+
+    return HASH_SUCCESS;
+}
+
+static hash_code_t oa_hash(hash_table_t *table, hash_key_t *key)
+{
+    hash_code_t h;
+
+    h = convert_key(table, key);
+
+    /* Zero marks an empty slot */
+    return h ? h : 1;
+}
+
+static bool oa_lookup(hash_table_t *table, hash_key_t *key, hash_code_t h,
+                      unsigned long *index)
+{
+    unsigned long i, dist;
+    oa_slot_t *slot;
+
+#ifdef HASH_STATISTICS
+    table->statistics.hash_accesses++;
+#endif
+    for (i = h & table->slot_mask, dist = 0; ;
+         i = (i + 1) & table->slot_mask, dist++) {
+        slot = &table->slots[i];
+        /*
+         * The key can't be beyond an empty slot or beyond an entry which
+         * is closer to its home slot than the key would be.
+         */
+        if (slot->hash == 0 || oa_distance(table, slot, i) < dist) {
+            stats_probes(table, dist);
+            return false;
+        }
+        if (slot->hash == h && key_equal(&slot->entry.key, key)) {
+            stats_probes(table, dist);
+            *index = i;
+            return true;
+        }
+#ifdef HASH_STATISTICS
+        table->statistics.hash_collisions++;
+#endif
+    }
+}
+
+/*
+ * Place an entry which is known not to be in the table, displacing
+ * entries which are closer to their home slot than the one being placed.
+ */
+static void oa_place(hash_table_t *table, oa_slot_t *item)
+{
+    unsigned long i, dist, slot_dist;
+    oa_slot_t current, tmp, *slot;
+
+    current = *item;
+    for (i = current.hash & table->slot_mask, dist = 0; ;
+         i = (i + 1) & table->slot_mask, dist++) {
+        slot = &table->slots[i];
+        if (slot->hash == 0) {
+            *slot = current;
+            return;
+        }
+        slot_dist = oa_distance(table, slot, i);
+        if (slot_dist < dist) {
+            tmp = *slot;
+            *slot = current;
+            current = tmp;
+            dist = slot_dist;
+        }
+    }
+}
+
+static int oa_resize(hash_table_t *table, unsigned long slot_count)
+{
+    oa_slot_t *old_slots;
+    unsigned long i, old_slot_count;
+
+    old_slots = table->slots;
+    old_slot_count = table->slot_mask + 1;
+
+    table->slots = (oa_slot_t *)halloc(table, slot_count * sizeof(oa_slot_t));
+    if (table->slots == NULL) {
+        table->slots = old_slots;
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(table->slots, 0, slot_count * sizeof(oa_slot_t));
+    table->slot_mask = slot_count - 1;
+    table->bucket_count = slot_count;
+
+#ifdef HASH_STATISTICS
+    if (slot_count > old_slot_count) {
+        table->statistics.table_expansions++;
+    } else {
+        table->statistics.table_contractions++;
+    }
+#endif
+    if (slot_count > old_slot_count) {
+        stat_add(table, expansions, 1);
+    } else {
+        stat_add(table, contractions, 1);
+    }
+
+    if (old_slots) {
+        /* Stored hashes are reused, keys are never rehashed */
+        for (i = 0; i < old_slot_count; i++) {
+            if (old_slots[i].hash != 0) {
+                oa_place(table, &old_slots[i]);
+            }
+        }
+        hfree(table, old_slots);
+    }
+
+    return HASH_SUCCESS;
+}
+
+static int oa_enter(hash_table_t *table, hash_key_t *key, hash_code_t h,
+                    hash_value_t *value)
+{
+    int error;
+    unsigned long index;
+    oa_slot_t item;
+
+    if (oa_lookup(table, key, h, &index)) {
+        hdelete_callback(table, HASH_ENTRY_DESTROY, &table->slots[index].entry);
+        set_value(&table->slots[index].entry.value, value);
+        release_key(table, key, &table->slots[index].entry.key);
+        return HASH_SUCCESS;
+    }
+
+    /*
+     * Table over-full?
+     */
+    if ((table->entry_count + 1) * OA_MAX_LOAD_DEN >
+        (table->slot_mask + 1) * OA_MAX_LOAD_NUM) {
+        error = oa_resize(table, (table->slot_mask + 1) << 1);
+        if (error != HASH_SUCCESS) {
+            return error;
+        }
+    }
+
+    item.hash = h;
+    error = copy_key(table, &item.entry.key, key);
+    if (error != HASH_SUCCESS) {
+        return error;
+    }
+    set_value(&item.entry.value, value);
+
+    oa_place(table, &item);
+    table->entry_count++;
+
+    return HASH_SUCCESS;
+}
+
+static int oa_delete(hash_table_t *table, hash_key_t *key, hash_code_t h)
+{
+    unsigned long i, next;
+    oa_slot_t *slot;
+
+    if (!oa_lookup(table, key, h, &i)) {
+        return HASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    slot = &table->slots[i];
+    hdelete_callback(table, HASH_ENTRY_DESTROY, &slot->entry);
+    free_key(table, &slot->entry.key);
+
+    /*
+     * Shift the following entries of the probe sequence back by one slot
+     * instead of leaving a tombstone behind.
+     */
+    for (next = (i + 1) & table->slot_mask;
+         table->slots[next].hash != 0 &&
+         oa_distance(table, &table->slots[next], next) != 0;
+         i = next, next = (next + 1) & table->slot_mask) {
+        table->slots[i] = table->slots[next];
+    }
+    table->slots[i].hash = 0;
+    table->entry_count--;
+
+    /*
+     * Table too sparse? Failing to shrink is harmless, the table simply
+     * stays at its current size.
+     */
+    if (table->slot_mask + 1 > MAX(table->min_slots, table->reserved_buckets) &&
+        table->entry_count * OA_MIN_LOAD_DEN < table->slot_mask + 1) {
+        oa_resize(table, (table->slot_mask + 1) >> 1);
+    }
+
+    return HASH_SUCCESS;
+}
+
+/*
+ * Remove an entry of a table with eviction because it expired or to make
+ * room for a new one. Such tables are never concurrent, so no locks are
+ * needed.
+ */
+static int evict_entry(hash_table_t *table, element_t *element)
+{
+    segment_t found, *chain;
+
+    lookup(table, &element->entry.key, element->hash,
+           hash_address(table, element->hash), &found, &chain);
+    delete_callback_values(table, HASH_ENTRY_EVICT, element);
+    stat_add(table, evictions, 1);
+    *chain = element->next;
+    free_element(table, element);
+    if (add_entry_count(table, -1) / table->bucket_count < table->min_load_factor) {
+        return contract_table(table);
+    }
+    return HASH_SUCCESS;
+}
+
+static int expire_entries(hash_table_t *table)
+{
+    evict_t *head = &table->evict_head;
+    uint64_t now;
+    int error;
+
+    if (head->exp_next == head) {
+        return HASH_SUCCESS;
+    }
+    now = now_ms();
+    while (head->exp_next != head && head->exp_next->expires <= now) {
+        if ((error = evict_entry(table, evict_element(head->exp_next))) != HASH_SUCCESS) {
+            return error;
+        }
+    }
+    return HASH_SUCCESS;
+}
+
+/*
+ * Called before a new entry is entered, drop the expired entries and evict
+ * until there is room for one more. Returns true if any entry was removed.
+ */
+static bool make_room(hash_table_t *table, int *error)
+{
+    unsigned long count = table->entry_count;
+    element_t *victim;
+
+    *error = expire_entries(table);
+    while (*error == HASH_SUCCESS && table->max_entries != 0 &&
+           table->entry_count >= table->max_entries &&
+           (victim = evict_victim(table)) != NULL) {
+        *error = evict_entry(table, victim);
+    }
+    return table->entry_count != count;
+}
+
+/*
+ * Enter, look up and delete the entry for key with hash code h in a table
+ * of chained buckets. The public functions validate their arguments and
+ * dispatch to these or to the open addressing ones.
+ */
+static int chain_enter(hash_table_t *table, hash_key_t *key, hash_code_t h,
+                       hash_value_t *value, unsigned long ttl)
+{
+    int error;
+    address_t address;
+    segment_t element, *chain;
+
+    address = lock_bucket(table, h, true);
+    lookup(table, key, h, address, &element, &chain);
+
+    /*
+     * Make room before linking the new entry, so that it can't be evicted
+     * itself. Evicting may move the bucket, look it up again then.
+     */
+    if (element == NULL && has_eviction(table)) {
+        if (make_room(table, &error)) {
+            address = hash_address(table, h);
+            lookup(table, key, h, address, &element, &chain);
+        }
+        if (error != HASH_SUCCESS) {
+            return error;
+        }
+    }
+
+    if (element == NULL) {                    /* not found */
+        element = new_element(table, key);
+        if (element == NULL) {
+            /* Allocation failed, return NULL */
+            unlock_bucket(table, address);
+            return HASH_ERROR_NO_MEMORY;
+        }
+        /*
+         * Initialize new element
+         */
+        set_value(&element->entry.value, value);
+
+        element->hash = h;
+        *chain = element;             /* link into chain */
+        element->next = NULL;
+        if (has_eviction(table)) {
+            evict_link(table, element_evict(element), ttl);
+        }
+        unlock_bucket(table, address);
+
+        /*
+         * Table over-full?
+         */
+        if (add_entry_count(table, 1) / load_relaxed(&table->bucket_count) > table->max_load_factor) {
+            if ((error = resize_table(table, expand_table)) != HASH_SUCCESS) { /* doesn't affect element */
+                return error;
+            }
+        }
+
+    } else {
+        delete_callback_values(table, HASH_ENTRY_DESTROY, element);
+        free_values(table, element);
+        set_value(&element->entry.value, value);
+        release_key(table, key, &element->entry.key);
+        if (has_eviction(table)) {
+            evict_set_ttl(table, element_evict(element), ttl);
+            evict_touch(table, element_evict(element));
+        }
+        unlock_bucket(table, address);
+    }
+
+    return HASH_SUCCESS;
+}
+
+static int chain_lookup(hash_table_t *table, hash_key_t *key, hash_code_t h,
+                        hash_value_t *value)
+{
+    address_t address;
+    segment_t element, *chain;
+
+    address = lock_bucket(table, h, false);
+    lookup(table, key, h, address, &element, &chain);
+
+    if (element && has_eviction(table)) {
+        if (element_evict(element)->expires != 0 &&
+            element_evict(element)->expires <= now_ms()) {
+            unlock_bucket(table, address);
+            evict_entry(table, element);
+            return HASH_ERROR_KEY_NOT_FOUND;
+        }
+        evict_touch(table, element_evict(element));
+    }
+
+    if (element) {
+        *value = element->entry.value;
+        unlock_bucket(table, address);
+        return HASH_SUCCESS;
+    } else {
+        unlock_bucket(table, address);
+        return HASH_ERROR_KEY_NOT_FOUND;
+    }
+}
+
+static int chain_delete(hash_table_t *table, hash_key_t *key, hash_code_t h)
+{
+    int error;
+    address_t address;
+    segment_t element, *chain;
+
+    address = lock_bucket(table, h, true);
+    lookup(table, key, h, address, &element, &chain);
+
+    if (element) {
+        delete_callback_values(table, HASH_ENTRY_DESTROY, element);
+        *chain = element->next; /* remove from chain */
+        unlock_bucket(table, address);
+        free_element(table, element);
+        /*
+         * Table too sparse?
+         */
+        if (add_entry_count(table, -1) / load_relaxed(&table->bucket_count) < table->min_load_factor) {
+            if ((error = resize_table(table, contract_table)) != HASH_SUCCESS) {
+                return error;
+            }
+        }
+        return HASH_SUCCESS;
+    } else {
+        unlock_bucket(table, address);
+        return HASH_ERROR_KEY_NOT_FOUND;
+    }
+}
+
+/*
+ * Grow the table up front so that it can hold entries entries without
+ * having to expand again, as far as the directory allows.
+ */
+static int reserve_entries(hash_table_t *table, unsigned long entries,
+                           bool keep)
+{
+    unsigned long slot_count, capacity;
+    int error = HASH_SUCCESS;
+
+    if (is_open_addressing(table)) {
+        for (slot_count = table->slot_mask + 1;
+             slot_count * OA_MAX_LOAD_NUM < entries * OA_MAX_LOAD_DEN;
+             slot_count <<= 1);
+        if (slot_count > table->slot_mask + 1) {
+            error = oa_resize(table, slot_count);
+        }
+        if (keep && error == HASH_SUCCESS) {
+            table->reserved_buckets = entries ? table->slot_mask + 1 : 0;
+        }
+        return error;
+    }
+
+    capacity = table->directory_size << table->segment_size_shift;
+    if (is_concurrent(table)) {
+        pthread_mutex_lock(&table->resize_lock);
+    }
+    while (entries / table->bucket_count > table->max_load_factor &&
+           table->bucket_count < capacity) {
+        if ((error = expand_table(table)) != HASH_SUCCESS) {
+            break;
+        }
+    }
+    /* Make the table keep the buckets the entries need */
+    if (keep && error == HASH_SUCCESS) {
+        table->reserved_buckets = entries ? table->bucket_count : 0;
+    }
+    if (is_concurrent(table)) {
+        pthread_mutex_unlock(&table->resize_lock);
+    }
+
+    return error;
+}
+
+/*
+ * Compute the hash codes of the next keys of a batch, at most
+ * HASH_BATCH_SIZE of them, and prefetch the buckets or slots they belong
+ * to so that their cache misses overlap instead of being taken one after
+ * the other. Returns the number of keys hashed.
+ */
+static unsigned long hash_batch(hash_table_t *table, hash_key_t *keys,
+                                unsigned long count, hash_code_t *codes)
+{
+    unsigned long i, n;
+    address_t address;
+    segment_t *s, *buckets[HASH_BATCH_SIZE];
+
+    n = MIN(count, HASH_BATCH_SIZE);
+
+    if (is_frozen(table)) {
+        for (i = 0; i < n; i++) {
+            codes[i] = oa_hash(table, &keys[i]);
+            __builtin_prefetch(&table->frozen_disp[codes[i] % table->frozen_buckets]);
+        }
+        return n;
+    }
+
+    if (is_open_addressing(table)) {
+        for (i = 0; i < n; i++) {
+            codes[i] = oa_hash(table, &keys[i]);
+            __builtin_prefetch(&table->slots[codes[i] & table->slot_mask]);
+        }
+        return n;
+    }
+
+    if (is_image(table)) {
+        for (i = 0; i < n; i++) {
+            codes[i] = oa_hash(table, &keys[i]);
+            __builtin_prefetch(&table->image_slots[codes[i] & table->slot_mask]);
+        }
+        return n;
+    }
+
+    for (i = 0; i < n; i++) {
+        codes[i] = convert_key(table, &keys[i]);
+    }
+
+    /*
+     * Other threads may resize concurrent tables at any time, their
+     * buckets can't be located without locking them.
+     */
+    if (is_concurrent(table)) {
+        return n;
+    }
+
+    for (i = 0; i < n; i++) {
+        address = hash_address(table, codes[i]);
+        s = table->directory[address >> table->segment_size_shift];
+        buckets[i] = &s[address & (table->segment_size - 1)];
+        __builtin_prefetch(buckets[i]);
+    }
+    for (i = 0; i < n; i++) {
+        if (*buckets[i] != NULL) {
+            __builtin_prefetch(*buckets[i]);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Concurrent tables: hold off resizing for the whole walk and read lock
+ * one segment at a time, so other threads may keep modifying segments
+ * which are not being visited at the moment.
+ */
+static int iterate_concurrent(hash_table_t *table, hash_iterate_callback callback,
+                              void *user_data)
+{
+    unsigned long i, j;
+    segment_t *s;
+    element_t *p;
+    bool more = true;
+
+    pthread_mutex_lock(&table->resize_lock);
+    for (i = 0; more && i < table->segment_count; i++) {
+        pthread_rwlock_rdlock(&table->segment_locks[i]);
+        if ((s = table->directory[i]) != NULL) {
+            for (j = 0; more && j < table->segment_size; j++) {
+                for (p = s[j]; more && p != NULL; p = p->next) {
+                    more = (*callback)(&p->entry, user_data);
+                }
+            }
+        }
+        pthread_rwlock_unlock(&table->segment_locks[i]);
+    }
+    pthread_mutex_unlock(&table->resize_lock);
+
+    return HASH_SUCCESS;
+}
+
+/*
+ * The array filling callbacks stop once the array is full, entries might
+ * have been added to a concurrent table since it was sized.
+ */
+static bool hash_keys_callback(hash_entry_t *item, void *user_data)
+{
+    hash_keys_callback_data_t *data = (hash_keys_callback_data_t *)user_data;
+
+    if (data->index == data->count) return false;
+    data->keys[data->index++] = item->key;
+    return true;
+}
+
+static bool hash_values_callback(hash_entry_t *item, void *user_data)
+{
+    hash_values_callback_data_t *data = (hash_values_callback_data_t *)user_data;
+
+    if (data->index == data->count) return false;
+    data->values[data->index++] = item->value;
+    return true;
+}
+
+/*
+ * Fill in the entry stored in a slot of an image. Returns false for slots
+ * whose key lies outside of the image, which can only happen if the file
+ * was damaged.
+ */
+static bool image_entry(hash_table_t *table, const image_slot_t *slot,
+                        hash_entry_t *entry)
+{
+    const char *base = (const char *)table->image;
+
+    memset(entry, 0, sizeof(hash_entry_t));
+    entry->key.type = slot->key_type;
+    if (slot->key_type == HASH_KEY_ULONG) {
+        entry->key.ul = slot->key;
+    } else {
+        if ((slot->key_type != HASH_KEY_STRING &&
+             slot->key_type != HASH_KEY_CONST_STRING) ||
+            slot->key >= table->image->size ||
+            slot->key_len >= table->image->size - slot->key ||
+            base[slot->key + slot->key_len] != '\0') {
+            return false;
+        }
+        entry->key.c_str = base + slot->key;
+    }
+    entry->value.type = slot->value_type;
+    memcpy(&entry->value.ul, &slot->value, IMAGE_VALUE_SIZE);
+    return true;
+}
+
+/*
+ * Look up the key with hash code h in a frozen table. Its slot is the only
+ * one it can be in.
+ */
+static bool frozen_lookup(hash_table_t *table, hash_key_t *key, hash_code_t h,
+                          unsigned long *index)
+{
+    oa_slot_t *slot;
+
+    *index = frozen_slot(h, table->frozen_disp[h % table->frozen_buckets],
+                         table->slot_mask + 1);
+    slot = &table->slots[*index];
+    stats_probes(table, 0);
+    return slot->hash == h && key_equal(&slot->entry.key, key);
+}
+
+/*
+ * Find the displacement of a bucket of a frozen table, the first one under
+ * which the size entries of items listed in bucket all go to free slots,
+ * and place them there. Returns false if two entries of the bucket have
+ * the same hash code, no displacement can tell those apart.
+ */
+static bool frozen_place(oa_slot_t *slots, unsigned long slot_count,
+                         oa_slot_t *items, unsigned long *bucket,
+                         unsigned long size, uint32_t *displacement)
+{
+    unsigned long i, j, slot;
+    uint32_t d;
+
+    for (i = 1; i < size; i++) {
+        for (j = 0; j < i; j++) {
+            if (items[bucket[i]].hash == items[bucket[j]].hash) {
+                return false;
+            }
+        }
+    }
+
+    for (d = 0; ; d++) {
+        for (i = 0; i < size; i++) {
+            slot = frozen_slot(items[bucket[i]].hash, d, slot_count);
+            if (slots[slot].hash != 0) {
+                break;
+            }
+            slots[slot] = items[bucket[i]];
+        }
+        if (i == size) {
+            *displacement = d;
+            return true;
+        }
+        /* Take back the entries placed under this displacement */
+        while (i-- > 0) {
+            slots[frozen_slot(items[bucket[i]].hash, d, slot_count)].hash = 0;
+        }
+        if (d == UINT32_MAX) {
+            return false;
+        }
+    }
+}
+
+static bool image_lookup(hash_table_t *table, hash_key_t *key, hash_code_t h,
+                         hash_value_t *value)
+{
+    const image_slot_t *slot;
+    hash_entry_t entry;
+    unsigned long i;
+    unsigned long probes;
+
+    /* Bounded, a damaged image might have no empty slot */
+    i = h & table->slot_mask;
+    for (probes = 0; probes <= table->slot_mask; probes++) {
+        slot = &table->image_slots[i];
+        if (slot->hash == 0) {
+            return false;
+        }
+        if (slot->hash == h && image_entry(table, slot, &entry) &&
+            key_equal(&entry.key, key)) {
+            *value = entry.value;
+            return true;
+        }
+        i = (i + 1) & table->slot_mask;
+    }
+    return false;
+}
+
+static void image_unmap(hash_table_t *table)
+{
+    munmap((void *)(uintptr_t)table->image, table->image->size);
+    table->image = NULL;
+    table->image_slots = NULL;
+}
+
+/*
+ * Turn a table loaded from an image into a chained table holding copies
+ * of its entries, before it is modified for the first time.
+ */
+static int image_promote(hash_table_t *table)
+{
+    hash_table_t *copy;
+    hash_entry_t entry;
+    unsigned long i;
+    int error;
+
+    error = hash_create_flags(table->entry_count, &copy, 0, 0, 0, 0,
+                              table->halloc, table->hfree, table->halloc_pvt,
+                              table->delete_callback, table->delete_pvt, 0);
+    if (error != HASH_SUCCESS) {
+        return error;
+    }
+    /* Keep the hash codes of the image */
+    copy->seed = table->seed;
+
+    for (i = 0; i <= table->slot_mask; i++) {
+        if (table->image_slots[i].hash == 0 ||
+            !image_entry(table, &table->image_slots[i], &entry)) {
+            continue;
+        }
+        error = chain_enter(copy, &entry.key, convert_key(copy, &entry.key),
+                            &entry.value, 0);
+        if (error != HASH_SUCCESS) {
+            /* Don't let the copy call the delete callback */
+            copy->delete_callback = NULL;
+            hash_destroy(copy);
+            return error;
+        }
+    }
+
+    copy->stats_flags = table->stats_flags;
+    copy->stats_interval = table->stats_interval;
+    copy->stats = table->stats;
+    copy->resize_steps = table->resize_steps;
+    image_unmap(table);
+    *table = *copy;
+    hfree(table, copy);
+
+    return HASH_SUCCESS;
+}
+
+typedef struct image_builder_t {
+    image_header_t *header;
+    image_slot_t *slots;
+    char *keys;                    /* where the next string key goes */
+    unsigned long count;
+    size_t key_bytes;
+    hash_table_t *table;
+    int error;
+} image_builder_t;
+
+/* First pass of hash_dump(), check the entries and size the image */
+static bool image_size_callback(hash_entry_t *item, void *user_data)
+{
+    image_builder_t *builder = (image_builder_t *)user_data;
+
+    if (item->key.type == HASH_KEY_BINARY) {
+        builder->error = HASH_ERROR_BAD_KEY_TYPE;
+        return false;
+    }
+    if (item->value.type == HASH_VALUE_PTR ||
+        item->value.type == HASH_VALUE_UNDEF) {
+        builder->error = HASH_ERROR_BAD_VALUE_TYPE;
+        return false;
+    }
+    if (item->key.type != HASH_KEY_ULONG) {
+        builder->key_bytes += strlen(item->key.c_str) + 1;
+    }
+    builder->count++;
+    return true;
+}
+
+/* Second pass of hash_dump(), place the entries into the image */
+static bool image_fill_callback(hash_entry_t *item, void *user_data)
+{
+    image_builder_t *builder = (image_builder_t *)user_data;
+    image_header_t *header = builder->header;
+    image_slot_t *slot;
+    hash_code_t h;
+    unsigned long i;
+    size_t len;
+
+    /* The table changed since the first pass */
+    if (builder->count == 0) {
+        builder->error = EBUSY;
+        return false;
+    }
+    builder->count--;
+
+    h = oa_hash(builder->table, &item->key);
+    for (i = h & header->slot_mask; builder->slots[i].hash != 0;
+         i = (i + 1) & header->slot_mask);
+    slot = &builder->slots[i];
+    slot->hash = h;
+    slot->key_type = item->key.type;
+    if (item->key.type == HASH_KEY_ULONG) {
+        slot->key = item->key.ul;
+    } else {
+        len = strlen(item->key.c_str);
+        if (len + 1 > builder->key_bytes) {
+            builder->error = EBUSY;
+            return false;
+        }
+        memcpy(builder->keys, item->key.c_str, len + 1);
+        slot->key = builder->keys - (char *)header;
+        slot->key_len = len;
+        builder->keys += len + 1;
+        builder->key_bytes -= len + 1;
+    }
+    slot->value_type = item->value.type;
+    memcpy(&slot->value, &item->value.ul, IMAGE_VALUE_SIZE);
+    return true;
+}
+
+/*****************************************************************************/
+/****************************  Exported Functions  ***************************/
+/*****************************************************************************/
+
+const char* hash_error_string(int error)
+{
+    switch(error) {
+    case HASH_SUCCESS:              return "Success";
+    case HASH_ERROR_BAD_KEY_TYPE:   return "Bad key type";
+    case HASH_ERROR_BAD_VALUE_TYPE: return "Bad value type";
+    case HASH_ERROR_NO_MEMORY:      return "No memory";
+    case HASH_ERROR_KEY_NOT_FOUND:  return "Key not found";
+    case HASH_ERROR_BAD_TABLE:      return "Bad table";
+    }
+    return NULL;
+}
+
+
+int hash_create(unsigned long count, hash_table_t **tbl,
+                hash_delete_callback *delete_callback,
+                void *delete_private_data)
+{
+    return hash_create_ex(count, tbl, 0, 0, 0, 0,
+                          NULL, NULL, NULL,
+                          delete_callback,
+                          delete_private_data);
+}
+
+int hash_create_ex(unsigned long count, hash_table_t **tbl,
+                   unsigned int directory_bits,
+                   unsigned int segment_bits,
+                   unsigned long min_load_factor,
+                   unsigned long max_load_factor,
+                   hash_alloc_func *alloc_func,
+                   hash_free_func *free_func,
+                   void *alloc_private_data,
+                   hash_delete_callback *delete_callback,
+                   void *delete_private_data)
+{
+    return hash_create_flags(count, tbl, directory_bits, segment_bits,
+                             min_load_factor, max_load_factor,
+                             alloc_func, free_func, alloc_private_data,
+                             delete_callback, delete_private_data, 0);
+}
+
+int hash_create_flags(unsigned long count, hash_table_t **tbl,
+                      unsigned int directory_bits,
+                      unsigned int segment_bits,
+                      unsigned long min_load_factor,
+                      unsigned long max_load_factor,
+                      hash_alloc_func *alloc_func,
+                      hash_free_func *free_func,
+                      void *alloc_private_data,
+                      hash_delete_callback *delete_callback,
+                      void *delete_private_data,
+                      unsigned int flags) {
+    unsigned long i;
+    unsigned long slot_count;
+    unsigned int n_addr_bits, requested_bits;
+    unsigned int requested_directory_bits;
+    unsigned int requested_segment_bits;
+    address_t addr;
+    hash_table_t *table = NULL;
+
+    /* Initialize to NULL in case of an early return due to an error */
+    *tbl = NULL;
+
+    if (flags & ~HASH_CREATE_VALID_FLAGS) return EINVAL;
+    /* At most one key ownership mode */
+    if ((flags & HASH_CREATE_KEY_OWNERSHIP) &
+        ((flags & HASH_CREATE_KEY_OWNERSHIP) - 1)) return EINVAL;
+    if ((flags & HASH_CREATE_OPEN_ADDRESSING) &&
+        (flags & (HASH_CREATE_CONCURRENT | HASH_CREATE_SLAB_ALLOC))) return EINVAL;
+    if ((flags & HASH_CREATE_EVICTION) &&
+        (flags & (HASH_CREATE_OPEN_ADDRESSING | HASH_CREATE_CONCURRENT))) return EINVAL;
+    if ((flags & HASH_CREATE_MULTIMAP) &&
+        (flags & (HASH_CREATE_OPEN_ADDRESSING | HASH_CREATE_CONCURRENT))) return EINVAL;
+
+    if (alloc_func == NULL) alloc_func = sys_malloc_wrapper;
+    if (free_func == NULL) free_func = sys_free_wrapper;
+
+    if (flags & HASH_CREATE_OPEN_ADDRESSING) {
+        table = (hash_table_t *)alloc_func(sizeof(hash_table_t),
+                                           alloc_private_data);
+        if (table == NULL) {
+            return HASH_ERROR_NO_MEMORY;
+        }
+        memset(table, 0, sizeof(hash_table_t));
+        table->halloc = alloc_func;
+        table->hfree = free_func;
+        table->halloc_pvt = alloc_private_data;
+        table->flags = flags;
+        if (flags & HASH_CREATE_RANDOM_SEED) {
+            table->seed = random_seed(table);
+        }
+        table->delete_callback = delete_callback;
+        table->delete_pvt = delete_private_data;
+        table->resize_steps = 1;
+
+        /* Enough slots to hold count entries without growing */
+        for (slot_count = OA_MIN_SLOTS;
+             slot_count * OA_MAX_LOAD_NUM < count * OA_MAX_LOAD_DEN;
+             slot_count <<= 1);
+        table->min_slots = slot_count;
+
+        if (oa_resize(table, slot_count) != HASH_SUCCESS) {
+            hash_destroy(table);
+            return HASH_ERROR_NO_MEMORY;
+        }
+#ifdef HASH_STATISTICS
+        memset(&table->statistics, 0, sizeof(table->statistics));
+#endif
+
+        *tbl = table;
+        return HASH_SUCCESS;
+    }
+
+    /* Compute directory and segment parameters */
+
+    /* compute power of 2 >= count; it's the number of requested buckets */
+    if (count > 1) {
+        for (requested_bits = 0; (1 << requested_bits) < count; requested_bits++);
+    } else {
+        requested_bits = 1;
+    }
+
+    /*
+     * If caller didn't specify directory & segment allocation then
+     * compute it from the requested count.
+     */
+    if (directory_bits == 0 || segment_bits == 0) {
+        /* Equally divide buckets between the directory and segments */
+        requested_directory_bits = MAX(requested_bits >> 1, 1);
+        requested_segment_bits = MAX(requested_bits - requested_directory_bits, 1);
+
+        /* If the requested count wasn't specified pick a default */
+        if (count == 0) {
+            directory_bits = MAX(requested_directory_bits, HASH_DEFAULT_DIRECTORY_BITS);
+            segment_bits = MAX(requested_segment_bits, HASH_DEFAULT_SEGMENT_BITS);
+        } else {
+            directory_bits = requested_directory_bits;
+            segment_bits = requested_segment_bits;
+        }
+    }
+
+    for (addr = ~0, n_addr_bits = 0; addr; addr >>= 1, n_addr_bits++);
+
+    if (directory_bits + segment_bits > n_addr_bits) return EINVAL;
+
+    table = (hash_table_t *)alloc_func(sizeof(hash_table_t),
+                                       alloc_private_data);
+    if (table == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(table, 0, sizeof(hash_table_t));
+    table->halloc = alloc_func;
+    table->hfree = free_func;
+    table->halloc_pvt = alloc_private_data;
+    table->flags = flags;
+    if (flags & HASH_CREATE_RANDOM_SEED) {
+        table->seed = random_seed(table);
+    }
+
+    if (flags & HASH_CREATE_EVICTION) {
+        table->evict_size = sizeof(evict_t);
+        table->evict_head.prev = table->evict_head.next = &table->evict_head;
+        table->evict_head.exp_prev = table->evict_head.exp_next = &table->evict_head;
+    }
+    table->prefix_size = table->evict_size +
+                         (flags & HASH_CREATE_MULTIMAP ? sizeof(multi_t) : 0);
+    if (flags & HASH_CREATE_SLAB_ALLOC) {
+        table->slab_slots = MIN(MAX(count, SLAB_MIN_SLOTS), SLAB_MAX_SLOTS);
+    }
+    if (needs_alloc_lock(table)) {
+        pthread_mutex_init(&table->alloc_lock, NULL);
+    }
+
+    table->directory_size_shift = directory_bits;
+    table->directory_size = directory_bits ? 1 << directory_bits : 0;
+
+    table->segment_size_shift = segment_bits;
+    table->segment_size = segment_bits ? 1 << segment_bits : 0;
+
+    /* Allocate directory */
+    table->directory = (segment_t **)halloc(table, table->directory_size * sizeof(segment_t *));
+    if (table->directory == NULL) {
+        hash_destroy(table);
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(table->directory, 0, table->directory_size * sizeof(segment_t *));
+
+    if (flags & HASH_CREATE_CONCURRENT) {
+        pthread_rwlockattr_t attr;
+
+        table->segment_locks = (pthread_rwlock_t *)halloc(table, table->directory_size * sizeof(pthread_rwlock_t));
+        if (table->segment_locks == NULL) {
+            hash_destroy(table);
+            return HASH_ERROR_NO_MEMORY;
+        }
+        /* A steady stream of readers must not starve writers */
+        pthread_rwlockattr_init(&attr);
+#if HAVE_DECL_PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        for (i = 0; i < table->directory_size; i++) {
+            pthread_rwlock_init(&table->segment_locks[i], &attr);
+        }
+        pthread_rwlockattr_destroy(&attr);
+        pthread_mutex_init(&table->resize_lock, NULL);
+    }
+
+    /*
+     * If one wanted to pre-allocate all the buckets necessary to meet the needs
+     * of the requested count it would be done like this:
+     *
+     * table->segment_count = MIN((count + table->segment_size-1) / table->segment_size,
+     *                            table->directory_size);
+     *
+     * But with dynamic hash tables there is little point to this, the whole idea is to
+     * allow the table to grow/shrink dynamically, therefore we start with just one
+     * segment of buckets, the minimum necessary.
+     */
+    table->segment_count = 1;
+    table->p = 0;
+    table->entry_count = 0;
+    table->delete_callback = delete_callback;
+    table->delete_pvt = delete_private_data;
+    table->resize_steps = 1;
+
+    /*
+     * Allocate initial segments of buckets
+     */
+    for (i = 0; i < table->segment_count; i++) {
+        table->directory[i] = (segment_t *)halloc(table, table->segment_size * sizeof(segment_t));
+        if (table->directory[i] == NULL) {
+            hash_destroy(table);
+            return HASH_ERROR_NO_MEMORY;
+        }
+        memset(table->directory[i], 0, table->segment_size * sizeof(segment_t));
+    }
+    table->bucket_count = table->segment_count << table->segment_size_shift;
+    table->maxp = table->bucket_count;
+    table->min_load_factor = min_load_factor == 0 ? HASH_DEFAULT_MIN_LOAD_FACTOR : min_load_factor;
+    table->max_load_factor = max_load_factor == 0 ? HASH_DEFAULT_MAX_LOAD_FACTOR : max_load_factor;
+
+#ifdef DEBUG
+    if (debug_level >= 1) {
+        fprintf(stderr, "hash_create_ex: count=%lu available buckets=%lu bucket_count=%lu maxp=%lu\n",
+                count, table->directory_size*table->segment_size, table->bucket_count, table->maxp);
+        fprintf(stderr, "                directory_bits=%u segment_bits=%u requested_bits=%u\n",
+                directory_bits, segment_bits, requested_bits);
+        fprintf(stderr, "                directory_size=%lu segment_size=%lu segment_count=%lu\n",
+                table->directory_size, table->segment_size, table->segment_count);
+        fprintf(stderr, "                min_load_factor=%lu max_load_factor=%lu\n",
+                table->min_load_factor, table->max_load_factor);
+    }
+#endif
+#ifdef HASH_STATISTICS
+    memset(&table->statistics, 0, sizeof(table->statistics));
+#endif
+
+    *tbl = table;
+    return HASH_SUCCESS;
+}
+
+#ifdef HASH_STATISTICS
+int hash_get_statistics(hash_table_t *table, hash_statistics_t *statistics)
+{
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (!statistics) return EINVAL;
+
+    *statistics = table->statistics;
+
+    return HASH_SUCCESS;
+}
+#endif
+
+int hash_destroy(hash_table_t *table)
+{
+    unsigned long i, j;
+    segment_t *s;
+    element_t *p, *q;
+    slab_t *slab;
+    bool walk_chains;
+    hash_entry_t entry;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    if (is_image(table)) {
+        for (i = 0; i <= table->slot_mask; i++) {
+            if (table->image_slots[i].hash != 0 &&
+                image_entry(table, &table->image_slots[i], &entry)) {
+                hdelete_callback(table, HASH_TABLE_DESTROY, &entry);
+            }
+        }
+        image_unmap(table);
+    }
+
+    if (table->slots) {
+        for (i = 0; i <= table->slot_mask; i++) {
+            if (table->slots[i].hash != 0) {
+                hdelete_callback(table, HASH_TABLE_DESTROY,
+                                 &table->slots[i].entry);
+                free_key(table, &table->slots[i].entry.key);
+            }
+        }
+        hfree(table, table->slots);
+    }
+    if (table->frozen_disp) {
+        hfree(table, table->frozen_disp);
+    }
+
+    /*
+     * Slab allocated elements go away together with their slabs, their
+     * chains only need to be walked for the delete callback or for keys
+     * which did not fit into the slab.
+     */
+    walk_chains = !is_slab_alloc(table) || table->delete_callback != NULL ||
+                  table->external_keys != 0 || is_multimap(table);
+
+    if (table->directory) {
+        for (i = 0; i < table->segment_count; i++) {
+            /* test probably unnecessary */
+            if ((s = table->directory[i]) != NULL) {
+                for (j = 0; walk_chains && j < table->segment_size; j++) {
+                    p = s[j];
+                    while (p != NULL) {
+                        q = p->next;
+                        delete_callback_values(table, HASH_TABLE_DESTROY, p);
+                        free_values(table, p);
+                        if (!is_slab_alloc(table)) {
+                            free_key(table, &p->entry.key);
+                            hfree(table, element_memory(table, p));
+                        } else if (has_external_key(table, p)) {
+                            free_key(table, &p->entry.key);
+                        }
+                        p = q;
+                    }
+                }
+                hfree(table, s);
+            }
+        }
+        hfree(table, table->directory);
+        if (table->spare_segment) {
+            hfree(table, table->spare_segment);
+        }
+    }
+    while ((slab = table->slabs) != NULL) {
+        table->slabs = slab->next;
+        hfree(table, slab);
+    }
+    while ((slab = table->key_chunks) != NULL) {
+        table->key_chunks = slab->next;
+        hfree(table, slab);
+    }
+    if (needs_alloc_lock(table)) {
+        pthread_mutex_destroy(&table->alloc_lock);
+    }
+    if (table->segment_locks) {
+        for (i = 0; i < table->directory_size; i++) {
+            pthread_rwlock_destroy(&table->segment_locks[i]);
+        }
+        hfree(table, table->segment_locks);
+        pthread_mutex_destroy(&table->resize_lock);
+    }
+    hfree(table, table);
+    table = NULL;
+
+    return HASH_SUCCESS;
+}
+
+int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user_data)
+{
+    unsigned long i, j;
+    segment_t *s;
+    element_t *p;
+    hash_entry_t entry;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    if (is_open_addressing(table)) {
+        for (i = 0; i <= table->slot_mask; i++) {
+            if (table->slots[i].hash != 0) {
+                if(!(*callback)(&table->slots[i].entry, user_data)) return HASH_SUCCESS;
+            }
+        }
+        return HASH_SUCCESS;
+    }
+
+    if (is_image(table)) {
+        for (i = 0; i <= table->slot_mask; i++) {
+            if (table->image_slots[i].hash != 0 &&
+                image_entry(table, &table->image_slots[i], &entry)) {
+                if(!(*callback)(&entry, user_data)) return HASH_SUCCESS;
+            }
+        }
+        return HASH_SUCCESS;
+    }
+
+    if (is_concurrent(table)) {
+        return iterate_concurrent(table, callback, user_data);
+    }
+
+    if (table != NULL) {
+        for (i = 0; i < table->segment_count; i++) {
+            /* test probably unnecessary */
+            if ((s = table->directory[i]) != NULL) {
+                for (j = 0; j < table->segment_size; j++) {
+                    p = s[j];
+                    while (p != NULL) {
+                        if(!(*callback)(&p->entry, user_data)) return HASH_SUCCESS;
+                        p = p->next;
+                    }
+                }
+            }
+        }
+    }
+    return HASH_SUCCESS;
+}
+
+static hash_entry_t *iter_context_next(struct hash_iter_context_t *iter_arg)
+{
+    struct _hash_iter_context_t *iter = (struct _hash_iter_context_t *) iter_arg;
+
+    return hash_iter_next_entry(&iter->it);
+}
+
+struct hash_iter_context_t *new_hash_iter_context(hash_table_t *table)
+{
+    struct _hash_iter_context_t *iter;
+
+    if (!table) return NULL;;
+
+    iter = halloc(table, sizeof(struct _hash_iter_context_t));
+    if (iter == NULL) {
+        return NULL;
+    }
+
+    iter->iter.next = (hash_iter_next_t) iter_context_next;
+    hash_iter_init(table, &iter->it);
+
+    return (struct hash_iter_context_t *)iter;
+}
+
+void hash_iter_init(hash_table_t *table, hash_iter_t *iter)
+{
+    memset(iter, 0, sizeof(hash_iter_t));
+    iter->table = table;
+}
+
+hash_entry_t *hash_iter_next_entry(hash_iter_t *iter)
+{
+    hash_table_t *table = iter->table;
+    element_t *element = iter->element;
+    const image_slot_t *slot;
+    oa_slot_t *oa;
+
+    if (table == NULL) return NULL;
+
+    if (is_open_addressing(table)) {
+        while (iter->bucket <= table->slot_mask) {
+            oa = &table->slots[iter->bucket++];
+            if (oa->hash != 0) {
+                return &oa->entry;
+            }
+        }
+        return NULL;
+    }
+
+    if (is_image(table)) {
+        while (iter->bucket <= table->slot_mask) {
+            slot = &table->image_slots[iter->bucket++];
+            if (slot->hash != 0 && image_entry(table, slot, &iter->entry)) {
+                return &iter->entry;
+            }
+        }
+        return NULL;
+    }
+
+    while (element == NULL) {
+        if (iter->bucket >= table->bucket_count) {
+            return NULL;
+        }
+        element = *bucket_chain(table, iter->bucket);
+        iter->bucket++;
+    }
+    iter->element = element->next;
+
+    return &element->entry;
+}
+
+unsigned long hash_iter_fetch(hash_iter_t *iter, hash_entry_t *entries,
+                              unsigned long max)
+{
+    hash_table_t *table = iter->table;
+    unsigned long n = 0, skip, segment;
+    element_t *element;
+    hash_entry_t *entry;
+
+    if (table == NULL) return 0;
+
+    if (!is_concurrent(table)) {
+        while (n < max && (entry = hash_iter_next_entry(iter)) != NULL) {
+            entries[n++] = *entry;
+        }
+        return n;
+    }
+
+    /*
+     * Elements of concurrent tables may be freed as soon as their segment
+     * is unlocked, so the position is kept as a bucket and the number of
+     * entries of it which were returned already.
+     */
+    while (n < max) {
+        segment = iter->bucket >> table->segment_size_shift;
+        if (segment >= table->directory_size) {
+            break;
+        }
+        pthread_rwlock_rdlock(&table->segment_locks[segment]);
+        if (iter->bucket >= load_relaxed(&table->bucket_count) ||
+            table->directory[segment] == NULL) {
+            pthread_rwlock_unlock(&table->segment_locks[segment]);
+            break;
+        }
+        element = *bucket_chain(table, iter->bucket);
+        for (skip = iter->skip; element != NULL && skip > 0; skip--) {
+            element = element->next;
+        }
+        for (; element != NULL && n < max; element = element->next) {
+            entries[n++] = element->entry;
+            iter->skip++;
+        }
+        pthread_rwlock_unlock(&table->segment_locks[segment]);
+        if (element == NULL) {
+            iter->bucket++;
+            iter->skip = 0;
+        }
+    }
+
+    return n;
+}
+
+unsigned long hash_segment_count(hash_table_t *table)
+{
+    if (!table) return 0;
+
+    if (is_open_addressing(table) || is_image(table)) {
+        return (table->slot_mask + ITER_SEGMENT_SLOTS) / ITER_SEGMENT_SLOTS;
+    }
+
+    return load_relaxed(&table->segment_count);
+}
+
+int hash_iterate_segment(hash_table_t *table, unsigned long segment,
+                         hash_iterate_callback callback, void *user_data)
+{
+    unsigned long i, end;
+    hash_entry_t entry;
+    element_t *p;
+    segment_t *s;
+    bool more = true;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    if (is_open_addressing(table) || is_image(table)) {
+        end = MIN((segment + 1) * ITER_SEGMENT_SLOTS, table->slot_mask + 1);
+        for (i = segment * ITER_SEGMENT_SLOTS; more && i < end; i++) {
+            if (is_image(table)) {
+                if (table->image_slots[i].hash != 0 &&
+                    image_entry(table, &table->image_slots[i], &entry)) {
+                    more = (*callback)(&entry, user_data);
+                }
+            } else if (table->slots[i].hash != 0) {
+                more = (*callback)(&table->slots[i].entry, user_data);
+            }
+        }
+        return HASH_SUCCESS;
+    }
+
+    if (segment >= table->directory_size) {
+        return HASH_SUCCESS;
+    }
+    if (is_concurrent(table)) {
+        pthread_rwlock_rdlock(&table->segment_locks[segment]);
+    }
+    if (segment < load_relaxed(&table->segment_count) &&
+        (s = table->directory[segment]) != NULL) {
+        for (i = 0; more && i < table->segment_size; i++) {
+            for (p = s[i]; more && p != NULL; p = p->next) {
+                more = (*callback)(&p->entry, user_data);
+            }
+        }
+    }
+    if (is_concurrent(table)) {
+        pthread_rwlock_unlock(&table->segment_locks[segment]);
+    }
+
+    return HASH_SUCCESS;
+}
+
+unsigned long hash_count(hash_table_t *table)
+{
+    return table->entry_count;
+}
+
+
+int hash_keys(hash_table_t *table, unsigned long *count_arg, hash_key_t **keys_arg)
+{
+    unsigned long count;
+    hash_key_t *keys;
+    hash_keys_callback_data_t data;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    count = table->entry_count;
+    if (count == 0) {
+        *count_arg = 0;
+        *keys_arg = NULL;
+        return HASH_SUCCESS;
+    }
+
+    keys = halloc(table, sizeof(hash_key_t) * count);
+    if (keys == NULL) {
+        *count_arg = -1;
+        *keys_arg = NULL;
+        return HASH_ERROR_NO_MEMORY;
+    }
+
+    data.index = 0;
+    data.count = count;
+    data.keys = keys;
+
+    hash_iterate(table, hash_keys_callback, &data);
+
+    *count_arg = data.index;
+    *keys_arg = keys;
+    return HASH_SUCCESS;
+}
+
+int hash_values(hash_table_t *table, unsigned long *count_arg, hash_value_t **values_arg)
+{
+    unsigned long count;
+    hash_value_t *values;
+    hash_values_callback_data_t data;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    count = table->entry_count;
+    if (count == 0) {
+        *count_arg = 0;
+        *values_arg = NULL;
+        return HASH_SUCCESS;
+    }
+
+    values = halloc(table, sizeof(hash_value_t) * count);
+    if (values == NULL) {
+        *count_arg = -1;
+        *values_arg = NULL;
+        return HASH_ERROR_NO_MEMORY;
+    }
+
+    data.index = 0;
+    data.count = count;
+    data.values = values;
+
+    hash_iterate(table, hash_values_callback, &data);
+
+    *count_arg = data.index;
+    *values_arg = values;
+    return HASH_SUCCESS;
+}
+
+typedef struct hash_entries_callback_data_t {
+    unsigned long index;
+    unsigned long count;
+    hash_entry_t *entries;
+} hash_entries_callback_data_t;
+
+static bool hash_entries_callback(hash_entry_t *item, void *user_data)
+{
+    hash_entries_callback_data_t *data = (hash_entries_callback_data_t *)user_data;
+
+    if (data->index == data->count) return false;
+    data->entries[data->index++] = *item;
+    return true;
+}
+
+int hash_entries(hash_table_t *table, unsigned long *count_arg, hash_entry_t **entries_arg)
+{
+    unsigned long count;
+    hash_entry_t *entries;
+    hash_entries_callback_data_t data;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    count = table->entry_count;
+    if (count == 0) {
+        *count_arg = 0;
+        *entries_arg = NULL;
+        return HASH_SUCCESS;
+    }
+
+    entries = halloc(table, sizeof(hash_entry_t) * count);
+    if (entries == NULL) {
+        *count_arg = -1;
+        *entries_arg = NULL;
+        return HASH_ERROR_NO_MEMORY;
+    }
+
+    data.index = 0;
+    data.count = count;
+    data.entries = entries;
+
+    hash_iterate(table, hash_entries_callback, &data);
+
+    *count_arg = data.index;
+    *entries_arg = entries;
+    return HASH_SUCCESS;
+}
+
+bool hash_has_key(hash_table_t *table, hash_key_t *key)
+{
+    hash_value_t value;
+
+    if (hash_lookup(table, key, &value) == HASH_SUCCESS)
+        return true;
+    else
+        return false;
+}
+
+
+int hash_get_default(hash_table_t *table, hash_key_t *key, hash_value_t *value, hash_value_t *default_value)
+{
+    int error;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    error = hash_lookup(table, key, value);
+    if (error == HASH_ERROR_KEY_NOT_FOUND) {
+
+        error = hash_enter(table, key, default_value);
+        if (error != HASH_SUCCESS) {
+            return error;
+        }
+        *value = *default_value;
+        return HASH_SUCCESS;
+    } else {
+        if (error != HASH_SUCCESS) return error;
+        /* The key was found, an adopted key is not needed any more */
+        if (is_adopted_key(table, key)) {
+            hfree(table, key->str);
+        }
+    }
+
+    return HASH_SUCCESS;
+}
+
+int hash_enter(hash_table_t *table, hash_key_t *key, hash_value_t *value)
+{
+    int error;
+    struct timespec start;
+    bool sampled;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
+
+    if (!is_valid_value_type(value->type))
+        return HASH_ERROR_BAD_VALUE_TYPE;
 
-    if (alloc_func == NULL) alloc_func = sys_malloc_wrapper;
-    if (free_func == NULL) free_func = sys_free_wrapper;
+    if (is_frozen(table)) return EPERM;
 
-    /* Compute directory and segment parameters */
+    if (is_image(table) && (error = image_promote(table)) != HASH_SUCCESS) {
+        return error;
+    }
 
-    /* compute power of 2 >= count; it's the number of requested buckets */
-    if (count > 1) {
-        for (requested_bits = 0; (1 << requested_bits) < count; requested_bits++);
+    sampled = stats_begin(table, &start);
+    if (is_open_addressing(table)) {
+        error = oa_enter(table, key, oa_hash(table, key), value);
     } else {
-        requested_bits = 1;
+        error = chain_enter(table, key, convert_key(table, key), value,
+                            table->default_ttl);
+    }
+    if (sampled) {
+        stats_end(table, table->stats.enter_latency, &start);
     }
 
-    /*
-     * If caller didn't specify directory & segment allocation then
-     * compute it from the requested count.
-     */
-    if (directory_bits == 0 || segment_bits == 0) {
-        /* Equally divide buckets between the directory and segments */
-        requested_directory_bits = MAX(requested_bits >> 1, 1);
-        requested_segment_bits = MAX(requested_bits - requested_directory_bits, 1);
+    return error;
+}
 
-        /* If the requested count wasn't specified pick a default */
-        if (count == 0) {
-            directory_bits = MAX(requested_directory_bits, HASH_DEFAULT_DIRECTORY_BITS);
-            segment_bits = MAX(requested_segment_bits, HASH_DEFAULT_SEGMENT_BITS);
+int hash_lookup(hash_table_t *table, hash_key_t *key, hash_value_t *value)
+{
+    int error;
+    unsigned long index;
+    struct timespec start;
+    bool sampled;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
+
+    sampled = stats_begin(table, &start);
+    if (is_frozen(table)) {
+        if (frozen_lookup(table, key, oa_hash(table, key), &index)) {
+            *value = table->slots[index].entry.value;
+            error = HASH_SUCCESS;
         } else {
-            directory_bits = requested_directory_bits;
-            segment_bits = requested_segment_bits;
+            error = HASH_ERROR_KEY_NOT_FOUND;
+        }
+    } else if (is_open_addressing(table)) {
+        if (oa_lookup(table, key, oa_hash(table, key), &index)) {
+            *value = table->slots[index].entry.value;
+            error = HASH_SUCCESS;
+        } else {
+            error = HASH_ERROR_KEY_NOT_FOUND;
         }
+    } else if (is_image(table)) {
+        error = image_lookup(table, key, oa_hash(table, key), value) ? HASH_SUCCESS
+                                                : HASH_ERROR_KEY_NOT_FOUND;
+    } else {
+        error = chain_lookup(table, key, convert_key(table, key), value);
+    }
+    if (sampled) {
+        stats_end(table, table->stats.lookup_latency, &start);
     }
+    stats_lookup(table, error);
 
-    for (addr = ~0, n_addr_bits = 0; addr; addr >>= 1, n_addr_bits++);
+    return error;
+}
 
-    if (directory_bits + segment_bits > n_addr_bits) return EINVAL;
+int hash_delete(hash_table_t *table, hash_key_t *key)
+{
+    int error;
+    struct timespec start;
+    bool sampled;
 
-    table = (hash_table_t *)alloc_func(sizeof(hash_table_t),
-                                       alloc_private_data);
-    if (table == NULL) {
-        return HASH_ERROR_NO_MEMORY;
-    }
-    memset(table, 0, sizeof(hash_table_t));
-    table->halloc = alloc_func;
-    table->hfree = free_func;
-    table->halloc_pvt = alloc_private_data;
+    if (!table) return HASH_ERROR_BAD_TABLE;
 
-    table->directory_size_shift = directory_bits;
-    table->directory_size = directory_bits ? 1 << directory_bits : 0;
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
 
-    table->segment_size_shift = segment_bits;
-    table->segment_size = segment_bits ? 1 << segment_bits : 0;
+    if (is_frozen(table)) return EPERM;
 
-    /* Allocate directory */
-    table->directory = (segment_t **)halloc(table, table->directory_size * sizeof(segment_t *));
-    if (table->directory == NULL) {
-        hash_destroy(table);
-        return HASH_ERROR_NO_MEMORY;
+    if (is_image(table) && (error = image_promote(table)) != HASH_SUCCESS) {
+        return error;
     }
-    memset(table->directory, 0, table->directory_size * sizeof(segment_t *));
-
-    /*
-     * If one wanted to pre-allocate all the buckets necessary to meet the needs
-     * of the requested count it would be done like this:
-     *
-     * table->segment_count = MIN((count + table->segment_size-1) / table->segment_size,
-     *                            table->directory_size);
-     *
-     * But with dynamic hash tables there is little point to this, the whole idea is to
-     * allow the table to grow/shrink dynamically, therefore we start with just one
-     * segment of buckets, the minimum necessary.
-     */
-    table->segment_count = 1;
-    table->p = 0;
-    table->entry_count = 0;
-    table->delete_callback = delete_callback;
-    table->delete_pvt = delete_private_data;
 
-    /*
-     * Allocate initial segments of buckets
-     */
-    for (i = 0; i < table->segment_count; i++) {
-        table->directory[i] = (segment_t *)halloc(table, table->segment_size * sizeof(segment_t));
-        if (table->directory[i] == NULL) {
-            hash_destroy(table);
-            return HASH_ERROR_NO_MEMORY;
-        }
-        memset(table->directory[i], 0, table->segment_size * sizeof(segment_t));
+    sampled = stats_begin(table, &start);
+    if (is_open_addressing(table)) {
+        error = oa_delete(table, key, oa_hash(table, key));
+    } else {
+        error = chain_delete(table, key, convert_key(table, key));
     }
-    table->bucket_count = table->segment_count << table->segment_size_shift;
-    table->maxp = table->bucket_count;
-    table->min_load_factor = min_load_factor == 0 ? HASH_DEFAULT_MIN_LOAD_FACTOR : min_load_factor;
-    table->max_load_factor = max_load_factor == 0 ? HASH_DEFAULT_MAX_LOAD_FACTOR : max_load_factor;
-
-#ifdef DEBUG
-    if (debug_level >= 1) {
-        fprintf(stderr, "hash_create_ex: count=%lu available buckets=%lu bucket_count=%lu maxp=%lu\n",
-                count, table->directory_size*table->segment_size, table->bucket_count, table->maxp);
-        fprintf(stderr, "                directory_bits=%u segment_bits=%u requested_bits=%u\n",
-                directory_bits, segment_bits, requested_bits);
-        fprintf(stderr, "                directory_size=%lu segment_size=%lu segment_count=%lu\n",
-                table->directory_size, table->segment_size, table->segment_count);
-        fprintf(stderr, "                min_load_factor=%lu max_load_factor=%lu\n",
-                table->min_load_factor, table->max_load_factor);
+    if (sampled) {
+        stats_end(table, table->stats.delete_latency, &start);
     }
-#endif
-#ifdef HASH_STATISTICS
-    memset(&table->statistics, 0, sizeof(table->statistics));
-#endif
 
-    *tbl = table;
-    return HASH_SUCCESS;
+    return error;
 }
 
-#ifdef HASH_STATISTICS
-int hash_get_statistics(hash_table_t *table, hash_statistics_t *statistics)
+int hash_enter_batch(hash_table_t *table, unsigned long count,
+                     hash_key_t *keys, hash_value_t *values)
 {
+    int error;
+    unsigned long i, j, n;
+    hash_code_t codes[HASH_BATCH_SIZE];
+
     if (!table) return HASH_ERROR_BAD_TABLE;
-    if (!statistics) return EINVAL;
 
-    *statistics = table->statistics;
+    for (i = 0; i < count; i++) {
+        if (!is_valid_key_type(keys[i].type))
+            return HASH_ERROR_BAD_KEY_TYPE;
 
-    return HASH_SUCCESS;
-}
-#endif
+        if (!is_valid_value_type(values[i].type))
+            return HASH_ERROR_BAD_VALUE_TYPE;
+    }
 
-int hash_destroy(hash_table_t *table)
-{
-    unsigned long i, j;
-    segment_t *s;
-    element_t *p, *q;
+    if (is_frozen(table)) return EPERM;
 
-    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (is_image(table) && (error = image_promote(table)) != HASH_SUCCESS) {
+        return error;
+    }
 
-    if (table->directory) {
-        for (i = 0; i < table->segment_count; i++) {
-            /* test probably unnecessary */
-            if ((s = table->directory[i]) != NULL) {
-                for (j = 0; j < table->segment_size; j++) {
-                    p = s[j];
-                    while (p != NULL) {
-                        q = p->next;
-                        hdelete_callback(table, HASH_TABLE_DESTROY, &p->entry);
-                        if (p->entry.key.type == HASH_KEY_STRING
-                                || p->entry.key.type == HASH_KEY_CONST_STRING) {
-                            /* Internally we do not use constant memory for keys
-                             * in hash table elements. */
-                            hfree(table, p->entry.key.str);
-                        }
-                        hfree(table, (char *)p);
-                        p = q;
-                    }
-                }
-                hfree(table, s);
+    error = reserve_entries(table, load_relaxed(&table->entry_count) + count, false);
+    if (error != HASH_SUCCESS) {
+        return error;
+    }
+
+    for (i = 0; i < count; i += n) {
+        n = hash_batch(table, &keys[i], count - i, codes);
+        for (j = 0; j < n; j++) {
+            if (is_open_addressing(table)) {
+                error = oa_enter(table, &keys[i + j], codes[j], &values[i + j]);
+            } else {
+                error = chain_enter(table, &keys[i + j], codes[j], &values[i + j],
+                                    table->default_ttl);
+            }
+            if (error != HASH_SUCCESS) {
+                return error;
             }
         }
-        hfree(table, table->directory);
     }
-    hfree(table, table);
-    table = NULL;
 
     return HASH_SUCCESS;
 }
 
-int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user_data)
+int hash_lookup_batch(hash_table_t *table, unsigned long count,
+                      hash_key_t *keys, hash_value_t *values, int *results)
 {
-    unsigned long i, j;
-    segment_t *s;
-    element_t *p;
+    int error, status = HASH_SUCCESS;
+    unsigned long i, j, n, index;
+    hash_code_t codes[HASH_BATCH_SIZE];
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
-    if (table != NULL) {
-        for (i = 0; i < table->segment_count; i++) {
-            /* test probably unnecessary */
-            if ((s = table->directory[i]) != NULL) {
-                for (j = 0; j < table->segment_size; j++) {
-                    p = s[j];
-                    while (p != NULL) {
-                        if(!(*callback)(&p->entry, user_data)) return HASH_SUCCESS;
-                        p = p->next;
-                    }
+    for (i = 0; i < count; i++) {
+        if (!is_valid_key_type(keys[i].type))
+            return HASH_ERROR_BAD_KEY_TYPE;
+    }
+
+    for (i = 0; i < count; i += n) {
+        n = hash_batch(table, &keys[i], count - i, codes);
+        for (j = 0; j < n; j++) {
+            if (is_frozen(table)) {
+                if (frozen_lookup(table, &keys[i + j], codes[j], &index)) {
+                    values[i + j] = table->slots[index].entry.value;
+                    error = HASH_SUCCESS;
+                } else {
+                    error = HASH_ERROR_KEY_NOT_FOUND;
+                }
+            } else if (is_open_addressing(table)) {
+                if (oa_lookup(table, &keys[i + j], codes[j], &index)) {
+                    values[i + j] = table->slots[index].entry.value;
+                    error = HASH_SUCCESS;
+                } else {
+                    error = HASH_ERROR_KEY_NOT_FOUND;
                 }
+            } else if (is_image(table)) {
+                error = image_lookup(table, &keys[i + j], codes[j], &values[i + j])
+                        ? HASH_SUCCESS : HASH_ERROR_KEY_NOT_FOUND;
+            } else {
+                error = chain_lookup(table, &keys[i + j], codes[j], &values[i + j]);
+            }
+            stats_lookup(table, error);
+            if (results) {
+                results[i + j] = error;
+            }
+            if (error != HASH_SUCCESS) {
+                status = error;
             }
         }
     }
-    return HASH_SUCCESS;
+
+    return status;
 }
 
-static hash_entry_t *hash_iter_next(struct hash_iter_context_t *iter_arg)
+int hash_delete_batch(hash_table_t *table, unsigned long count,
+                      hash_key_t *keys, int *results)
 {
-    struct _hash_iter_context_t *iter = (struct _hash_iter_context_t *) iter_arg;
-    hash_entry_t *entry = NULL;
-    enum hash_iter_state state = HI_STATE_3A;
-
-    if (iter->table == NULL) return NULL;
-
-    while (state != HI_STATE_0) {
-
-        switch (state) {
-            case HI_STATE_1:
-                iter->i++;
-                if(iter->i >= iter->table->segment_count) return NULL;
-                /* test probably unnecessary */
-                iter->s = iter->table->directory[iter->i];
-                if (iter->s == NULL) {
-                    state = HI_STATE_1;
-                    break;
-                }
-                iter->j = 0;
-                state = HI_STATE_2;
-                /* FALLTHROUGH */
-
-            case HI_STATE_2:
-                if (iter->j >= iter->table->segment_size) {
-                    state = HI_STATE_1;
-                    break;
-                }
-                iter->p = iter->s[iter->j];
-                state = HI_STATE_3A;
-                /* FALLTHROUGH */
-
-            case HI_STATE_3A:
-                if (iter->p == NULL) {
-                    state = HI_STATE_3B;
-                    break;
-                }
-                entry = &iter->p->entry;
-                iter->p = iter->p->next;
-                state = HI_STATE_0;
-                break;
+    int error, status = HASH_SUCCESS;
+    unsigned long i, j, n;
+    hash_code_t codes[HASH_BATCH_SIZE];
 
-            case HI_STATE_3B:
-                iter->j++;
-                state = HI_STATE_2;
-                break;
+    if (!table) return HASH_ERROR_BAD_TABLE;
 
-            default:
-                /* Should never reach here */
-                fprintf(stderr, "ERROR hash_iter_next reached invalid state\n");
-                return NULL;
-                break;
+    for (i = 0; i < count; i++) {
+        if (!is_valid_key_type(keys[i].type))
+            return HASH_ERROR_BAD_KEY_TYPE;
+    }
+
+    if (is_frozen(table)) return EPERM;
+
+    if (is_image(table) && (error = image_promote(table)) != HASH_SUCCESS) {
+        return error;
+    }
+
+    for (i = 0; i < count; i += n) {
+        n = hash_batch(table, &keys[i], count - i, codes);
+        for (j = 0; j < n; j++) {
+            if (is_open_addressing(table)) {
+                error = oa_delete(table, &keys[i + j], codes[j]);
+            } else {
+                error = chain_delete(table, &keys[i + j], codes[j]);
+            }
+            if (results) {
+                results[i + j] = error;
+            }
+            if (error != HASH_SUCCESS) {
+                status = error;
+            }
         }
     }
 
-    return entry;
+    return status;
 }
 
-struct hash_iter_context_t *new_hash_iter_context(hash_table_t *table)
+int hash_enter_multi(hash_table_t *table, hash_key_t *key, hash_value_t *value)
 {
-    struct _hash_iter_context_t *iter;
+    int error;
+    hash_code_t h;
+    segment_t element, *chain;
 
-    if (!table) return NULL;;
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (!is_multimap(table)) return EINVAL;
 
-    iter = halloc(table, sizeof(struct _hash_iter_context_t));
-    if (iter == NULL) {
-        return NULL;
-    }
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
 
+    if (!is_valid_value_type(value->type))
+        return HASH_ERROR_BAD_VALUE_TYPE;
 
-    iter->iter.next = (hash_iter_next_t) hash_iter_next;
+    h = convert_key(table, key);
+    lookup(table, key, h, hash_address(table, h), &element, &chain);
+    if (element == NULL) {
+        return chain_enter(table, key, h, value, table->default_ttl);
+    }
 
-    iter->table = table;
-    iter->i = 0;
-    iter->j = 0;
-    iter->s = table->directory[iter->i];
-    iter->p = iter->s[iter->j];
+    if ((error = multi_add(table, element, value)) != HASH_SUCCESS) {
+        return error;
+    }
+    release_key(table, key, &element->entry.key);
+    if (has_eviction(table)) {
+        evict_touch(table, element_evict(element));
+    }
 
-    return (struct hash_iter_context_t *)iter;
+    return HASH_SUCCESS;
 }
 
-unsigned long hash_count(hash_table_t *table)
+int hash_lookup_all(hash_table_t *table, hash_key_t *key,
+                    hash_value_t **values, unsigned long *count)
 {
-    return table->entry_count;
-}
+    hash_code_t h;
+    segment_t element, *chain;
+    multi_t *multi;
 
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (!is_multimap(table) || !values || !count) return EINVAL;
 
-int hash_keys(hash_table_t *table, unsigned long *count_arg, hash_key_t **keys_arg)
-{
-    unsigned long count;
-    hash_key_t *keys;
-    hash_keys_callback_data_t data;
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
 
-    if (!table) return HASH_ERROR_BAD_TABLE;
+    h = convert_key(table, key);
+    lookup(table, key, h, hash_address(table, h), &element, &chain);
 
-    count = table->entry_count;
-    if (count == 0) {
-        *count_arg = 0;
-        *keys_arg = NULL;
-        return HASH_SUCCESS;
+    if (element && has_eviction(table)) {
+        if (element_evict(element)->expires != 0 &&
+            element_evict(element)->expires <= now_ms()) {
+            evict_entry(table, element);
+            element = NULL;
+        } else {
+            evict_touch(table, element_evict(element));
+        }
+    }
+    if (element == NULL) {
+        stats_lookup(table, HASH_ERROR_KEY_NOT_FOUND);
+        return HASH_ERROR_KEY_NOT_FOUND;
     }
 
-    keys = halloc(table, sizeof(hash_key_t) * count);
-    if (keys == NULL) {
-        *count_arg = -1;
-        *keys_arg = NULL;
-        return HASH_ERROR_NO_MEMORY;
+    multi = element_multi(table, element);
+    if (multi->values) {
+        *values = multi->values;
+        *count = multi->count;
+    } else {
+        *values = &element->entry.value;
+        *count = 1;
+    }
+    stats_lookup(table, HASH_SUCCESS);
+
+    return HASH_SUCCESS;
+}
+
+int hash_delete_value(hash_table_t *table, hash_key_t *key, hash_value_t *value)
+{
+    hash_code_t h;
+    segment_t element, *chain;
+    hash_entry_t entry;
+    multi_t *multi;
+    unsigned long i;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (!is_multimap(table)) return EINVAL;
+
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
+
+    h = convert_key(table, key);
+    lookup(table, key, h, hash_address(table, h), &element, &chain);
+    if (element == NULL) {
+        return HASH_ERROR_KEY_NOT_FOUND;
     }
 
-    data.index = 0;
-    data.keys = keys;
+    /* The last value goes together with the key */
+    multi = element_multi(table, element);
+    if (multi->values == NULL) {
+        if (!value_equal(&element->entry.value, value)) {
+            return HASH_ERROR_KEY_NOT_FOUND;
+        }
+        return chain_delete(table, key, h);
+    }
 
-    hash_iterate(table, hash_keys_callback, &data);
+    for (i = 0; i < multi->count && !value_equal(&multi->values[i], value); i++);
+    if (i == multi->count) {
+        return HASH_ERROR_KEY_NOT_FOUND;
+    }
+    entry.key = element->entry.key;
+    entry.value = multi->values[i];
+    hdelete_callback(table, HASH_ENTRY_DESTROY, &entry);
+    memmove(&multi->values[i], &multi->values[i + 1],
+            (multi->count - i - 1) * sizeof(hash_value_t));
+    multi->count--;
+    element->entry.value = multi->values[0];
+    if (multi->count == 1) {
+        free_values(table, element);
+    }
 
-    *count_arg = count;
-    *keys_arg = keys;
     return HASH_SUCCESS;
 }
 
-int hash_values(hash_table_t *table, unsigned long *count_arg, hash_value_t **values_arg)
+int hash_set_eviction(hash_table_t *table, unsigned int policy,
+                      unsigned long max_entries, unsigned long ttl_ms)
 {
-    unsigned long count;
-    hash_value_t *values;
-    hash_values_callback_data_t data;
-
     if (!table) return HASH_ERROR_BAD_TABLE;
 
-    count = table->entry_count;
-    if (count == 0) {
-        *count_arg = 0;
-        *values_arg = NULL;
-        return HASH_SUCCESS;
-    }
-
-    values = halloc(table, sizeof(hash_value_t) * count);
-    if (values == NULL) {
-        *count_arg = -1;
-        *values_arg = NULL;
-        return HASH_ERROR_NO_MEMORY;
+    if (!has_eviction(table) || policy > HASH_EVICT_CLOCK) {
+        return EINVAL;
     }
 
-    data.index = 0;
-    data.values = values;
-
-    hash_iterate(table, hash_values_callback, &data);
+    table->evict_policy = policy;
+    table->max_entries = policy == HASH_EVICT_NONE ? 0 : max_entries;
+    table->default_ttl = ttl_ms;
 
-    *count_arg = count;
-    *values_arg = values;
     return HASH_SUCCESS;
 }
 
-typedef struct hash_entries_callback_data_t {
-    unsigned long index;
-    hash_entry_t *entries;
-} hash_entries_callback_data_t;
-
-static bool hash_entries_callback(hash_entry_t *item, void *user_data)
+int hash_enter_ttl(hash_table_t *table, hash_key_t *key, hash_value_t *value,
+                   unsigned long ttl_ms)
 {
-    hash_entries_callback_data_t *data = (hash_entries_callback_data_t *)user_data;
+    if (!table) return HASH_ERROR_BAD_TABLE;
 
-    data->entries[data->index++] = *item;
-    return true;
+    if (!has_eviction(table)) {
+        return EINVAL;
+    }
+
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
+
+    if (!is_valid_value_type(value->type))
+        return HASH_ERROR_BAD_VALUE_TYPE;
+
+    return chain_enter(table, key, convert_key(table, key), value, ttl_ms);
 }
 
-int hash_entries(hash_table_t *table, unsigned long *count_arg, hash_entry_t **entries_arg)
+int hash_expire(hash_table_t *table)
 {
-    unsigned long count;
-    hash_entry_t *entries;
-    hash_entries_callback_data_t data;
-
     if (!table) return HASH_ERROR_BAD_TABLE;
 
-    count = table->entry_count;
-    if (count == 0) {
-        *count_arg = 0;
-        *entries_arg = NULL;
+    if (!has_eviction(table)) {
         return HASH_SUCCESS;
     }
 
-    entries = halloc(table, sizeof(hash_entry_t) * count);
-    if (entries == NULL) {
-        *count_arg = -1;
-        *entries_arg = NULL;
-        return HASH_ERROR_NO_MEMORY;
-    }
+    return expire_entries(table);
+}
 
-    data.index = 0;
-    data.entries = entries;
+int hash_enable_stats(hash_table_t *table, unsigned int what,
+                      unsigned int sample_interval)
+{
+    if (!table) return HASH_ERROR_BAD_TABLE;
 
-    hash_iterate(table, hash_entries_callback, &data);
+    if (what & ~(HASH_STATS_COUNTERS | HASH_STATS_LATENCY)) {
+        return EINVAL;
+    }
+
+    /* Stop collecting before clearing what was collected so far */
+    store_relaxed(&table->stats_flags, 0);
+    memset(&table->stats, 0, sizeof(table->stats));
+    store_relaxed(&table->stats_interval,
+                  sample_interval ? sample_interval : HASH_STATS_DEFAULT_INTERVAL);
+    __atomic_store_n(&table->stats_flags, what, __ATOMIC_RELEASE);
 
-    *count_arg = count;
-    *entries_arg = entries;
     return HASH_SUCCESS;
 }
 
-bool hash_has_key(hash_table_t *table, hash_key_t *key)
+int hash_get_stats(hash_table_t *table, hash_stats_t *stats)
 {
-    hash_value_t value;
+    const unsigned long *src;
+    unsigned long *dst;
+    size_t i;
 
-    if (hash_lookup(table, key, &value) == HASH_SUCCESS)
-        return true;
-    else
-        return false;
-}
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (!stats) return EINVAL;
 
+    /* hash_stats_t is made of unsigned longs only, read them one by one */
+    src = (const unsigned long *)&table->stats;
+    dst = (unsigned long *)stats;
+    for (i = 0; i < sizeof(hash_stats_t) / sizeof(unsigned long); i++) {
+        dst[i] = load_relaxed(&src[i]);
+    }
 
-int hash_get_default(hash_table_t *table, hash_key_t *key, hash_value_t *value, hash_value_t *default_value)
-{
-    int error;
+    return HASH_SUCCESS;
+}
 
-    if (!table) return HASH_ERROR_BAD_TABLE;
+/*
+ * Write the image to a temporary file next to path and rename it over path,
+ * so that processes which mapped the old image with hash_load() keep it.
+ * An existing file keeps its permissions, a new one is readable by all.
+ */
+static int image_write(const char *path, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    struct stat st;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    size_t len;
+    ssize_t written;
+    char *tmp;
+    int fd, error;
 
-    error = hash_lookup(table, key, value);
-    if (error == HASH_ERROR_KEY_NOT_FOUND) {
+    len = strlen(path);
+    tmp = (char *)malloc(len + sizeof(".XXXXXX"));
+    if (tmp == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        error = errno;
+        free(tmp);
+        return error;
+    }
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777;
+    }
 
-        error = hash_enter(table, key, default_value);
-        if (error != HASH_SUCCESS) {
-            return error;
+    error = HASH_SUCCESS;
+    if (fchmod(fd, mode) != 0) {
+        error = errno;
+    }
+    while (error == HASH_SUCCESS && size > 0) {
+        written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno != EINTR) error = errno;
+            continue;
         }
-        *value = *default_value;
-        return HASH_SUCCESS;
-    } else {
-        if (error != HASH_SUCCESS) return error;
+        bytes += written;
+        size -= written;
+    }
+    if (error == HASH_SUCCESS && fsync(fd) != 0) {
+        error = errno;
+    }
+    if (close(fd) != 0 && error == HASH_SUCCESS) {
+        error = errno;
     }
+    if (error == HASH_SUCCESS && rename(tmp, path) != 0) {
+        error = errno;
+    }
+    if (error != HASH_SUCCESS) {
+        unlink(tmp);
+    }
+    free(tmp);
 
-    return HASH_SUCCESS;
+    return error;
 }
 
-int hash_enter(hash_table_t *table, hash_key_t *key, hash_value_t *value)
+int hash_dump(hash_table_t *table, const char *path)
 {
+    image_builder_t builder;
+    image_header_t *header;
+    unsigned long slot_count;
+    size_t size;
     int error;
-    segment_t element, *chain;
-    size_t len;
 
     if (!table) return HASH_ERROR_BAD_TABLE;
+    if (!path || is_multimap(table)) return EINVAL;
 
-    if (!is_valid_key_type(key->type))
-        return HASH_ERROR_BAD_KEY_TYPE;
+    memset(&builder, 0, sizeof(builder));
+    builder.table = table;
+    hash_iterate(table, image_size_callback, &builder);
+    if (builder.error != HASH_SUCCESS) {
+        return builder.error;
+    }
 
-    if (!is_valid_value_type(value->type))
-        return HASH_ERROR_BAD_VALUE_TYPE;
+    /* At most half full, so that misses end quickly */
+    for (slot_count = IMAGE_MIN_SLOTS; slot_count < builder.count * 2;
+         slot_count <<= 1);
+    size = sizeof(image_header_t) + slot_count * sizeof(image_slot_t) +
+           builder.key_bytes;
 
-    lookup(table, key, &element, &chain);
+    header = (image_header_t *)halloc(table, size);
+    if (header == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(header, 0, size);
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+    header->version = IMAGE_VERSION;
+    header->long_size = sizeof(long);
+    header->byte_order = IMAGE_BYTE_ORDER;
+    header->seed = table->seed;
+    header->count = builder.count;
+    header->slot_mask = slot_count - 1;
+    header->size = size;
+
+    builder.header = header;
+    builder.slots = (image_slot_t *)(header + 1);
+    builder.keys = (char *)(builder.slots + slot_count);
+    hash_iterate(table, image_fill_callback, &builder);
+    if (builder.error == HASH_SUCCESS && builder.count != 0) {
+        builder.error = EBUSY;
+    }
+    if (builder.error != HASH_SUCCESS) {
+        hfree(table, header);
+        return builder.error;
+    }
 
-    if (element == NULL) {                    /* not found */
-        element = (element_t *)halloc(table, sizeof(element_t));
-        if (element == NULL) {
-            /* Allocation failed, return NULL */
-            return HASH_ERROR_NO_MEMORY;
-        }
-        memset(element, 0, sizeof(element_t));
-        /*
-         * Initialize new element
-         */
-        switch(element->entry.key.type = key->type) {
-        case HASH_KEY_ULONG:
-            element->entry.key.ul = key->ul;
-            break;
-        case HASH_KEY_STRING:
-        case HASH_KEY_CONST_STRING:
-            len = strlen(key->c_str) + 1;
-            element->entry.key.str = halloc(table, len);
-            if (element->entry.key.str == NULL) {
-                hfree(table, element);
-                return HASH_ERROR_NO_MEMORY;
-            }
-            memcpy(element->entry.key.str, key->str, len);
-            break;
-        }
+    error = image_write(path, header, size);
+    hfree(table, header);
 
-        *chain = element;             /* link into chain */
-        element->next = NULL;
+    return error;
+}
 
-        /*
-         * Table over-full?
-         */
-        if (++table->entry_count / table->bucket_count > table->max_load_factor) {
-            if ((error = expand_table(table)) != HASH_SUCCESS) { /* doesn't affect element */
-                return error;
-            }
-        }
+int hash_load(const char *path, hash_table_t **tbl,
+              hash_alloc_func *alloc_func,
+              hash_free_func *free_func,
+              void *alloc_private_data,
+              hash_delete_callback *delete_callback,
+              void *delete_private_data)
+{
+    const image_header_t *header;
+    hash_table_t *table;
+    struct stat st;
+    void *image;
+    int fd, error;
 
-    } else {
-        hdelete_callback(table, HASH_ENTRY_DESTROY, &element->entry);
+    if (tbl == NULL) return EINVAL;
+    *tbl = NULL;
+    if (!path) return EINVAL;
+
+    if (alloc_func == NULL) alloc_func = sys_malloc_wrapper;
+    if (free_func == NULL) free_func = sys_free_wrapper;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    if (fstat(fd, &st) != 0) {
+        error = errno;
+        close(fd);
+        return error;
+    }
+    if (st.st_size < (off_t)sizeof(image_header_t)) {
+        close(fd);
+        return EINVAL;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    error = errno;
+    close(fd);
+    if (image == MAP_FAILED) {
+        return error;
     }
 
-    switch(element->entry.value.type = value->type) {
-    case HASH_VALUE_UNDEF:
-        element->entry.value.ul = 0;
-        break;
-    case HASH_VALUE_PTR:
-        element->entry.value.ptr = value->ptr;
-        break;
-    case HASH_VALUE_INT:
-        element->entry.value.i = value->i;
-        break;
-    case HASH_VALUE_UINT:
-        element->entry.value.ui = value->ui;
-        break;
-    case HASH_VALUE_LONG:
-        element->entry.value.l = value->l;
-        break;
-    case HASH_VALUE_ULONG:
-        element->entry.value.ul = value->ul;
-        break;
-    case HASH_VALUE_FLOAT:
-        element->entry.value.f = value->f;
-        break;
-    case HASH_VALUE_DOUBLE:
-        element->entry.value.d = value->d;
-        break;
+    /* The slots must fit, keys are checked when they are used */
+    header = (const image_header_t *)image;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMAGE_VERSION ||
+        header->long_size != sizeof(long) ||
+        header->byte_order != IMAGE_BYTE_ORDER ||
+        header->size != (uint64_t)st.st_size ||
+        header->slot_mask < IMAGE_MIN_SLOTS - 1 ||
+        (header->slot_mask & (header->slot_mask + 1)) != 0 ||
+        header->slot_mask >= (header->size - sizeof(image_header_t)) / sizeof(image_slot_t) ||
+        header->count > header->slot_mask) {
+        munmap(image, st.st_size);
+        return EINVAL;
+    }
+
+    table = (hash_table_t *)alloc_func(sizeof(hash_table_t), alloc_private_data);
+    if (table == NULL) {
+        munmap(image, st.st_size);
+        return HASH_ERROR_NO_MEMORY;
     }
+    memset(table, 0, sizeof(hash_table_t));
+    table->halloc = alloc_func;
+    table->hfree = free_func;
+    table->halloc_pvt = alloc_private_data;
+    table->delete_callback = delete_callback;
+    table->delete_pvt = delete_private_data;
+    table->resize_steps = 1;
+    table->seed = header->seed;
+    table->entry_count = header->count;
+    table->slot_mask = header->slot_mask;
+    table->image = header;
+    table->image_slots = (const image_slot_t *)(header + 1);
 
+    *tbl = table;
     return HASH_SUCCESS;
 }
 
-int hash_lookup(hash_table_t *table, hash_key_t *key, hash_value_t *value)
+int hash_reserve(hash_table_t *table, unsigned long count)
 {
-    segment_t element, *chain;
+    int error;
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
-    if (!is_valid_key_type(key->type))
-        return HASH_ERROR_BAD_KEY_TYPE;
-
-    lookup(table, key, &element, &chain);
+    if (is_frozen(table)) return EPERM;
 
-    if (element) {
-        *value = element->entry.value;
-        return HASH_SUCCESS;
-    } else {
-        return HASH_ERROR_KEY_NOT_FOUND;
+    if (is_image(table) && (error = image_promote(table)) != HASH_SUCCESS) {
+        return error;
     }
+
+    return reserve_entries(table, count, true);
 }
 
-int hash_delete(hash_table_t *table, hash_key_t *key)
+int hash_set_resize_budget(hash_table_t *table, unsigned long steps)
+{
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (steps == 0) return EINVAL;
+
+    store_relaxed(&table->resize_steps, steps);
+
+    return HASH_SUCCESS;
+}
+
+int hash_freeze(hash_table_t *table)
 {
+    oa_slot_t *items, *slots;
+    element_t **elements, *p;
+    uint32_t *disp;
+    unsigned long *bucket_end, *order;
+    unsigned long n, slot_count, bucket_count, size, max_size, i, j, b;
+    unsigned long copied = 0;
+    segment_t *s;
+    slab_t *slab;
     int error;
-    segment_t element, *chain;
 
     if (!table) return HASH_ERROR_BAD_TABLE;
+    if (is_frozen(table)) return HASH_SUCCESS;
+    if (is_multimap(table)) return EINVAL;
 
-    if (!is_valid_key_type(key->type))
-        return HASH_ERROR_BAD_KEY_TYPE;
+    if (is_image(table) && (error = image_promote(table)) != HASH_SUCCESS) {
+        return error;
+    }
+    if (has_eviction(table) && (error = expire_entries(table)) != HASH_SUCCESS) {
+        return error;
+    }
 
-    lookup(table, key, &element, &chain);
+    n = table->entry_count;
+    slot_count = MAX(n, 1);
+    bucket_count = n / FROZEN_BUCKET_LOAD + 1;
+    items = (oa_slot_t *)halloc(table, slot_count * sizeof(oa_slot_t));
+    elements = (element_t **)halloc(table, slot_count * sizeof(element_t *));
+    order = (unsigned long *)halloc(table, slot_count * sizeof(unsigned long));
+    bucket_end = (unsigned long *)halloc(table, bucket_count * sizeof(unsigned long));
+    slots = (oa_slot_t *)halloc(table, slot_count * sizeof(oa_slot_t));
+    disp = (uint32_t *)halloc(table, bucket_count * sizeof(uint32_t));
+    if (!items || !elements || !order || !bucket_end || !slots || !disp) {
+        error = HASH_ERROR_NO_MEMORY;
+        goto fail;
+    }
+    memset(slots, 0, slot_count * sizeof(oa_slot_t));
+    memset(disp, 0, bucket_count * sizeof(uint32_t));
+    memset(bucket_end, 0, bucket_count * sizeof(unsigned long));
 
-    if (element) {
-        hdelete_callback(table, HASH_ENTRY_DESTROY, &element->entry);
-        *chain = element->next; /* remove from chain */
-        /*
-         * Table too sparse?
-         */
-        if (--table->entry_count / table->bucket_count < table->min_load_factor) {
-            if ((error = contract_table(table)) != HASH_SUCCESS) { /* doesn't affect element */
-                return error;
+    /*
+     * Collect the entries. Keys stored inside slab elements need a copy of
+     * their own, everything else moves over as it is.
+     */
+    n = 0;
+    if (is_open_addressing(table)) {
+        for (i = 0; i <= table->slot_mask; i++) {
+            if (table->slots[i].hash != 0) {
+                items[n++] = table->slots[i];
             }
         }
-        if (element->entry.key.type == HASH_KEY_STRING
-                || element->entry.key.type == HASH_KEY_CONST_STRING) {
-            hfree(table, element->entry.key.str);
-        }
-        hfree(table, element);
-        return HASH_SUCCESS;
     } else {
-        return HASH_ERROR_KEY_NOT_FOUND;
+        for (i = 0; i < table->segment_count; i++) {
+            if ((s = table->directory[i]) == NULL) {
+                continue;
+            }
+            for (j = 0; j < table->segment_size; j++) {
+                for (p = s[j]; p != NULL; p = p->next) {
+                    items[n].hash = p->hash ? p->hash : 1;
+                    items[n].entry = p->entry;
+                    elements[n++] = p;
+                }
+            }
+        }
+    }
+    for (i = 0; is_slab_alloc(table) && i < n; i++) {
+        if (elements[i]->entry.key.type != HASH_KEY_ULONG &&
+            key_memory(&elements[i]->entry.key) == inline_key(elements[i]) &&
+            (error = copy_key(table, &items[i].entry.key,
+                              &elements[i]->entry.key)) != HASH_SUCCESS) {
+            copied = i;
+            goto fail;
+        }
+    }
+    copied = is_slab_alloc(table) ? n : 0;
+
+    /* Sort the entries by bucket, then place the largest buckets first */
+    max_size = 0;
+    for (i = 0; i < n; i++) {
+        b = items[i].hash % bucket_count;
+        bucket_end[b]++;
+        max_size = MAX(max_size, bucket_end[b]);
+    }
+    for (b = 1; b < bucket_count; b++) {
+        bucket_end[b] += bucket_end[b - 1];
+    }
+    for (i = n; i-- > 0; ) {
+        order[--bucket_end[items[i].hash % bucket_count]] = i;
+    }
+    /* bucket_end[b] is now the start of bucket b */
+    for (size = max_size; size > 0; size--) {
+        for (b = 0; b < bucket_count; b++) {
+            j = b + 1 < bucket_count ? bucket_end[b + 1] : n;
+            if (j - bucket_end[b] == size &&
+                !frozen_place(slots, slot_count, items, &order[bucket_end[b]],
+                              size, &disp[b])) {
+                error = EINVAL;
+                goto fail;
+            }
+        }
     }
-}
 
+    /* Release the old storage, the keys now belong to the slots */
+    if (is_open_addressing(table)) {
+        hfree(table, table->slots);
+    } else {
+        for (i = 0; !is_slab_alloc(table) && i < n; i++) {
+            hfree(table, element_memory(table, elements[i]));
+        }
+        for (i = 0; i < table->segment_count; i++) {
+            if (table->directory[i]) {
+                hfree(table, table->directory[i]);
+            }
+        }
+        hfree(table, table->directory);
+        table->directory = NULL;
+        table->segment_count = 0;
+        if (table->spare_segment) {
+            hfree(table, table->spare_segment);
+            table->spare_segment = NULL;
+        }
+        while ((slab = table->slabs) != NULL) {
+            table->slabs = slab->next;
+            hfree(table, slab);
+        }
+        table->free_elements = NULL;
+        table->external_keys = 0;
+    }
+    if (needs_alloc_lock(table)) {
+        pthread_mutex_destroy(&table->alloc_lock);
+    }
+    if (table->segment_locks) {
+        for (i = 0; i < table->directory_size; i++) {
+            pthread_rwlock_destroy(&table->segment_locks[i]);
+        }
+        hfree(table, table->segment_locks);
+        table->segment_locks = NULL;
+        pthread_mutex_destroy(&table->resize_lock);
+    }
+    table->evict_size = table->prefix_size = 0;
+    table->evict_head.prev = table->evict_head.next = &table->evict_head;
+    table->evict_head.exp_prev = table->evict_head.exp_next = &table->evict_head;
+    table->clock_hand = NULL;
+    table->max_entries = table->default_ttl = 0;
+
+    table->flags = (table->flags & (HASH_CREATE_RANDOM_SEED | HASH_CREATE_KEY_OWNERSHIP)) |
+                   HASH_CREATE_OPEN_ADDRESSING;
+    table->slots = slots;
+    table->slot_mask = slot_count - 1;
+    table->reserved_buckets = 0;
+    table->frozen_buckets = bucket_count;
+    table->frozen_disp = disp;
+
+    hfree(table, items);
+    hfree(table, elements);
+    hfree(table, order);
+    hfree(table, bucket_end);
+    return HASH_SUCCESS;
 
+fail:
+    /* Drop the copies of slab keys made so far */
+    for (i = 0; i < copied; i++) {
+        if (key_memory(&items[i].entry.key) != key_memory(&elements[i]->entry.key)) {
+            free_key(table, &items[i].entry.key);
+        }
+    }
+    if (items) hfree(table, items);
+    if (elements) hfree(table, elements);
+    if (order) hfree(table, order);
+    if (bucket_end) hfree(table, bucket_end);
+    if (slots) hfree(table, slots);
+    if (disp) hfree(table, disp);
+    return error;
+}
@@ -45,8 +45,8 @@ locating the key in the table and returning its value.
 A dynamic hash table keeps the number of hash collisions constant
 independent of the number of entries in the hash table.
 
-Both keys and values may be of different types. Two different key types are
-supported, strings and unsigned longs. If the key type is a string the hash
+Both keys and values may be of different types. The basic key types are
+strings and unsigned longs. If the key type is a string the hash
 library will automatically allocate memory to hold the hash key string and
 will automatically free the memory for the key string when the hash entry
 is destroyed. Items in the hash table only match when their key types match
@@ -55,12 +55,29 @@ one whose key type was an unsigned long equal to 1 and one whose key type was
 a string equal to "1" they would not match, these are considered two
 distinct entries.
 
+Keys may also be arbitrary bytes given by a pointer and a length
+(HASH_KEY_BINARY), which are copied like strings and compared with memcmp().
+See hash_create_flags() for tables which borrow or adopt key memory instead
+of copying it.
+
 The value of the key may be a undefined, pointer, an int, an unsigned int, a
 long, an unsigned long, a float, or a double. The hash library does nothing
 with user pointers (value.type == HASH_VALUE_PTR). Its the user responsibility
 to free items pointed to by these pointers when a hash entry is deleted or the
 hash table is destroyed (see hash_delete_callback and/or hash_destroy).
 
+Keys are hashed to 64 bit hash codes, strings eight bytes at a time. The hash
+code of every entry is kept alongside it so that keys are only compared when
+their hash codes match and are never rehashed when the table grows or shrinks.
+
+By default entries are kept in separately allocated elements chained off the
+buckets of the dynamic hash table described above. A table may instead be
+created in open addressing mode (see hash_create_flags) in which case the
+entries are stored directly in one flat array of slots probed in Robin Hood
+order. This avoids a memory allocation per entry and keeps lookups within a
+few adjacent cache lines, at the cost of moving entries around in memory when
+the table is modified. The API and its semantics are identical for both modes.
+
 See dhash_example.c for an illustration of how one might use the API. It does not
 represent complete API coverage nor the optimal way to do things in all cases,
 it is just a general example.
@@ -92,6 +109,29 @@ terms of this license.
 #define HASH_DEFAULT_MIN_LOAD_FACTOR 1
 #define HASH_DEFAULT_MAX_LOAD_FACTOR 5
 
+/* Flags for hash_create_flags() */
+#define HASH_CREATE_OPEN_ADDRESSING 0x0001
+#define HASH_CREATE_RANDOM_SEED     0x0002
+#define HASH_CREATE_CONCURRENT      0x0004
+#define HASH_CREATE_SLAB_ALLOC      0x0008
+#define HASH_CREATE_BORROW_KEYS     0x0010
+#define HASH_CREATE_ADOPT_KEYS      0x0020
+#define HASH_CREATE_INTERN_KEYS     0x0040
+#define HASH_CREATE_EVICTION        0x0080
+#define HASH_CREATE_MULTIMAP        0x0100
+
+/* What hash_enable_stats() collects */
+#define HASH_STATS_COUNTERS 0x0001
+#define HASH_STATS_LATENCY  0x0002
+
+#define HASH_STATS_CHAIN_BUCKETS   16
+#define HASH_STATS_LATENCY_BUCKETS 32
+
+/* Eviction policies for hash_set_eviction() */
+#define HASH_EVICT_NONE  0
+#define HASH_EVICT_LRU   1
+#define HASH_EVICT_CLOCK 2
+
 #define HASH_ERROR_BASE -2000
 #define HASH_ERROR_LIMIT (HASH_ERROR_BASE+20)
 #define IS_HASH_ERROR(error)  (((error) >= HASH_ERROR_BASE) && ((error) < HASH_ERROR_LIMIT))
@@ -113,7 +153,8 @@ typedef struct hash_table_str hash_table_t;
 typedef enum {
     HASH_KEY_STRING,
     HASH_KEY_ULONG,
-    HASH_KEY_CONST_STRING
+    HASH_KEY_CONST_STRING,
+    HASH_KEY_BINARY
 } hash_key_enum;
 
 typedef enum
@@ -131,15 +172,26 @@ typedef enum
 typedef enum
 {
     HASH_TABLE_DESTROY,
-    HASH_ENTRY_DESTROY
+    HASH_ENTRY_DESTROY,
+    HASH_ENTRY_EVICT
 } hash_destroy_enum;
 
+/*
+ * Arbitrary bytes used as a HASH_KEY_BINARY key. Keys are equal if they
+ * have the same length and the same bytes.
+ */
+typedef struct hash_binary_t {
+    const void *data;
+    size_t len;
+} hash_binary_t;
+
 typedef struct hash_key_t {
     hash_key_enum type;
     union {
         char *str;
         const char *c_str;
         unsigned long ul;
+        const hash_binary_t *bin;
     };
 } hash_key_t;
 
@@ -161,6 +213,26 @@ typedef struct hash_entry_t {
     hash_value_t value;
 } hash_entry_t;
 
+/*
+ * Runtime statistics of a table, see hash_enable_stats(). chain_length[i]
+ * counts the key searches which compared i entries before they found the
+ * key or gave up, the last bucket also counts all longer searches. Bucket i
+ * of the latency histograms counts sampled operations which took from 2^i
+ * to 2^(i+1) nanoseconds.
+ */
+typedef struct hash_stats_t {
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long expansions;
+    unsigned long contractions;
+    unsigned long evictions;
+    unsigned long bytes_allocated; /* total requested from alloc_func */
+    unsigned long chain_length[HASH_STATS_CHAIN_BUCKETS];
+    unsigned long enter_latency[HASH_STATS_LATENCY_BUCKETS];
+    unsigned long lookup_latency[HASH_STATS_LATENCY_BUCKETS];
+    unsigned long delete_latency[HASH_STATS_LATENCY_BUCKETS];
+} hash_stats_t;
+
 #ifdef HASH_STATISTICS
 typedef struct hash_statistics_t {
     unsigned long hash_accesses;
@@ -183,6 +255,18 @@ struct hash_iter_context_t {
     hash_iter_next_t next;
 };
 
+/*
+ * Iterator which can live on the stack, see hash_iter_init(). The fields
+ * are private to the library.
+ */
+typedef struct hash_iter_t {
+    hash_table_t *table;
+    unsigned long bucket;
+    unsigned long skip;
+    void *element;
+    hash_entry_t entry;
+} hash_iter_t;
+
 /* typedef for hash_create_ex() */
 typedef void *(hash_alloc_func)(size_t size, void *pvt);
 typedef void (hash_free_func)(void *ptr, void *pvt);
@@ -284,6 +368,107 @@ int hash_create_ex(unsigned long count, hash_table_t **tbl,
                    hash_delete_callback *delete_callback,
                    void *delete_private_data);
 
+/*
+ * Identical to hash_create_ex() with an additional flags parameter selecting
+ * optional table behavior. flags is a bitwise OR of zero or more of:
+ *
+ * HASH_CREATE_OPEN_ADDRESSING
+ *     Store entries in a flat open addressing array instead of in chains of
+ *     individually allocated elements. directory_bits, segment_bits,
+ *     min_load_factor and max_load_factor are ignored, the slot array is
+ *     sized from count and doubles or halves as entries come and go. Note
+ *     that in this mode any insertion or deletion may move other entries,
+ *     so hash_entry_t pointers obtained through iteration are only valid
+ *     until the table is next modified.
+ *
+ * HASH_CREATE_RANDOM_SEED
+ *     Seed the key hash function of this table with a random value. This
+ *     makes it impractical to craft sets of keys which all collide (hash
+ *     flooding) at the price of iteration order differing from one table,
+ *     and one process, to the next.
+ *
+ * HASH_CREATE_CONCURRENT
+ *     Make the table safe to use from several threads at once without any
+ *     external locking. Every segment of buckets has its own read/write
+ *     lock: hash_lookup() takes it shared, so readers never wait for each
+ *     other, hash_enter() and hash_delete() take it exclusively, so only
+ *     writers to the same segment are serialized. Expansion and contraction
+ *     still proceed one bucket at a time and only lock the two segments
+ *     involved. hash_iterate() and the functions built on it (hash_keys(),
+ *     hash_values(), hash_entries()) block resizing for their duration and
+ *     visit the table one segment at a time, they see a consistent view of
+ *     each segment but not of the table as a whole. Their callback runs
+ *     with resizing blocked and the segment of the entry read locked, so
+ *     it must not call back into the table. Iterator objects from
+ *     new_hash_iter_context() are not protected and must only be used while
+ *     no other thread modifies the table. The delete callback is called
+ *     with the segment of the entry locked and must not call back into the
+ *     table. Only table expansions and contractions are counted in the
+ *     statistics of concurrent tables. Can't be combined with
+ *     HASH_CREATE_OPEN_ADDRESSING.
+ *
+ * HASH_CREATE_SLAB_ALLOC
+ *     Carve the table elements out of large slabs obtained from alloc_func
+ *     instead of allocating each of them separately, and store string keys
+ *     of up to 47 characters inside the element rather than in a copy of
+ *     their own. Longer keys are still copied individually. The first slab
+ *     is sized from count. Elements of deleted entries are reused by later
+ *     insertions, the slabs are only released by hash_destroy(), which
+ *     frees them in bulk without visiting every entry unless there is a
+ *     delete callback to call or a long key to free. Can't be combined
+ *     with HASH_CREATE_OPEN_ADDRESSING.
+ *
+ * By default the table stores its own copy of every string and binary key
+ * and frees it when the entry is deleted. One of the following flags may be
+ * given to change that:
+ *
+ * HASH_CREATE_BORROW_KEYS
+ *     Store the key pointers passed to hash_enter() as they are, nothing is
+ *     copied or freed. The caller must keep the key strings, or binary key
+ *     descriptors and data, unchanged for as long as they are in the table.
+ *
+ * HASH_CREATE_ADOPT_KEYS
+ *     Take over HASH_KEY_STRING keys passed to hash_enter() instead of
+ *     copying them, the table frees them with free_func when the entry is
+ *     deleted, so they must have been allocated to match it (with malloc()
+ *     by default). hash_enter() adopts the key string even if the key was
+ *     already in the table, in which case the string is freed right away,
+ *     as does hash_get_default(). The caller keeps the key only if an error
+ *     is returned. Constant string and binary keys are still copied.
+ *
+ * HASH_CREATE_INTERN_KEYS
+ *     Pack the copies of the keys into large chunks instead of allocating
+ *     each one separately. Their memory is not reused when entries are
+ *     deleted, only hash_destroy() releases it, so this suits tables which
+ *     are filled once and mostly read.
+ *
+ * HASH_CREATE_EVICTION
+ *     Keep the per entry state needed to expire entries after a time to
+ *     live and to evict entries when the table is full, see
+ *     hash_set_eviction(). Costs 48 bytes per entry. Can't be combined with
+ *     HASH_CREATE_OPEN_ADDRESSING or HASH_CREATE_CONCURRENT.
+ *
+ * HASH_CREATE_MULTIMAP
+ *     Let a key map to several values, see hash_enter_multi(). The values
+ *     of a key are kept in one contiguous vector next to its entry, so
+ *     hash_lookup_all() finds all of them with a single lookup. Costs 24
+ *     bytes per entry. Can't be combined with HASH_CREATE_OPEN_ADDRESSING
+ *     or HASH_CREATE_CONCURRENT.
+ *
+ * Unknown flags cause EINVAL to be returned.
+ */
+int hash_create_flags(unsigned long count, hash_table_t **tbl,
+                      unsigned int directory_bits,
+                      unsigned int segment_bits,
+                      unsigned long min_load_factor,
+                      unsigned long max_load_factor,
+                      hash_alloc_func *alloc_func,
+                      hash_free_func *free_func,
+                      void *alloc_private_data,
+                      hash_delete_callback *delete_callback,
+                      void *delete_private_data,
+                      unsigned int flags);
+
 #ifdef HASH_STATISTICS
 /*
  * Return statistics for the table.
@@ -291,6 +476,34 @@ int hash_create_ex(unsigned long count, hash_table_t **tbl,
 int hash_get_statistics(hash_table_t *table, hash_statistics_t *statistics);
 #endif
 
+/*
+ * Start collecting runtime statistics for the table, or stop if what is 0.
+ * Unlike hash_get_statistics() these are available in every build and cost
+ * nothing while they are off. what is a combination of:
+ *
+ * HASH_STATS_COUNTERS
+ *     Count lookups and hits of hash_lookup() and hash_lookup_batch(), the
+ *     length of every key search, table expansions and contractions,
+ *     evicted entries and the bytes requested from alloc_func.
+ *
+ * HASH_STATS_LATENCY
+ *     Time one in every sample_interval calls to hash_enter(), hash_lookup()
+ *     and hash_delete() made by a thread, or one in 64 if sample_interval is
+ *     0, and add them to the latency histograms.
+ *
+ * The statistics collected so far are cleared. On concurrent tables the
+ * counters are updated atomically, which is cheap but not free when many
+ * threads share a table. Returns EINVAL for unknown flags.
+ */
+int hash_enable_stats(hash_table_t *table, unsigned int what,
+                      unsigned int sample_interval);
+
+/*
+ * Copy the runtime statistics of the table to stats. On concurrent tables
+ * each counter is read atomically, but not all of them at the same time.
+ */
+int hash_get_stats(hash_table_t *table, hash_stats_t *stats);
+
 /*
  * hash_destroy deletes all entries in the hash table, freeing all memory used
  * in implementing the hash table. Some hash entries may have values which are
@@ -339,6 +552,165 @@ int hash_get_default(hash_table_t *table, hash_key_t *key, hash_value_t *value,
  */
 int hash_delete(hash_table_t *table, hash_key_t *key);
 
+/*
+ * Batch versions of hash_enter(), hash_lookup() and hash_delete() operating on
+ * count keys at once, and for hash_enter_batch() and hash_lookup_batch() on
+ * the count values at the same indexes. They give the same results as calling
+ * the single key function for every key in turn, but hash_enter_batch() grows
+ * the table once for all the new entries and all of them hash groups of keys
+ * together and prefetch their buckets, which makes loading or querying many
+ * keys at once considerably faster.
+ *
+ * All keys (and values) are validated before the table is touched, if any of
+ * them is invalid HASH_ERROR_BAD_KEY_TYPE (or HASH_ERROR_BAD_VALUE_TYPE) is
+ * returned and nothing is done. hash_enter_batch() stops at the first key it
+ * fails to enter, the keys before it have been entered. hash_lookup_batch()
+ * and hash_delete_batch() process every key; if results is not NULL the status
+ * for keys[i] is stored in results[i], and HASH_ERROR_KEY_NOT_FOUND is
+ * returned if any of the keys was not in the table. The values of keys which
+ * were not found are not updated.
+ */
+int hash_enter_batch(hash_table_t *table, unsigned long count,
+                     hash_key_t *keys, hash_value_t *values);
+int hash_lookup_batch(hash_table_t *table, unsigned long count,
+                      hash_key_t *keys, hash_value_t *values, int *results);
+int hash_delete_batch(hash_table_t *table, unsigned long count,
+                      hash_key_t *keys, int *results);
+
+/*
+ * Multimap tables, created with HASH_CREATE_MULTIMAP, map every key to one
+ * or more values in the order they were entered. hash_enter_multi() adds
+ * value to the values of key, entering the key if it is new; equal values
+ * are added again. hash_lookup_all() returns the values of key as a vector
+ * owned by the table, which is valid until the key is next modified or
+ * deleted. hash_delete_value() removes the first value of key equal to
+ * value, of the same type and with the same contents, and deletes the key
+ * along with its last value, HASH_ERROR_KEY_NOT_FOUND is returned if
+ * there is no such value. The delete callback is called once for every
+ * removed value.
+ *
+ * The other functions treat multimap tables as a map from every key to its
+ * first value: hash_lookup() and iteration return the first value,
+ * hash_count() counts the keys, hash_enter() replaces all values of a key
+ * by one and hash_delete() deletes a key with all of its values.
+ *
+ * These functions return EINVAL for tables which are not multimap tables.
+ */
+int hash_enter_multi(hash_table_t *table, hash_key_t *key, hash_value_t *value);
+int hash_lookup_all(hash_table_t *table, hash_key_t *key,
+                    hash_value_t **values, unsigned long *count);
+int hash_delete_value(hash_table_t *table, hash_key_t *key, hash_value_t *value);
+
+/*
+ * Turn a table which is not going to change any more into a compact
+ * read-only one. The entries are moved into a flat array with one slot per
+ * entry, indexed by a minimal perfect hash function built for the keys in
+ * the table, so a lookup goes straight to the one slot its key can be in.
+ * Frozen tables take no locks and any number of threads may look them up
+ * and iterate them at the same time, entry pointers stay valid until the
+ * table is destroyed. Chains, slabs and eviction state are released,
+ * expired entries are dropped first. hash_enter(), hash_delete(), their
+ * batch versions and hash_reserve() return EPERM on frozen tables. Must
+ * not be called while other threads use the table. Returns EINVAL for
+ * multimap tables, or in the unlikely case of two keys with the same
+ * 64 bit hash code.
+ */
+int hash_freeze(hash_table_t *table);
+
+/*
+ * Grow the table right away so that it can hold count entries without
+ * resizing, and keep it from shrinking below that size until hash_reserve()
+ * is called again, with 0 to let it shrink as usual. Use it ahead of bulk
+ * loads, or for tables which repeatedly fill up and drain, to take resizing
+ * out of the way of the individual operations. The growth of chained
+ * tables is limited by the directory size given to hash_create_ex().
+ */
+int hash_reserve(hash_table_t *table, unsigned long count);
+
+/*
+ * Chained tables are expanded or contracted by one bucket whenever an
+ * operation finds the load outside of the load factors given at creation,
+ * which keeps the cost of every operation low but lets the load run out of
+ * bounds during bursts of insertions or deletions. This sets how many
+ * buckets one operation may split or merge while the load stays out of
+ * bounds, 1 by default. Open addressing tables always resize at once.
+ * Returns EINVAL if steps is 0.
+ */
+int hash_set_resize_budget(hash_table_t *table, unsigned long steps);
+
+/*
+ * Set the eviction policy of a table created with HASH_CREATE_EVICTION.
+ *
+ * When max_entries is not zero, entering a new key into a table which
+ * already holds max_entries entries evicts one: with HASH_EVICT_LRU the
+ * least recently entered or looked up entry, with HASH_EVICT_CLOCK the next
+ * entry the clock hand finds which was not used since it last passed, which
+ * approximates LRU but only sets a bit on hash_lookup(). HASH_EVICT_NONE
+ * never evicts for capacity.
+ *
+ * When ttl_ms is not zero, entries entered from now on by hash_enter() and
+ * the batch functions expire ttl_ms milliseconds after they were last
+ * entered. Expired entries are removed when they are looked up, when new
+ * entries are entered and by hash_expire(); until then they are still seen
+ * by hash_iterate() and hash_count(). Use hash_enter_ttl() to give single
+ * entries a different time to live.
+ *
+ * Evicted and expired entries are passed to the delete callback with
+ * HASH_ENTRY_EVICT. Returns EINVAL if the table wasn't created with
+ * HASH_CREATE_EVICTION or the policy is unknown. The new limit is applied
+ * the next time an entry is entered.
+ */
+int hash_set_eviction(hash_table_t *table, unsigned int policy,
+                      unsigned long max_entries, unsigned long ttl_ms);
+
+/*
+ * Like hash_enter() but the entry expires ttl_ms milliseconds from now, or
+ * never if ttl_ms is zero, instead of after the default time to live of the
+ * table. Returns EINVAL if the table wasn't created with
+ * HASH_CREATE_EVICTION.
+ */
+int hash_enter_ttl(hash_table_t *table, hash_key_t *key, hash_value_t *value,
+                   unsigned long ttl_ms);
+
+/*
+ * Remove all expired entries from a table created with HASH_CREATE_EVICTION.
+ * Tables without eviction are left alone.
+ */
+int hash_expire(hash_table_t *table);
+
+/*
+ * Write an image of the table to the file at path for hash_load() to map
+ * later. The image goes to a temporary file in the same directory which is
+ * then renamed over path, so tables already loaded from path keep working.
+ * Only unsigned long and string keys with values other than pointers can be
+ * saved, otherwise HASH_ERROR_BAD_KEY_TYPE or HASH_ERROR_BAD_VALUE_TYPE is
+ * returned and nothing is written. The image can only be loaded on a host
+ * with the same byte order and size of long. The table must not be modified
+ * while it is dumped, EBUSY is returned if a concurrent table changed.
+ * Errors of the file operations are returned as errno values, EINVAL for
+ * multimap tables.
+ */
+int hash_dump(hash_table_t *table, const char *path);
+
+/*
+ * Map an image written by hash_dump() read-only and return a table serving
+ * lookups and iteration directly from it, without reading or copying the
+ * entries up front. String keys of the entries point into the mapping. The
+ * first hash_enter(), hash_delete() or batch version of them copies all
+ * entries into an ordinary chained table and unmaps the image, so keys
+ * obtained from the table before then must not be used afterwards. The
+ * table is not concurrent. The allocator and delete callback parameters are
+ * the same as those of hash_create_ex(). Returns EINVAL if the file is not
+ * an image this library can load, or an errno value if it can't be opened
+ * or mapped.
+ */
+int hash_load(const char *path, hash_table_t **tbl,
+              hash_alloc_func *alloc_func,
+              hash_free_func *free_func,
+              void *alloc_private_data,
+              hash_delete_callback *delete_callback,
+              void *delete_private_data);
+
 /*
  * Often it is useful to operate on every key and/or value in the hash
  * table. The hash_iterate function will invoke the users callback on every item
@@ -356,6 +728,11 @@ int hash_delete(hash_table_t *table, hash_key_t *key);
  * obtain a list of keys or items using hash_keys() or hash_items() which
  * returns a copy of the keys or items. You may then loop on the list returned
  * and safely update the table (don't forget to free the list when done).
+ *
+ * For HASH_CREATE_CONCURRENT tables the callback is called with resizing
+ * blocked and the segment of the item read locked. Calling hash_enter(),
+ * hash_delete() or any other function on the same table from the callback
+ * deadlocks.
  */
 int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user_data);
 
@@ -384,6 +761,60 @@ int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user
  */
 struct hash_iter_context_t *new_hash_iter_context(hash_table_t *table);
 
+/*
+ * The same iteration without allocating anything: hash_iter_init() sets up
+ * an iterator provided by the caller, usually on the stack, and every call
+ * to hash_iter_next_entry() returns the next entry, then NULL. The same
+ * rules as for new_hash_iter_context() apply.
+ *
+ * Example:
+ *
+ * hash_iter_t iter;
+ * hash_entry_t *entry;
+ *
+ * hash_iter_init(table, &iter);
+ * while ((entry = hash_iter_next_entry(&iter)) != NULL) {
+ *     do_something(entry);
+ * }
+ */
+void hash_iter_init(hash_table_t *table, hash_iter_t *iter);
+hash_entry_t *hash_iter_next_entry(hash_iter_t *iter);
+
+/*
+ * Copy up to max of the next entries of an iterator set up by
+ * hash_iter_init() into entries and return how many were copied, 0 once
+ * all entries have been fetched. Like hash_keys() the copies share the
+ * pointers of the keys and values with the table. This is the cheapest way
+ * to copy a whole table, in chunks of any size.
+ *
+ * Unlike the other iterators this one may be used on concurrent tables
+ * while other threads modify them: each call read locks one segment at a
+ * time and the position is kept between calls without pointing into the
+ * table. Entries added or deleted in the meantime may or may not be
+ * returned, and while the table is resized some entries may be missed or
+ * returned twice.
+ */
+unsigned long hash_iter_fetch(hash_iter_t *iter, hash_entry_t *entries,
+                              unsigned long max);
+
+/*
+ * Scan a table from several threads: hash_segment_count() splits the table
+ * into that many parts, and hash_iterate_segment() calls callback for each
+ * entry of one part, as hash_iterate() does for the whole table, until it
+ * returns false. Each thread can take its share of the parts, e.g. thread
+ * i of n the parts i, i + n, i + 2n and so on. Nothing is allocated. Parts
+ * past the end of the table are empty.
+ *
+ * The table must not be modified during the scan, except for concurrent
+ * tables: their segment is read locked while it is walked, so that the
+ * callback sees it in a consistent state, but entries moved by a resize
+ * may be missed or seen twice. As with hash_iterate() the callback must
+ * not call back into a concurrent table.
+ */
+unsigned long hash_segment_count(hash_table_t *table);
+int hash_iterate_segment(hash_table_t *table, unsigned long segment,
+                         hash_iterate_callback callback, void *user_data);
+
 /*
  * Return a count of how many items are currently in the table.
  */
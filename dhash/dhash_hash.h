@@ -0,0 +1,108 @@
+/*
+    Key hash function shared by the dhash tables.
+
+    Copyright (C) 2026 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DHASH_HASH_H
+#define DHASH_HASH_H
+
+/*
+ * Not part of the API. dhash.c and the inline functions of dhash_typed.h
+ * use these to hash keys the same way, which is why the file is installed.
+ * Applications should not include it or call the dhash_priv_ functions.
+ */
+
+/*****************************************************************************/
+/******************************* Include Files *******************************/
+/*****************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*****************************************************************************/
+/*********************************** Defines *********************************/
+/*****************************************************************************/
+
+/* Multipliers of the key hash function */
+#define DHASH_PRIV_PRIME64_1 0x9e3779b185ebca87ULL
+#define DHASH_PRIV_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define DHASH_PRIV_PRIME64_3 0x165667b19e3779f9ULL
+#define DHASH_PRIV_PRIME64_4 0x85ebca77c2b2ae63ULL
+
+/*****************************************************************************/
+/****************************  Inline Functions  *****************************/
+/*****************************************************************************/
+
+static inline uint64_t dhash_priv_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * Final avalanche of the key hash, every input bit affects every output
+ * bit. Integer keys are hashed with it alone.
+ */
+static inline uint64_t dhash_priv_mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= DHASH_PRIV_PRIME64_2;
+    h ^= h >> 29;
+    h *= DHASH_PRIV_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*
+ * Hash len bytes of data eight bytes at a time, the hash the tables use
+ * for string and binary keys. Unaligned and trailing bytes are read
+ * through memcpy() which compilers turn into plain loads.
+ */
+static inline uint64_t dhash_priv_bytes64(const void *data, size_t len,
+                                          uint64_t seed)
+{
+    const char *str = data;
+    const char *end = str + len;
+    uint64_t word;
+    uint64_t h;
+
+    h = seed + DHASH_PRIV_PRIME64_4 + (uint64_t)len * DHASH_PRIV_PRIME64_1;
+
+    for (; end - str >= 8; str += 8) {
+        memcpy(&word, str, 8);
+        word *= DHASH_PRIV_PRIME64_2;
+        word = dhash_priv_rotl64(word, 31);
+        word *= DHASH_PRIV_PRIME64_1;
+        h ^= word;
+        h = dhash_priv_rotl64(h, 27) * DHASH_PRIV_PRIME64_1 +
+            DHASH_PRIV_PRIME64_4;
+    }
+    if (str < end) {
+        word = 0;
+        memcpy(&word, str, end - str);
+        word *= DHASH_PRIV_PRIME64_2;
+        word = dhash_priv_rotl64(word, 31);
+        word *= DHASH_PRIV_PRIME64_1;
+        h ^= word;
+        h = dhash_priv_rotl64(h, 27) * DHASH_PRIV_PRIME64_1 +
+            DHASH_PRIV_PRIME64_4;
+    }
+
+    return dhash_priv_mix64(h);
+}
+
+#endif /* DHASH_HASH_H */
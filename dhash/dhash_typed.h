@@ -0,0 +1,327 @@
+/*
+    Type specialized hash tables generated at compile time.
+
+    Copyright (C) 2026 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DHASH_TYPED_H
+#define DHASH_TYPED_H
+
+/*****************************************************************************/
+/******************************** Documentation ******************************/
+/*****************************************************************************/
+
+#if 0
+
+The tables of dhash.h store every key and value in tagged unions and look at
+the tags on every access. For hot maps with a fixed key and value type this
+header generates specialized tables instead, with the keys and values stored
+as they are and the hash and compare functions inlined into every operation.
+Nothing needs to be linked, all functions are static inline.
+
+DHASH_DEFINE(name, key_type, value_type) defines a table for integer keys,
+DHASH_DEFINE_EX(name, key_type, value_type, hash, equal) one for any key type
+with hash(key) returning a uint64_t and equal(a, b) true for equal keys.
+DHASH_TYPED_HASH_STR and DHASH_TYPED_EQUAL_STR can be used for C strings,
+which are stored as pointers, the caller keeps the strings alive.
+
+Either generates the types name_t and name_entry_t and these functions:
+
+int name_init(name_t *table, unsigned long count);
+    Set up an empty table sized for count entries.
+void name_destroy(name_t *table);
+    Free the memory of the table.
+int name_put(name_t *table, key_type key, value_type value);
+    Enter or update the entry for key.
+value_type *name_get(name_t *table, key_type key);
+    Return the value stored for key, NULL if key is not in the table. The
+    pointer is valid until the table is next modified.
+int name_remove(name_t *table, key_type key);
+    Delete the entry for key.
+unsigned long name_count(name_t *table);
+    Return the number of entries.
+name_entry_t *name_next(name_t *table, unsigned long *pos);
+    Iterate over the entries, starting with *pos set to 0, until NULL is
+    returned. The table must not be modified while iterating.
+
+Errors are reported with the HASH_ERROR_* codes of dhash.h. The tables use
+open addressing with Robin Hood ordering like HASH_CREATE_OPEN_ADDRESSING
+tables and are not thread safe.
+
+Example:
+
+DHASH_DEFINE(u64_u64, uint64_t, uint64_t)
+
+u64_u64_t table;
+uint64_t *value;
+
+u64_u64_init(&table, 0);
+u64_u64_put(&table, 42, 4711);
+if ((value = u64_u64_get(&table, 42)) != NULL) {
+    ...
+}
+u64_u64_destroy(&table);
+
+#endif
+
+/*****************************************************************************/
+/******************************* Include Files *******************************/
+/*****************************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dhash.h"
+#include "dhash_hash.h"
+
+/*****************************************************************************/
+/*********************************** Defines *********************************/
+/*****************************************************************************/
+
+#define DHASH_TYPED_MIN_SLOTS 16
+/* Grow above 7/8 full, shrink below 1/8 */
+#define DHASH_TYPED_MAX_LOAD_NUM 7
+#define DHASH_TYPED_MAX_LOAD_DEN 8
+#define DHASH_TYPED_MIN_LOAD_DEN 8
+/* Probe distances are kept in 16 bits, more colliding keys grow the table */
+#define DHASH_TYPED_MAX_DIST UINT16_MAX
+
+/* String hash of the library with a zero seed */
+static inline uint64_t dhash_typed_hash_str(const char *str)
+{
+    return dhash_priv_bytes64(str, strlen(str), 0);
+}
+
+#define DHASH_TYPED_HASH_INT(key) dhash_priv_mix64((uint64_t)(key))
+#define DHASH_TYPED_EQUAL(a, b) ((a) == (b))
+#define DHASH_TYPED_HASH_STR(key) dhash_typed_hash_str(key)
+#define DHASH_TYPED_EQUAL_STR(a, b) (strcmp((a), (b)) == 0)
+
+#define DHASH_DEFINE(name, key_type, value_type) \
+    DHASH_DEFINE_EX(name, key_type, value_type, \
+                    DHASH_TYPED_HASH_INT, DHASH_TYPED_EQUAL)
+
+#define DHASH_DEFINE_EX(name, key_type, value_type, hash, equal) \
+\
+typedef struct name##_entry_t { \
+    key_type key; \
+    value_type value; \
+} name##_entry_t; \
+\
+/* dist is 0 for empty slots, else 1 + distance from the home slot */ \
+typedef struct name##_t { \
+    name##_entry_t *entries; \
+    uint16_t *dist; \
+    unsigned long mask; \
+    unsigned long count; \
+} name##_t; \
+\
+/* \
+ * Check without changing the table if an entry with hash h can be placed \
+ * before a probe sequence gets too long. \
+ */ \
+static inline bool name##_fits(name##_t *table, uint64_t h) \
+{ \
+    unsigned long i; \
+    uint16_t d; \
+\
+    i = h & table->mask; \
+    for (d = 1; ; d++) { \
+        if (table->dist[i] == 0) { \
+            return true; \
+        } \
+        if (table->dist[i] < d) { \
+            d = table->dist[i]; \
+        } \
+        if (d == DHASH_TYPED_MAX_DIST) { \
+            return false; \
+        } \
+        i = (i + 1) & table->mask; \
+    } \
+} \
+\
+/* \
+ * Place an entry with hash h known not to be in the table, displacing \
+ * entries closer to their home slot. Returns false, with entry holding \
+ * the entry still to be placed, if a probe sequence got too long. \
+ */ \
+static inline bool name##_place(name##_t *table, name##_entry_t *entry, \
+                                uint64_t h) \
+{ \
+    unsigned long i; \
+    uint16_t d, tmp_dist; \
+    name##_entry_t tmp; \
+\
+    i = h & table->mask; \
+    for (d = 1; ; d++) { \
+        if (table->dist[i] == 0) { \
+            table->dist[i] = d; \
+            table->entries[i] = *entry; \
+            return true; \
+        } \
+        if (table->dist[i] < d) { \
+            tmp = table->entries[i]; \
+            table->entries[i] = *entry; \
+            *entry = tmp; \
+            tmp_dist = table->dist[i]; \
+            table->dist[i] = d; \
+            d = tmp_dist; \
+        } \
+        if (d == DHASH_TYPED_MAX_DIST) { \
+            return false; \
+        } \
+        i = (i + 1) & table->mask; \
+    } \
+} \
+\
+static inline int name##_resize(name##_t *table, unsigned long slots) \
+{ \
+    name##_t old = *table; \
+    name##_entry_t entry; \
+    unsigned long i; \
+\
+    table->entries = (name##_entry_t *)malloc(slots * sizeof(name##_entry_t)); \
+    table->dist = (uint16_t *)calloc(slots, sizeof(uint16_t)); \
+    table->mask = slots - 1; \
+    if (table->entries == NULL || table->dist == NULL) { \
+        goto fail; \
+    } \
+    for (i = 0; old.dist && i <= old.mask; i++) { \
+        if (old.dist[i] != 0) { \
+            entry = old.entries[i]; \
+            if (!name##_place(table, &entry, hash(entry.key))) { \
+                goto fail; \
+            } \
+        } \
+    } \
+    free(old.entries); \
+    free(old.dist); \
+    return HASH_SUCCESS; \
+\
+fail: \
+    free(table->entries); \
+    free(table->dist); \
+    *table = old; \
+    return HASH_ERROR_NO_MEMORY; \
+} \
+\
+static inline int name##_init(name##_t *table, unsigned long count) \
+{ \
+    unsigned long slots; \
+\
+    for (slots = DHASH_TYPED_MIN_SLOTS; \
+         slots * DHASH_TYPED_MAX_LOAD_NUM < count * DHASH_TYPED_MAX_LOAD_DEN; \
+         slots <<= 1); \
+    memset(table, 0, sizeof(name##_t)); \
+    return name##_resize(table, slots); \
+} \
+\
+static inline void name##_destroy(name##_t *table) \
+{ \
+    free(table->entries); \
+    free(table->dist); \
+    memset(table, 0, sizeof(name##_t)); \
+} \
+\
+static inline unsigned long name##_find(name##_t *table, key_type key, \
+                                        uint64_t h) \
+{ \
+    unsigned long i; \
+    uint16_t d; \
+\
+    for (i = h & table->mask, d = 1; table->dist[i] >= d; \
+         i = (i + 1) & table->mask, d++) { \
+        if (table->dist[i] == d && equal(table->entries[i].key, key)) { \
+            return i; \
+        } \
+    } \
+    return table->mask + 1; \
+} \
+\
+static inline value_type *name##_get(name##_t *table, key_type key) \
+{ \
+    unsigned long i = name##_find(table, key, hash(key)); \
+\
+    return i <= table->mask ? &table->entries[i].value : NULL; \
+} \
+\
+static inline int name##_put(name##_t *table, key_type key, value_type value) \
+{ \
+    name##_entry_t entry; \
+    uint64_t h = hash(key); \
+    unsigned long i; \
+\
+    if ((i = name##_find(table, key, h)) <= table->mask) { \
+        table->entries[i].value = value; \
+        return HASH_SUCCESS; \
+    } \
+    if ((table->count + 1) * DHASH_TYPED_MAX_LOAD_DEN > \
+        (table->mask + 1) * DHASH_TYPED_MAX_LOAD_NUM && \
+        name##_resize(table, (table->mask + 1) << 1) != HASH_SUCCESS) { \
+        return HASH_ERROR_NO_MEMORY; \
+    } \
+    /* Grow first, a failed place would leave a displaced entry out */ \
+    while (!name##_fits(table, h)) { \
+        if (name##_resize(table, (table->mask + 1) << 1) != HASH_SUCCESS) { \
+            return HASH_ERROR_NO_MEMORY; \
+        } \
+    } \
+    entry.key = key; \
+    entry.value = value; \
+    name##_place(table, &entry, h); \
+    table->count++; \
+    return HASH_SUCCESS; \
+} \
+\
+static inline int name##_remove(name##_t *table, key_type key) \
+{ \
+    unsigned long i, j; \
+\
+    if ((i = name##_find(table, key, hash(key))) > table->mask) { \
+        return HASH_ERROR_KEY_NOT_FOUND; \
+    } \
+    /* Shift the following entries of the cluster back by one */ \
+    for (j = (i + 1) & table->mask; table->dist[j] > 1; \
+         i = j, j = (j + 1) & table->mask) { \
+        table->entries[i] = table->entries[j]; \
+        table->dist[i] = table->dist[j] - 1; \
+    } \
+    table->dist[i] = 0; \
+    table->count--; \
+    /* Failing to shrink is harmless */ \
+    if (table->mask + 1 > DHASH_TYPED_MIN_SLOTS && \
+        table->count * DHASH_TYPED_MIN_LOAD_DEN < table->mask + 1) { \
+        name##_resize(table, (table->mask + 1) >> 1); \
+    } \
+    return HASH_SUCCESS; \
+} \
+\
+static inline unsigned long name##_count(name##_t *table) \
+{ \
+    return table->count; \
+} \
+\
+static inline name##_entry_t *name##_next(name##_t *table, unsigned long *pos) \
+{ \
+    while (*pos <= table->mask) { \
+        if (table->dist[(*pos)++] != 0) { \
+            return &table->entries[*pos - 1]; \
+        } \
+    } \
+    return NULL; \
+}
+
+#endif /* DHASH_TYPED_H */
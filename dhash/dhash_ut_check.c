@@ -23,14 +23,22 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <check.h>
 
 /* #define TRACE_LEVEL 7 */
 #define TRACE_HOME
 #include "dhash.h"
+#include "dhash_typed.h"
 
 #define HTABLE_SIZE 128
 
+DHASH_DEFINE(u64_u64, uint64_t, uint64_t)
+DHASH_DEFINE_EX(str_ulong, const char *, unsigned long,
+                DHASH_TYPED_HASH_STR, DHASH_TYPED_EQUAL_STR)
+
 int verbose = 0;
 
 /* There must be no warnings generated during this test
@@ -199,6 +207,1294 @@ START_TEST(test_key_ulong)
 }
 END_TEST
 
+START_TEST(test_open_addressing)
+{
+    hash_table_t *htable;
+    int ret;
+    unsigned long i;
+    unsigned long count;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    hash_entry_t *entry;
+    struct hash_iter_context_t *iter;
+    char buf[32];
+
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, HASH_CREATE_OPEN_ADDRESSING);
+    fail_unless(ret == 0);
+
+    /* Enough entries to force the slot array to grow several times */
+    for (i = 0; i < 10000; i++) {
+        enter_val.type = HASH_VALUE_ULONG;
+        enter_val.ul = i;
+        if (i & 1) {
+            snprintf(buf, sizeof(buf), "key%lu", i);
+            key.type = HASH_KEY_STRING;
+            key.str = buf;
+        } else {
+            key.type = HASH_KEY_ULONG;
+            key.ul = i;
+        }
+        ret = hash_enter(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+    }
+    fail_unless(hash_count(htable) == 10000);
+
+    count = 0;
+    iter = new_hash_iter_context(htable);
+    fail_unless(iter != NULL);
+    while ((entry = iter->next(iter)) != NULL) {
+        count++;
+    }
+    free(iter);
+    fail_unless(count == 10000);
+
+    /* Delete every entry but every tenth one, forcing the table to shrink */
+    for (i = 0; i < 10000; i++) {
+        if (i & 1) {
+            snprintf(buf, sizeof(buf), "key%lu", i);
+            key.type = HASH_KEY_STRING;
+            key.str = buf;
+        } else {
+            key.type = HASH_KEY_ULONG;
+            key.ul = i;
+        }
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == 0);
+        fail_unless(ret_val.ul == i);
+
+        if (i % 10 != 0) {
+            ret = hash_delete(htable, &key);
+            fail_unless(ret == 0);
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        }
+    }
+    fail_unless(hash_count(htable) == 1000);
+
+    for (i = 0; i < 10000; i += 10) {
+        key.type = HASH_KEY_ULONG;
+        key.ul = i;
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == 0);
+        fail_unless(ret_val.ul == i);
+    }
+
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    /* Unknown flags are rejected */
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, 0x8000);
+    fail_unless(ret == EINVAL);
+    fail_unless(htable == NULL);
+
+    /* Open addressing tables can't be concurrent */
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, HASH_CREATE_OPEN_ADDRESSING |
+                                        HASH_CREATE_CONCURRENT);
+    fail_unless(ret == EINVAL);
+    fail_unless(htable == NULL);
+}
+END_TEST
+
+START_TEST(test_similar_string_keys)
+{
+    hash_table_t *htable;
+    hash_statistics_t stats;
+    int ret;
+    unsigned long i;
+    unsigned int flags;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    char buf[64];
+
+    /* Run once with the default and once with a random seed */
+    for (flags = 0; flags <= HASH_CREATE_RANDOM_SEED;
+         flags += HASH_CREATE_RANDOM_SEED) {
+        ret = hash_create_flags(20000, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, flags);
+        fail_unless(ret == 0);
+
+        /* Keys differing only in a few characters in the middle */
+        key.type = HASH_KEY_STRING;
+        key.str = buf;
+        enter_val.type = HASH_VALUE_ULONG;
+        for (i = 0; i < 20000; i++) {
+            snprintf(buf, sizeof(buf), "uid=user%lu,ou=people,dc=example,dc=com", i);
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 20000);
+
+        for (i = 0; i < 20000; i++) {
+            snprintf(buf, sizeof(buf), "uid=user%lu,ou=people,dc=example,dc=com", i);
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == 0);
+            fail_unless(ret_val.ul == i);
+        }
+
+        /* Chains stay close to the load factor with a well distributed hash */
+        ret = hash_get_statistics(htable, &stats);
+        fail_unless(ret == 0);
+        fail_unless(stats.hash_collisions <
+                    (HASH_DEFAULT_MAX_LOAD_FACTOR + 2) * stats.hash_accesses);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+static void count_deletes(hash_entry_t *entry, hash_destroy_enum type, void *pvt)
+{
+    unsigned long *deletes = (unsigned long *)pvt;
+
+    deletes[type == HASH_TABLE_DESTROY ? 1 : 0]++;
+}
+
+static void make_slab_key(unsigned long i, hash_key_t *key, char *buf, size_t len)
+{
+    /* Every third key is too long to be stored inside the element */
+    if (i % 3 == 0) {
+        snprintf(buf, len, "cn=%lu,ou=a rather long organizational unit,dc=example,dc=com", i);
+        key->type = HASH_KEY_STRING;
+        key->str = buf;
+    } else if (i % 3 == 1) {
+        snprintf(buf, len, "key%lu", i);
+        key->type = HASH_KEY_STRING;
+        key->str = buf;
+    } else {
+        key->type = HASH_KEY_ULONG;
+        key->ul = i;
+    }
+}
+
+START_TEST(test_slab_alloc)
+{
+    hash_table_t *htable;
+    int ret;
+    unsigned long i;
+    unsigned long deletes[2];
+    hash_delete_callback *callback;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    char buf[128];
+
+    /* Once with a delete callback and once taking the bulk destroy path */
+    for (callback = count_deletes; ; callback = NULL) {
+        deletes[0] = deletes[1] = 0;
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                callback, deletes, HASH_CREATE_SLAB_ALLOC);
+        fail_unless(ret == 0);
+
+        enter_val.type = HASH_VALUE_ULONG;
+        for (i = 0; i < 5000; i++) {
+            make_slab_key(i, &key, buf, sizeof(buf));
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 5000);
+
+        /* Delete half of the entries and enter them again from the free list */
+        for (i = 0; i < 5000; i += 2) {
+            make_slab_key(i, &key, buf, sizeof(buf));
+            ret = hash_delete(htable, &key);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 2500);
+        for (i = 0; i < 5000; i += 2) {
+            make_slab_key(i, &key, buf, sizeof(buf));
+            enter_val.ul = i * 2;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+
+        for (i = 0; i < 5000; i++) {
+            make_slab_key(i, &key, buf, sizeof(buf));
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == 0);
+            fail_unless(ret_val.ul == (i & 1 ? i : i * 2));
+        }
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+
+        if (callback == NULL) break;
+        fail_unless(deletes[0] == 2500);
+        fail_unless(deletes[1] == 5000);
+    }
+
+    /* Open addressing tables don't have elements to allocate */
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, HASH_CREATE_OPEN_ADDRESSING |
+                                        HASH_CREATE_SLAB_ALLOC);
+    fail_unless(ret == EINVAL);
+}
+END_TEST
+
+#define BATCH_KEYS 3000
+
+START_TEST(test_batch)
+{
+    static const unsigned int table_flags[] = {
+        0, HASH_CREATE_OPEN_ADDRESSING, HASH_CREATE_SLAB_ALLOC,
+        HASH_CREATE_CONCURRENT
+    };
+    static char bufs[BATCH_KEYS + 100][32];
+    hash_table_t *htable;
+    hash_key_t *keys;
+    hash_value_t *values;
+    int *results;
+    int ret;
+    unsigned long i, f;
+
+    keys = calloc(BATCH_KEYS + 100, sizeof(hash_key_t));
+    values = calloc(BATCH_KEYS + 100, sizeof(hash_value_t));
+    results = calloc(BATCH_KEYS + 100, sizeof(int));
+    fail_unless(keys != NULL && values != NULL && results != NULL);
+
+    for (i = 0; i < BATCH_KEYS + 100; i++) {
+        if (i & 1) {
+            snprintf(bufs[i], sizeof(bufs[i]), "key%lu", i);
+            keys[i].type = HASH_KEY_STRING;
+            keys[i].str = bufs[i];
+        } else {
+            keys[i].type = HASH_KEY_ULONG;
+            keys[i].ul = i;
+        }
+    }
+
+    for (f = 0; f < sizeof(table_flags) / sizeof(table_flags[0]); f++) {
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, table_flags[f]);
+        fail_unless(ret == 0);
+
+        for (i = 0; i < BATCH_KEYS; i++) {
+            values[i].type = HASH_VALUE_ULONG;
+            values[i].ul = i * 7;
+        }
+        ret = hash_enter_batch(htable, BATCH_KEYS, keys, values);
+        fail_unless(ret == 0);
+        fail_unless(hash_count(htable) == BATCH_KEYS);
+
+        /* The last 100 keys were never entered */
+        memset(values, 0, (BATCH_KEYS + 100) * sizeof(hash_value_t));
+        ret = hash_lookup_batch(htable, BATCH_KEYS + 100, keys, values, results);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        for (i = 0; i < BATCH_KEYS + 100; i++) {
+            if (i < BATCH_KEYS) {
+                fail_unless(results[i] == HASH_SUCCESS);
+                fail_unless(values[i].ul == i * 7);
+            } else {
+                fail_unless(results[i] == HASH_ERROR_KEY_NOT_FOUND);
+            }
+        }
+
+        /* Delete the first half, then everything */
+        ret = hash_delete_batch(htable, BATCH_KEYS / 2, keys, NULL);
+        fail_unless(ret == 0);
+        fail_unless(hash_count(htable) == BATCH_KEYS / 2);
+        ret = hash_lookup_batch(htable, BATCH_KEYS, keys, values, results);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        for (i = 0; i < BATCH_KEYS; i++) {
+            fail_unless(results[i] == (i < BATCH_KEYS / 2 ?
+                                       HASH_ERROR_KEY_NOT_FOUND : HASH_SUCCESS));
+        }
+        ret = hash_delete_batch(htable, BATCH_KEYS, keys, results);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        fail_unless(results[0] == HASH_ERROR_KEY_NOT_FOUND);
+        fail_unless(results[BATCH_KEYS - 1] == HASH_SUCCESS);
+        fail_unless(hash_count(htable) == 0);
+
+        /* Nothing is entered if any of the keys is invalid */
+        keys[10].type = (hash_key_enum)-1;
+        ret = hash_enter_batch(htable, BATCH_KEYS, keys, values);
+        fail_unless(ret == HASH_ERROR_BAD_KEY_TYPE);
+        fail_unless(hash_count(htable) == 0);
+        keys[10].type = HASH_KEY_ULONG;
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+
+    free(keys);
+    free(values);
+    free(results);
+}
+END_TEST
+
+START_TEST(test_binary_keys)
+{
+    hash_table_t *htable;
+    int ret;
+    unsigned long i;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    hash_binary_t bin;
+    unsigned int flags;
+    unsigned char data[64];
+
+    key.type = HASH_KEY_BINARY;
+    key.bin = &bin;
+    bin.data = data;
+    enter_val.type = HASH_VALUE_ULONG;
+
+    /* Short keys are stored inline in slab allocated elements */
+    for (flags = 0; flags <= HASH_CREATE_SLAB_ALLOC;
+         flags += HASH_CREATE_SLAB_ALLOC) {
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, flags);
+        fail_unless(ret == 0);
+
+        /* Prefixes of the same bytes, with embedded zeros, are distinct keys */
+        memset(data, 0, sizeof(data));
+        for (i = 0; i <= sizeof(data); i++) {
+            bin.len = i;
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == sizeof(data) + 1);
+
+        /* Lookups only need equal bytes, not the same buffer */
+        for (i = 0; i <= sizeof(data); i++) {
+            unsigned char copy[sizeof(data)];
+            hash_binary_t other = { copy, i };
+            hash_key_t other_key;
+
+            memset(copy, 0, sizeof(copy));
+            other_key.type = HASH_KEY_BINARY;
+            other_key.bin = &other;
+            ret = hash_lookup(htable, &other_key, &ret_val);
+            fail_unless(ret == 0);
+            fail_unless(ret_val.ul == i);
+        }
+
+        data[0] = 1;
+        bin.len = 1;
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_key_ownership)
+{
+    static const unsigned int modes[] = {
+        HASH_CREATE_BORROW_KEYS, HASH_CREATE_ADOPT_KEYS, HASH_CREATE_INTERN_KEYS
+    };
+    hash_table_t *htable;
+    int ret;
+    unsigned long i, m, count;
+    unsigned int flags;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    hash_key_t *keys;
+    char bufs[1000][16];
+    char *str;
+
+    enter_val.type = HASH_VALUE_ULONG;
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]) * 2; m++) {
+        flags = modes[m / 2] | (m & 1 ? HASH_CREATE_SLAB_ALLOC : 0);
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, flags);
+        fail_unless(ret == 0);
+
+        /* Every key is entered twice, the second time only updates it */
+        for (i = 0; i < 2000; i++) {
+            snprintf(bufs[i % 1000], sizeof(bufs[0]), "key%lu", i % 1000);
+            if (flags & HASH_CREATE_ADOPT_KEYS) {
+                str = strdup(bufs[i % 1000]);
+                fail_unless(str != NULL);
+            } else {
+                str = bufs[i % 1000];
+            }
+            key.type = HASH_KEY_STRING;
+            key.str = str;
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 1000);
+
+        /* Borrowed keys are the caller's strings */
+        ret = hash_keys(htable, &count, &keys);
+        fail_unless(ret == 0);
+        fail_unless(count == 1000);
+        for (i = 0; i < count; i++) {
+            if (flags & HASH_CREATE_BORROW_KEYS) {
+                fail_unless(keys[i].str >= bufs[0] && keys[i].str <= bufs[999]);
+            } else {
+                fail_unless(keys[i].str < bufs[0] || keys[i].str > bufs[999]);
+            }
+        }
+        free(keys);
+
+        for (i = 0; i < 1000; i += 2) {
+            key.type = HASH_KEY_CONST_STRING;
+            key.c_str = bufs[i];
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+            key.type = HASH_KEY_STRING;
+            key.str = bufs[i];
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == 0);
+            fail_unless(ret_val.ul == i + 1000);
+            ret = hash_delete(htable, &key);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 500);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+
+    /* Only one ownership mode at a time */
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, HASH_CREATE_BORROW_KEYS |
+                                        HASH_CREATE_INTERN_KEYS);
+    fail_unless(ret == EINVAL);
+}
+END_TEST
+
+static void count_evictions(hash_entry_t *entry, hash_destroy_enum type, void *pvt)
+{
+    unsigned long *evictions = (unsigned long *)pvt;
+
+    if (type == HASH_ENTRY_EVICT) {
+        (*evictions)++;
+    }
+}
+
+START_TEST(test_eviction)
+{
+    hash_table_t *htable;
+    int ret;
+    unsigned long i, evictions;
+    unsigned int flags;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+
+    key.type = HASH_KEY_ULONG;
+    enter_val.type = HASH_VALUE_ULONG;
+    for (flags = HASH_CREATE_EVICTION; ;
+         flags = HASH_CREATE_EVICTION | HASH_CREATE_SLAB_ALLOC) {
+        /* LRU: the entry looked up last survives */
+        evictions = 0;
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                count_evictions, &evictions, flags);
+        fail_unless(ret == 0);
+        ret = hash_set_eviction(htable, HASH_EVICT_LRU, 100, 0);
+        fail_unless(ret == 0);
+        for (i = 0; i < 100; i++) {
+            key.ul = i;
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        key.ul = 0;
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == 0);
+        key.ul = 100;
+        ret = hash_enter(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+        fail_unless(evictions == 1);
+        key.ul = 0;
+        fail_unless(hash_has_key(htable, &key));
+        key.ul = 1;
+        fail_unless(!hash_has_key(htable, &key));
+        for (i = 101; i < 1000; i++) {
+            key.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 100);
+        fail_unless(evictions == 900);
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+
+        /* CLOCK: entries looked up get a second chance */
+        evictions = 0;
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                count_evictions, &evictions, flags);
+        fail_unless(ret == 0);
+        ret = hash_set_eviction(htable, HASH_EVICT_CLOCK, 100, 0);
+        fail_unless(ret == 0);
+        for (i = 0; i < 100; i++) {
+            key.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        for (i = 0; i < 50; i++) {
+            key.ul = i;
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == 0);
+        }
+        for (i = 100; i < 150; i++) {
+            key.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(evictions == 50);
+        for (i = 0; i < 150; i++) {
+            key.ul = i;
+            fail_unless(hash_has_key(htable, &key) == (i < 50 || i >= 100));
+        }
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+
+        /* TTL: expired entries are gone, the one entered without stays */
+        evictions = 0;
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                count_evictions, &evictions, flags);
+        fail_unless(ret == 0);
+        ret = hash_set_eviction(htable, HASH_EVICT_NONE, 0, 50);
+        fail_unless(ret == 0);
+        for (i = 0; i < 10; i++) {
+            key.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        key.ul = 10;
+        ret = hash_enter_ttl(htable, &key, &enter_val, 0);
+        fail_unless(ret == 0);
+        usleep(100000);
+        fail_unless(hash_count(htable) == 11);
+        key.ul = 0;
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        fail_unless(evictions == 1);
+        ret = hash_expire(htable);
+        fail_unless(ret == 0);
+        fail_unless(evictions == 10);
+        fail_unless(hash_count(htable) == 1);
+        key.ul = 10;
+        fail_unless(hash_has_key(htable, &key));
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+        fail_unless(evictions == 10);
+
+        if (flags & HASH_CREATE_SLAB_ALLOC) break;
+    }
+
+    /* Eviction needs the flag and a chained table without locking */
+    ret = hash_create(0, &htable, NULL, NULL);
+    fail_unless(ret == 0);
+    ret = hash_set_eviction(htable, HASH_EVICT_LRU, 100, 0);
+    fail_unless(ret == EINVAL);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, HASH_CREATE_EVICTION |
+                                        HASH_CREATE_CONCURRENT);
+    fail_unless(ret == EINVAL);
+}
+END_TEST
+
+START_TEST(test_stats)
+{
+    static const unsigned int table_flags[] = {
+        0, HASH_CREATE_OPEN_ADDRESSING, HASH_CREATE_CONCURRENT
+    };
+    hash_table_t *htable;
+    hash_stats_t stats;
+    int ret;
+    unsigned long i, f, sum;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+
+    key.type = HASH_KEY_ULONG;
+    enter_val.type = HASH_VALUE_ULONG;
+    for (f = 0; f < sizeof(table_flags) / sizeof(table_flags[0]); f++) {
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, table_flags[f]);
+        fail_unless(ret == 0);
+
+        /* Nothing is collected until enabled */
+        ret = hash_get_stats(htable, &stats);
+        fail_unless(ret == 0);
+        fail_unless(stats.bytes_allocated == 0 && stats.lookups == 0);
+
+        ret = hash_enable_stats(htable, HASH_STATS_COUNTERS | HASH_STATS_LATENCY, 1);
+        fail_unless(ret == 0);
+        for (i = 0; i < 2000; i++) {
+            key.ul = i;
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        for (i = 0; i < 3000; i++) {
+            key.ul = i;
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == (i < 2000 ? 0 : HASH_ERROR_KEY_NOT_FOUND));
+        }
+        for (i = 0; i < 2000; i++) {
+            key.ul = i;
+            ret = hash_delete(htable, &key);
+            fail_unless(ret == 0);
+        }
+
+        ret = hash_get_stats(htable, &stats);
+        fail_unless(ret == 0);
+        fail_unless(stats.lookups == 3000);
+        fail_unless(stats.hits == 2000);
+        fail_unless(stats.expansions > 0);
+        fail_unless(stats.contractions > 0);
+        fail_unless(stats.bytes_allocated > 0);
+        for (i = 0, sum = 0; i < HASH_STATS_CHAIN_BUCKETS; i++) {
+            sum += stats.chain_length[i];
+        }
+        fail_unless(sum >= 7000);
+        for (i = 0, sum = 0; i < HASH_STATS_LATENCY_BUCKETS; i++) {
+            sum += stats.lookup_latency[i];
+        }
+        fail_unless(sum == 3000);
+        for (i = 0, sum = 0; i < HASH_STATS_LATENCY_BUCKETS; i++) {
+            sum += stats.enter_latency[i] + stats.delete_latency[i];
+        }
+        fail_unless(sum == 4000);
+
+        /* Disabling clears and stops counting */
+        ret = hash_enable_stats(htable, 0, 0);
+        fail_unless(ret == 0);
+        key.ul = 0;
+        hash_lookup(htable, &key, &ret_val);
+        ret = hash_get_stats(htable, &stats);
+        fail_unless(ret == 0);
+        fail_unless(stats.lookups == 0);
+
+        ret = hash_enable_stats(htable, 0x100, 0);
+        fail_unless(ret == EINVAL);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_dump_load)
+{
+    hash_table_t *htable;
+    int ret, fd;
+    unsigned long i, deletes[2];
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    hash_key_t keys[100];
+    hash_value_t values[100];
+    struct hash_iter_context_t *iter;
+    char path[] = "/tmp/dhash_ut_XXXXXX";
+    char buf[32];
+    uint64_t used = 1;
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0);
+    close(fd);
+
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL, HASH_CREATE_RANDOM_SEED);
+    fail_unless(ret == 0);
+    for (i = 0; i < 1000; i++) {
+        if (i & 1) {
+            snprintf(buf, sizeof(buf), "key%lu", i);
+            key.type = HASH_KEY_STRING;
+            key.str = buf;
+            enter_val.type = HASH_VALUE_DOUBLE;
+            enter_val.d = i / 2.0;
+        } else {
+            key.type = HASH_KEY_ULONG;
+            key.ul = i;
+            enter_val.type = HASH_VALUE_ULONG;
+            enter_val.ul = i * 3;
+        }
+        ret = hash_enter(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+    }
+    ret = hash_dump(htable, path);
+    fail_unless(ret == 0);
+
+    /* Pointers don't survive a restart */
+    enter_val.type = HASH_VALUE_PTR;
+    enter_val.ptr = buf;
+    key.type = HASH_KEY_ULONG;
+    key.ul = 5000;
+    ret = hash_enter(htable, &key, &enter_val);
+    fail_unless(ret == 0);
+    ret = hash_dump(htable, path);
+    fail_unless(ret == HASH_ERROR_BAD_VALUE_TYPE);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    /* Unmodified images were left alone by the failed dump */
+    deletes[0] = deletes[1] = 0;
+    ret = hash_load(path, &htable, NULL, NULL, NULL, count_deletes, deletes);
+    fail_unless(ret == 0);
+    fail_unless(hash_count(htable) == 1000);
+    for (i = 0; i < 1100; i++) {
+        if (i & 1) {
+            snprintf(buf, sizeof(buf), "key%lu", i);
+            key.type = HASH_KEY_STRING;
+            key.str = buf;
+        } else {
+            key.type = HASH_KEY_ULONG;
+            key.ul = i;
+        }
+        ret = hash_lookup(htable, &key, &ret_val);
+        if (i >= 1000) {
+            fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        } else if (i & 1) {
+            fail_unless(ret == 0);
+            fail_unless(ret_val.type == HASH_VALUE_DOUBLE && ret_val.d == i / 2.0);
+        } else {
+            fail_unless(ret == 0);
+            fail_unless(ret_val.type == HASH_VALUE_ULONG && ret_val.ul == i * 3);
+        }
+    }
+    for (i = 0; i < 100; i++) {
+        keys[i].type = HASH_KEY_ULONG;
+        keys[i].ul = i * 2;
+    }
+    ret = hash_lookup_batch(htable, 100, keys, values, NULL);
+    fail_unless(ret == 0);
+    fail_unless(values[99].ul == 198 * 3);
+    iter = new_hash_iter_context(htable);
+    fail_unless(iter != NULL);
+    for (i = 0; iter->next(iter) != NULL; i++);
+    free(iter);
+    fail_unless(i == 1000);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+    fail_unless(deletes[1] == 1000);
+
+    /* The first modification copies the image into a table of its own */
+    ret = hash_load(path, &htable, NULL, NULL, NULL, NULL, NULL);
+    fail_unless(ret == 0);
+    key.type = HASH_KEY_ULONG;
+    key.ul = 0;
+    ret = hash_delete(htable, &key);
+    fail_unless(ret == 0);
+    enter_val.type = HASH_VALUE_ULONG;
+    enter_val.ul = 7;
+    key.ul = 2000;
+    ret = hash_enter(htable, &key, &enter_val);
+    fail_unless(ret == 0);
+    fail_unless(hash_count(htable) == 1000);
+    snprintf(buf, sizeof(buf), "key%d", 999);
+    key.type = HASH_KEY_STRING;
+    key.str = buf;
+    ret = hash_lookup(htable, &key, &ret_val);
+    fail_unless(ret == 0 && ret_val.d == 499.5);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    /* Dumping over a loaded image leaves the mapping alone */
+    ret = hash_load(path, &htable, NULL, NULL, NULL, NULL, NULL);
+    fail_unless(ret == 0);
+    ret = hash_dump(htable, path);
+    fail_unless(ret == 0);
+    ret = hash_dump(htable, path);
+    fail_unless(ret == 0);
+    ret = hash_lookup(htable, &key, &ret_val);
+    fail_unless(ret == 0 && ret_val.d == 499.5);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    /* Misses end in a damaged image without empty slots, the 8 slots of
+     * 40 bytes follow the 56 bytes of the header */
+    ret = hash_create(0, &htable, NULL, NULL);
+    fail_unless(ret == 0);
+    ret = hash_dump(htable, path);
+    fail_unless(ret == 0);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+    fd = open(path, O_WRONLY);
+    fail_unless(fd >= 0);
+    for (i = 0; i < 8; i++) {
+        fail_unless(pwrite(fd, &used, 8, 56 + i * 40) == 8);
+    }
+    close(fd);
+    ret = hash_load(path, &htable, NULL, NULL, NULL, NULL, NULL);
+    fail_unless(ret == 0);
+    key.type = HASH_KEY_ULONG;
+    key.ul = 12345;
+    ret = hash_lookup(htable, &key, &ret_val);
+    fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    /* Anything else is rejected */
+    fd = open(path, O_WRONLY | O_TRUNC);
+    fail_unless(fd >= 0);
+    fail_unless(write(fd, "not an image of a table, really", 32) == 32);
+    close(fd);
+    ret = hash_load(path, &htable, NULL, NULL, NULL, NULL, NULL);
+    fail_unless(ret == EINVAL);
+    fail_unless(htable == NULL);
+
+    unlink(path);
+}
+END_TEST
+
+static bool sum_keys(hash_entry_t *item, void *user_data)
+{
+    unsigned long *sum = (unsigned long *)user_data;
+
+    *sum += item->key.ul;
+    return true;
+}
+
+START_TEST(test_iterators)
+{
+    static const unsigned int table_flags[] = {
+        0, HASH_CREATE_OPEN_ADDRESSING, HASH_CREATE_SLAB_ALLOC,
+        HASH_CREATE_CONCURRENT
+    };
+    hash_table_t *htable;
+    int ret;
+    unsigned long i, f, n, count, sum;
+    hash_value_t enter_val;
+    hash_key_t key;
+    hash_iter_t iter;
+    hash_entry_t *entry;
+    hash_entry_t entries[7];
+    const unsigned long expected = 4999UL * 5000 / 2;
+
+    key.type = HASH_KEY_ULONG;
+    enter_val.type = HASH_VALUE_ULONG;
+    for (f = 0; f < sizeof(table_flags) / sizeof(table_flags[0]); f++) {
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, table_flags[f]);
+        fail_unless(ret == 0);
+        for (i = 0; i < 5000; i++) {
+            key.ul = i;
+            enter_val.ul = i;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+
+        count = sum = 0;
+        hash_iter_init(htable, &iter);
+        while ((entry = hash_iter_next_entry(&iter)) != NULL) {
+            count++;
+            sum += entry->key.ul;
+        }
+        fail_unless(count == 5000 && sum == expected);
+        fail_unless(hash_iter_next_entry(&iter) == NULL);
+
+        /* In chunks smaller than some chains */
+        count = sum = 0;
+        hash_iter_init(htable, &iter);
+        while ((n = hash_iter_fetch(&iter, entries, 7)) != 0) {
+            fail_unless(n <= 7);
+            for (i = 0; i < n; i++) {
+                fail_unless(entries[i].value.ul == entries[i].key.ul);
+                sum += entries[i].key.ul;
+            }
+            count += n;
+        }
+        fail_unless(count == 5000 && sum == expected);
+
+        /* The segments cover every entry exactly once */
+        sum = 0;
+        n = hash_segment_count(htable);
+        fail_unless(n > 0);
+        for (i = 0; i <= n; i++) {
+            ret = hash_iterate_segment(htable, i, sum_keys, &sum);
+            fail_unless(ret == 0);
+        }
+        fail_unless(sum == expected);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_reserve)
+{
+    static const unsigned int table_flags[] = {
+        0, HASH_CREATE_OPEN_ADDRESSING, HASH_CREATE_CONCURRENT
+    };
+    hash_table_t *htable;
+    hash_stats_t stats;
+    int ret;
+    unsigned long i, f;
+    hash_value_t enter_val;
+    hash_key_t key;
+
+    key.type = HASH_KEY_ULONG;
+    enter_val.type = HASH_VALUE_ULONG;
+    for (f = 0; f < sizeof(table_flags) / sizeof(table_flags[0]); f++) {
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, table_flags[f]);
+        fail_unless(ret == 0);
+        ret = hash_reserve(htable, 10000);
+        fail_unless(ret == 0);
+
+        /* Reserved tables neither grow nor shrink while churning */
+        ret = hash_enable_stats(htable, HASH_STATS_COUNTERS, 0);
+        fail_unless(ret == 0);
+        for (i = 0; i < 30000; i++) {
+            key.ul = i % 10000;
+            enter_val.ul = i;
+            if (i / 10000 == 1) {
+                ret = hash_delete(htable, &key);
+            } else {
+                ret = hash_enter(htable, &key, &enter_val);
+            }
+            fail_unless(ret == 0);
+        }
+        ret = hash_get_stats(htable, &stats);
+        fail_unless(ret == 0);
+        fail_unless(stats.expansions == 0 && stats.contractions == 0);
+        fail_unless(hash_count(htable) == 10000);
+
+        /* Released, chained tables merge up to the budget per delete */
+        for (i = 0; i < 9990; i++) {
+            key.ul = i;
+            ret = hash_delete(htable, &key);
+            fail_unless(ret == 0);
+        }
+        ret = hash_reserve(htable, 0);
+        fail_unless(ret == 0);
+        ret = hash_set_resize_budget(htable, 0);
+        fail_unless(ret == EINVAL);
+        ret = hash_set_resize_budget(htable, 16);
+        fail_unless(ret == 0);
+        ret = hash_get_stats(htable, &stats);
+        fail_unless(ret == 0);
+        fail_unless(stats.contractions == 0);
+        key.ul = 9990;
+        ret = hash_delete(htable, &key);
+        fail_unless(ret == 0);
+        ret = hash_get_stats(htable, &stats);
+        fail_unless(ret == 0);
+        if (table_flags[f] & HASH_CREATE_OPEN_ADDRESSING) {
+            fail_unless(stats.contractions == 1);
+        } else {
+            fail_unless(stats.contractions == 16);
+        }
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_typed)
+{
+    static const char *names[] = { "one", "two", "three", "four", "five" };
+    u64_u64_t table;
+    u64_u64_entry_t *entry;
+    str_ulong_t strings;
+    uint64_t *value, i, sum;
+    unsigned long pos, *ul;
+    int ret;
+
+    ret = u64_u64_init(&table, 0);
+    fail_unless(ret == HASH_SUCCESS);
+    for (i = 0; i < 10000; i++) {
+        ret = u64_u64_put(&table, i * 7, i);
+        fail_unless(ret == HASH_SUCCESS);
+    }
+    fail_unless(u64_u64_count(&table) == 10000);
+    for (i = 0; i < 10000; i++) {
+        value = u64_u64_get(&table, i * 7);
+        fail_unless(value != NULL && *value == i);
+        fail_unless(u64_u64_get(&table, i * 7 + 1) == NULL);
+    }
+
+    /* Updates replace the value in place */
+    ret = u64_u64_put(&table, 0, 4711);
+    fail_unless(ret == HASH_SUCCESS);
+    fail_unless(u64_u64_count(&table) == 10000);
+    fail_unless(*u64_u64_get(&table, 0) == 4711);
+
+    /* Delete every other key, shrinking the table on the way */
+    for (i = 0; i < 10000; i += 2) {
+        ret = u64_u64_remove(&table, i * 7);
+        fail_unless(ret == HASH_SUCCESS);
+    }
+    ret = u64_u64_remove(&table, 0);
+    fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+    fail_unless(u64_u64_count(&table) == 5000);
+
+    sum = 0;
+    pos = 0;
+    while ((entry = u64_u64_next(&table, &pos)) != NULL) {
+        fail_unless(entry->key == entry->value * 7 && (entry->value & 1));
+        sum += entry->value;
+    }
+    fail_unless(sum == 5000 * 5000);
+
+    for (i = 1; i < 10000; i += 2) {
+        ret = u64_u64_remove(&table, i * 7);
+        fail_unless(ret == HASH_SUCCESS);
+    }
+    fail_unless(u64_u64_count(&table) == 0);
+    u64_u64_destroy(&table);
+
+    ret = str_ulong_init(&strings, 1000);
+    fail_unless(ret == HASH_SUCCESS);
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        ret = str_ulong_put(&strings, names[i], i + 1);
+        fail_unless(ret == HASH_SUCCESS);
+    }
+    ul = str_ulong_get(&strings, "three");
+    fail_unless(ul != NULL && *ul == 3);
+    fail_unless(str_ulong_get(&strings, "six") == NULL);
+    ret = str_ulong_remove(&strings, "three");
+    fail_unless(ret == HASH_SUCCESS);
+    fail_unless(str_ulong_get(&strings, "three") == NULL);
+    fail_unless(str_ulong_count(&strings) == 4);
+    str_ulong_destroy(&strings);
+}
+END_TEST
+
+static void sum_deleted(hash_entry_t *entry, hash_destroy_enum type, void *pvt)
+{
+    unsigned long *sum = (unsigned long *)pvt;
+
+    *sum += entry->value.ul;
+}
+
+START_TEST(test_multimap)
+{
+    static const unsigned int table_flags[] = {
+        HASH_CREATE_MULTIMAP,
+        HASH_CREATE_MULTIMAP | HASH_CREATE_SLAB_ALLOC,
+        HASH_CREATE_MULTIMAP | HASH_CREATE_EVICTION
+    };
+    hash_table_t *htable;
+    hash_value_t *values;
+    unsigned long count, deleted, i, f;
+    hash_value_t enter_val;
+    hash_value_t lookup_val;
+    hash_key_t key;
+    char str[] = "group";
+    int ret;
+
+    ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                            NULL, NULL,
+                            HASH_CREATE_MULTIMAP | HASH_CREATE_OPEN_ADDRESSING);
+    fail_unless(ret == EINVAL);
+    ret = hash_create(0, &htable, NULL, NULL);
+    fail_unless(ret == 0);
+    key.type = HASH_KEY_ULONG;
+    key.ul = 1;
+    enter_val.type = HASH_VALUE_ULONG;
+    enter_val.ul = 1;
+    ret = hash_enter_multi(htable, &key, &enter_val);
+    fail_unless(ret == EINVAL);
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    for (f = 0; f < sizeof(table_flags) / sizeof(table_flags[0]); f++) {
+        deleted = 0;
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                sum_deleted, &deleted, table_flags[f]);
+        fail_unless(ret == 0);
+
+        /* Values are kept in order, duplicates included */
+        key.type = HASH_KEY_STRING;
+        key.str = str;
+        for (i = 1; i <= 100; i++) {
+            enter_val.ul = i % 10;
+            ret = hash_enter_multi(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 1);
+        ret = hash_lookup_all(htable, &key, &values, &count);
+        fail_unless(ret == 0);
+        fail_unless(count == 100);
+        for (i = 0; i < count; i++) {
+            fail_unless(values[i].type == HASH_VALUE_ULONG &&
+                        values[i].ul == (i + 1) % 10);
+        }
+        ret = hash_lookup(htable, &key, &lookup_val);
+        fail_unless(ret == 0 && lookup_val.ul == 1);
+
+        /* Removing the first value makes the next one the first */
+        enter_val.ul = 1;
+        ret = hash_delete_value(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+        ret = hash_lookup(htable, &key, &lookup_val);
+        fail_unless(ret == 0 && lookup_val.ul == 2);
+        enter_val.type = HASH_VALUE_LONG;
+        enter_val.l = 2;
+        ret = hash_delete_value(htable, &key, &enter_val);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        enter_val.type = HASH_VALUE_ULONG;
+        for (i = 0; i < 9; i++) {
+            enter_val.ul = 0;
+            ret = hash_delete_value(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        enter_val.ul = 0;
+        ret = hash_delete_value(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+        ret = hash_delete_value(htable, &key, &enter_val);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        ret = hash_lookup_all(htable, &key, &values, &count);
+        fail_unless(ret == 0 && count == 89);
+        fail_unless(deleted == 1);
+
+        /* hash_enter() replaces all values */
+        enter_val.ul = 1000;
+        ret = hash_enter(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+        ret = hash_lookup_all(htable, &key, &values, &count);
+        fail_unless(ret == 0 && count == 1 && values[0].ul == 1000);
+        fail_unless(deleted == 450);
+
+        /* The last value goes with the key */
+        ret = hash_delete_value(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+        fail_unless(hash_count(htable) == 0);
+        ret = hash_lookup_all(htable, &key, &values, &count);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        fail_unless(deleted == 1450);
+
+        /* Keys with several values left are cleaned up on destroy */
+        key.type = HASH_KEY_ULONG;
+        for (i = 0; i < 1000; i++) {
+            key.ul = i / 4;
+            enter_val.ul = i;
+            ret = hash_enter_multi(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 250);
+        key.ul = 10;
+        ret = hash_delete(htable, &key);
+        fail_unless(ret == 0);
+        deleted = 0;
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+        fail_unless(deleted == 999 * 1000 / 2 - (40 + 41 + 42 + 43));
+    }
+}
+END_TEST
+
+static bool count_entries(hash_entry_t *item, void *user_data)
+{
+    unsigned long *count = (unsigned long *)user_data;
+
+    (*count)++;
+    return true;
+}
+
+START_TEST(test_freeze)
+{
+    static const unsigned int table_flags[] = {
+        0, HASH_CREATE_OPEN_ADDRESSING, HASH_CREATE_CONCURRENT,
+        HASH_CREATE_SLAB_ALLOC, HASH_CREATE_SLAB_ALLOC | HASH_CREATE_INTERN_KEYS,
+        HASH_CREATE_EVICTION
+    };
+    hash_table_t *htable;
+    unsigned long i, f, count;
+    hash_value_t enter_val;
+    hash_value_t lookup_val;
+    hash_key_t keys[100];
+    hash_value_t values[100];
+    hash_key_t key;
+    char buf[32];
+    int ret;
+
+    enter_val.type = HASH_VALUE_ULONG;
+    for (f = 0; f < sizeof(table_flags) / sizeof(table_flags[0]); f++) {
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, table_flags[f]);
+        fail_unless(ret == 0);
+        ret = hash_freeze(htable);
+        fail_unless(ret == 0);
+        fail_unless(hash_count(htable) == 0);
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+
+        ret = hash_create_flags(0, &htable, 0, 0, 0, 0, NULL, NULL, NULL,
+                                NULL, NULL, table_flags[f]);
+        fail_unless(ret == 0);
+        for (i = 0; i < 10000; i++) {
+            if (i & 1) {
+                snprintf(buf, sizeof(buf), "key-%lu", i);
+                key.type = HASH_KEY_STRING;
+                key.str = buf;
+            } else {
+                key.type = HASH_KEY_ULONG;
+                key.ul = i;
+            }
+            enter_val.ul = i * 3;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        ret = hash_freeze(htable);
+        fail_unless(ret == 0);
+        ret = hash_freeze(htable);
+        fail_unless(ret == 0);
+        fail_unless(hash_count(htable) == 10000);
+
+        for (i = 0; i < 10000; i++) {
+            if (i & 1) {
+                snprintf(buf, sizeof(buf), "key-%lu", i);
+                key.type = HASH_KEY_STRING;
+                key.str = buf;
+            } else {
+                key.type = HASH_KEY_ULONG;
+                key.ul = i;
+            }
+            ret = hash_lookup(htable, &key, &lookup_val);
+            fail_unless(ret == 0);
+            fail_unless(lookup_val.ul == i * 3);
+        }
+        key.type = HASH_KEY_ULONG;
+        key.ul = 10001;
+        ret = hash_lookup(htable, &key, &lookup_val);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+
+        for (i = 0; i < 100; i++) {
+            keys[i].type = HASH_KEY_ULONG;
+            keys[i].ul = i * 2;
+        }
+        keys[99].ul = 10001;
+        ret = hash_lookup_batch(htable, 100, keys, values, NULL);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+        for (i = 0; i < 99; i++) {
+            fail_unless(values[i].ul == i * 6);
+        }
+
+        count = 0;
+        ret = hash_iterate(htable, count_entries, &count);
+        fail_unless(ret == 0 && count == 10000);
+
+        /* Frozen tables can't be modified */
+        key.ul = 0;
+        ret = hash_enter(htable, &key, &enter_val);
+        fail_unless(ret == EPERM);
+        ret = hash_delete(htable, &key);
+        fail_unless(ret == EPERM);
+        ret = hash_reserve(htable, 20000);
+        fail_unless(ret == EPERM);
+        fail_unless(hash_count(htable) == 10000);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
 static Suite *dhash_suite(void)
 {
     Suite *s = suite_create("");
@@ -207,6 +1503,20 @@ static Suite *dhash_suite(void)
     tcase_add_test(tc_basic, test_key_const_string);
     tcase_add_test(tc_basic, test_key_string);
     tcase_add_test(tc_basic, test_key_ulong);
+    tcase_add_test(tc_basic, test_open_addressing);
+    tcase_add_test(tc_basic, test_similar_string_keys);
+    tcase_add_test(tc_basic, test_slab_alloc);
+    tcase_add_test(tc_basic, test_batch);
+    tcase_add_test(tc_basic, test_binary_keys);
+    tcase_add_test(tc_basic, test_key_ownership);
+    tcase_add_test(tc_basic, test_eviction);
+    tcase_add_test(tc_basic, test_stats);
+    tcase_add_test(tc_basic, test_dump_load);
+    tcase_add_test(tc_basic, test_iterators);
+    tcase_add_test(tc_basic, test_reserve);
+    tcase_add_test(tc_basic, test_typed);
+    tcase_add_test(tc_basic, test_multimap);
+    tcase_add_test(tc_basic, test_freeze);
     suite_add_tcase(s, tc_basic);
 
     return s;
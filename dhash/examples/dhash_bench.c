@@ -0,0 +1,461 @@
+/*
+    Benchmark for dhash tables with reproducible workloads.
+
+    Copyright (C) 2026 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Runs a fixed sequence of phases against a table of --count keys, once for
+ * unsigned long and once for string keys unless --keys picks one:
+ *
+ *   insert          enter all keys
+ *   lookup_uniform  look up keys drawn uniformly
+ *   lookup_zipf     look up keys drawn from a Zipf distribution
+ *   mixed           --read-percent Zipf lookups, the rest updates
+ *   churn           delete and enter again uniformly drawn keys
+ *   delete          delete all keys
+ *
+ * Every phase is split over --threads threads, which makes the table
+ * concurrent, so more than one thread can't be combined with
+ * --open-addressing. The random streams only depend on --seed and the
+ * thread number, so runs with the same options do the same operations.
+ *
+ * Each phase prints one JSON object per line with its throughput, the
+ * percentiles of the time taken by single operations and the peak RSS of
+ * the process so far.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "dhash.h"
+
+#define BUF_SIZE 32
+
+enum phase_t {
+    PHASE_INSERT,
+    PHASE_LOOKUP_UNIFORM,
+    PHASE_LOOKUP_ZIPF,
+    PHASE_MIXED,
+    PHASE_CHURN,
+    PHASE_DELETE,
+    PHASE_COUNT
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+    "insert", "lookup_uniform", "lookup_zipf", "mixed", "churn", "delete"
+};
+
+typedef struct thread_data_t {
+    pthread_t thread;
+    enum phase_t phase;
+    unsigned long id;
+    unsigned long first;
+    unsigned long ops;
+    uint64_t rand;
+    uint32_t *ns;
+} thread_data_t;
+
+static hash_table_t *table;
+static hash_key_enum key_type;
+static char **key_strings;
+static double *zipf_cdf;
+static unsigned long n_keys = 100000;
+static unsigned long n_ops = 1000000;
+static unsigned long n_threads = 1;
+static unsigned int read_percent = 90;
+
+static void fail(const char *what, unsigned long n, int status)
+{
+    fprintf(stderr, "Error: %s failed for key %lu (%s)\n", what, n,
+            IS_HASH_ERROR(status) ? hash_error_string(status) : strerror(status));
+    exit(1);
+}
+
+/* xorshift64*, good enough and identical everywhere */
+static uint64_t next_rand(thread_data_t *data)
+{
+    data->rand ^= data->rand >> 12;
+    data->rand ^= data->rand << 25;
+    data->rand ^= data->rand >> 27;
+    return data->rand * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned long uniform_key(thread_data_t *data)
+{
+    return next_rand(data) % n_keys;
+}
+
+static unsigned long zipf_key(thread_data_t *data)
+{
+    double u = (next_rand(data) >> 11) * (1.0 / 9007199254740992.0);
+    unsigned long lo = 0, hi = n_keys - 1, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (zipf_cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int make_zipf(double theta)
+{
+    unsigned long i;
+    double sum = 0;
+
+    zipf_cdf = malloc(n_keys * sizeof(double));
+    if (zipf_cdf == NULL) {
+        return ENOMEM;
+    }
+    for (i = 0; i < n_keys; i++) {
+        sum += 1.0 / pow(i + 1, theta);
+        zipf_cdf[i] = sum;
+    }
+    for (i = 0; i < n_keys; i++) {
+        zipf_cdf[i] /= sum;
+    }
+    return 0;
+}
+
+static void make_key(unsigned long n, hash_key_t *key)
+{
+    key->type = key_type;
+    if (key_type == HASH_KEY_STRING) {
+        key->str = key_strings[n];
+    } else {
+        key->ul = n;
+    }
+}
+
+static uint32_t now_ns(const struct timespec *start)
+{
+    struct timespec now;
+    uint64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start->tv_sec) * 1000000000ULL +
+         now.tv_nsec - start->tv_nsec;
+    return ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+static void do_op(thread_data_t *data, unsigned long i)
+{
+    hash_key_t key;
+    hash_value_t value;
+    unsigned long n;
+    int status;
+
+    value.type = HASH_VALUE_ULONG;
+    switch (data->phase) {
+    case PHASE_INSERT:
+        n = data->first + i;
+        make_key(n, &key);
+        value.ul = n;
+        if ((status = hash_enter(table, &key, &value)) != HASH_SUCCESS) {
+            fail("hash_enter", n, status);
+        }
+        break;
+    case PHASE_LOOKUP_UNIFORM:
+    case PHASE_LOOKUP_ZIPF:
+        n = data->phase == PHASE_LOOKUP_ZIPF ? zipf_key(data) : uniform_key(data);
+        make_key(n, &key);
+        if ((status = hash_lookup(table, &key, &value)) != HASH_SUCCESS) {
+            fail("hash_lookup", n, status);
+        }
+        break;
+    case PHASE_MIXED:
+        n = zipf_key(data);
+        make_key(n, &key);
+        if (next_rand(data) % 100 < read_percent) {
+            status = hash_lookup(table, &key, &value);
+        } else {
+            value.ul = n;
+            status = hash_enter(table, &key, &value);
+        }
+        /* Churning threads may have the key deleted right now */
+        if (status != HASH_SUCCESS && status != HASH_ERROR_KEY_NOT_FOUND) {
+            fail("mixed", n, status);
+        }
+        break;
+    case PHASE_CHURN:
+        n = uniform_key(data);
+        make_key(n, &key);
+        status = hash_delete(table, &key);
+        if (status != HASH_SUCCESS && status != HASH_ERROR_KEY_NOT_FOUND) {
+            fail("hash_delete", n, status);
+        }
+        value.ul = n;
+        if ((status = hash_enter(table, &key, &value)) != HASH_SUCCESS) {
+            fail("hash_enter", n, status);
+        }
+        break;
+    case PHASE_DELETE:
+        n = data->first + i;
+        make_key(n, &key);
+        if ((status = hash_delete(table, &key)) != HASH_SUCCESS) {
+            fail("hash_delete", n, status);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void *worker(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    struct timespec start;
+    unsigned long i;
+
+    for (i = 0; i < data->ops; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do_op(data, i);
+        data->ns[i] = now_ns(&start);
+    }
+    return NULL;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(uint32_t *ns, unsigned long count, double p)
+{
+    unsigned long i = (unsigned long)(count * p);
+
+    return ns[i < count ? i : count - 1];
+}
+
+static void run_phase(enum phase_t phase, thread_data_t *threads,
+                      uint32_t *ns, uint64_t seed, const char *config)
+{
+    struct timespec start, end;
+    struct rusage usage;
+    unsigned long i, total, per_thread;
+    double seconds;
+
+    /* Insert and delete walk all keys, the other phases do --ops operations */
+    total = phase == PHASE_INSERT || phase == PHASE_DELETE ? n_keys : n_ops;
+    per_thread = total / n_threads;
+    for (i = 0; i < n_threads; i++) {
+        threads[i].phase = phase;
+        threads[i].id = i;
+        threads[i].first = i * per_thread;
+        threads[i].ops = i == n_threads - 1 ? total - i * per_thread : per_thread;
+        threads[i].ns = ns + i * per_thread;
+        threads[i].rand = (seed + phase) * 0x9e3779b97f4a7c15ULL + i + 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (n_threads == 1) {
+        worker(&threads[0]);
+    } else {
+        for (i = 0; i < n_threads; i++) {
+            pthread_create(&threads[i].thread, NULL, worker, &threads[i]);
+        }
+        for (i = 0; i < n_threads; i++) {
+            pthread_join(threads[i].thread, NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    qsort(ns, total, sizeof(uint32_t), compare_ns);
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"phase\":\"%s\",\"keys\":\"%s\",%s,"
+           "\"ops\":%lu,\"seconds\":%.6f,\"ops_per_sec\":%.0f,"
+           "\"ns_p50\":%u,\"ns_p90\":%u,\"ns_p99\":%u,\"ns_p999\":%u,"
+           "\"ns_max\":%u,\"peak_rss_kb\":%ld}\n",
+           phase_names[phase],
+           key_type == HASH_KEY_STRING ? "string" : "ulong", config,
+           total, seconds, total / seconds,
+           percentile(ns, total, 0.5), percentile(ns, total, 0.9),
+           percentile(ns, total, 0.99), percentile(ns, total, 0.999),
+           ns[total - 1], usage.ru_maxrss);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int directory_bits = 0;
+    unsigned int segment_bits = 0;
+    unsigned int flags = 0;
+    uint64_t seed = 1;
+    double theta = 0.99;
+    int use_ulong = 1, use_string = 1;
+    thread_data_t *threads;
+    uint32_t *ns;
+    char config[256], buf[BUF_SIZE];
+    enum phase_t phase;
+    unsigned long i;
+    int pass, status;
+
+    while (1) {
+        int arg;
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"count", 1, 0, 'c'},
+            {"ops", 1, 0, 'n'},
+            {"threads", 1, 0, 't'},
+            {"keys", 1, 0, 'k'},
+            {"directory-bits", 1, 0, 'd'},
+            {"segment-bits", 1, 0, 'b'},
+            {"read-percent", 1, 0, 'r'},
+            {"theta", 1, 0, 'z'},
+            {"seed", 1, 0, 'S'},
+            {"open-addressing", 0, 0, 'o'},
+            {"slab", 0, 0, 's'},
+            {0, 0, 0, 0}
+        };
+
+        arg = getopt_long(argc, argv, "c:n:t:k:d:b:r:z:S:os",
+                          long_options, &option_index);
+        if (arg == -1) break;
+
+        switch (arg) {
+        case 'c':
+            n_keys = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            n_ops = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            n_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            use_ulong = strcmp(optarg, "string") != 0;
+            use_string = strcmp(optarg, "ulong") != 0;
+            break;
+        case 'd':
+            directory_bits = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            segment_bits = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            read_percent = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            theta = strtod(optarg, NULL);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            flags |= HASH_CREATE_OPEN_ADDRESSING;
+            break;
+        case 's':
+            flags |= HASH_CREATE_SLAB_ALLOC;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [--count N] [--ops N] [--threads N] "
+                    "[--keys ulong|string] [--directory-bits N] "
+                    "[--segment-bits N] [--read-percent N] [--theta X] "
+                    "[--seed N] [--open-addressing] [--slab]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (n_keys == 0 || n_threads == 0 || n_ops < n_threads ||
+        n_keys < n_threads || read_percent > 100) {
+        fprintf(stderr, "count, ops and threads must be positive, count and "
+                "ops at least threads and read-percent at most 100\n");
+        exit(1);
+    }
+    if (n_threads > 1 && (flags & HASH_CREATE_OPEN_ADDRESSING)) {
+        fprintf(stderr, "--open-addressing can't be combined with "
+                "--threads above 1, open addressing tables can't be "
+                "concurrent\n");
+        exit(1);
+    }
+    if (n_threads > 1) {
+        flags |= HASH_CREATE_CONCURRENT;
+    }
+
+    threads = calloc(n_threads, sizeof(thread_data_t));
+    ns = malloc((n_keys > n_ops ? n_keys : n_ops) * sizeof(uint32_t));
+    key_strings = calloc(n_keys, sizeof(char *));
+    if (threads == NULL || ns == NULL || key_strings == NULL ||
+        make_zipf(theta) != 0) {
+        fprintf(stderr, "Failed to allocate benchmark data\n");
+        exit(1);
+    }
+    for (i = 0; i < n_keys; i++) {
+        snprintf(buf, BUF_SIZE, "key-%lu", i);
+        if ((key_strings[i] = strdup(buf)) == NULL) {
+            fprintf(stderr, "Failed to allocate benchmark data\n");
+            exit(1);
+        }
+    }
+
+    snprintf(config, sizeof(config),
+             "\"count\":%lu,\"threads\":%lu,\"directory_bits\":%u,"
+             "\"segment_bits\":%u,\"open_addressing\":%d,\"slab\":%d,"
+             "\"read_percent\":%u,\"theta\":%.2f,\"seed\":%llu",
+             n_keys, n_threads, directory_bits, segment_bits,
+             (flags & HASH_CREATE_OPEN_ADDRESSING) != 0,
+             (flags & HASH_CREATE_SLAB_ALLOC) != 0,
+             read_percent, theta, (unsigned long long)seed);
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 0 ? !use_ulong : !use_string) {
+            continue;
+        }
+        key_type = pass == 0 ? HASH_KEY_ULONG : HASH_KEY_STRING;
+
+        if ((status = hash_create_flags(0, &table, directory_bits,
+                                        segment_bits, 0, 0, NULL, NULL, NULL,
+                                        NULL, NULL, flags)) != HASH_SUCCESS) {
+            fail("hash_create_flags", 0, status);
+        }
+        for (phase = PHASE_INSERT; phase < PHASE_COUNT; phase++) {
+            run_phase(phase, threads, ns, seed, config);
+        }
+        if (hash_count(table) != 0) {
+            fprintf(stderr, "Error: %lu entries left after delete\n",
+                    hash_count(table));
+            exit(1);
+        }
+        if ((status = hash_destroy(table)) != HASH_SUCCESS) {
+            fail("hash_destroy", 0, status);
+        }
+    }
+
+    for (i = 0; i < n_keys; i++) {
+        free(key_strings[i]);
+    }
+    free(key_strings);
+    free(zipf_cdf);
+    free(ns);
+    free(threads);
+    return 0;
+}
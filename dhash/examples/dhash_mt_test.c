@@ -0,0 +1,333 @@
+/*
+    Multi-threaded stress and throughput test for concurrent dhash tables.
+
+    Copyright (C) 2026 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Writer threads each own a disjoint range of keys which they repeatedly
+ * insert, verify and delete, string keys for odd and unsigned long keys for
+ * even numbers, so the table keeps growing and shrinking. At the same time
+ * reader threads look up random keys from all ranges and an iterating
+ * thread walks the whole table. The value stored for a key is always a
+ * function of the key, so any entry seen with the wrong value, or any key
+ * of a writer not found by that writer, means the table is broken.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "dhash.h"
+
+#define BUF_SIZE 64
+
+static hash_table_t *table;
+static unsigned long n_keys = 10000;
+static unsigned long n_rounds = 4;
+static int verbose = 0;
+static int writers_done = 0;
+
+typedef struct thread_data_t {
+    pthread_t thread;
+    unsigned long id;
+    unsigned long ops;
+    unsigned int seed;
+} thread_data_t;
+
+static void make_key(unsigned long n, hash_key_t *key, char *buf)
+{
+    if (n & 1) {
+        snprintf(buf, BUF_SIZE, "key-%lu", n);
+        key->type = HASH_KEY_STRING;
+        key->str = buf;
+    } else {
+        key->type = HASH_KEY_ULONG;
+        key->ul = n;
+    }
+}
+
+static void fail(const char *what, unsigned long n, int status)
+{
+    fprintf(stderr, "Error: %s failed for key %lu (%s)\n", what, n,
+            IS_HASH_ERROR(status) ? hash_error_string(status) : strerror(status));
+    exit(1);
+}
+
+static bool check_entry(hash_entry_t *entry, void *user_data)
+{
+    unsigned long *count = (unsigned long *)user_data;
+    unsigned long n;
+
+    if (entry->key.type == HASH_KEY_ULONG) {
+        n = entry->key.ul;
+    } else {
+        n = strtoul(entry->key.str + 4, NULL, 10);
+    }
+    if (entry->value.ul != n * 3) {
+        fail("iteration", n, HASH_ERROR_BAD_VALUE_TYPE);
+    }
+    (*count)++;
+    return true;
+}
+
+static void *writer(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    unsigned long first = data->id * n_keys;
+    unsigned long round, i;
+    hash_key_t key;
+    hash_value_t value;
+    char buf[BUF_SIZE];
+    int status;
+
+    value.type = HASH_VALUE_ULONG;
+    for (round = 0; round < n_rounds; round++) {
+        for (i = first; i < first + n_keys; i++) {
+            make_key(i, &key, buf);
+            value.ul = i * 3;
+            if ((status = hash_enter(table, &key, &value)) != HASH_SUCCESS) {
+                fail("hash_enter", i, status);
+            }
+        }
+        for (i = first; i < first + n_keys; i++) {
+            make_key(i, &key, buf);
+            if ((status = hash_lookup(table, &key, &value)) != HASH_SUCCESS) {
+                fail("hash_lookup", i, status);
+            }
+            if (value.ul != i * 3) {
+                fail("hash_lookup value", i, HASH_ERROR_BAD_VALUE_TYPE);
+            }
+        }
+        /* Leave the keys of the last round in the table */
+        if (round == n_rounds - 1) {
+            data->ops += 2 * n_keys;
+            break;
+        }
+        for (i = first; i < first + n_keys; i++) {
+            make_key(i, &key, buf);
+            if ((status = hash_delete(table, &key)) != HASH_SUCCESS) {
+                fail("hash_delete", i, status);
+            }
+            if (hash_has_key(table, &key)) {
+                fail("hash_has_key after delete", i, HASH_ERROR_KEY_NOT_FOUND);
+            }
+        }
+        data->ops += 4 * n_keys;
+    }
+
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    unsigned long n, n_all;
+    hash_key_t key;
+    hash_value_t value;
+    char buf[BUF_SIZE];
+    int status;
+
+    n_all = data->id * n_keys;
+    while (!__atomic_load_n(&writers_done, __ATOMIC_RELAXED)) {
+        n = rand_r(&data->seed) % n_all;
+        make_key(n, &key, buf);
+        status = hash_lookup(table, &key, &value);
+        if (status == HASH_SUCCESS) {
+            if (value.ul != n * 3) {
+                fail("concurrent hash_lookup value", n, HASH_ERROR_BAD_VALUE_TYPE);
+            }
+        } else if (status != HASH_ERROR_KEY_NOT_FOUND) {
+            fail("concurrent hash_lookup", n, status);
+        }
+        data->ops++;
+    }
+
+    return NULL;
+}
+
+static void *iterator(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    unsigned long count, i, n;
+    hash_iter_t iter;
+    hash_entry_t entries[64];
+    int status;
+
+    while (!__atomic_load_n(&writers_done, __ATOMIC_RELAXED)) {
+        count = 0;
+        /* Alternate between full walks and fetching in chunks */
+        if (data->ops & 1) {
+            hash_iter_init(table, &iter);
+            while ((n = hash_iter_fetch(&iter, entries, 64)) != 0) {
+                /* Writers may free the string keys of fetched entries */
+                for (i = 0; i < n; i++) {
+                    if (entries[i].key.type == HASH_KEY_ULONG) {
+                        check_entry(&entries[i], &count);
+                    }
+                }
+            }
+        } else if ((status = hash_iterate(table, check_entry, &count)) != HASH_SUCCESS) {
+            fail("hash_iterate", 0, status);
+        }
+        data->ops++;
+        /* Full walks hold off resizing, don't run them back to back */
+        usleep(1000);
+    }
+
+    return NULL;
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n_writers = 4;
+    unsigned long n_readers = 4;
+    unsigned long i, count, writer_ops, reader_ops;
+    unsigned int flags = HASH_CREATE_CONCURRENT;
+    thread_data_t *writers, *readers, iter_data;
+    struct timespec start;
+    double seconds;
+    int status;
+
+    while (1) {
+        int arg;
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"count", 1, 0, 'c'},
+            {"rounds", 1, 0, 'r'},
+            {"writers", 1, 0, 'w'},
+            {"readers", 1, 0, 'R'},
+            {"slab", 0, 0, 's'},
+            {"verbose", 0, 0, 'v'},
+            {0, 0, 0, 0}
+        };
+
+        arg = getopt_long(argc, argv, "c:r:w:R:sv",
+                          long_options, &option_index);
+        if (arg == -1) break;
+
+        switch (arg) {
+        case 'c':
+            n_keys = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            n_rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            n_writers = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            n_readers = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            flags |= HASH_CREATE_SLAB_ALLOC;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        }
+    }
+
+    if (n_keys == 0 || n_rounds == 0 || n_writers == 0) {
+        fprintf(stderr, "count, rounds and writers must be positive\n");
+        exit(1);
+    }
+
+    /*
+     * Size the directory for all the keys, the table still starts with a
+     * single segment and keeps being resized as the writers add and remove
+     * their keys.
+     */
+    if ((status = hash_create_flags(n_writers * n_keys, &table, 0, 0, 0, 0,
+                                    NULL, NULL, NULL, NULL, NULL,
+                                    flags)) != HASH_SUCCESS) {
+        fail("hash_create_flags", 0, status);
+    }
+
+    writers = calloc(n_writers, sizeof(thread_data_t));
+    readers = calloc(n_readers + 1, sizeof(thread_data_t));
+    if (writers == NULL || readers == NULL) {
+        fprintf(stderr, "Failed to allocate thread data\n");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < n_readers; i++) {
+        readers[i].id = n_writers;
+        readers[i].seed = i + 1;
+        pthread_create(&readers[i].thread, NULL, reader, &readers[i]);
+    }
+    memset(&iter_data, 0, sizeof(iter_data));
+    pthread_create(&iter_data.thread, NULL, iterator, &iter_data);
+    for (i = 0; i < n_writers; i++) {
+        writers[i].id = i;
+        pthread_create(&writers[i].thread, NULL, writer, &writers[i]);
+    }
+
+    writer_ops = 0;
+    for (i = 0; i < n_writers; i++) {
+        pthread_join(writers[i].thread, NULL);
+        writer_ops += writers[i].ops;
+    }
+    __atomic_store_n(&writers_done, 1, __ATOMIC_RELAXED);
+    reader_ops = 0;
+    for (i = 0; i < n_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        reader_ops += readers[i].ops;
+    }
+    pthread_join(iter_data.thread, NULL);
+
+    seconds = elapsed(&start);
+
+    /* Only the keys of the last round of every writer are left */
+    count = 0;
+    hash_iterate(table, check_entry, &count);
+    if (count != n_writers * n_keys || hash_count(table) != count) {
+        fprintf(stderr, "Error: expected %lu entries, hash_count %lu, iterated %lu\n",
+                n_writers * n_keys, hash_count(table), count);
+        exit(1);
+    }
+
+    printf("%lu writers: %lu ops, %.0f ops/sec\n", n_writers, writer_ops,
+           writer_ops / seconds);
+    printf("%lu readers: %lu ops, %.0f ops/sec\n", n_readers, reader_ops,
+           reader_ops / seconds);
+    if (verbose) {
+        printf("full table walks: %lu\n", iter_data.ops);
+    }
+
+    if ((status = hash_destroy(table)) != HASH_SUCCESS) {
+        fail("hash_destroy", 0, status);
+    }
+    free(writers);
+    free(readers);
+
+    printf("Successfully tested %lu threads in %.2f seconds\n",
+           n_writers + n_readers + 1, seconds);
+    return 0;
+}
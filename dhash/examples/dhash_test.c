@@ -165,6 +165,7 @@ int main(int argc, char **argv)
     unsigned int segment_bits = 0;
     unsigned long min_load_factor = HASH_DEFAULT_MIN_LOAD_FACTOR;
     unsigned long max_load_factor = HASH_DEFAULT_MAX_LOAD_FACTOR;
+    unsigned int flags = 0;
 
     while (1) {
         int arg;
@@ -179,10 +180,11 @@ int main(int argc, char **argv)
             {"min-load-factor", 1, 0, 'l'},
             {"max-load-factor", 1, 0, 'h'},
             {"seed", 1, 0, 'r'},
+            {"open-addressing", 0, 0, 'o'},
             {0, 0, 0, 0}
         };
 
-        arg = getopt_long(argc, argv, "c:vqt:d:s:l:h:r:",
+        arg = getopt_long(argc, argv, "c:vqt:d:s:l:h:r:o",
                           long_options, &option_index);
         if (arg == -1) break;
 
@@ -214,6 +216,9 @@ int main(int argc, char **argv)
         case 'r':
             seed = strtoul(optarg, NULL, 0);
             break;
+        case 'o':
+            flags |= HASH_CREATE_OPEN_ADDRESSING;
+            break;
         }
     }
 
@@ -236,11 +241,12 @@ int main(int argc, char **argv)
     printf("random seed: %#x\n", seed);
 
     /* Create the hash table as small as possible to exercise growth */
-    if ((status = hash_create_ex(table_size, &table,
-                                 directory_bits, segment_bits,
-                                 min_load_factor, max_load_factor,
-                                 NULL, NULL, NULL,
-                                 delete_callback, NULL)) != HASH_SUCCESS) {
+    if ((status = hash_create_flags(table_size, &table,
+                                    directory_bits, segment_bits,
+                                    min_load_factor, max_load_factor,
+                                    NULL, NULL, NULL,
+                                    delete_callback, NULL,
+                                    flags)) != HASH_SUCCESS) {
         fprintf(stderr, "table creation failed at line %d (%s)\n", __LINE__, error_string(status));
         exit(1);
     }
@@ -53,7 +53,7 @@ struct parser_obj {
     /* Wrapping boundary */
     uint32_t boundary;
     /* Action queue */
-    struct collection_item *queue;
+    struct col_ring *queue;
     /* Last error */
     uint32_t last_error;
     /* Last line number */
@@ -161,13 +161,20 @@ static int is_allowed_spaces(const char *str,
     return line_ok;
 }
 
+/* Schedule the next action */
+static int parser_schedule(struct parser_obj *po, uint32_t action)
+{
+    return col_enqueue_value(po->queue, PARSE_ACTION, COL_TYPE_UNSIGNED,
+                             &action, sizeof(uint32_t));
+}
+
 /* Destroy parser object */
 static void parser_destroy(struct parser_obj *po)
 {
     TRACE_FLOW_ENTRY();
 
     if(po) {
-        col_destroy_queue(po->queue);
+        col_destroy_queue_ring(po->queue);
         col_destroy_collection_with_cb(po->sec, ini_cleanup_cb, NULL);
         ini_comment_destroy(po->ic);
         value_destroy_arrays(po->raw_lines,
@@ -270,16 +277,14 @@ static int parser_create(struct ini_cfgobj *co,
     }
 
     /* Create a queue */
-    error = col_create_queue(&(new_po->queue));
+    error = col_create_queue_ring(&(new_po->queue), 0);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to create queue", error);
         parser_destroy(new_po);
         return error;
     }
 
-    error = col_enqueue_unsigned_property(new_po->queue,
-                                          PARSE_ACTION,
-                                          PARSE_READ);
+    error = parser_schedule(new_po, PARSE_READ);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to create queue", error);
         parser_destroy(new_po);
@@ -358,9 +363,7 @@ static int parser_read(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          action);
+    error = parser_schedule(po, action);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1412,9 +1415,7 @@ static int parser_inspect(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          action);
+    error = parser_schedule(po, action);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1472,9 +1473,7 @@ static int parser_post(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          PARSE_DONE);
+    error = parser_schedule(po, PARSE_DONE);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1598,9 +1597,7 @@ static int parser_error(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          action);
+    error = parser_schedule(po, action);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1615,7 +1612,7 @@ static int parser_error(struct parser_obj *po)
 static int parser_run(struct parser_obj *po)
 {
     int error = EOK;
-    struct collection_item *item = NULL;
+    struct col_value value;
     uint32_t action = 0;
     action_fn operations[] = { parser_read,
                                parser_inspect,
@@ -1627,16 +1624,14 @@ static int parser_run(struct parser_obj *po)
 
     while(1) {
         /* Get next action */
-        item = NULL;
-        error = col_dequeue_item(po->queue, &item);
+        error = col_dequeue_value(po->queue, &value);
         if (error) {
             TRACE_ERROR_NUMBER("Failed to get action", error);
             return error;
         }
 
         /* Get action, run operation */
-        action = *((uint32_t *)(col_get_item_data(item)));
-        col_delete_item(item);
+        action = *((const uint32_t *)(value.data));
 
         if (action == PARSE_DONE) {
 